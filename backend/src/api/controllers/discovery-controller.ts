@@ -5,13 +5,14 @@ interface ScanQuery {
     port?: number;
     broadcastAddress?: string;
     timeout?: number;
+    memStats?: boolean;
 }
 
 export const scanNetwork = async (req: FastifyRequest<{ Body: ScanQuery }>, reply: FastifyReply) => {
     try {
-        const { port, broadcastAddress, timeout } = req.body || {};
+        const { port, broadcastAddress, timeout, memStats } = req.body || {};
 
-        const results = await discoveryService.scan(port, broadcastAddress, timeout);
+        const results = await discoveryService.scan(port, broadcastAddress, timeout, memStats);
 
         return reply.send({
             success: true,
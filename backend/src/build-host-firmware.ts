@@ -0,0 +1,86 @@
+import fs from 'fs';
+import path from 'path';
+import { FirmwareBuilder } from './services/FirmwareBuilder';
+
+// Generates a sketch for the host build (firmware/host/build.sh): the
+// regular FirmwareBuilder output for a "host" board, plus what arduino-cli
+// would otherwise add (function prototypes) and the entry point the host
+// runner benchmarks.
+//
+//   ts-node src/build-host-firmware.ts [--transport wifi_native]
+//       [--plugins a,b] [--commands all|a,b] [--out sketch.cpp]
+
+const HOST_BOARD = {
+    key: 'host',
+    label: 'Host (Linux)',
+    firmware_config: {
+        requirements: { core: 'host:host' },
+        pins: {},
+        interfaces: {}
+    }
+};
+
+const HOST_ADAPTER = `
+// === HOST ADAPTER ===
+// Entry point of the host runner's bench: one command straight into the
+// dispatcher, as if it had arrived on the console.
+void hostProcessCommand(char* line, char* reply, size_t size) {
+  ResponseBuffer res(reply, size);
+  currentRoute.kind = ROUTE_SERIAL;
+  currentRoute.binary = false;
+  processCommand(line, res);
+}
+`;
+
+const parseArgs = (argv: string[]) => {
+    const args: Record<string, string> = { transport: 'wifi_native', plugins: '', commands: 'all', out: '' };
+    for (let i = 0; i < argv.length; i++) {
+        if (argv[i].startsWith('--') && i + 1 < argv.length) args[argv[i].slice(2)] = argv[++i];
+    }
+    return args;
+};
+
+// arduino-cli generates prototypes so functions can be called before they
+// are defined; g++ needs them spelled out. They go right before the
+// skeleton's own prototypes, after every type is declared.
+const PROTOTYPE_PATTERN = /^((?:static |inline |unsigned |const )*[A-Za-z_][\w<>:]*[ *&]+\**)(\w+)\(([^;{)]*)\)\s*\{/gm;
+const NOT_FUNCTIONS = new Set(['setup', 'loop', 'if', 'while', 'for', 'switch']);
+
+const addPrototypes = (sketch: string): string => {
+    const prototypes: string[] = [];
+    for (const match of sketch.matchAll(PROTOTYPE_PATTERN)) {
+        const [, returnType, name, params] = match;
+        if (NOT_FUNCTIONS.has(name) || ['else', 'return'].includes(returnType.trim())) continue;
+        prototypes.push(`${returnType}${name}(${params.replace(/\s*=\s*[^,]+/g, '')});`);
+    }
+    return sketch.replace('// === PROTOTYPES ===', `// === PROTOTYPES ===\n${prototypes.join('\n')}`);
+};
+
+const run = () => {
+    const args = parseArgs(process.argv.slice(2));
+    const definitionsPath = path.join(__dirname, '../../firmware/definitions');
+
+    const commandIds = args.commands === 'all'
+        ? fs.readdirSync(path.join(definitionsPath, 'commands'))
+            .filter(file => file.endsWith('.json') && file !== 'system_commands.json')
+            .map(file => file.slice(0, -'.json'.length))
+        : args.commands.split(',').filter(Boolean);
+
+    const sketch = new FirmwareBuilder().build({
+        boardId: HOST_BOARD.key,
+        transportId: args.transport,
+        pluginIds: args.plugins.split(',').filter(Boolean),
+        commandIds,
+        settings: { ssid: 'host', password: 'host' }
+    }, HOST_BOARD);
+
+    const output = addPrototypes(sketch) + HOST_ADAPTER;
+    if (args.out) {
+        fs.writeFileSync(args.out, output);
+        console.error(`Host sketch written to ${args.out} (${commandIds.length} commands)`);
+    } else {
+        process.stdout.write(output);
+    }
+};
+
+run();
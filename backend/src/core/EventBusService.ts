@@ -28,6 +28,7 @@ export interface SystemEvents {
         timestamp?: Date | string
     };
     'command:sent': { deviceId: string; controllerId: string; packet: any; raw?: string };
+    'hardware:telemetry': { controllerId: string; dropped: number; samples: { sub: number; age: number; data: any }[]; receivedAt: Date };
 
     // Automation Events
     'automation:block_start': { blockId: string; type: string; sessionId?: string | null };
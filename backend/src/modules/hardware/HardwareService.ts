@@ -1,4 +1,4 @@
-import { events } from '../../core/EventBusService';
+import { events, SystemEvents } from '../../core/EventBusService';
 import { logger } from '../../core/LoggerService';
 import { HardwarePacket } from './interfaces';
 import { v4 as uuidv4 } from 'uuid';
@@ -20,9 +20,21 @@ export interface Device {
     lastSeen: Date;
 }
 
+export interface SensorReading {
+    raw: number;
+    value: number | null;
+    unit?: string;
+    baseValue: number | null;
+    baseUnit: string;
+    hwValue: number;
+    hwUnit: string;
+    details?: any;
+}
+
 export class HardwareService {
     private static instance: HardwareService;
     private devices: Map<string, Device> = new Map();
+    private telemetrySubs: Map<string, string> = new Map(); // `${controllerId}:${sub}` -> deviceId
 
     private constructor() { }
 
@@ -35,6 +47,7 @@ export class HardwareService {
 
     public async initialize(): Promise<void> {
         logger.info('🚀 [HardwareService] Initializing...');
+        events.on('hardware:telemetry', this.handleTelemetry.bind(this));
         try {
             await templates.loadTemplates();
             const { DeviceModel } = await import('../../models/Device');
@@ -81,10 +94,6 @@ export class HardwareService {
         params: Record<string, any> = {},
         context: { pin?: number | string; pins?: any[]; address?: string } = {}
     ): Promise<any> {
-        const { DeviceModel } = await import('../../models/Device');
-        const deviceDoc = await DeviceModel.findById(deviceId);
-        if (!deviceDoc) throw new Error(`Device ${deviceId} not found`);
-
         if (command === 'TEST_DOSING') {
             return CalibrationService.getInstance().runDosingTest(
                 this,
@@ -95,6 +104,26 @@ export class HardwareService {
             );
         }
 
+        const { controllerId, packet } = await this.buildPacket(deviceId, driverId, command, params, context);
+        return this.enqueueCommand(controllerId, packet);
+    }
+
+    /**
+     * Resolves the owning controller and hardware pins of a device and builds
+     * the packet for a driver command. Relay commands also sync the stored
+     * channel state.
+     */
+    private async buildPacket(
+        deviceId: string,
+        driverId: string,
+        command: string,
+        params: Record<string, any>,
+        context: { pin?: number | string; pins?: any[]; address?: string }
+    ): Promise<{ controllerId: string; packet: HardwarePacket }> {
+        const { DeviceModel } = await import('../../models/Device');
+        const deviceDoc = await DeviceModel.findById(deviceId);
+        if (!deviceDoc) throw new Error(`Device ${deviceId} not found`);
+
         let controllerId: string;
         let resolvedPin: string | undefined;
 
@@ -197,7 +226,7 @@ export class HardwareService {
 
         const packetData = driver.createPacket(command, params, finalContext);
 
-        if (packetData.cmd === 'MODBUS_RTU_READ' && packetData.pins && Array.isArray(packetData.pins)) {
+        if (packetData.cmd?.startsWith('MODBUS_RTU_') && packetData.pins && Array.isArray(packetData.pins)) {
             const rx = packetData.pins.find((p: any) => p.role === 'RX');
             const tx = packetData.pins.find((p: any) => p.role === 'TX');
             if (rx) packetData.rxPin = rx.gpio;
@@ -212,19 +241,10 @@ export class HardwareService {
             ...packetData
         };
 
-        return this.enqueueCommand(controllerId, packet);
+        return { controllerId, packet };
     }
 
-    public async readSensorValue(deviceId: string, strategyOverride?: string): Promise<{
-        raw: number,
-        value: number | null,
-        unit?: string,
-        baseValue: number | null,
-        baseUnit: string,
-        hwValue: number,
-        hwUnit: string,
-        details?: any
-    }> {
+    public async readSensorValue(deviceId: string, strategyOverride?: string): Promise<SensorReading> {
         const { DeviceModel } = await import('../../models/Device');
         const device = await DeviceModel.findById(deviceId);
         if (!device) throw new Error('Device not found');
@@ -256,15 +276,33 @@ export class HardwareService {
             raw = sensorProcessor.extractRawValue(rawResponse, valuePath);
         }
 
+        return this.processReading(device, driverDoc, context, rawResponse, raw, strategyOverride);
+    }
+
+    /**
+     * Converts a raw READ reply (polled or from telemetry) into calibrated and
+     * display values, stores it as the device's last reading and emits
+     * `device:data`.
+     */
+    private async processReading(
+        device: any,
+        driverDoc: any,
+        context: any,
+        rawResponse: any,
+        raw: number,
+        strategyOverride?: string,
+        timestamp: Date = new Date()
+    ): Promise<SensorReading> {
         if (isNaN(raw)) raw = 0;
 
+        const { sensorProcessor } = await import('./SensorProcessor');
         const basicResult = await sensorProcessor.processRawToBasic(raw, device, driverDoc, context, strategyOverride);
         const { value: baseLogValue, unit: baseLogUnit, hwValue: baseHwValue, hwUnit: baseHwUnit, activeStrategy, details: conversionDetails } = basicResult;
 
         try {
-            device.lastReading = { value: isNaN(baseLogValue) ? null : baseLogValue, raw, timestamp: new Date() };
+            device.lastReading = { value: isNaN(baseLogValue) ? null : baseLogValue, raw, timestamp };
             await device.save();
-        } catch (err) { logger.warn({ deviceId, err }, '⚠️ DB Save Failed'); }
+        } catch (err) { logger.warn({ deviceId: device.id, err }, '⚠️ DB Save Failed'); }
 
         const displayResult = sensorProcessor.processBasicToDisplay(baseLogValue, baseLogUnit, device);
         const { value: displayVal, unit: displayUnitFinal } = displayResult;
@@ -279,7 +317,7 @@ export class HardwareService {
             baseValue: isNaN(baseLogValue) ? null : baseLogValue, baseUnit: baseLogUnit,
             hwValue: baseHwValue, hwUnit: baseHwUnit, readings,
             details: { ...rawResponse, baseHwValue, baseHwUnit, baseLogValue, baseLogUnit, activeStrategy, ...conversionDetails },
-            timestamp: new Date()
+            timestamp
         });
 
         return {
@@ -291,11 +329,78 @@ export class HardwareService {
     }
 
 
+    /**
+     * Lets the controller sample the device's READ command itself and push
+     * the results in batches (firmware plugin `telemetry_sampler`), instead of
+     * one request per reading. Subscriptions live in controller RAM, so call
+     * this again after the controller resets; repeating it only updates the
+     * period. Returns the firmware subscription id.
+     */
+    public async subscribeSensor(deviceId: string, periodMs: number): Promise<number> {
+        const { DeviceModel } = await import('../../models/Device');
+        const device = await DeviceModel.findById(deviceId);
+        if (!device) throw new Error('Device not found');
+
+        const { contextResolver } = await import('./HardwareContextResolver');
+        const context = await contextResolver.resolveContext(device, this.readSensorValue.bind(this));
+        const { controllerId, packet } = await this.buildPacket(deviceId, device.config.driverId, 'READ', {}, context);
+
+        const reply = await this.sendSystemCommand(controllerId, 'SUBSCRIBE', { command: packet, period: periodMs });
+        this.telemetrySubs.set(`${controllerId}:${reply.sub}`, deviceId);
+        logger.info({ deviceId, controllerId, sub: reply.sub, periodMs }, '📡 [HardwareService] Subscribed sensor telemetry');
+        return reply.sub;
+    }
+
+    public async unsubscribeSensor(deviceId: string): Promise<void> {
+        for (const [key, subDeviceId] of this.telemetrySubs) {
+            if (subDeviceId !== deviceId) continue;
+            const [controllerId, sub] = key.split(':');
+            this.telemetrySubs.delete(key);
+            await this.sendSystemCommand(controllerId, 'UNSUBSCRIBE', { sub: Number(sub) });
+        }
+    }
+
+    private async handleTelemetry(payload: SystemEvents['hardware:telemetry']): Promise<void> {
+        const { controllerId, dropped, samples, receivedAt } = payload;
+        if (dropped > 0) {
+            logger.warn({ controllerId, dropped }, '⚠️ [HardwareService] Controller dropped telemetry samples');
+        }
+
+        const { DeviceModel } = await import('../../models/Device');
+        const { contextResolver } = await import('./HardwareContextResolver');
+        const { sensorProcessor } = await import('./SensorProcessor');
+
+        for (const sample of samples) {
+            const deviceId = this.telemetrySubs.get(`${controllerId}:${sample.sub}`);
+            if (!deviceId) {
+                logger.debug({ controllerId, sub: sample.sub }, 'Telemetry for unknown subscription');
+                continue;
+            }
+            if (!sample.data || sample.data.ok !== 1) {
+                logger.warn({ deviceId, error: sample.data?.error }, '⚠️ [HardwareService] Telemetry sample failed');
+                continue;
+            }
+
+            try {
+                const device = await DeviceModel.findById(deviceId);
+                if (!device) continue;
+                const driverDoc = templates.getDriver(device.config.driverId);
+                const context = await contextResolver.resolveContext(device, this.readSensorValue.bind(this));
+                const raw = sensorProcessor.extractRawValue(sample.data, driverDoc.commands?.READ?.valuePath);
+                await this.processReading(device, driverDoc, context, sample.data, raw, undefined, new Date(receivedAt.getTime() - sample.age));
+            } catch (err) {
+                logger.warn({ err, deviceId }, '⚠️ [HardwareService] Failed to process telemetry sample');
+            }
+        }
+    }
+
     public async sendSystemCommand(controllerId: string, cmd: string, params: any = {}): Promise<any> {
         const packet: HardwarePacket = { id: uuidv4(), cmd, ...params };
         return this.enqueueCommand(controllerId, packet);
     }
 
+    // Commands queued behind one in flight (e.g. a Promise.all over a controller's
+    // devices) are coalesced into one BATCH round trip by the transport manager.
     private async enqueueCommand(controllerId: string, packet: HardwarePacket): Promise<any> {
         const { transportManager } = await import('./HardwareTransportManager');
         return transportManager.enqueueCommand(controllerId, packet);
@@ -367,6 +472,10 @@ export class HardwareService {
         if (newStatus === 'online') {
             try {
                 const info = await this.sendSystemCommand(controllerId, 'INFO');
+                if (info?.stall && statusChanged) {
+                    // Breadcrumb of the watchdog_timer plugin: what hung before the last reset
+                    logger.warn({ controllerId, stall: info.stall }, '⚠️ Controller was reset by its watchdog');
+                }
                 if (info && Array.isArray(info.capabilities)) {
                     controller.capabilities = info.capabilities.map((c: string) => c.toLowerCase());
                     await controller.save();
@@ -1,17 +1,44 @@
 import { v4 as uuidv4 } from 'uuid';
 import { logger } from '../../core/LoggerService';
+import { events } from '../../core/EventBusService';
 import { IHardwareTransport, HardwarePacket, HardwareResponse } from './interfaces';
 import { SerialTransport } from './transports/SerialTransport';
 import { UdpTransport } from './transports/UdpTransport';
+import { serializeCommand } from './transports/CommandSerializer';
 import { Controller } from '../../models/Controller';
 
+// Upper bound for a firmware job (Modbus: 3 attempts of up to `timeout` per
+// request; a 16-read MODBUS_RTU_PLAN against dead slaves takes ~24s)
+const JOB_TIMEOUT_MS = 30000;
+
+// Longest BATCH the firmware reads in one go: the UDP packet buffer
+// (wifi_native `packet_buffer_size`, 512) and the serial line (COMMAND_BUFFER_SIZE, 128)
+const BATCH_MAX_CHARS_UDP = 500;
+const BATCH_MAX_CHARS_SERIAL = 120;
+const BATCH_MAX_ITEMS = 16;
+// Commands that must keep a reply of their own, and those whose reply rarely
+// fits next to others (the firmware cuts an item off that has no room left)
+const NON_BATCHABLE = new Set([
+    'BATCH', 'PROTO', 'RESET', 'TEST_WATCHDOG', 'SUBSCRIBE', 'JOB',
+    'INFO', 'STATS', 'MEMSTATS', 'ANALOG_BURST', 'MODBUS_RTU_PLAN'
+]);
+
+interface QueuedCommand {
+    packet: HardwarePacket;
+    resolve: Function;
+    reject: Function;
+}
+
 export class HardwareTransportManager {
     private static instance: HardwareTransportManager;
     private transports: Map<string, IHardwareTransport> = new Map();
-    private commandQueues: Map<string, (() => Promise<void>)[]> = new Map();
+    private commandQueues: Map<string, QueuedCommand[]> = new Map();
+    private batchUnsupported: Set<string> = new Set(); // firmware without BATCH
     private isProcessingQueue: Map<string, boolean> = new Map();
-    private activeCommands: Map<string, string> = new Map(); // controllerId -> requestId
+    private inFlight: Map<string, Set<Promise<void>>> = new Map(); // controllerId -> commands awaiting a reply
+    private activeCommands: Map<string, string> = new Map(); // controllerId -> latest requestId (replies without id)
     private pendingRequests: Map<string, { resolve: Function, reject: Function, timeout: NodeJS.Timeout }> = new Map();
+    private pendingJobs: Map<string, { resolve: Function, reject: Function, timeout: NodeJS.Timeout }> = new Map(); // `${controllerId}:${jobId}`
 
     private constructor() { }
 
@@ -27,37 +54,134 @@ export class HardwareTransportManager {
             if (!this.commandQueues.has(controllerId)) {
                 this.commandQueues.set(controllerId, []);
             }
-            const queue = this.commandQueues.get(controllerId)!;
-
-            queue.push(async () => {
-                try {
-                    const transport = await this.getOrConnectTransport(controllerId);
-                    const result = await this.executePacket(controllerId, transport, packet);
-                    resolve(result);
-                } catch (error) {
-                    reject(error);
-                }
-            });
-
+            this.commandQueues.get(controllerId)!.push({ packet, resolve, reject });
             this.processQueue(controllerId);
         });
     }
 
+    /**
+     * Sends queued commands, up to the transport's in-flight limit (one unless
+     * replies carry request ids). Commands that piled up behind the ones in
+     * flight are coalesced into a single BATCH round trip.
+     */
     private async processQueue(controllerId: string) {
         if (this.isProcessingQueue.get(controllerId)) return;
         this.isProcessingQueue.set(controllerId, true);
 
         const queue = this.commandQueues.get(controllerId);
+        if (!this.inFlight.has(controllerId)) this.inFlight.set(controllerId, new Set());
+        const running = this.inFlight.get(controllerId)!;
         try {
             while (queue && queue.length > 0) {
-                const command = queue.shift();
-                if (command) await command();
+                let transport: IHardwareTransport;
+                try {
+                    transport = await this.getOrConnectTransport(controllerId);
+                } catch (error) {
+                    queue.shift()!.reject(error);
+                    continue;
+                }
+                // A command that completes restarts the queue
+                if (running.size >= (transport.maxInFlight?.() ?? 1)) break;
+
+                const head = queue.shift()!;
+                const batch = [head, ...this.takeBatchable(controllerId, transport, head, queue)];
+                const task: Promise<void> = (batch.length > 1
+                    ? this.executeBatch(controllerId, transport, batch, queue)
+                    : this.executePacket(controllerId, transport, head.packet).then(
+                        result => head.resolve(result),
+                        error => head.reject(error)
+                    )
+                ).finally(() => {
+                    running.delete(task);
+                    this.processQueue(controllerId);
+                });
+                running.add(task);
             }
         } finally {
             this.isProcessingQueue.set(controllerId, false);
         }
     }
 
+    // Removes the commands directly behind `head` that fit into one BATCH with it
+    private takeBatchable(controllerId: string, transport: IHardwareTransport, head: QueuedCommand, queue: QueuedCommand[]): QueuedCommand[] {
+        if (this.batchUnsupported.has(controllerId)) return [];
+
+        const maxChars = transport instanceof UdpTransport ? BATCH_MAX_CHARS_UDP : BATCH_MAX_CHARS_SERIAL;
+        const headText = this.batchItemText(head.packet);
+        if (headText === null) return [];
+
+        let length = 'BATCH|'.length + headText.length;
+        let count = 0;
+        while (count < queue.length && count + 1 < BATCH_MAX_ITEMS) {
+            const text = this.batchItemText(queue[count].packet);
+            if (text === null || length + 1 + text.length > maxChars) break;
+            length += 1 + text.length;
+            count++;
+        }
+        return queue.splice(0, count);
+    }
+
+    private batchItemText(packet: HardwarePacket): string | null {
+        if (NON_BATCHABLE.has(packet.cmd)) return null;
+        try {
+            const text = serializeCommand(packet);
+            return /[;\n]/.test(text) ? null : text;
+        } catch {
+            return null;
+        }
+    }
+
+    private async executeBatch(controllerId: string, transport: IHardwareTransport, batch: QueuedCommand[], queue: QueuedCommand[]): Promise<void> {
+        const packet: HardwarePacket = { id: uuidv4(), cmd: 'BATCH', items: batch.map(entry => entry.packet) };
+
+        let reply: any;
+        try {
+            reply = await this.executePacket(controllerId, transport, packet);
+        } catch (error: any) {
+            if (error?.message === 'ERR_INVALID_COMMAND') {
+                // Firmware predates BATCH: send these (and everything after) one by one
+                logger.info({ controllerId }, 'Controller does not support BATCH, sending commands individually');
+                this.batchUnsupported.add(controllerId);
+                queue.unshift(...batch);
+                return;
+            }
+            batch.forEach(entry => entry.reject(error));
+            return;
+        }
+
+        const results: any[] = Array.isArray(reply?.results) ? reply.results : [];
+        if (results.length === 0 && reply?.done === 0) {
+            // The first reply did not fit behind the batch header: send it alone
+            queue.unshift(...batch.slice(1));
+            const head = batch[0];
+            await this.executePacket(controllerId, transport, head.packet).then(
+                result => head.resolve(result),
+                error => head.reject(error)
+            );
+            return;
+        }
+        if (results.length === 0) {
+            batch.forEach(entry => entry.reject(new Error('Empty BATCH reply')));
+            return;
+        }
+        results.slice(0, batch.length).forEach((result, i) => this.settleBatchItem(controllerId, batch[i], result));
+
+        // Items the firmware had no reply space for were cut off; resend them first
+        if (results.length < batch.length) queue.unshift(...batch.slice(results.length));
+    }
+
+    private settleBatchItem(controllerId: string, entry: QueuedCommand, result: any): void {
+        if (!result) {
+            entry.reject(new Error(`Command ${entry.packet.cmd} returned no reply`));
+        } else if (result.job !== undefined && result.pending === 1) {
+            this.awaitJob(controllerId, result.job, entry.resolve, entry.reject);
+        } else if (result.ok === 1) {
+            entry.resolve(result);
+        } else {
+            entry.reject(new Error(result.error || 'Unknown Hardware Error'));
+        }
+    }
+
     public async getOrConnectTransport(controllerId: string): Promise<IHardwareTransport> {
         if (this.transports.has(controllerId)) {
             return this.transports.get(controllerId)!;
@@ -94,7 +218,7 @@ export class HardwareTransportManager {
         return new Promise((resolve, reject) => {
             const timeout = setTimeout(() => {
                 this.pendingRequests.delete(packet.id);
-                this.activeCommands.delete(controllerId);
+                this.clearActiveCommand(controllerId, packet.id);
                 reject(new Error(`Command ${packet.cmd} (ID:${packet.id}) timed out after 5s`));
             }, 5000);
 
@@ -104,18 +228,41 @@ export class HardwareTransportManager {
             transport.send(packet).catch(err => {
                 clearTimeout(timeout);
                 this.pendingRequests.delete(packet.id);
-                this.activeCommands.delete(controllerId);
+                this.clearActiveCommand(controllerId, packet.id);
                 reject(err);
             });
         });
     }
 
+    private clearActiveCommand(controllerId: string, requestId: string): void {
+        if (this.activeCommands.get(controllerId) === requestId) this.activeCommands.delete(controllerId);
+    }
+
     private handleMessage(controllerId: string, msg: HardwareResponse | any): void {
         if (msg.type === 'log') {
             logger.debug({ controllerId, log: msg.message }, 'MCU Log');
             return;
         }
 
+        // Telemetry sampler batches. Pushed batches carry no "ok" and must not
+        // complete the active request; a TELEMETRY poll reply (ok:1) does.
+        if (msg.type === 'TELEMETRY') {
+            events.emit('hardware:telemetry', {
+                controllerId,
+                dropped: msg.dropped || 0,
+                samples: Array.isArray(msg.samples) ? msg.samples : [],
+                receivedAt: new Date()
+            });
+            if (msg.ok === undefined) return;
+        }
+
+        // Firmware job engine: slow reads answer {"job":N,"pending":1} at once and
+        // push {"job":N,...result} later. Release the queue while the job runs.
+        if (msg.job !== undefined) {
+            this.handleJobMessage(controllerId, msg);
+            return;
+        }
+
         let requestId = msg.id;
         if (!requestId) {
             requestId = this.activeCommands.get(controllerId);
@@ -125,7 +272,7 @@ export class HardwareTransportManager {
             const req = this.pendingRequests.get(requestId)!;
             clearTimeout(req.timeout);
             this.pendingRequests.delete(requestId);
-            this.activeCommands.delete(controllerId);
+            this.clearActiveCommand(controllerId, requestId);
 
             if (msg.status === 'ok' || msg.success === true || msg.ok === 1) {
                 req.resolve(msg.data || msg);
@@ -135,6 +282,46 @@ export class HardwareTransportManager {
         }
     }
 
+    private handleJobMessage(controllerId: string, msg: any): void {
+        const jobKey = `${controllerId}:${msg.job}`;
+
+        if (msg.pending === 1) {
+            const requestId = msg.id || this.activeCommands.get(controllerId);
+            const req = requestId ? this.pendingRequests.get(requestId) : undefined;
+            if (!req) return;
+
+            clearTimeout(req.timeout);
+            this.pendingRequests.delete(requestId);
+            this.clearActiveCommand(controllerId, requestId);
+            this.awaitJob(controllerId, msg.job, req.resolve, req.reject);
+            return;
+        }
+
+        const job = this.pendingJobs.get(jobKey);
+        if (!job) {
+            logger.debug({ controllerId, job: msg.job }, 'Unclaimed job result');
+            return;
+        }
+        clearTimeout(job.timeout);
+        this.pendingJobs.delete(jobKey);
+
+        if (msg.ok === 1) {
+            job.resolve(msg);
+        } else {
+            job.reject(new Error(msg.error || 'Unknown Hardware Error'));
+        }
+    }
+
+    // Settles a request once the firmware pushes the result of its job
+    private awaitJob(controllerId: string, job: number, resolve: Function, reject: Function): void {
+        const jobKey = `${controllerId}:${job}`;
+        const timeout = setTimeout(() => {
+            this.pendingJobs.delete(jobKey);
+            reject(new Error(`Job ${job} on controller ${controllerId} timed out after ${JOB_TIMEOUT_MS / 1000}s`));
+        }, JOB_TIMEOUT_MS);
+        this.pendingJobs.set(jobKey, { resolve, reject, timeout });
+    }
+
     public async disconnectController(controllerId: string): Promise<void> {
         const transport = this.transports.get(controllerId);
         if (transport) {
@@ -38,6 +38,9 @@ export interface IHardwareTransport {
     onClose(handler: () => void): void;
 
     isConnected(): boolean;
+
+    // Requests that may be in flight at once (default 1: replies in order)
+    maxInFlight?(): number;
 }
 
 /**
@@ -0,0 +1,250 @@
+import { FirmwareBuilder } from '../../../services/FirmwareBuilder';
+
+/**
+ * Codec for the optional binary protocol (firmware plugin `binary_protocol`,
+ * see firmware/definitions/plugins/src/binary_protocol.cpp).
+ *
+ * Frame:   0x00 | COBS(payload | crc16_le) | 0x00
+ * Request: op_hash u16 | seq u8 | tagged args
+ * Reply:   seq u8 | tagged value (same shape as the JSON reply)
+ *
+ * op_hash is FirmwareBuilder.hashCommandName(cmd, seed); the seed is
+ * announced by the firmware in its reply to `PROTO`.
+ */
+
+export const BINARY_PROTOCOL_VERSION = 1;
+
+const T_NULL = 0x00;
+const T_I8 = 0x01;
+const T_I16 = 0x02;
+const T_I32 = 0x03;
+const T_F32 = 0x04;
+const T_STR = 0x05;
+const T_TRUE = 0x06;
+const T_FALSE = 0x07;
+const T_ARRAY = 0x08;
+const T_OBJECT = 0x09;
+const T_U32 = 0x0A;
+const T_END = 0xFF;
+
+// CRC-16/MODBUS, same as calculateModbusCRC16() in the firmware skeleton
+export function crc16Modbus(data: Uint8Array): number {
+    let crc = 0xFFFF;
+    for (const byte of data) {
+        crc ^= byte;
+        for (let i = 0; i < 8; i++) {
+            crc = (crc & 1) ? (crc >>> 1) ^ 0xA001 : crc >>> 1;
+        }
+    }
+    return crc;
+}
+
+export function cobsEncode(data: Uint8Array): Buffer {
+    const out: number[] = [];
+    let start = 0;
+    while (true) {
+        let end = start;
+        while (end < data.length && data[end] !== 0 && end - start < 254) end++;
+        out.push(end - start + 1);
+        for (let i = start; i < end; i++) out.push(data[i]);
+        if (end >= data.length) break;
+        start = data[end] === 0 ? end + 1 : end;
+    }
+    return Buffer.from(out);
+}
+
+export function cobsDecode(data: Uint8Array): Buffer | null {
+    const out: number[] = [];
+    let i = 0;
+    while (i < data.length) {
+        const code = data[i++];
+        if (code === 0) return null;
+        for (let k = 1; k < code; k++) {
+            if (i >= data.length) return null;
+            out.push(data[i++]);
+        }
+        if (code !== 0xFF && i < data.length) out.push(0);
+    }
+    return Buffer.from(out);
+}
+
+/**
+ * Per-link state once the firmware has agreed to binary framing.
+ */
+export class BinarySession {
+    private seq = 0;
+
+    constructor(private readonly seed: number) { }
+
+    /** Returns a session if `msg` is a positive reply to `PROTO`, otherwise null (stay on text). */
+    static fromProtoReply(msg: any): BinarySession | null {
+        if (msg && msg.ok === 1 && msg.proto === 'bin' && msg.ver === BINARY_PROTOCOL_VERSION && typeof msg.seed === 'number') {
+            return new BinarySession(msg.seed);
+        }
+        return null;
+    }
+
+    /**
+     * Encodes a text-protocol command (`CMD|a|b`) as a complete frame.
+     * Throws if an argument cannot be represented; callers send text instead.
+     */
+    encodeRequest(message: string): Buffer {
+        const [cmd, ...args] = message.split('|');
+        const op = FirmwareBuilder.hashCommandName(cmd, this.seed);
+        this.seq = (this.seq + 1) & 0xFF;
+
+        const payload: number[] = [op & 0xFF, op >> 8, this.seq];
+        args.forEach(arg => this.encodeArg(arg, payload));
+
+        const crc = crc16Modbus(Uint8Array.from(payload));
+        payload.push(crc & 0xFF, crc >> 8);
+        return Buffer.concat([Buffer.from([0]), cobsEncode(Uint8Array.from(payload)), Buffer.from([0])]);
+    }
+
+    /**
+     * Decodes a frame (delimiters stripped). Returns null for corrupt frames
+     * and for replies to an earlier request (e.g. one that already timed out).
+     * Pushed job results and telemetry batches carry the seq of the request
+     * that started them and are always accepted.
+     */
+    decodeReply(frame: Uint8Array): any | null {
+        const payload = cobsDecode(frame);
+        if (!payload || payload.length < 4) return null;
+
+        const body = payload.subarray(0, payload.length - 2);
+        if (crc16Modbus(body) !== payload.readUInt16LE(payload.length - 2)) return null;
+
+        const reader = { buf: body, pos: 1 };
+        const value = this.readValue(reader);
+        if (body[0] !== this.seq && !(value && (value.job !== undefined || value.type === 'TELEMETRY'))) return null;
+        return value;
+    }
+
+    private encodeArg(arg: string, out: number[]): void {
+        if (/^-?\d+$/.test(arg) && String(Number(arg)) === arg) {
+            const v = Number(arg);
+            if (v >= -128 && v <= 127) {
+                out.push(T_I8, v & 0xFF);
+                return;
+            }
+            if (v >= -32768 && v <= 32767) {
+                out.push(T_I16, v & 0xFF, (v >> 8) & 0xFF);
+                return;
+            }
+            if (v >= -2147483648 && v <= 0xFFFFFFFF) {
+                const b = Buffer.alloc(4);
+                if (v <= 2147483647) b.writeInt32LE(v); else b.writeUInt32LE(v);
+                out.push(v <= 2147483647 ? T_I32 : T_U32, ...b);
+                return;
+            }
+        }
+        // The firmware prints floats back with 4 decimals, so only send those that survive it
+        if (/^-?\d+\.\d{1,4}$/.test(arg) && Math.abs(Number(arg)) < 1e6) {
+            const b = Buffer.alloc(4);
+            b.writeFloatLE(Number(arg));
+            out.push(T_F32, ...b);
+            return;
+        }
+        const bytes = Buffer.from(arg, 'latin1');
+        if (bytes.length > 255) {
+            throw new Error(`Argument too long for binary frame (${bytes.length} bytes)`);
+        }
+        out.push(T_STR, bytes.length, ...bytes);
+    }
+
+    private readValue(r: { buf: Buffer, pos: number }): any {
+        const tag = r.buf[r.pos++];
+        switch (tag) {
+            case T_NULL: return null;
+            case T_TRUE: return true;
+            case T_FALSE: return false;
+            case T_I8: return r.buf.readInt8(r.pos++);
+            case T_I16: { const v = r.buf.readInt16LE(r.pos); r.pos += 2; return v; }
+            case T_I32: { const v = r.buf.readInt32LE(r.pos); r.pos += 4; return v; }
+            case T_U32: { const v = r.buf.readUInt32LE(r.pos); r.pos += 4; return v; }
+            case T_F32: {
+                // float32 -> shortest decimal the firmware could have meant
+                const v = r.buf.readFloatLE(r.pos);
+                r.pos += 4;
+                return parseFloat(v.toPrecision(7));
+            }
+            case T_STR: return this.readString(r);
+            case T_ARRAY: {
+                const arr: any[] = [];
+                while (r.buf[r.pos] !== T_END) arr.push(this.readValue(r));
+                r.pos++;
+                return arr;
+            }
+            case T_OBJECT: {
+                const obj: Record<string, any> = {};
+                while (r.buf[r.pos] !== T_END) {
+                    const key = this.readString(r);
+                    obj[key] = this.readValue(r);
+                }
+                r.pos++;
+                return obj;
+            }
+            default:
+                throw new Error(`Unknown binary tag 0x${(tag ?? 0).toString(16)}`);
+        }
+    }
+
+    private readString(r: { buf: Buffer, pos: number }): string {
+        const len = r.buf[r.pos++];
+        if (r.pos + len > r.buf.length) throw new Error('Truncated binary string');
+        const s = r.buf.toString('latin1', r.pos, r.pos + len);
+        r.pos += len;
+        return s;
+    }
+}
+
+/**
+ * Splits a serial byte stream into text lines and binary frames. A zero byte
+ * opens a frame and the next zero closes it; everything else is
+ * newline-delimited text.
+ */
+export class FrameSplitter {
+    private text: number[] = [];
+    private frame: number[] = [];
+    private inFrame = false;
+
+    constructor(
+        private readonly onLine: (line: string) => void,
+        private readonly onFrame: (frame: Buffer) => void
+    ) { }
+
+    push(chunk: Buffer): void {
+        for (const byte of chunk) {
+            if (this.inFrame) {
+                if (byte !== 0) {
+                    this.frame.push(byte);
+                } else if (this.frame.length > 0) {
+                    // Closing delimiter (an empty frame is a doubled delimiter, keep waiting)
+                    this.onFrame(Buffer.from(this.frame));
+                    this.frame = [];
+                    this.inFrame = false;
+                }
+            } else if (byte === 0) {
+                this.flushText();
+                this.inFrame = true;
+            } else if (byte === 0x0A) {
+                this.flushText();
+            } else {
+                this.text.push(byte);
+            }
+        }
+    }
+
+    /** Drops a partial line or frame (e.g. noise after a baud rate change). */
+    reset(): void {
+        this.text = [];
+        this.frame = [];
+        this.inFrame = false;
+    }
+
+    private flushText(): void {
+        if (this.text.length === 0) return;
+        this.onLine(Buffer.from(this.text).toString('utf-8'));
+        this.text = [];
+    }
+}
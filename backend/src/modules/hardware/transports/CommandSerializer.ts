@@ -0,0 +1,181 @@
+import { HardwarePacket } from '../interfaces';
+
+/**
+ * Converts a packet to the firmware text wire format: CMD|PARAM1|PARAM2...
+ * Shared by SerialTransport and UdpTransport; the binary protocol encodes the
+ * same message, so both framings carry identical parameters.
+ */
+export function serializeCommand(packet: HardwarePacket): string {
+    let message = packet.cmd;
+
+    // Serialize Parameters based on Command Type
+    // SENSORS (Single Pin)
+    if (['DIGITAL_READ', 'DHT_READ', 'PULSE_RATE', 'PULSE_RESET', 'ONEWIRE_SCAN'].includes(packet.cmd)) {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+    }
+    // ADC (Format: ANALOG|PIN[|SAMPLES[|mean or median[|BITS]]]); trailing empty fields are dropped
+    else if (packet.cmd === 'ANALOG') {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+        message += optionalArgs([packet.samples, packet.filter, packet.bits]);
+    }
+    else if (packet.cmd === 'ANALOG_WATCH') {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+        message += `|${packet.periodMs ?? 0}` + optionalArgs([packet.samples, packet.alphaPct]);
+    }
+    else if (packet.cmd === 'ANALOG_BURST') {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+        message += `|${packet.count ?? 1}` + optionalArgs([packet.intervalUs, packet.bits]);
+    }
+    // DS18B20 (Format: ONEWIRE_READ_TEMP|PIN[|ROM or *[|RESOLUTION]])
+    else if (packet.cmd === 'ONEWIRE_READ_TEMP') {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+        if (packet.rom !== undefined || packet.resolution !== undefined) message += `|${packet.rom ?? ''}`;
+        if (packet.resolution !== undefined) message += `|${packet.resolution}`;
+    }
+    // ACTUATORS (Pin + State/Value)
+    else if (['RELAY_SET', 'DIGITAL_WRITE'].includes(packet.cmd)) {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+        if (packet.state !== undefined) message += `|${packet.state}`;
+    }
+    else if (packet.cmd === 'PWM_WRITE' || packet.cmd === 'WRITE') {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+        if (packet.value !== undefined) message += `|${packet.value}`;
+    }
+    else if (packet.cmd === 'SERVO_WRITE') {
+        const pinStr = formatPin(packet);
+        if (pinStr) message += `|${pinStr}`;
+        if (packet.angle !== undefined) message += `|${packet.angle}`;
+    }
+    // MODBUS RTU (JSON Format: CMD|JSON)
+    else if (packet.cmd === 'MODBUS_RTU_READ') {
+        const jsonParams: any = {
+            slaveId: packet.slaveId ?? packet.addr ?? 1,
+            funcCode: packet.funcCode ?? packet.func ?? 3,
+            startAddr: packet.startAddr ?? packet.reg ?? 0,
+            len: packet.len ?? packet.count ?? 1,
+            ...modbusBusParams(packet)
+        };
+        message += `|${JSON.stringify(jsonParams)}`;
+    }
+    // FC05/06 take a single value, FC15/16 a values array
+    else if (packet.cmd === 'MODBUS_RTU_WRITE') {
+        const jsonParams: any = {
+            slaveId: packet.slaveId ?? packet.addr ?? 1,
+            funcCode: packet.funcCode ?? packet.func ?? (Array.isArray(packet.values) ? 16 : 6),
+            startAddr: packet.startAddr ?? packet.reg ?? 0,
+            ...modbusBusParams(packet)
+        };
+        if (Array.isArray(packet.values)) jsonParams.values = packet.values;
+        else jsonParams.value = packet.value;
+        message += `|${JSON.stringify(jsonParams)}`;
+    }
+    // Read plan: reads = [[slaveId, funcCode, startAddr, len], ...] on one bus
+    else if (packet.cmd === 'MODBUS_RTU_PLAN') {
+        if (!Array.isArray(packet.reads) || packet.reads.length === 0) {
+            throw new Error('MODBUS_RTU_PLAN requires a reads array');
+        }
+        const jsonParams: any = { reads: packet.reads, ...modbusBusParams(packet) };
+        message += `|${JSON.stringify(jsonParams)}`;
+    }
+    // I2C READ (Format: I2C_READ|ADDR|COUNT)
+    else if (packet.cmd === 'I2C_READ') {
+        const addr = packet.addr !== undefined ? packet.addr : packet.address;
+        const count = packet.count !== undefined ? packet.count : packet.bytes;
+
+        if (addr === undefined || count === undefined) {
+            throw new Error('I2C_READ requires addr and count parameters');
+        }
+        message += `|${addr}|${count}`;
+    }
+    // UART SENSORS (Format: UART_READ_DISTANCE|RX|TX)
+    else if (packet.cmd === 'UART_READ_DISTANCE') {
+        const rxStr = formatRolePin(packet, 'RX');
+        const txStr = formatRolePin(packet, 'TX');
+
+        if (!rxStr || !txStr) {
+            throw new Error('UART_READ_DISTANCE requires RX and TX pins');
+        }
+
+        message += `|${rxStr}|${txStr}`;
+    }
+    // ULTRASONIC (Format: ULTRASONIC_TRIG_ECHO|TRIG|ECHO[|SAMPLES])
+    else if (packet.cmd === 'ULTRASONIC_TRIG_ECHO') {
+        const trigStr = formatRolePin(packet, 'TRIG');
+        const echoStr = formatRolePin(packet, 'ECHO');
+
+        if (!trigStr || !echoStr) {
+            throw new Error('ULTRASONIC_TRIG_ECHO requires TRIG and ECHO pins');
+        }
+
+        message += `|${trigStr}|${echoStr}` + optionalArgs([packet.samples]);
+    }
+    // TELEMETRY SAMPLER (Format: SUBSCRIBE|<serialized command>|PERIOD_MS)
+    else if (packet.cmd === 'SUBSCRIBE') {
+        if (!packet.command || packet.period === undefined) {
+            throw new Error('SUBSCRIBE requires command and period parameters');
+        }
+        message += `|${serializeCommand(packet.command)}|${packet.period}`;
+    }
+    else if (packet.cmd === 'UNSUBSCRIBE') {
+        if (packet.sub !== undefined) message += `|${packet.sub}`;
+    }
+    // BATCH (Format: BATCH|CMD1|A|B;CMD2|C...)
+    else if (packet.cmd === 'BATCH') {
+        if (!Array.isArray(packet.items) || packet.items.length === 0) {
+            throw new Error('BATCH requires at least one item');
+        }
+        message += `|${packet.items.map((item: HardwarePacket) => serializeCommand(item)).join(';')}`;
+    }
+
+    return message;
+}
+
+/** Bus settings shared by the MODBUS_RTU_* commands (firmware accepts 'pins' or rxPin/txPin) */
+function modbusBusParams(packet: HardwarePacket): any {
+    const params: any = { baudRate: packet.baudRate ?? 9600 };
+    if (packet.timeout !== undefined) params.timeout = packet.timeout;
+
+    if (packet.pins && Array.isArray(packet.pins)) {
+        params.pins = packet.pins;
+    } else {
+        if (packet.rxPin !== undefined) params.rxPin = packet.rxPin;
+        if (packet.txPin !== undefined) params.txPin = packet.txPin;
+        // Legacy fallback
+        if (params.rxPin === undefined && packet.rx !== undefined) params.rxPin = packet.rx;
+        if (params.txPin === undefined && packet.tx !== undefined) params.txPin = packet.tx;
+    }
+    return params;
+}
+
+/** Positional optional arguments: `|a|b|c`, empty for unset ones in the middle, none trailing */
+function optionalArgs(values: any[]): string {
+    let last = values.length - 1;
+    while (last >= 0 && values[last] === undefined) last--;
+    return values.slice(0, last + 1).map(v => `|${v ?? ''}`).join('');
+}
+
+function formatPin(packet: HardwarePacket): string | undefined {
+    if (packet.pins && Array.isArray(packet.pins) && packet.pins.length > 0) {
+        const p = packet.pins.find((p: any) => p.role === 'default') || packet.pins[0];
+        return `${p.portId}_${p.gpio}`;
+    }
+    if (packet.pin !== undefined) {
+        return `${packet.pin}`;
+    }
+    return undefined;
+}
+
+function formatRolePin(packet: HardwarePacket, role: string): string | undefined {
+    if (packet.pins && Array.isArray(packet.pins)) {
+        const p = packet.pins.find((p: any) => p.role === role);
+        if (p) return `${p.portId}_${p.gpio}`;
+    }
+    return undefined;
+}
@@ -1,12 +1,28 @@
 import { IHardwareTransport, HardwarePacket, HardwareResponse } from '../interfaces';
-import { ReadlineParser } from '@serialport/parser-readline';
 import { logger } from '../../../core/LoggerService';
+import { serializeCommand } from './CommandSerializer';
+import { BinarySession, FrameSplitter } from './BinaryCodec';
+
+const PROTO_NEGOTIATION_TIMEOUT_MS = 1000;
+
+// SET_BAUD (firmware sys_baud.cpp): rates tried, fastest first. The firmware
+// keeps a confirmed rate across resets, so these are also probed when the
+// configured rate gets no answer.
+const BAUD_UPGRADE_RATES = [1000000, 500000, 115200];
+const BAUD_PROBE_TIMEOUT_MS = 300;
+const BAUD_SWITCH_DELAY_MS = 50;   // the firmware flushes its reply, then switches
+const BAUD_VERIFY_ATTEMPTS = 2;
 
 export class SerialTransport implements IHardwareTransport {
     private port: any | null = null; // SerialPort instance
-    private parser: any | null = null;
+    private parser: FrameSplitter | null = null;
     private path: string = '';
     private _isConnected: boolean = false;
+    private binary: BinarySession | null = null; // Set when the firmware accepted binary framing
+    private replyWaiter: ((msg: any) => void) | null = null; // Handshake replies (PROTO, SET_BAUD, PING)
+    private baudRate: number = 9600;
+    private static lastBaudRate = new Map<string, number>(); // path -> rate the firmware confirmed
+    private static failedBaudRate = new Map<string, number>(); // path -> lowest rate that did not verify
 
     private messageHandler: ((msg: HardwareResponse | any) => void) | null = null;
     private errorHandler: ((err: Error) => void) | null = null;
@@ -15,6 +31,7 @@ export class SerialTransport implements IHardwareTransport {
     async connect(path: string, options?: any): Promise<void> {
         this.path = path;
         const baudRate = options?.baudRate || 9600;
+        this.baudRate = baudRate;
         logger.info({ path, baudRate }, '🔌 [SerialTransport] Connecting...');
 
         try {
@@ -39,13 +56,17 @@ export class SerialTransport implements IHardwareTransport {
                     logger.info({ path }, '✅ [SerialTransport] Port Opened');
                     this._isConnected = true;
 
-                    // Setup Parser
-                    this.parser = this.port.pipe(new ReadlineParser({ delimiter: '\n' }));
+                    // Setup Parser (text lines and binary frames share the stream)
+                    const parser = new FrameSplitter(
+                        (line: string) => {
+                            logger.debug({ data: line }, '📥 [SerialTransport] Raw Data Received');
+                            this.handleData(line);
+                        },
+                        (frame: Buffer) => this.handleFrame(frame)
+                    );
 
-                    this.parser.on('data', (data: string) => {
-                        logger.debug({ data }, '📥 [SerialTransport] Raw Data Received');
-                        this.handleData(data);
-                    });
+                    this.parser = parser;
+                    this.port.on('data', (chunk: Buffer) => parser.push(chunk));
 
                     this.port.on('error', (err: Error) => {
                         logger.error({ err }, '🔥 [SerialTransport] Port Error');
@@ -55,11 +76,19 @@ export class SerialTransport implements IHardwareTransport {
                     this.port.on('close', () => {
                         logger.warn({ path }, '🔌 [SerialTransport] Port Closed');
                         this._isConnected = false;
+                        this.binary = null;
                         if (this.closeHandler) this.closeHandler();
                     });
 
                     // Wait for Arduino Reset/Startup (optional, but good practice)
-                    setTimeout(() => {
+                    setTimeout(async () => {
+                        await this.probeBaudRate(baudRate);
+                        if (options?.baudUpgrade !== false) {
+                            await this.upgradeBaudRate();
+                        }
+                        if (options?.protocol !== 'text') {
+                            await this.negotiateProtocol();
+                        }
                         resolve();
                     }, 2000);
                 });
@@ -89,124 +118,152 @@ export class SerialTransport implements IHardwareTransport {
             throw new Error('Serial port not connected');
         }
 
-        // Convert Packet to Delimited String: CMD|PARAM1|PARAM2...
         logger.debug({ packet }, '🔍 [SerialTransport] Processing Packet');
-        let message = '';
-        if (packet.cmd === 'PING') {
-            message = 'PING';
-        } else if (packet.cmd === 'STATUS') {
-            message = 'STATUS';
-        } else {
-            message = packet.cmd;
-
-            // Serialize Parameters based on Command Type
-            // SENSORS (Single Pin)
-            if (['ANALOG', 'DIGITAL_READ', 'DHT_READ', 'ONEWIRE_READ_TEMP', 'PULSE_RATE'].includes(packet.cmd)) {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-            }
-            // ACTUATORS (Pin + State/Value)
-            else if (['RELAY_SET', 'DIGITAL_WRITE'].includes(packet.cmd)) {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-                if (packet.state !== undefined) message += `|${packet.state}`;
-            }
-            else if (packet.cmd === 'PWM_WRITE') {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-                if (packet.value !== undefined) message += `|${packet.value}`;
-            }
-            else if (packet.cmd === 'WRITE') {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-                if (packet.value !== undefined) message += `|${packet.value}`;
-            }
-            else if (packet.cmd === 'SERVO_WRITE') {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-                if (packet.angle !== undefined) message += `|${packet.angle}`;
-            }
-            // MODBUS RTU (JSON Format: CMD|JSON)
-            else if (packet.cmd === 'MODBUS_RTU_READ') {
-                const jsonParams: any = {
-                    slaveId: packet.slaveId ?? packet.addr ?? 1,
-                    funcCode: packet.funcCode ?? packet.func ?? 3,
-                    startAddr: packet.startAddr ?? packet.reg ?? 0,
-                    len: packet.len ?? packet.count ?? 1,
-                    baudRate: packet.baudRate ?? 9600
-                };
-
-                // Add pins if available
-                if (packet.pins && Array.isArray(packet.pins)) {
-                    jsonParams.pins = packet.pins;
-                } else {
-                    if (packet.rxPin !== undefined) jsonParams.rxPin = packet.rxPin;
-                    if (packet.txPin !== undefined) jsonParams.txPin = packet.txPin;
-                    // Legacy fallback
-                    if (!jsonParams.rxPin && packet.rx !== undefined) jsonParams.rxPin = packet.rx;
-                    if (!jsonParams.txPin && packet.tx !== undefined) jsonParams.txPin = packet.tx;
-                }
+        const message = serializeCommand(packet);
 
-                message += `|${JSON.stringify(jsonParams)}`;
+        // Binary framing when negotiated; text (newline-delimited) otherwise
+        let data: string | Buffer = message + '\n';
+        if (this.binary) {
+            try {
+                data = this.binary.encodeRequest(message);
+            } catch (err) {
+                logger.debug({ err, message }, '📝 [SerialTransport] Not encodable as binary, sending text');
             }
-            // I2C READ (Format: I2C_READ|ADDR|COUNT)
-            else if (packet.cmd === 'I2C_READ') {
-                const addr = packet.addr !== undefined ? packet.addr : packet.address;
-                const count = packet.count !== undefined ? packet.count : packet.bytes;
+        }
+        logger.debug({ packet, serialized: message }, '📤 [SerialTransport] Sending Raw String (DEBUG)');
 
-                if (addr === undefined || count === undefined) {
-                    throw new Error('I2C_READ requires addr and count parameters');
-                }
-                message += `|${addr}|${count}`;
-            }
-            // UART SENSORS (Format: UART_READ_DISTANCE|RX|TX)
-            else if (packet.cmd === 'UART_READ_DISTANCE') {
-                let rxStr: string | undefined;
-                let txStr: string | undefined;
-
-                if (packet.pins && Array.isArray(packet.pins)) {
-                    const rxPin = packet.pins.find((p: any) => p.role === 'RX');
-                    const txPin = packet.pins.find((p: any) => p.role === 'TX');
-                    if (rxPin) rxStr = `${rxPin.portId}_${rxPin.gpio}`;
-                    if (txPin) txStr = `${txPin.portId}_${txPin.gpio}`;
-                }
+        return new Promise((resolve, reject) => {
+            this.port.write(data, (err: Error | null) => {
+                if (err) reject(err);
+                else resolve(message); // The newline/frame is transport framing; the content is 'message'.
+            });
+        });
+    }
 
-                if (!rxStr || !txStr) {
-                    throw new Error('UART_READ_DISTANCE requires RX and TX pins');
-                }
+    /**
+     * Sends a text line outside the command queue and resolves with the next
+     * JSON reply carrying `ok`, or null after `timeoutMs`.
+     */
+    private query(line: string, timeoutMs: number): Promise<any> {
+        return new Promise<any>((resolve) => {
+            const timer = setTimeout(() => {
+                this.replyWaiter = null;
+                resolve(null);
+            }, timeoutMs);
+            this.replyWaiter = (msg: any) => {
+                clearTimeout(timer);
+                this.replyWaiter = null;
+                resolve(msg);
+            };
+            this.port.write(line + '\n');
+        });
+    }
+
+    private async ping(): Promise<boolean> {
+        const reply = await this.query('PING', BAUD_PROBE_TIMEOUT_MS);
+        return reply?.pong === 1;
+    }
+
+    private setPortBaudRate(baudRate: number): Promise<void> {
+        return new Promise((resolve, reject) => {
+            this.port.update({ baudRate }, (err: Error | null) => {
+                if (err) return reject(err);
+                this.baudRate = baudRate;
+                this.parser?.reset(); // bytes received around the switch are noise
+                resolve();
+            });
+        });
+    }
 
-                message += `|${rxStr}|${txStr}`;
+    /**
+     * The firmware starts at the rate it last confirmed. When the configured
+     * rate gets no PING answer, the last rate seen on this port and the
+     * upgrade rates are tried. Nothing answering leaves the configured rate.
+     */
+    private async probeBaudRate(configured: number): Promise<void> {
+        if (await this.ping()) return;
+        const last = SerialTransport.lastBaudRate.get(this.path);
+        const candidates = [last, ...BAUD_UPGRADE_RATES].filter((rate, i, all): rate is number =>
+            rate !== undefined && rate !== configured && all.indexOf(rate) === i);
+        for (const rate of candidates) {
+            await this.setPortBaudRate(rate);
+            if (await this.ping()) {
+                logger.info({ path: this.path, baudRate: rate }, '🔎 [SerialTransport] Firmware found at a negotiated baud rate');
+                return;
+            }
+        }
+        await this.setPortBaudRate(configured);
+    }
+
+    /**
+     * Raises the link to the fastest rate both ends can hold: SET_BAUD|rate,
+     * switch the port, verify with PING. The firmware goes back to the old
+     * rate by itself when the PING does not arrive (confirm_ms), and so does
+     * the port. Firmware without SET_BAUD answers ERR_INVALID_COMMAND and the
+     * rate stays.
+     */
+    private async upgradeBaudRate(): Promise<void> {
+        for (const rate of BAUD_UPGRADE_RATES) {
+            if (rate <= this.baudRate) break;
+            if (rate >= (SerialTransport.failedBaudRate.get(this.path) ?? Infinity)) continue;
+            const from = this.baudRate;
+            const reply = await this.query(`SET_BAUD|${rate}`, PROTO_NEGOTIATION_TIMEOUT_MS);
+            if (!reply) return;
+            if (reply.ok !== 1) {
+                if (reply.error === 'ERR_INVALID_VALUE') continue; // rate not offered by this board
+                return;
             }
-            // ULTRASONIC (Format: ULTRASONIC_TRIG_ECHO|TRIG|ECHO)
-            else if (packet.cmd === 'ULTRASONIC_TRIG_ECHO') {
-                let trigStr: string | undefined;
-                let echoStr: string | undefined;
-
-                if (packet.pins && Array.isArray(packet.pins)) {
-                    const trigPin = packet.pins.find((p: any) => p.role === 'TRIG');
-                    const echoPin = packet.pins.find((p: any) => p.role === 'ECHO');
-                    if (trigPin) trigStr = `${trigPin.portId}_${trigPin.gpio}`;
-                    if (echoPin) echoStr = `${echoPin.portId}_${echoPin.gpio}`;
-                }
 
-                if (!trigStr || !echoStr) {
-                    throw new Error('ULTRASONIC_TRIG_ECHO requires trig_pin and echo_pin');
+            const switchedAt = Date.now();
+            await new Promise(resolve => setTimeout(resolve, BAUD_SWITCH_DELAY_MS));
+            await this.setPortBaudRate(rate);
+            for (let attempt = 0; attempt < BAUD_VERIFY_ATTEMPTS; attempt++) {
+                if (await this.ping()) {
+                    SerialTransport.lastBaudRate.set(this.path, rate);
+                    logger.info({ path: this.path, from, baudRate: rate }, '⚡ [SerialTransport] Baud rate upgraded');
+                    return;
                 }
+            }
 
-                message += `|${trigStr}|${echoStr}`;
+            // Wait out the firmware's trial, then make sure it is back
+            logger.warn({ path: this.path, baudRate: rate }, '⚠️ [SerialTransport] No answer at the new baud rate, reverting');
+            SerialTransport.failedBaudRate.set(this.path, rate);
+            await this.setPortBaudRate(from);
+            const confirmMs = Number(reply.confirm_ms) || 2000;
+            const remaining = switchedAt + confirmMs + BAUD_SWITCH_DELAY_MS - Date.now();
+            if (remaining > 0) await new Promise(resolve => setTimeout(resolve, remaining));
+            if (!(await this.ping())) {
+                logger.error({ path: this.path, baudRate: from }, '❌ [SerialTransport] Firmware did not return to the previous baud rate');
+                return;
             }
         }
+    }
 
-        // Add newline delimiter
-        const data = message + '\n';
-        logger.debug({ packet, serialized: data.trim() }, '📤 [SerialTransport] Sending Raw String (DEBUG)');
+    /**
+     * Asks the firmware for the binary protocol. Firmware without the
+     * binary_protocol plugin answers ERR_INVALID_COMMAND (or nothing) and the
+     * link stays on text.
+     */
+    private async negotiateProtocol(): Promise<void> {
+        const reply = await this.query('PROTO', PROTO_NEGOTIATION_TIMEOUT_MS);
 
-        return new Promise((resolve, reject) => {
-            this.port.write(data, (err: Error | null) => {
-                if (err) reject(err);
-                else resolve(message); // Return original message (without newline for display clarity, or with?) User wants 1:1. The newline is transport framing. The content is 'message'.
-            });
-        });
+        this.binary = BinarySession.fromProtoReply(reply);
+        logger.info({ path: this.path, protocol: this.binary ? 'binary' : 'text' }, '🤝 [SerialTransport] Protocol negotiated');
+    }
+
+    private handleFrame(frame: Buffer): void {
+        try {
+            const msg = this.binary?.decodeReply(frame);
+            if (!msg) {
+                logger.debug({ bytes: frame.length }, '📝 [SerialTransport] Dropped binary frame (corrupt or stale)');
+                return;
+            }
+            if (this.messageHandler) {
+                this.messageHandler(msg);
+            }
+        } catch (error) {
+            logger.error({ error }, '❌ [SerialTransport] Binary Decode Error');
+        }
     }
 
     private handleData(raw: string): void {
@@ -217,6 +274,10 @@ export class SerialTransport implements IHardwareTransport {
             // Try parsing JSON
             try {
                 const msg = JSON.parse(trimmed);
+                if (this.replyWaiter && msg.ok !== undefined) {
+                    this.replyWaiter(msg);
+                    return;
+                }
                 if (this.messageHandler) {
                     this.messageHandler(msg);
                 }
@@ -248,15 +309,4 @@ export class SerialTransport implements IHardwareTransport {
     isConnected(): boolean {
         return this._isConnected;
     }
-
-    private formatPin(packet: HardwarePacket): string | undefined {
-        if (packet.pins && Array.isArray(packet.pins) && packet.pins.length > 0) {
-            const p = packet.pins.find((p: any) => p.role === 'default') || packet.pins[0];
-            return `${p.portId}_${p.gpio}`;
-        }
-        if (packet.pin !== undefined) {
-            return `${packet.pin}`;
-        }
-        return undefined;
-    }
 }
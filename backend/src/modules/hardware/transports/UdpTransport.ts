@@ -1,12 +1,37 @@
 import { IHardwareTransport, HardwarePacket, HardwareResponse } from '../interfaces';
 import { createSocket, Socket } from 'dgram';
 import { logger } from '../../../core/LoggerService';
+import { serializeCommand } from './CommandSerializer';
+import { BinarySession } from './BinaryCodec';
+
+const PROTO_NEGOTIATION_TIMEOUT_MS = 1000;
+
+// Text requests carry an id ("#<id>|CMD|...") when the firmware echoes it
+// (wifi_native, sys_replay.cpp). Unanswered requests are resent with the same
+// id; the firmware answers a repeat from its replay cache instead of running
+// it again. Four sends span the manager's 5s command timeout.
+const REQUEST_ID_MAX = 65535;
+const RETRANSMIT_MS = 1200;
+const MAX_SENDS = 4;
+const MAX_IN_FLIGHT = 4; // within the firmware's replay cache (8 replies)
+
+interface InFlightRequest {
+    packetId: string;
+    data: string;
+    sends: number;
+    timer: NodeJS.Timeout;
+}
 
 export class UdpTransport implements IHardwareTransport {
     private socket: Socket | null = null;
     private targetIp: string = '';
     private targetPort: number = 8888;
     private _isConnected: boolean = false;
+    private binary: BinarySession | null = null; // Set when the firmware accepted binary framing
+    private protoWaiter: ((msg: any) => void) | null = null;
+    private requestIds = false; // Set when the firmware echoed a request id
+    private nextRequestId = 1;
+    private inFlight: Map<number, InFlightRequest> = new Map();
 
     private messageHandler: ((msg: HardwareResponse | any) => void) | null = null;
     private errorHandler: ((err: Error) => void) | null = null;
@@ -45,6 +70,12 @@ export class UdpTransport implements IHardwareTransport {
                 });
 
                 this.socket.on('message', (msg, rinfo) => {
+                    // Binary replies start with the frame delimiter
+                    if (msg.length > 1 && msg[0] === 0) {
+                        const end = msg[msg.length - 1] === 0 ? msg.length - 1 : msg.length;
+                        this.handleFrame(msg.subarray(1, end));
+                        return;
+                    }
                     const raw = msg.toString();
                     logger.debug({ raw, from: rinfo.address }, '📥 [UdpTransport] Received');
                     this.handleData(raw);
@@ -56,8 +87,14 @@ export class UdpTransport implements IHardwareTransport {
                 });
 
                 // UDP is connectionless, so we just bind to a random port to listen for responses
-                this.socket.bind(0, () => {
+                this.socket.bind(0, async () => {
                     this._isConnected = true;
+                    if (options?.protocol !== 'text') {
+                        await this.negotiateProtocol();
+                    }
+                    if (!this.binary) {
+                        await this.negotiateRequestIds();
+                    }
                     resolve();
                 });
 
@@ -71,6 +108,9 @@ export class UdpTransport implements IHardwareTransport {
         if (this.socket) {
             this.socket.close();
             this._isConnected = false;
+            this.binary = null;
+            this.inFlight.forEach(request => clearTimeout(request.timer));
+            this.inFlight.clear();
             if (this.closeHandler) this.closeHandler();
         }
     }
@@ -78,120 +118,133 @@ export class UdpTransport implements IHardwareTransport {
     async send(packet: HardwarePacket): Promise<string> {
         if (!this.socket) throw new Error('UDP Socket not initialized');
 
-        // Convert Packet to Delimited String: CMD|PARAM1|PARAM2...
-        let message = '';
-        if (packet.cmd === 'PING') {
-            message = 'PING';
-        } else if (packet.cmd === 'STATUS') {
-            message = 'STATUS';
-        } else {
-            message = packet.cmd;
-
-            // Serialize Parameters based on Command Type
-            // SENSORS (Single Pin)
-            if (['ANALOG', 'DIGITAL_READ', 'DHT_READ', 'ONEWIRE_READ_TEMP', 'PULSE_RATE'].includes(packet.cmd)) {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-            }
-            // ACTUATORS (Pin + State/Value)
-            else if (['RELAY_SET', 'DIGITAL_WRITE'].includes(packet.cmd)) {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-                if (packet.state !== undefined) message += `|${packet.state}`;
-            }
-            else if (packet.cmd === 'PWM_WRITE') {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-                if (packet.value !== undefined) message += `|${packet.value}`;
-            }
-            else if (packet.cmd === 'SERVO_WRITE') {
-                const pinStr = this.formatPin(packet);
-                if (pinStr) message += `|${pinStr}`;
-                if (packet.angle !== undefined) message += `|${packet.angle}`;
-            }
-            // MODBUS RTU (JSON Format: CMD|JSON)
-            else if (packet.cmd === 'MODBUS_RTU_READ') {
-                // Construct parameters matching firmware generic implementation
-                const jsonParams: any = {
-                    slaveId: packet.slaveId ?? packet.addr ?? 1,
-                    funcCode: packet.funcCode ?? packet.func ?? 3,
-                    startAddr: packet.startAddr ?? packet.reg ?? 0,
-                    len: packet.len ?? packet.count ?? 1,
-                    baudRate: packet.baudRate ?? 9600
-                };
-
-                // Add pins if available (Firmware handles 'pins' array or rxPin/txPin)
-                if (packet.pins && Array.isArray(packet.pins)) {
-                    jsonParams.pins = packet.pins;
-                } else if (packet.rxPin !== undefined && packet.txPin !== undefined) {
-                    jsonParams.rxPin = packet.rxPin;
-                    jsonParams.txPin = packet.txPin;
-                } else if (packet.rx !== undefined && packet.tx !== undefined) {
-                    // Fallback for legacy
-                    jsonParams.rxPin = packet.rx;
-                    jsonParams.txPin = packet.tx;
-                }
+        const message = serializeCommand(packet);
 
-                message += `|${JSON.stringify(jsonParams)}`;
+        // Binary framing when negotiated; plain text datagram otherwise
+        let data: string | Buffer = message;
+        if (this.binary) {
+            try {
+                data = this.binary.encodeRequest(message);
+            } catch (err) {
+                logger.debug({ err, message }, '📝 [UdpTransport] Not encodable as binary, sending text');
             }
-            // I2C READ (Format: I2C_READ|ADDR|COUNT)
-            else if (packet.cmd === 'I2C_READ') {
-                const addr = packet.addr !== undefined ? packet.addr : packet.address;
-                const count = packet.count !== undefined ? packet.count : packet.bytes;
+        }
 
-                if (addr === undefined || count === undefined) {
-                    throw new Error('I2C_READ requires addr and count parameters');
-                }
-                message += `|${addr}|${count}`;
-            }
-            // UART SENSORS (Format: UART_READ_DISTANCE|RX|TX)
-            else if (packet.cmd === 'UART_READ_DISTANCE') {
-                let rxStr: string | undefined;
-                let txStr: string | undefined;
-
-                if (packet.pins && Array.isArray(packet.pins)) {
-                    const rxPin = packet.pins.find((p: any) => p.role === 'RX');
-                    const txPin = packet.pins.find((p: any) => p.role === 'TX');
-                    if (rxPin) rxStr = `${rxPin.portId}_${rxPin.gpio}`;
-                    if (txPin) txStr = `${txPin.portId}_${txPin.gpio}`;
-                }
+        logger.debug({ ip: this.targetIp, port: this.targetPort, message }, '📤 [UdpTransport] Sending');
 
-                if (!rxStr || !txStr) {
-                    throw new Error('UART_READ_DISTANCE requires RX and TX pins');
-                }
+        if (this.requestIds && typeof data === 'string') {
+            await this.sendWithId(packet.id, data);
+            return message;
+        }
 
-                message += `|${rxStr}|${txStr}`;
-            }
-            // ULTRASONIC (Format: ULTRASONIC_TRIG_ECHO|TRIG|ECHO)
-            else if (packet.cmd === 'ULTRASONIC_TRIG_ECHO') {
-                let trigStr: string | undefined;
-                let echoStr: string | undefined;
-
-                if (packet.pins && Array.isArray(packet.pins)) {
-                    const trigPin = packet.pins.find((p: any) => p.role === 'TRIG');
-                    const echoPin = packet.pins.find((p: any) => p.role === 'ECHO');
-                    if (trigPin) trigStr = `${trigPin.portId}_${trigPin.gpio}`;
-                    if (echoPin) echoStr = `${echoPin.portId}_${echoPin.gpio}`;
-                }
+        return new Promise((resolve, reject) => {
+            this.socket?.send(data, this.targetPort, this.targetIp, (err) => {
+                if (err) reject(err);
+                else resolve(message);
+            });
+        });
+    }
 
-                if (!trigStr || !echoStr) {
-                    throw new Error('ULTRASONIC_TRIG_ECHO requires TRIG and ECHO pins');
-                }
+    /**
+     * How many requests the manager may keep in flight: several once replies
+     * are matched by id, otherwise one (replies are matched by arrival order).
+     */
+    maxInFlight(): number {
+        return this.requestIds ? MAX_IN_FLIGHT : 1;
+    }
 
-                message += `|${trigStr}|${echoStr}`;
-            }
+    private async sendWithId(packetId: string, message: string): Promise<void> {
+        const id = this.nextRequestId;
+        this.nextRequestId = id >= REQUEST_ID_MAX ? 1 : id + 1;
+
+        const request: InFlightRequest = { packetId, data: `#${id}|${message}`, sends: 1, timer: this.retransmitTimer(id) };
+        this.inFlight.set(id, request);
+        try {
+            await this.transmit(request.data);
+        } catch (err) {
+            clearTimeout(request.timer);
+            this.inFlight.delete(id);
+            throw err;
         }
+    }
 
-        logger.debug({ ip: this.targetIp, port: this.targetPort, message }, '📤 [UdpTransport] Sending');
+    private retransmitTimer(id: number): NodeJS.Timeout {
+        return setTimeout(() => {
+            const request = this.inFlight.get(id);
+            if (!request) return;
+            if (request.sends >= MAX_SENDS) {
+                this.inFlight.delete(id); // the manager times the command out
+                return;
+            }
+            request.sends++;
+            request.timer = this.retransmitTimer(id);
+            logger.debug({ ip: this.targetIp, id, sends: request.sends }, '🔁 [UdpTransport] Resending unanswered request');
+            this.transmit(request.data).catch(err => logger.warn({ err, id }, '⚠️ [UdpTransport] Resend failed'));
+        }, RETRANSMIT_MS);
+    }
 
+    private transmit(data: string): Promise<void> {
         return new Promise((resolve, reject) => {
-            this.socket?.send(message, this.targetPort, this.targetIp, (err) => {
+            this.socket?.send(data, this.targetPort, this.targetIp, (err) => {
                 if (err) reject(err);
-                else resolve(message);
+                else resolve();
             });
         });
     }
 
+    /**
+     * Checks whether the firmware echoes request ids. Firmware without them
+     * rejects the prefixed PING as ERR_INVALID_COMMAND (without running
+     * anything) and the link keeps one request in flight.
+     */
+    private async negotiateRequestIds(): Promise<void> {
+        const reply = await this.awaitNegotiation(`#${REQUEST_ID_MAX}|PING`);
+        this.requestIds = reply?.id === REQUEST_ID_MAX;
+        logger.info({ ip: this.targetIp, requestIds: this.requestIds }, '🤝 [UdpTransport] Request ids negotiated');
+    }
+
+    /**
+     * Asks the firmware for the binary protocol. Firmware without the
+     * binary_protocol plugin answers ERR_INVALID_COMMAND (or nothing) and the
+     * link stays on text.
+     */
+    private async negotiateProtocol(): Promise<void> {
+        const reply = await this.awaitNegotiation('PROTO');
+        this.binary = BinarySession.fromProtoReply(reply);
+        logger.info({ ip: this.targetIp, protocol: this.binary ? 'binary' : 'text' }, '🤝 [UdpTransport] Protocol negotiated');
+    }
+
+    // Sends a handshake request and resolves with its reply (null on timeout)
+    private awaitNegotiation(request: string): Promise<any> {
+        return new Promise<any>((resolve) => {
+            const timer = setTimeout(() => {
+                this.protoWaiter = null;
+                resolve(null);
+            }, PROTO_NEGOTIATION_TIMEOUT_MS);
+            this.protoWaiter = (msg: any) => {
+                clearTimeout(timer);
+                this.protoWaiter = null;
+                resolve(msg);
+            };
+            this.socket?.send(request, this.targetPort, this.targetIp);
+        });
+    }
+
+    private handleFrame(frame: Buffer): void {
+        try {
+            const msg = this.binary?.decodeReply(frame);
+            if (!msg) {
+                logger.debug({ bytes: frame.length }, '📝 [UdpTransport] Dropped binary frame (corrupt or stale)');
+                return;
+            }
+            if (this.messageHandler) {
+                this.messageHandler(msg);
+            }
+        } catch (error) {
+            logger.error({ error }, '❌ [UdpTransport] Binary Decode Error');
+        }
+    }
+
     private handleData(raw: string): void {
         try {
             const trimmed = raw.trim();
@@ -200,6 +253,20 @@ export class UdpTransport implements IHardwareTransport {
             // Firmware returns JSON
             try {
                 const msg = JSON.parse(trimmed);
+                if (this.protoWaiter && msg.ok !== undefined) {
+                    this.protoWaiter(msg);
+                    return;
+                }
+                if (typeof msg.id === 'number') {
+                    const request = this.inFlight.get(msg.id);
+                    if (!request) {
+                        logger.debug({ id: msg.id }, '📝 [UdpTransport] Dropped reply to a request already answered');
+                        return;
+                    }
+                    clearTimeout(request.timer);
+                    this.inFlight.delete(msg.id);
+                    msg.id = request.packetId;
+                }
                 if (this.messageHandler) {
                     this.messageHandler(msg);
                 }
@@ -226,15 +293,4 @@ export class UdpTransport implements IHardwareTransport {
     isConnected(): boolean {
         return this._isConnected;
     }
-
-    private formatPin(packet: HardwarePacket): string | undefined {
-        if (packet.pins && Array.isArray(packet.pins) && packet.pins.length > 0) {
-            const p = packet.pins.find((p: any) => p.role === 'default') || packet.pins[0];
-            return `${p.portId}_${p.gpio}`;
-        }
-        if (packet.pin !== undefined) {
-            return `${packet.pin}`;
-        }
-        return undefined;
-    }
 }
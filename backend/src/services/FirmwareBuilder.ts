@@ -16,8 +16,11 @@ export interface CodeBlock {
     globals?: string | string[] | Record<string, string | string[]>;
     setup?: string | string[] | Record<string, string | string[]>;
     loop?: string | string[] | Record<string, string | string[]>;
+    // Runs in loop() next to the transport; `loop` runs in acquisitionPass()
+    // (the acquisition task with the dual_core plugin)
+    network_loop?: string | string[] | Record<string, string | string[]>;
     functions?: string | string[] | Record<string, string | string[]>;
-    dispatcher?: string | string[] | Record<string, string | string[]>;
+    dispatch?: Record<string, string>; // COMMAND_NAME -> handler function name
 }
 
 export interface TransportDefinition {
@@ -40,6 +43,8 @@ export interface CommandDefinition {
     id: string;
     name: string;
     description: string;
+    // Result cache TTL: one value for every command in `dispatch`, or per command name
+    cache_ttl_ms?: number | Record<string, number>;
     code: CodeBlock;
 }
 
@@ -115,8 +120,11 @@ export class FirmwareBuilder {
         let globals = new Set<string>();
         let setup: string[] = [];
         let loop: string[] = [];
+        let acquisitionLoop: string[] = [];
         let functions: string[] = [];
-        let dispatchers: string[] = [];
+        let dispatch = new Map<string, string>();
+        let loopSections: string[] = [];
+        let acquisitionSections: string[] = [];
 
         // 3.1 Generate Capabilities Array
         // Filter out system commands from capabilities list
@@ -125,18 +133,28 @@ export class FirmwareBuilder {
         globals.add(capabilitiesCode);
 
         // 4. Process Transport
-        this.processCodeBlock(transport.code, arch, settings, { includes, globals, setup, loop, functions, dispatchers });
+        // The transport's loop block is network work wherever it is declared
+        const transportCode = { ...transport.code, loop: undefined, network_loop: transport.code.network_loop ?? transport.code.loop };
+        this.processCodeBlock(transport.id, transportCode, arch, settings, { includes, globals, setup, loop, acquisitionLoop, functions, dispatch, loopSections, acquisitionSections });
 
         // 5. Process Plugins
         plugins.forEach(plugin => {
-            this.processCodeBlock(plugin.code, arch, settings, { includes, globals, setup, loop, functions, dispatchers });
+            this.processCodeBlock(plugin.id, plugin.code, arch, settings, { includes, globals, setup, loop, acquisitionLoop, functions, dispatch, loopSections, acquisitionSections });
         });
 
         // 6. Process Commands
+        const cacheTtl = new Map<string, number>();
         commands.forEach(command => {
-            this.processCodeBlock(command.code, arch, settings, { includes, globals, setup, loop, functions, dispatchers });
+            this.processCodeBlock(command.id, command.code, arch, settings, { includes, globals, setup, loop, acquisitionLoop, functions, dispatch, loopSections, acquisitionSections });
+            this.collectCacheTtl(command, cacheTtl);
         });
 
+        // 6.1 Lay out the dispatch table. The hash parameters go into globals so
+        // transports and plugins can reference them before the table itself.
+        const dispatchTable = this.generateDispatchTable(dispatch, cacheTtl);
+        globals.add(dispatchTable.defines);
+        globals.add(this.generateLoopSectionDefines(loopSections, acquisitionSections));
+
         // 6. Load Skeleton
         let skeleton = fs.readFileSync(path.join(this.templatesPath, 'base/skeleton.ino'), 'utf-8');
 
@@ -145,11 +163,11 @@ export class FirmwareBuilder {
         skeleton = skeleton.replace('{{GLOBALS}}', Array.from(globals).join('\n'));
         skeleton = skeleton.replace('{{SETUP_CODE}}', setup.join('\n  '));
         skeleton = skeleton.replace('{{LOOP_CODE}}', loop.join('\n  '));
+        skeleton = skeleton.replace('{{ACQUISITION_LOOP_CODE}}', acquisitionLoop.join('\n  '));
 
-        // Special handling for functions to inject dispatchers
+        // Special handling for functions to inject the dispatch table
         let functionsCode = functions.join('\n');
-        const dispatchersCode = dispatchers.join('\n  ');
-        functionsCode = functionsCode.replace('{{COMMAND_DISPATCHERS}}', dispatchersCode);
+        functionsCode = functionsCode.replace('{{COMMAND_TABLE}}', dispatchTable.table);
 
         skeleton = skeleton.replace('{{FUNCTIONS_CODE}}', functionsCode);
 
@@ -182,17 +200,165 @@ export class FirmwareBuilder {
     }
 
     private processCodeBlock(
+        id: string,
         block: CodeBlock,
         arch: string,
         settings: Record<string, any> | undefined,
-        output: { includes: Set<string>, globals: Set<string>, setup: string[], loop: string[], functions: string[], dispatchers: string[] }
+        output: { includes: Set<string>, globals: Set<string>, setup: string[], loop: string[], acquisitionLoop: string[], functions: string[], dispatch: Map<string, string>, loopSections: string[], acquisitionSections: string[] }
     ) {
         if (block.includes) this.addCode(output.includes, block.includes, arch, settings);
         if (block.globals) this.addCode(output.globals, block.globals, arch, settings);
         if (block.setup) this.addCode(output.setup, block.setup, arch, settings);
-        if (block.loop) this.addCode(output.loop, block.loop, arch, settings);
+        if (block.network_loop) {
+            this.addLoopSection(id, block.network_loop, arch, settings, output.loop, 'LOOP_SECTION_END', output.loopSections, '');
+        }
+        if (block.loop) {
+            const name = block.network_loop ? `${id}_acquisition` : id;
+            this.addLoopSection(name, block.loop, arch, settings, output.acquisitionLoop, 'ACQUISITION_SECTION_END', output.acquisitionSections, 'LOOP_NETWORK_SECTIONS + ');
+        }
         if (block.functions) this.addCode(output.functions, block.functions, arch, settings);
-        if (block.dispatcher) this.addCode(output.dispatchers, block.dispatcher, arch, settings);
+        if (block.dispatch) {
+            for (const [command, handler] of Object.entries(block.dispatch)) {
+                if (output.dispatch.has(command)) {
+                    logger.warn({ command }, '⚠️ [FirmwareBuilder] Duplicate dispatch entry, keeping the first one');
+                    continue;
+                }
+                output.dispatch.set(command, handler);
+            }
+        }
+    }
+
+    // Appends a loop block ended by its section hook (see generateLoopSectionDefines)
+    private addLoopSection(
+        name: string,
+        code: string | string[] | Record<string, string | string[]>,
+        arch: string,
+        settings: Record<string, any> | undefined,
+        target: string[],
+        hook: string,
+        sections: string[],
+        base: string
+    ) {
+        const start = target.length;
+        this.addCode(target, code, arch, settings);
+        if (FirmwareBuilder.hasCode(target.slice(start))) {
+            target.push(`${hook}(${base}${sections.length});`);
+            sections.push(name);
+        }
+    }
+
+    // True if the lines contain more than comments and blank lines
+    private static hasCode(lines: string[]): boolean {
+        return lines.some(block => block.split('\n').some(line => {
+            const trimmed = line.trim();
+            return trimmed !== '' && !trimmed.startsWith('//');
+        }));
+    }
+
+    /**
+     * Each definition's loop block ends with LOOP_SECTION_END(n) (network
+     * blocks, in loop()) or ACQUISITION_SECTION_END(n) (acquisitionPass()), so
+     * the command_stats plugin can time the loop per definition (a no-op
+     * without the plugin). Network sections are numbered first, in the order
+     * they run; acquisition sections follow from LOOP_NETWORK_SECTIONS. The
+     * names go out as one string literal, which costs nothing unless the
+     * plugin prints it.
+     */
+    private generateLoopSectionDefines(networkSections: string[], acquisitionSections: string[]): string {
+        const loopSections = [...networkSections, ...acquisitionSections];
+        return [
+            `// Loop sections: ${loopSections.length}`,
+            `#define LOOP_SECTIONS ${loopSections.length}`,
+            `#define LOOP_NETWORK_SECTIONS ${networkSections.length}`,
+            `#define LOOP_SECTION_NAMES "${loopSections.join(',')}"`
+        ].join('\n');
+    }
+
+    /**
+     * Reads a command definition's `cache_ttl_ms` into `cacheTtl` (command
+     * name -> ms). System commands are never cached, and TTLs are clamped to
+     * the 16-bit field of the dispatch table.
+     */
+    private collectCacheTtl(command: CommandDefinition, cacheTtl: Map<string, number>) {
+        const ttl = command.cache_ttl_ms;
+        if (ttl === undefined) return;
+        if (command.id === 'system_commands') {
+            logger.warn('⚠️ [FirmwareBuilder] cache_ttl_ms is ignored for system commands');
+            return;
+        }
+
+        const names = Object.keys(command.code.dispatch || {});
+        const entries: [string, number][] = typeof ttl === 'number'
+            ? names.map(name => [name, ttl] as [string, number])
+            : Object.entries(ttl).filter(([name]) => names.includes(name));
+        entries.forEach(([name, ms]) => {
+            if (!(ms > 0)) return;
+            cacheTtl.set(name, Math.min(Math.round(ms), 0xFFFF));
+        });
+    }
+
+    /**
+     * Emits the command lookup table used by processCommand (sys_common.cpp).
+     * The table is a minimal perfect hash over the enabled command names, so
+     * lookup is one hash pass plus one string compare regardless of how many
+     * commands are compiled in. Names and handler pointers live in PROGMEM.
+     * Each entry carries the command's result cache TTL (0 = not cached).
+     * Returns the COMMAND_HASH_SEED/COMMAND_TABLE_SLOTS/RESULT_CACHE_COMMANDS
+     * defines separately from the table so they can be emitted with the globals.
+     */
+    private generateDispatchTable(dispatch: Map<string, string>, cacheTtl: Map<string, number>): { defines: string, table: string } {
+        const names = Array.from(dispatch.keys()).sort();
+        const { seed, slots } = this.findPerfectHash(names);
+
+        const table: (string | null)[] = new Array(slots).fill(null);
+        names.forEach(name => {
+            table[FirmwareBuilder.hashCommandName(name, seed) % slots] = name;
+        });
+
+        const defines = [
+            `// Dispatch table: ${names.length} commands, ${slots} slots`,
+            `#define COMMAND_HASH_SEED ${seed}`,
+            `#define COMMAND_TABLE_SLOTS ${slots}`,
+            `#define RESULT_CACHE_COMMANDS ${names.filter(name => cacheTtl.has(name)).length}`
+        ].join('\n');
+
+        const lines: string[] = [];
+        names.forEach(name => {
+            lines.push(`const char CMD_NAME_${name}[] PROGMEM = "${name}";`);
+        });
+        lines.push('const CommandEntry COMMAND_TABLE[COMMAND_TABLE_SLOTS] PROGMEM = {');
+        table.forEach(name => {
+            lines.push(name ? `  { CMD_NAME_${name}, ${dispatch.get(name)}, ${cacheTtl.get(name) ?? 0} },` : '  { NULL, NULL, 0 },');
+        });
+        lines.push('};');
+        return { defines, table: lines.join('\n') };
+    }
+
+    private findPerfectHash(names: string[]): { seed: number, slots: number } {
+        const minSlots = Math.max(names.length, 1);
+        for (let slots = minSlots; slots <= minSlots * 4; slots++) {
+            for (let seed = 0; seed < 0x1000; seed++) {
+                const used = new Set<number>();
+                const collisionFree = names.every(name => {
+                    const slot = FirmwareBuilder.hashCommandName(name, seed) % slots;
+                    if (used.has(slot)) return false;
+                    used.add(slot);
+                    return true;
+                });
+                if (collisionFree) return { seed, slots };
+            }
+        }
+        throw new Error(`Unable to build dispatch table for ${names.length} commands`);
+    }
+
+    // Must stay in sync with hashCommandStep() in firmware/definitions/commands/src/sys_common.cpp.
+    // Also used by the binary protocol codec, whose opcodes are these hashes.
+    public static hashCommandName(name: string, seed: number): number {
+        let h = seed & 0xFFFF;
+        for (let i = 0; i < name.length; i++) {
+            h = Math.imul(h ^ (name.charCodeAt(i) & 0xFF), 0x0193) & 0xFFFF;
+        }
+        return h;
     }
 
     private addCode(
@@ -225,9 +391,10 @@ export class FirmwareBuilder {
             if (!line) return;
 
             let processedLine = line;
+            const isFile = processedLine.startsWith('@file:');
 
             // Handle @file directive
-            if (processedLine.startsWith('@file:')) {
+            if (isFile) {
                 const relativePath = processedLine.substring(6).trim();
                 const fullPath = path.join(this.definitionsPath, relativePath);
 
@@ -247,6 +414,8 @@ export class FirmwareBuilder {
             }
 
             if (Array.isArray(target)) {
+                // A shared source file (e.g. uart_frames.cpp) listed by several definitions goes in once
+                if (isFile && target.includes(processedLine)) return;
                 target.push(processedLine);
             } else {
                 target.add(processedLine);
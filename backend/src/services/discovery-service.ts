@@ -7,6 +7,8 @@ export interface DiscoveredDevice {
     model?: string;
     firmware?: string;
     capabilities?: string[];
+    memStats?: Record<string, number | null>;  // scan(..., includeMemStats): see MEMSTATS
+    stall?: { task: string; ran_ms: number | null; up_ms: number };  // watchdog reset breadcrumb
     lastSeen: Date;
 }
 
@@ -23,11 +25,13 @@ export class DiscoveryService extends EventEmitter {
      * @param port The UDP port to send/receive on (default: 8888)
      * @param broadcastAddress The broadcast IP (default: 255.255.255.255)
      * @param timeoutMs Duration to listen for responses (default: 3000ms)
+     * @param includeMemStats Ask controllers to add their heap/stack statistics
      */
     public async scan(
         port: number = 8888,
         broadcastAddress: string = '255.255.255.255',
-        timeoutMs: number = 3000
+        timeoutMs: number = 3000,
+        includeMemStats: boolean = false
     ): Promise<DiscoveredDevice[]> {
         return new Promise((resolve, reject) => {
             this.discoveredDevices.clear();
@@ -54,6 +58,8 @@ export class DiscoveryService extends EventEmitter {
                             model: data.model || 'Unknown',
                             firmware: data.firmware || 'Unknown',
                             capabilities: data.capabilities || [],
+                            memStats: data.mem,
+                            stall: data.stall,
                             lastSeen: new Date()
                         };
                         this.discoveredDevices.set(data.mac, device);
@@ -68,7 +74,7 @@ export class DiscoveryService extends EventEmitter {
 
                 this.socket.setBroadcast(true);
 
-                const message = Buffer.from('HYDROPONICS_DISCOVERY');
+                const message = Buffer.from(includeMemStats ? 'HYDROPONICS_DISCOVERY|MEM' : 'HYDROPONICS_DISCOVERY');
 
                 console.log(`[DiscoveryService] Broadcasting to ${broadcastAddress}:${port}...`);
 
@@ -1,28 +1,286 @@
+// === ANALOG ACQUISITION ===
+// The ADC is always read at its full width (ADC_MAX_BITS) and results are
+// scaled to the requested resolution. Without arguments ANALOG still answers
+// in the core's default range (10 bit, 12 on the ESP32), so existing
+// calibrations keep working.
+//
+//   ANALOG|pin[|samples[|mean or median[|bits]]]
+//     Averages (or takes the median of) up to ANALOG_MAX_SAMPLES readings.
+//     Asking for more bits than the ADC has oversamples and decimates: each
+//     extra bit needs 4x the samples, which are raised automatically.
+//   ANALOG_WATCH|pin|period_ms[|samples[|alpha_pct]]
+//     Background sampling from loop(): every period the median of `samples`
+//     readings feeds an EMA (alpha in %). A plain ANALOG of the pin then
+//     answers the filtered value at once, with "age" in ms. Period 0 stops.
+//   ANALOG_BURST|pin|count[|interval_us[|bits]]
+//     `count` raw readings at a fixed interval in one reply.
 
+// ADC_MAX_BITS / ADC_DEFAULT_BITS are in the globals (setup() needs them)
 
-String handleAnalog(const char* params) {
+#define ANALOG_MAX_SAMPLES 64      // 4^3: at most 3 bits from oversampling
+
+#if defined(__AVR__)
+  #define ANALOG_WATCH_SLOTS 2
+  #define ANALOG_BURST_MAX 32
+#else
+  #define ANALOG_WATCH_SLOTS 8
+  #define ANALOG_BURST_MAX 150
+#endif
+
+#define ANALOG_BURST_MAX_US 50000UL  // a burst blocks the loop
+
+struct AnalogWatch {
+  int8_t pin;                // -1 = free
+  uint8_t samples;
+  uint8_t alphaPct;
+  bool primed;
+  unsigned long periodMs;
+  unsigned long lastAt;
+  float ema;                 // ADC_MAX_BITS units
+};
+
+AnalogWatch analogWatches[ANALOG_WATCH_SLOTS];
+bool analogWatchesReady = false;
+
+void initAnalogWatches() {
+  for (uint8_t i = 0; i < ANALOG_WATCH_SLOTS; i++) analogWatches[i].pin = -1;
+  analogWatchesReady = true;
+}
+
+int findAnalogWatch(int pin) {
+  if (!analogWatchesReady) initAnalogWatches();
+  for (uint8_t i = 0; i < ANALOG_WATCH_SLOTS; i++) {
+    if (analogWatches[i].pin == pin) return i;
+  }
+  return -1;
+}
+
+// Sum of `n` readings, or median * n, so both scale the same way
+uint32_t sampleAnalog(int pin, uint8_t n, bool median) {
+  uint16_t values[ANALOG_MAX_SAMPLES];
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    uint16_t v = analogRead(pin);
+    sum += v;
+    if (!median) continue;
+    // Insertion sort while reading
+    uint8_t j = i;
+    while (j > 0 && values[j - 1] > v) {
+      values[j] = values[j - 1];
+      j--;
+    }
+    values[j] = v;
+  }
+  if (!median) return sum;
+  if (n % 2) return (uint32_t)values[n / 2] * n;
+  return ((uint32_t)values[n / 2 - 1] + values[n / 2]) * n / 2;
+}
+
+// Sum of n ADC_MAX_BITS readings -> rounded value with `bits` bits
+uint32_t scaleAnalog(uint32_t sum, uint8_t n, uint8_t bits) {
+  if (bits >= ADC_MAX_BITS) {
+    return ((sum << (bits - ADC_MAX_BITS)) + n / 2) / n;
+  }
+  uint32_t divisor = (uint32_t)n << (ADC_MAX_BITS - bits);
+  return (sum + divisor / 2) / divisor;
+}
+
+// Bits above the ADC's own come from oversampling, at most 3 of them
+bool analogBitsValid(long bits) {
+  return bits >= 8 && bits <= 16 && bits <= ADC_MAX_BITS + 3;
+}
+
+// Oversampling needs 4 samples per extra bit
+uint8_t samplesForBits(uint8_t bits, long samples) {
+  long needed = bits > ADC_MAX_BITS ? 1L << (2 * (bits - ADC_MAX_BITS)) : 1;
+  return (uint8_t)(samples < needed ? needed : samples);
+}
+
+// Next '|'-separated argument, or NULL
+const char* nextAnalogArg(const char* arg) {
+  if (!arg) return NULL;
+  arg = strchr(arg, '|');
+  return arg ? arg + 1 : NULL;
+}
+
+bool analogArgGiven(const char* arg) {
+  return arg && *arg != '\0' && *arg != '|';
+}
+
+void printAnalogPin(const char* params, ResponseBuffer& res) {
+  const char* end = strchr(params, '|');
+  res.print(F("{\"ok\":1,\"pin\":\""));
+  res.write((const uint8_t*)params, end ? (size_t)(end - params) : strlen(params));
+  res.print('"');
+}
+
+// Called from loop(): one watched pin per pass keeps loop() latency flat
+void serviceAnalogWatches() {
+  if (!analogWatchesReady) return;
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < ANALOG_WATCH_SLOTS; i++) {
+    AnalogWatch& watch = analogWatches[i];
+    if (watch.pin == -1 || (watch.primed && now - watch.lastAt < watch.periodMs)) continue;
+
+    float value = (float)sampleAnalog(watch.pin, watch.samples, true) / watch.samples;
+    watch.ema = watch.primed ? watch.ema + (value - watch.ema) * watch.alphaPct / 100.0 : value;
+    watch.primed = true;
+    watch.lastAt = now;
+    return;
+  }
+}
+
+void handleAnalog(const char* params, ResponseBuffer& res) {
   // Parse pin from params (e.g., "A0_14")
-  if (!params || strlen(params) < 2) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+  if (!params || params[0] == '\0') {
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
   // Use global parsePin helper (handles Label_GPIO format)
-  // Note: parsePin is expected to be available in the main sketch or shared utils
   int analogPin = parsePin(params);
-  
   if (analogPin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
+  }
+
+  long samples = 1;
+  bool median = false;
+  long bits = ADC_DEFAULT_BITS;
+
+  const char* arg = nextAnalogArg(params);
+  bool sampling = analogArgGiven(arg);
+  if (sampling) {
+    samples = atol(arg);
+    if (samples < 1 || samples > ANALOG_MAX_SAMPLES) return res.error(F("ERR_OUT_OF_RANGE"));
+  }
+  arg = nextAnalogArg(arg);
+  if (analogArgGiven(arg)) {
+    sampling = true;
+    if (strncmp_P(arg, PSTR("median"), 6) == 0) median = true;
+    else if (strncmp_P(arg, PSTR("mean"), 4) != 0) return res.error(F("ERR_INVALID_VALUE"));
+  }
+  arg = nextAnalogArg(arg);
+  if (analogArgGiven(arg)) {
+    bits = atol(arg);
+    if (!analogBitsValid(bits)) return res.error(F("ERR_OUT_OF_RANGE"));
+  }
+
+  // A watched pin answers its filtered value unless sampling was asked for
+  int watch = findAnalogWatch(analogPin);
+  if (!sampling && watch >= 0 && analogWatches[watch].primed) {
+    const AnalogWatch& w = analogWatches[watch];
+    printAnalogPin(params, res);
+    res.print(F(",\"value\":"));
+    res.print(w.ema * (1UL << bits) / (1UL << ADC_MAX_BITS), 2);
+    res.print(F(",\"bits\":"));
+    res.print(bits);
+    res.print(F(",\"age\":"));
+    res.print(millis() - w.lastAt);
+    res.print('}');
+    return;
+  }
+
+  uint8_t n = samplesForBits((uint8_t)bits, samples);
+  uint32_t value = scaleAnalog(sampleAnalog(analogPin, n, median), n, (uint8_t)bits);
+
+  printAnalogPin(params, res);
+  res.print(F(",\"value\":"));
+  res.print(value);
+  res.print(F(",\"bits\":"));
+  res.print(bits);
+  res.print('}');
+}
+
+void handleAnalogWatch(const char* params, ResponseBuffer& res) {
+  if (!params || params[0] == '\0') {
+    return res.error(F("ERR_MISSING_PARAMETER"));
+  }
+
+  int analogPin = parsePin(params);
+  if (analogPin == -1) {
+    return res.error(F("ERR_INVALID_PIN"));
+  }
+
+  const char* arg = nextAnalogArg(params);
+  if (!analogArgGiven(arg)) return res.error(F("ERR_MISSING_PARAMETER"));
+  long periodMs = atol(arg);
+  long samples = 8;
+  long alphaPct = 20;
+  arg = nextAnalogArg(arg);
+  if (analogArgGiven(arg)) samples = atol(arg);
+  arg = nextAnalogArg(arg);
+  if (analogArgGiven(arg)) alphaPct = atol(arg);
+
+  if (periodMs < 0 || periodMs > 3600000L || samples < 1 || samples > ANALOG_MAX_SAMPLES ||
+      alphaPct < 1 || alphaPct > 100) {
+    return res.error(F("ERR_OUT_OF_RANGE"));
+  }
+
+  int slot = findAnalogWatch(analogPin);
+  if (periodMs == 0) {
+    if (slot >= 0) analogWatches[slot].pin = -1;
+  } else {
+    if (slot < 0) slot = findAnalogWatch(-1);
+    if (slot < 0) return res.error(F("ERR_BUSY"));
+    AnalogWatch& watch = analogWatches[slot];
+    if (watch.pin != analogPin) watch.primed = false;
+    watch.pin = analogPin;
+    watch.periodMs = periodMs;
+    watch.samples = (uint8_t)samples;
+    watch.alphaPct = (uint8_t)alphaPct;
+  }
+
+  printAnalogPin(params, res);
+  res.print(F(",\"period\":"));
+  res.print(periodMs);
+  res.print('}');
+}
+
+void handleAnalogBurst(const char* params, ResponseBuffer& res) {
+  if (!params || params[0] == '\0') {
+    return res.error(F("ERR_MISSING_PARAMETER"));
+  }
+
+  int analogPin = parsePin(params);
+  if (analogPin == -1) {
+    return res.error(F("ERR_INVALID_PIN"));
+  }
+
+  const char* arg = nextAnalogArg(params);
+  if (!analogArgGiven(arg)) return res.error(F("ERR_MISSING_PARAMETER"));
+  long count = atol(arg);
+  long intervalUs = 0;
+  long bits = ADC_DEFAULT_BITS;
+  arg = nextAnalogArg(arg);
+  if (analogArgGiven(arg)) intervalUs = atol(arg);
+  arg = nextAnalogArg(arg);
+  if (analogArgGiven(arg)) bits = atol(arg);
+
+  if (count < 1 || count > ANALOG_BURST_MAX) return res.error(F("ERR_INVALID_COUNT"));
+  if (intervalUs < 0 || (unsigned long)intervalUs * count > ANALOG_BURST_MAX_US ||
+      bits < 8 || bits > ADC_MAX_BITS) {
+    return res.error(F("ERR_OUT_OF_RANGE"));
   }
 
-  // Read analog value (0-1023)
-  int value = analogRead(analogPin);
+  // Sample first, print after, so printing does not skew the interval
+  uint16_t samples[ANALOG_BURST_MAX];
+  unsigned long next = micros();
+  for (uint8_t i = 0; i < count; i++) {
+    if (intervalUs > 0) {
+      while ((long)(micros() - next) < 0) { }
+      next += intervalUs;
+    }
+    samples[i] = analogRead(analogPin);
+  }
 
-  // Build and return JSON response
-  String response = "{\"ok\":1,\"pin\":\"";
-  response += params;
-  response += "\",\"value\":";
-  response += value;
-  response += "}";
-  
-  return response;
+  printAnalogPin(params, res);
+  res.print(F(",\"bits\":"));
+  res.print(bits);
+  res.print(F(",\"interval_us\":"));
+  res.print(intervalUs);
+  res.print(F(",\"samples\":["));
+  for (uint8_t i = 0; i < count; i++) {
+    if (i > 0) res.print(',');
+    res.print(scaleAnalog(samples[i], 1, (uint8_t)bits));
+  }
+  res.print(F("]}"));
 }
@@ -1,104 +1,219 @@
+// === DHT11 / DHT22 ===
+// The sensor answers the start signal with a 40-bit frame: each bit is a
+// ~50 us low followed by a 26 us (0) or 70 us (1) high. The falling edges are
+// timestamped by an interrupt while the job sleeps, then decoded from the
+// falling-to-falling period (~76 us for a 0, ~120 us for a 1). A period has
+// ~20 us of margin either side of the threshold, so a late timestamp from a
+// WiFi or serial ISR no longer flips a bit. Pins without an interrupt fall
+// back to polling for the same edges.
+//
+// The DHT22 cannot be sampled faster than every 2 s. Reads of a pin within
+// DHT_MIN_INTERVAL_MS of its last good reading answer at once from a per-pin
+// cache, with "age" in ms.
+
+#ifndef IRAM_ATTR
+  #define IRAM_ATTR
+#endif
+
+#if defined(__AVR__)
+  #define DHT_CACHE_SLOTS 2
+#else
+  #define DHT_CACHE_SLOTS 4
+#endif
+
+#define DHT_MIN_INTERVAL_MS 2000UL
+#define DHT_EDGES 42                // response + 40 bits + end of last bit
+#define DHT_BIT_THRESHOLD_US 100    // falling-to-falling period
+#define DHT_EDGE_TIMEOUT_US 200     // polling: longest phase is 80 us
+
+struct DhtCache {
+  int8_t pin;                 // -1 = free
+  bool valid;
+  unsigned long readAt;       // last good reading
+  unsigned long attemptAt;    // last start signal
+  float temp;
+  float humidity;
+};
+
+DhtCache dhtCache[DHT_CACHE_SLOTS];
+bool dhtCacheReady = false;
+
+// Falling edges of the frame being captured (low 16 bits of micros())
+volatile uint16_t dhtEdgeUs[DHT_EDGES];
+volatile uint8_t dhtEdgeCount = 0;
+uint8_t dhtCaptureOwner = 0;  // job id holding the capture buffer, 0 = free
+
+void IRAM_ATTR dhtCaptureIsr() {
+  if (dhtEdgeCount < DHT_EDGES) dhtEdgeUs[dhtEdgeCount++] = (uint16_t)micros();
+}
 
-
-String handleDHTRead(const char* params) {
-  // Parse pin from params (e.g., "D4")
-  if (!params || strlen(params) < 2) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+// Cache slot of `pin`, claiming the oldest one if the pin is new
+uint8_t dhtCacheSlot(int pin) {
+  if (!dhtCacheReady) {
+    for (uint8_t i = 0; i < DHT_CACHE_SLOTS; i++) dhtCache[i].pin = -1;
+    dhtCacheReady = true;
   }
-
-  int dataPin = parsePin(String(params));
-  if (dataPin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
-  }
-
-  // DHT22 protocol parameters
-  const unsigned long START_LOW_DURATION = 18000;  // 18ms
-  const unsigned long START_HIGH_DURATION = 40;     // 40μs
-  const unsigned long BIT_THRESHOLD = 40;           // 40μs threshold
-  const int NUM_BITS = 40;                          // 40 bits (5 bytes)
-  const unsigned long TIMEOUT = 5000;               // 5s timeout
-
-  byte data[5] = {0};  // 5 bytes: humidity_int, humidity_dec, temp_int, temp_dec, checksum
-
-  // Send start signal
-  pinMode(dataPin, OUTPUT);
-  digitalWrite(dataPin, LOW);
-  delayMicroseconds(START_LOW_DURATION);
-  digitalWrite(dataPin, HIGH);
-  delayMicroseconds(START_HIGH_DURATION);
-  pinMode(dataPin, INPUT);
-
-  unsigned long timeoutStart = millis();
-
-  // Wait for sensor response (pull low)
-  while (digitalRead(dataPin) == HIGH) {
-    if (millis() - timeoutStart > TIMEOUT) {
-      return "{\"ok\":0,\"error\":\"ERR_SENSOR_TIMEOUT\"}";
+  uint8_t oldest = 0;
+  for (uint8_t i = 0; i < DHT_CACHE_SLOTS; i++) {
+    if (dhtCache[i].pin == pin) return i;
+    if (dhtCache[i].pin == -1) {
+      oldest = i;
+      break;
     }
+    if ((long)(dhtCache[i].attemptAt - dhtCache[oldest].attemptAt) < 0) oldest = i;
   }
+  DhtCache& entry = dhtCache[oldest];
+  entry.pin = pin;
+  entry.valid = false;
+  entry.attemptAt = millis() - DHT_MIN_INTERVAL_MS;
+  return oldest;
+}
 
-  // Wait for sensor ready (pull high)
-  while (digitalRead(dataPin) == LOW) {
-    if (millis() - timeoutStart > TIMEOUT) {
-      return "{\"ok\":0,\"error\":\"ERR_SENSOR_TIMEOUT\"}";
+bool dhtCacheFresh(uint8_t slot) {
+  return dhtCache[slot].valid && millis() - dhtCache[slot].readAt < DHT_MIN_INTERVAL_MS;
+}
+
+void printDhtReading(uint8_t slot, ResponseBuffer& res) {
+  const DhtCache& entry = dhtCache[slot];
+  res.print(F("{\"ok\":1,\"temp\":"));
+  res.print(entry.temp, 1);
+  res.print(F(",\"humidity\":"));
+  res.print(entry.humidity, 1);
+  res.print(F(",\"age\":"));
+  res.print(millis() - entry.readAt);
+  res.print('}');
+}
+
+// Records the falling edges by polling, for pins without an interrupt
+void pollDhtEdges(int pin) {
+  int level = digitalRead(pin);
+  unsigned long last = micros();
+  while (dhtEdgeCount < DHT_EDGES) {
+    int now = digitalRead(pin);
+    unsigned long t = micros();
+    if (now != level) {
+      if (now == LOW) dhtEdgeUs[dhtEdgeCount++] = (uint16_t)t;
+      level = now;
+      last = t;
+    } else if (t - last > DHT_EDGE_TIMEOUT_US) {
+      return;
     }
   }
+}
 
-  // Wait for data start (pull low)
-  while (digitalRead(dataPin) == HIGH) {
-    if (millis() - timeoutStart > TIMEOUT) {
-      return "{\"ok\":0,\"error\":\"ERR_SENSOR_TIMEOUT\"}";
-    }
+// Decodes the captured edges into data[5]; returns NULL or an error code
+const __FlashStringHelper* decodeDhtFrame(byte data[5]) {
+  if (dhtEdgeCount == 0) return F("ERR_SENSOR_TIMEOUT");
+  if (dhtEdgeCount < DHT_EDGES) return F("ERR_READ_TIMEOUT");
+
+  memset(data, 0, 5);
+  for (uint8_t i = 0; i < 40; i++) {
+    // Bit i runs from falling edge i+1 to falling edge i+2
+    uint16_t period = dhtEdgeUs[i + 2] - dhtEdgeUs[i + 1];
+    if (period > DHT_BIT_THRESHOLD_US) data[i / 8] |= (1 << (7 - (i % 8)));
   }
 
-  // Read 40 bits of data
-  for (int i = 0; i < NUM_BITS; i++) {
-    // Wait for bit start (high pulse)
-    while (digitalRead(dataPin) == LOW) {
-      if (millis() - timeoutStart > TIMEOUT) {
-        return "{\"ok\":0,\"error\":\"ERR_READ_TIMEOUT\"}";
-      }
-    }
+  byte checksum = data[0] + data[1] + data[2] + data[3];
+  if (checksum != data[4]) return F("ERR_CHECKSUM_FAILED");
+  return NULL;
+}
+
+void finishDhtJob(Job& job) {
+  if (dhtCaptureOwner == job.id) dhtCaptureOwner = 0;
+}
 
-    // Measure high pulse duration
-    unsigned long pulseStart = micros();
-    while (digitalRead(dataPin) == HIGH) {
-      if (millis() - timeoutStart > TIMEOUT) {
-        return "{\"ok\":0,\"error\":\"ERR_READ_TIMEOUT\"}";
-      }
+// Job steps: 0 = wait for the capture buffer and the sensor's minimum
+// interval, then pull the line low (start signal); 1 = release it and
+// capture the frame (~5 ms); 2 = decode.
+// vars[0] = pin
+bool stepDHTRead(Job& job, ResponseBuffer& res) {
+  int dataPin = (int)job.vars[0];
+  uint8_t slot = dhtCacheSlot(dataPin);
+  DhtCache& entry = dhtCache[slot];
+
+  if (job.step == 0) {
+    // Another read of this pin may have finished while we waited
+    if (dhtCacheFresh(slot)) {
+      printDhtReading(slot, res);
+      return true;
+    }
+    if (dhtCaptureOwner != 0 && dhtCaptureOwner != job.id) {
+      jobSleep(job, 5);
+      return false;
     }
-    unsigned long pulseDuration = micros() - pulseStart;
+    unsigned long sinceAttempt = millis() - entry.attemptAt;
+    if (sinceAttempt < DHT_MIN_INTERVAL_MS) {
+      jobSleep(job, DHT_MIN_INTERVAL_MS - sinceAttempt);
+      return false;
+    }
+
+    dhtCaptureOwner = job.id;
+    entry.attemptAt = millis();
+    pinMode(dataPin, OUTPUT);
+    digitalWrite(dataPin, LOW);
+    job.step = 1;
+    jobSleep(job, 19);  // 18 ms for the DHT11, 1 ms is enough for the DHT22
+    return false;
+  }
 
-    // Decode bit: >40μs = 1, <40μs = 0
-    int byteIndex = i / 8;
-    int bitIndex = 7 - (i % 8);
-    if (pulseDuration > BIT_THRESHOLD) {
-      data[byteIndex] |= (1 << bitIndex);
+  if (job.step == 1) {
+    dhtEdgeCount = 0;
+    int irq = digitalPinToInterrupt(dataPin);
+    if (irq >= 0) {
+      attachInterrupt(irq, dhtCaptureIsr, FALLING);
+      // The falling edge of the start signal is still latched (AVR INTFn, the
+      // R4 ICU flag) and fires the ISR as soon as it is attached. The line is
+      // held low until the release, so nothing captured so far is the frame.
+      dhtEdgeCount = 0;
+      pinMode(dataPin, INPUT_PULLUP);  // release; the sensor answers within 40 us
+      job.step = 2;
+      jobSleep(job, 6);
+      return false;
     }
+    pinMode(dataPin, INPUT_PULLUP);
+    pollDhtEdges(dataPin);
+  } else {
+    detachInterrupt(digitalPinToInterrupt(dataPin));
   }
+  finishDhtJob(job);
 
-  // Verify checksum
-  byte checksum = data[0] + data[1] + data[2] + data[3];
-  if (checksum != data[4]) {
-    return "{\"ok\":0,\"error\":\"ERR_CHECKSUM_FAILED\"}";
+  byte data[5];  // humidity_int, humidity_dec, temp_int, temp_dec, checksum
+  const __FlashStringHelper* error = decodeDhtFrame(data);
+  if (error) {
+    res.error(error);
+    return true;
   }
 
-  // Parse DHT22 data (high precision: 0.1°C, 0.1% RH)
-  // For DHT11, data[1] and data[3] will be 0
+  // DHT22 data (0.1°C, 0.1% RH); for the DHT11, data[1] and data[3] are 0
   float humidity = ((data[0] << 8) | data[1]) / 10.0;
   float temperature = (((data[2] & 0x7F) << 8) | data[3]) / 10.0;
-  
-  // Handle negative temperature (DHT22 only)
-  if (data[2] & 0x80) {
-    temperature = -temperature;
+  if (data[2] & 0x80) temperature = -temperature;  // DHT22 only
+
+  entry.valid = true;
+  entry.readAt = millis();
+  entry.temp = temperature;
+  entry.humidity = humidity;
+  printDhtReading(slot, res);
+  return true;
+}
+
+void handleDHTRead(const char* params, ResponseBuffer& res) {
+  // Parse pin from params (e.g., "D4")
+  if (!params || params[0] == '\0') {
+    return res.error(F("ERR_MISSING_PARAMETER"));
+  }
+
+  int dataPin = parsePin(params);
+  if (dataPin == -1) {
+    return res.error(F("ERR_INVALID_PIN"));
+  }
+
+  // Within the sensor's minimum interval: answer from the cache, no job
+  uint8_t slot = dhtCacheSlot(dataPin);
+  if (dhtCacheFresh(slot)) {
+    return printDhtReading(slot, res);
   }
 
-  // Build and return JSON response
-  String response = "{\"ok\":1,\"temp\":";
-  response += String(temperature, 1);
-  response += ",\"humidity\":";
-  response += String(humidity, 1);
-  response += "}";
-  
-  return response;
+  Job* job = startJob(stepDHTRead, res);
+  if (job) job->vars[0] = dataPin;
 }
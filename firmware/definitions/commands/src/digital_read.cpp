@@ -1,25 +1,23 @@
 
 
-String handleDigitalRead(const char* params) {
+void handleDigitalRead(const char* params, ResponseBuffer& res) {
   // Parse pin from params (e.g., "D3")
   if (!params || strlen(params) < 2) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
-  int pin = parsePin(String(params));
+  int pin = parsePin(params);
   if (pin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
   // Read state
   int state = digitalRead(pin);
 
   // Build and return JSON response
-  String response = "{\"ok\":1,\"pin\":\"";
-  response += params;
-  response += "\",\"state\":";
-  response += state;
-  response += "}";
-  
-  return response;
+  res.print(F("{\"ok\":1,\"pin\":\""));
+  res.print(params);
+  res.print(F("\",\"state\":"));
+  res.print(state);
+  res.print('}');
 }
@@ -1,9 +1,9 @@
 
 
-String handleDigitalWrite(const char* params) {
+void handleDigitalWrite(const char* params, ResponseBuffer& res) {
   // Parse params: "D8|1" -> pin=D8, state=1
   if (!params || strlen(params) < 4) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
   // Find delimiter
@@ -13,7 +13,7 @@ String handleDigitalWrite(const char* params) {
   
   char* delimiter = strchr(paramsCopy, '|');
   if (!delimiter) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_FORMAT\"}";
+    return res.error(F("ERR_INVALID_FORMAT"));
   }
 
   *delimiter = '\0';
@@ -21,15 +21,15 @@ String handleDigitalWrite(const char* params) {
   const char* stateStr = delimiter + 1;
 
   // Parse pin
-  int pin = parsePin(String(pinStr));
+  int pin = parsePin(pinStr);
   if (pin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
   // Parse state (0 or 1)
   int state = atoi(stateStr);
   if (state != 0 && state != 1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_VALUE\"}";
+    return res.error(F("ERR_INVALID_VALUE"));
   }
 
   // Set pin mode and state
@@ -41,11 +41,9 @@ String handleDigitalWrite(const char* params) {
   #endif
 
   // Build and return JSON response
-  String response = "{\"ok\":1,\"pin\":\"";
-  response += pinStr;
-  response += "\",\"state\":";
-  response += state;
-  response += "}";
-  
-  return response;
+  res.print(F("{\"ok\":1,\"pin\":\""));
+  res.print(pinStr);
+  res.print(F("\",\"state\":"));
+  res.print(state);
+  res.print('}');
 }
@@ -1,10 +1,10 @@
 
 #include <Wire.h>
 
-String handleI2CRead(const char* params) {
+void handleI2CRead(const char* params, ResponseBuffer& res) {
   // Parse params: "0x76|2" -> address=0x76, bytes=2
   if (!params || strlen(params) < 5) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
   // Find delimiter
@@ -14,7 +14,7 @@ String handleI2CRead(const char* params) {
   
   char* delimiter = strchr(paramsCopy, '|');
   if (!delimiter) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_FORMAT\"}";
+    return res.error(F("ERR_INVALID_FORMAT"));
   }
 
   *delimiter = '\0';
@@ -32,7 +32,7 @@ String handleI2CRead(const char* params) {
   // Parse bytes to read
   int bytesToRead = atoi(bytesStr);
   if (bytesToRead < 1 || bytesToRead > 32) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_VALUE\"}";
+    return res.error(F("ERR_INVALID_VALUE"));
   }
 
   // Note: Wire.begin() should be called in setup or lazily here if we had a global flag.
@@ -54,7 +54,7 @@ String handleI2CRead(const char* params) {
   }
 
   if (Wire.available() < bytesToRead) {
-    return "{\"ok\":0,\"error\":\"ERR_I2C_TIMEOUT\"}";
+    return res.error(F("ERR_I2C_TIMEOUT"));
   }
 
   // Read data
@@ -64,14 +64,12 @@ String handleI2CRead(const char* params) {
   }
 
   // Build and return JSON response
-  String response = "{\"ok\":1,\"address\":\"";
-  response += addrStr;
-  response += "\",\"data\":[";
+  res.print(F("{\"ok\":1,\"address\":\""));
+  res.print(addrStr);
+  res.print(F("\",\"data\":["));
   for (int i = 0; i < bytesToRead; i++) {
-    response += data[i];
-    if (i < bytesToRead - 1) response += ",";
+    res.print(data[i]);
+    if (i < bytesToRead - 1) res.print(',');
   }
-  response += "]}";
-  
-  return response;
+  res.print(F("]}"));
 }
@@ -1,256 +1,604 @@
+// Modbus RTU Master
+// The bus is a serial port leased from the pool in serial_ports.cpp for the
+// duration of each job, so buses on different pins and other serial sensors
+// can be used side by side.
 
-// Modbus RTU Read Handler with EEPROM Config + Auto-Reset
-// Prevents Bus Fault on Arduino Uno R4 when pins change at runtime
+// Note: Globals (modbusStream, modbusPort) are provided by the command
+// definition JSON file
 
-// Note: Globals (modbusStream, modbusSoftwareSerial, modbusRxPin, modbusTxPin, modbusIsHardware) 
-// are provided by the command definition JSON file
+#define MODBUS_SETTLE_MS 100  // a freshly opened port settles before the first request
 
-// EEPROM addresses for Modbus config (different from UART to avoid conflicts)
-#define EEPROM_MODBUS_MAGIC_ADDR 110
-#define EEPROM_MODBUS_RX_ADDR    111
-#define EEPROM_MODBUS_TX_ADDR    112
-#define EEPROM_MODBUS_MAGIC_VALUE 0xCD
+// === MASTER ENGINE ===
+// One job owns the bus at a time and works through modbusItems: a single
+// read/write, or a read plan covering several slaves and register ranges.
+// Timing follows the RTU spec instead of fixed delays:
+//   - a request goes out as soon as the bus has been silent for t3.5
+//   - the reply length follows from the function code, so reception ends on
+//     the last byte (or on the shorter exception frame)
+//   - a t3.5 gap inside a reply ends it as a broken frame
+//   - the response timeout adapts to each slave's measured turnaround
+//     (smoothed RTT + 4 * deviation), capped by the request's timeout;
+//     retries always wait the full timeout
 
-#if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-  #include <EEPROM.h>
+#if defined(__AVR__)
+  #define MODBUS_PLAN_SLOTS 4
+  #define MODBUS_SLAVE_STATS 4
+#else
+  #define MODBUS_PLAN_SLOTS 16
+  #define MODBUS_SLAVE_STATS 16
 #endif
 
-// Save Modbus config to EEPROM (R4 only)
-void saveModbusConfig(int rxPin, int txPin) {
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    EEPROM.write(EEPROM_MODBUS_MAGIC_ADDR, EEPROM_MODBUS_MAGIC_VALUE);
-    EEPROM.write(EEPROM_MODBUS_RX_ADDR, (uint8_t)rxPin);
-    EEPROM.write(EEPROM_MODBUS_TX_ADDR, (uint8_t)txPin);
-  #endif
+// A reply must fit the job result (JOB_RESULT_SIZE), error replies included,
+// so a read whose reply would not fit is rejected before it goes on the bus
+// (see modbusReadReplySize). A plan holds as many reads as can all fail with
+// the longest error: one on AVR with the default 96 bytes.
+#define MODBUS_ERROR_REPLY_SIZE 55  // {"ok":0,"error":"ERR_MODBUS_EXCEPTION","exception":255}
+#define MODBUS_PLAN_REPLY_SIZE 37   // {"ok":1,"ms":4294967295,"results":[]}
+#define MODBUS_PLAN_FIT ((JOB_RESULT_SIZE - MODBUS_PLAN_REPLY_SIZE) / (MODBUS_ERROR_REPLY_SIZE + 1))
+#if MODBUS_PLAN_FIT < MODBUS_PLAN_SLOTS
+  #define MODBUS_PLAN_MAX MODBUS_PLAN_FIT
+#else
+  #define MODBUS_PLAN_MAX MODBUS_PLAN_SLOTS
+#endif
+
+#define MODBUS_MIN_TIMEOUT_MS 10
+#define MODBUS_TIMEOUT_MARGIN_MS 5
+
+// Item status; 0x01..0x7F is an exception code returned by the slave
+#define MODBUS_ST_OK        0x00
+#define MODBUS_ST_TIMEOUT   0xF0
+#define MODBUS_ST_BAD_FRAME 0xF1  // CRC, wrong slave/function, wrong length
+#define MODBUS_ST_RECEIVING 0xFF
+
+struct ModbusItem {
+  uint8_t addr;
+  uint8_t fc;
+  uint16_t start;
+  uint16_t count;   // registers or coils
+  uint16_t data;    // FC05/06: the value; otherwise the offset into modbusData
+  uint8_t status;
+};
+
+struct ModbusSlaveStat {
+  uint8_t addr;       // 0 = unused
+  uint16_t srtt8;     // smoothed turnaround, ms * 8
+  uint16_t rttvar8;   // mean deviation, ms * 8
+};
+
+ModbusItem modbusItems[MODBUS_PLAN_MAX];
+uint8_t modbusItemCount = 0;
+uint8_t modbusItemIndex = 0;
+bool modbusPlanReply = false;
+uint16_t modbusData[MODBUS_MAX_REGISTERS];  // read results, FC15/16 values
+
+ModbusSlaveStat modbusStats[MODBUS_SLAVE_STATS];
+uint8_t modbusStatNext = 0;
+
+uint8_t modbusFrame[MODBUS_MAX_REGISTERS * 2 + 9];  // FC16 request or FC03 reply
+size_t modbusFrameLen = 0;
+size_t modbusExpectLen = 0;
+uint8_t modbusBusOwner = 0;  // job id holding the bus
+uint8_t modbusAttempt = 0;
+unsigned long modbusBaud = 9600;
+unsigned long modbusTimeout = 500;  // ms, from the request
+unsigned long modbusDeadline = 0;
+unsigned long modbusTxDoneUs = 0;
+unsigned long modbusLastByteUs = 0;  // last byte on the bus, either direction
+unsigned long modbusCycleStart = 0;
+
+// Ends the transaction and frees the bus for the next job
+bool finishModbusJob(ResponseBuffer& res, const __FlashStringHelper* error) {
+  releaseSerialPort(modbusPort);
+  modbusPort = -1;
+  modbusStream = nullptr;
+  modbusBusOwner = 0;
+  modbusItemCount = 0;
+  if (error) res.error(error);
+  return true;
 }
 
-// Load Modbus config from EEPROM (R4 only)
-bool loadModbusConfig(int* rxPin, int* txPin) {
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    if (EEPROM.read(EEPROM_MODBUS_MAGIC_ADDR) == EEPROM_MODBUS_MAGIC_VALUE) {
-      *rxPin = EEPROM.read(EEPROM_MODBUS_RX_ADDR);
-      *txPin = EEPROM.read(EEPROM_MODBUS_TX_ADDR);
-      return true;
-    }
-  #endif
-  return false;
+// --- Timing ---
+
+// 11 bits per character: start, 8 data, parity (or 2nd stop), stop
+unsigned long modbusCharUs() {
+  return 11000000UL / modbusBaud;
 }
 
-// Initialize Modbus from saved config at boot (call from setup())
-void initModbusFromEeprom(unsigned long baudRate) {
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    int rxPin, txPin;
-    if (loadModbusConfig(&rxPin, &txPin)) {
-      if (rxPin == 0 && txPin == 1) {
-        Serial1.begin(baudRate);
-        modbusStream = &Serial1;
-        modbusIsHardware = true;
-      } else if (rxPin >= 0 && txPin >= 0 && rxPin != txPin) {
-        modbusSoftwareSerial = new SoftwareSerial(rxPin, txPin);
-        if (modbusSoftwareSerial) {
-          modbusSoftwareSerial->begin(baudRate);
-          modbusStream = modbusSoftwareSerial;
-          modbusIsHardware = false;
-        }
-      }
-      modbusRxPin = rxPin;
-      modbusTxPin = txPin;
-    }
-  #endif
+// Inter-frame silence; the spec fixes it at 1.75 ms above 19200 baud
+unsigned long modbusT35Us() {
+  return modbusBaud > 19200 ? 1750UL : modbusCharUs() * 7 / 2;
 }
 
-unsigned int calculateModbusCRC16(unsigned char *buf, int len) {
-  unsigned int crc = 0xFFFF;
-  for (int pos = 0; pos < len; pos++) {
-    crc ^= (unsigned int)buf[pos];
-    for (int i = 8; i != 0; i--) {
-      if ((crc & 0x0001) != 0) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      } else {
-        crc >>= 1;
-      }
-    }
+uint8_t modbusStatSlot(uint8_t addr, bool create) {
+  for (uint8_t i = 0; i < MODBUS_SLAVE_STATS; i++) {
+    if (modbusStats[i].addr == addr) return i;
+  }
+  if (!create) return 0xFF;
+  uint8_t slot = modbusStatNext;
+  modbusStatNext = (modbusStatNext + 1) % MODBUS_SLAVE_STATS;
+  modbusStats[slot].addr = 0;
+  return slot;
+}
+
+unsigned long modbusResponseTimeoutMs(uint8_t addr) {
+  unsigned long wait = modbusTimeout;
+  uint8_t slot = modbusStatSlot(addr, false);
+  if (slot != 0xFF && modbusAttempt == 1) {
+    unsigned long rto = ((unsigned long)modbusStats[slot].srtt8 + 4UL * modbusStats[slot].rttvar8) / 8 + MODBUS_TIMEOUT_MARGIN_MS;
+    if (rto < MODBUS_MIN_TIMEOUT_MS) rto = MODBUS_MIN_TIMEOUT_MS;
+    if (rto < wait) wait = rto;
+  }
+  // Plus the time the reply itself spends on the wire
+  return wait + (modbusExpectLen * modbusCharUs()) / 1000 + 1;
+}
+
+// Turnaround = time from our last byte to the slave's first byte
+void modbusRecordTurnaround(uint8_t addr) {
+  unsigned long wireUs = modbusFrameLen * modbusCharUs();
+  unsigned long elapsedUs = modbusLastByteUs - modbusTxDoneUs;
+  long sample8 = (long)((elapsedUs > wireUs ? elapsedUs - wireUs : 0) / 125);
+  if (sample8 > 60000L) sample8 = 60000L;
+
+  ModbusSlaveStat& stat = modbusStats[modbusStatSlot(addr, true)];
+  if (stat.addr != addr) {
+    stat.addr = addr;
+    stat.srtt8 = (uint16_t)sample8;
+    stat.rttvar8 = (uint16_t)(sample8 / 2);
+    return;
   }
-  return crc;
+  long err = sample8 - (long)stat.srtt8;
+  stat.srtt8 = (uint16_t)((long)stat.srtt8 + err / 8);
+  stat.rttvar8 = (uint16_t)((long)stat.rttvar8 + ((err < 0 ? -err : err) - (long)stat.rttvar8) / 4);
 }
 
-uint8_t readN(uint8_t *buf, size_t len, unsigned long timeout) {
-  size_t offset = 0, left = len;
-  uint8_t *buffer = buf;
-  unsigned long startTime = millis();
+// --- Frames ---
 
-  while (left) {
-    if (modbusStream && modbusStream->available()) {
-      buffer[offset] = modbusStream->read();
-      offset++;
-      left--;
+size_t modbusReplyLength(uint8_t fc, uint16_t count) {
+  if (fc == 1 || fc == 2) return 5 + (count + 7) / 8;
+  if (fc == 3 || fc == 4) return 5 + 2 * (size_t)count;
+  return 8;  // FC05/06/15/16 echo address and value/count
+}
+
+void modbusBuildRequest(uint8_t index) {
+  ModbusItem& item = modbusItems[index];
+  size_t n = 0;
+  modbusFrame[n++] = item.addr;
+  modbusFrame[n++] = item.fc;
+  modbusFrame[n++] = item.start >> 8;
+  modbusFrame[n++] = item.start & 0xFF;
+
+  if (item.fc == 5 || item.fc == 6) {
+    uint16_t value = (item.fc == 5) ? (item.data ? 0xFF00 : 0x0000) : item.data;
+    modbusFrame[n++] = value >> 8;
+    modbusFrame[n++] = value & 0xFF;
+  } else {
+    modbusFrame[n++] = item.count >> 8;
+    modbusFrame[n++] = item.count & 0xFF;
+  }
+
+  if (item.fc == 15) {
+    uint8_t bytes = (item.count + 7) / 8;
+    modbusFrame[n++] = bytes;
+    for (uint8_t b = 0; b < bytes; b++) {
+      uint8_t packed = 0;
+      for (uint8_t bit = 0; bit < 8 && b * 8 + bit < item.count; bit++) {
+        if (modbusData[item.data + b * 8 + bit]) packed |= 1 << bit;
+      }
+      modbusFrame[n++] = packed;
     }
-    if (millis() - startTime > timeout) {
-      break;
+  } else if (item.fc == 16) {
+    modbusFrame[n++] = item.count * 2;
+    for (uint16_t i = 0; i < item.count; i++) {
+      modbusFrame[n++] = modbusData[item.data + i] >> 8;
+      modbusFrame[n++] = modbusData[item.data + i] & 0xFF;
     }
   }
-  return offset;
+
+  uint16_t crc = calculateModbusCRC16(modbusFrame, n);
+  modbusFrame[n++] = crc & 0xFF;
+  modbusFrame[n++] = crc >> 8;
+  modbusFrameLen = n;
+}
+
+// Drains anything still on the line; true once it has been silent for t3.5
+bool modbusBusIdle() {
+  while (modbusStream->available()) {
+    modbusStream->read();
+    modbusLastByteUs = micros();
+  }
+  return micros() - modbusLastByteUs >= modbusT35Us();
 }
 
-String handleModbusRtuRead(const char* params) {
-  DynamicJsonDocument doc(1024);
-  DeserializationError error = deserializeJson(doc, params);
+void modbusSend(uint8_t index) {
+  ModbusItem& item = modbusItems[index];
+  modbusBuildRequest(index);
+  modbusStream->write(modbusFrame, modbusFrameLen);
+  modbusStream->flush();
+  modbusTxDoneUs = micros();
+  modbusLastByteUs = modbusTxDoneUs;
 
-  if (error) {
-    return F("{\"ok\":0,\"error\":\"JSON_PARSE_ERROR\"}");
+  modbusAttempt++;
+  modbusFrameLen = 0;
+  modbusExpectLen = modbusReplyLength(item.fc, item.count);
+  modbusDeadline = millis() + modbusResponseTimeoutMs(item.addr);
+}
+
+// Collects reply bytes; returns MODBUS_ST_RECEIVING until the reply is
+// complete, broken off or timed out.
+uint8_t modbusPoll(uint8_t index) {
+  ModbusItem& item = modbusItems[index];
+  while (modbusFrameLen < modbusExpectLen && modbusStream->available()) {
+    modbusFrame[modbusFrameLen++] = modbusStream->read();
+    modbusLastByteUs = micros();
+    // Exception replies are address | fc + 0x80 | code | crc
+    if (modbusFrameLen == 2 && modbusFrame[1] == (item.fc | 0x80)) modbusExpectLen = 5;
+  }
+
+  if (modbusFrameLen >= modbusExpectLen) {
+    if (modbusFrame[0] != item.addr || (modbusFrame[1] & 0x7F) != item.fc) return MODBUS_ST_BAD_FRAME;
+    uint16_t crc = modbusFrame[modbusFrameLen - 2] | (modbusFrame[modbusFrameLen - 1] << 8);
+    if (crc != calculateModbusCRC16(modbusFrame, modbusFrameLen - 2)) return MODBUS_ST_BAD_FRAME;
+
+    modbusRecordTurnaround(item.addr);
+    if (modbusFrame[1] & 0x80) return (modbusFrame[2] > 0 && modbusFrame[2] < 0x80) ? modbusFrame[2] : MODBUS_ST_BAD_FRAME;
+    if (item.fc <= 4 && modbusFrame[2] != modbusExpectLen - 5) return MODBUS_ST_BAD_FRAME;
+    return MODBUS_ST_OK;
   }
 
-  int rxPin = 0;
-  int txPin = 1;
+  if (modbusFrameLen > 0 && micros() - modbusLastByteUs > modbusT35Us()) return MODBUS_ST_BAD_FRAME;
+  if ((long)(millis() - modbusDeadline) >= 0) return MODBUS_ST_TIMEOUT;
+  return MODBUS_ST_RECEIVING;
+}
 
-  if (doc.containsKey("pins")) {
-    JsonArray pins = doc["pins"];
-    for (JsonObject pin : pins) {
-      const char* role = pin["role"];
-      if (role && strcmp(role, "RX") == 0) rxPin = pin["gpio"] | 0;
-      else if (role && strcmp(role, "TX") == 0) txPin = pin["gpio"] | 1;
+void modbusStoreReply(uint8_t index) {
+  ModbusItem& item = modbusItems[index];
+  for (uint16_t i = 0; i < item.count && item.fc <= 4; i++) {
+    if (item.fc <= 2) {
+      modbusData[item.data + i] = (modbusFrame[3 + i / 8] >> (i % 8)) & 1;
+    } else {
+      modbusData[item.data + i] = (modbusFrame[3 + i * 2] << 8) | modbusFrame[4 + i * 2];
     }
-  } else {
-     rxPin = doc["rxPin"] | 0;
-     txPin = doc["txPin"] | 1;
   }
+}
+
+// Longest reply printModbusItem() can write for a read of `count` registers
+// (5 digits each) or coils, or for its longest error
+size_t modbusReadReplySize(uint8_t fc, uint16_t count) {
+  size_t size = (fc <= 2) ? 17 + 2 * (size_t)count : 22 + 6 * (size_t)count;
+  return max(size, (size_t)MODBUS_ERROR_REPLY_SIZE);
+}
+
+void printModbusItem(uint8_t index, ResponseBuffer& res) {
+  ModbusItem& item = modbusItems[index];
+  if (item.status == MODBUS_ST_TIMEOUT) return res.error(F("ERR_TIMEOUT"));
+  if (item.status == MODBUS_ST_BAD_FRAME) return res.error(F("ERR_CHECKSUM_FAILED"));
+  if (item.status != MODBUS_ST_OK) {
+    res.print(F("{\"ok\":0,\"error\":\"ERR_MODBUS_EXCEPTION\",\"exception\":"));
+    res.print(item.status);
+    res.print('}');
+    return;
+  }
+  if (item.fc > 4) {
+    res.print(F("{\"ok\":1}"));
+    return;
+  }
+  res.print(item.fc <= 2 ? F("{\"ok\":1,\"bits\":[") : F("{\"ok\":1,\"registers\":["));
+  for (uint16_t i = 0; i < item.count; i++) {
+    if (i > 0) res.print(',');
+    res.print(modbusData[item.data + i]);
+  }
+  res.print(F("]}"));
+}
+
+// Job steps:
+//   0 = wait for the bus, configure the stream
+//   1 = send the current item once the bus is idle
+//   2 = receive; then retry, go to the next item or reply
+// Single requests carry their parameters in vars and fill modbusItems once
+// they own the bus. Plans and multi-register writes fill modbusItems in the
+// handler and already own the bus (vars[0] == 0).
+// vars[0] = slaveId | funcCode << 8 | count << 16
+// vars[1] = startAddr | value << 16 (FC05/06)
+// vars[2] = rxPin | txPin << 8 | timeout << 16
+// vars[3] = baudRate
+bool stepModbus(Job& job, ResponseBuffer& res) {
+  switch (job.step) {
+    case 0: {
+      if (job.vars[0] != 0) {
+        if (modbusBusOwner != 0 && modbusBusOwner != job.id) {
+          jobSleep(job, 5);
+          return false;
+        }
+        modbusBusOwner = job.id;
+        ModbusItem& item = modbusItems[0];
+        item.addr = job.vars[0] & 0xFF;
+        item.fc = (job.vars[0] >> 8) & 0xFF;
+        item.count = (job.vars[0] >> 16) & 0xFFFF;
+        item.start = job.vars[1] & 0xFFFF;
+        item.data = (job.vars[1] >> 16) & 0xFFFF;
+        modbusItemCount = 1;
+        modbusPlanReply = false;
+      }
+      modbusItemIndex = 0;
+      modbusAttempt = 0;
+      modbusTimeout = (job.vars[2] >> 16) & 0xFFFF;
+      modbusBaud = (unsigned long)job.vars[3];
 
-  unsigned long baudRate = doc["baudRate"] | 4800;
-  uint8_t deviceAddress = doc["slaveId"] | doc["deviceAddress"] | 1;
-  uint8_t functionCode = doc["funcCode"] | doc["functionCode"] | 3;
-  uint16_t registerAddress = doc["startAddr"] | doc["registerAddress"] | 0;
-  uint16_t registerCount = doc["len"] | doc["registerCount"] | 1;
-  unsigned long timeout = doc["timeout"] | 500;
-
-  if (deviceAddress < 1 || deviceAddress > 247) return F("{\"ok\":0,\"error\":\"ERR_INVALID_ADDR\"}");
-  if (registerCount < 1 || registerCount > 125) return F("{\"ok\":0,\"error\":\"ERR_INVALID_COUNT\"}");
-  if (rxPin == txPin) return F("{\"ok\":0,\"error\":\"ERR_SAME_PIN\"}");
-
-  // === R4 EEPROM + AUTO-RESET LOGIC ===
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    // Check if Modbus is already initialized with different pins
-    if (modbusStream != nullptr && (rxPin != modbusRxPin || txPin != modbusTxPin)) {
-      // Pins changed! Save new config and trigger auto-reset
-      saveModbusConfig(rxPin, txPin);
-      delay(50);
-      NVIC_SystemReset();
-      return F("{\"ok\":0,\"error\":\"ERR_RESTARTING\"}");
+      modbusPort = leaseSerialPort(job.vars[2] & 0xFF, (job.vars[2] >> 8) & 0xFF, modbusBaud);
+      if (modbusPort < 0) {
+        return finishModbusJob(res, F("ERR_PORT_BUSY"));
+      }
+      modbusStream = serialPortStream(modbusPort);
+      modbusLastByteUs = micros();
+      job.step = 1;
+      unsigned long age = serialPortAge(modbusPort);
+      jobSleep(job, age < MODBUS_SETTLE_MS ? MODBUS_SETTLE_MS - age : 0);
+      return false;
     }
-    
-    // First-time initialization
-    if (modbusStream == nullptr) {
-      saveModbusConfig(rxPin, txPin);
-      
-      if (rxPin == 0 && txPin == 1) {
-        Serial1.begin(baudRate);
-        modbusStream = &Serial1;
-        modbusIsHardware = true;
+
+    case 1:
+      if (!modbusBusIdle()) return false;  // checked again on the next loop()
+      if (modbusItemIndex == 0 && modbusAttempt == 0) modbusCycleStart = millis();
+      modbusSend(modbusItemIndex);
+      job.step = 2;
+      return false;
+
+    default: {
+      uint8_t status = modbusPoll(modbusItemIndex);
+      if (status == MODBUS_ST_RECEIVING) return false;
+
+      if ((status == MODBUS_ST_TIMEOUT || status == MODBUS_ST_BAD_FRAME) && modbusAttempt < MODBUS_MAX_ATTEMPTS) {
+        job.step = 1;  // the t3.5 idle check is the only gap before the retry
+        return false;
+      }
+      modbusItems[modbusItemIndex].status = status;
+      if (status == MODBUS_ST_OK) modbusStoreReply(modbusItemIndex);
+      modbusAttempt = 0;
+
+      if (++modbusItemIndex < modbusItemCount) {
+        job.step = 1;
+        return false;
+      }
+
+      if (!modbusPlanReply) {
+        printModbusItem(0, res);
       } else {
-        modbusSoftwareSerial = new SoftwareSerial(rxPin, txPin);
-        if (modbusSoftwareSerial == nullptr) {
-          return F("{\"ok\":0,\"error\":\"ERR_MEMORY\"}");
+        res.print(F("{\"ok\":1,\"ms\":"));
+        res.print(millis() - modbusCycleStart);
+        res.print(F(",\"results\":["));
+        for (uint8_t i = 0; i < modbusItemCount; i++) {
+          if (i > 0) res.print(',');
+          printModbusItem(i, res);
         }
-        modbusSoftwareSerial->begin(baudRate);
-        modbusStream = modbusSoftwareSerial;
-        modbusIsHardware = false;
+        res.print(F("]}"));
       }
-      
-      modbusRxPin = rxPin;
-      modbusTxPin = txPin;
-      delay(100);
+      return finishModbusJob(res, NULL);
     }
-  #else
-    // Non-R4 platforms: allow runtime pin changes
-    if (modbusStream == nullptr || modbusRxPin != rxPin || modbusTxPin != txPin) {
-      if (modbusSoftwareSerial != nullptr) {
-        delete modbusSoftwareSerial;
-        modbusSoftwareSerial = nullptr;
-      }
-      modbusStream = nullptr;
-
-      modbusSoftwareSerial = new SoftwareSerial(rxPin, txPin);
-      modbusSoftwareSerial->begin(baudRate);
-      modbusStream = modbusSoftwareSerial;
-      modbusIsHardware = false;
-      
-      modbusRxPin = rxPin;
-      modbusTxPin = txPin;
-      delay(100);
+  }
+}
+
+// --- Command handlers ---
+
+// Parameters of the Modbus commands, decoded in one pass by parseModbusParams()
+struct ModbusParams {
+  long rxPin;
+  long txPin;
+  long baudRate;
+  long timeout;
+  long slaveId;
+  long funcCode;        // 0 = not given, the handler picks its default
+  long startAddr;
+  long count;
+  long value;
+  bool hasValue;
+  uint16_t valueCount;  // "values" decoded into modbusData
+  uint8_t readCount;    // "reads" decoded into modbusItems
+};
+
+ModbusParams modbusParams;
+
+// "pins":[{"role":"RX","gpio":4},{"role":"TX","gpio":5}]
+void parseModbusPins(ParamReader& in) {
+  if (!in.beginArray()) return;
+  while (in.nextItem()) {
+    char key[8];
+    char role[4] = "";
+    long gpio = -1;
+    if (!in.beginObject()) return;
+    while (in.nextKey(key, sizeof(key))) {
+      if (strcmp_P(key, PSTR("role")) == 0) in.readString(role, sizeof(role));
+      else if (strcmp_P(key, PSTR("gpio")) == 0) gpio = in.readLong(-1);
+      else in.skip();
     }
-  #endif
+    if (gpio < 0) continue;
+    if (strcmp_P(role, PSTR("RX")) == 0) modbusParams.rxPin = gpio;
+    else if (strcmp_P(role, PSTR("TX")) == 0) modbusParams.txPin = gpio;
+  }
+}
 
-  if (modbusStream == nullptr) {
-    return F("{\"ok\":0,\"error\":\"ERR_STREAM_NULL\"}");
+// "values":[v,...] straight into modbusData
+const __FlashStringHelper* parseModbusValues(ParamReader& in) {
+  uint16_t n = 0;
+  if (!in.beginArray()) return NULL;
+  while (in.nextItem()) {
+    long v = in.readLong(-1);
+    if (n >= MODBUS_MAX_REGISTERS) return F("ERR_INVALID_COUNT");
+    if (v < 0 || v > 0xFFFF) return F("ERR_OUT_OF_RANGE");
+    modbusData[n++] = (uint16_t)v;
   }
+  modbusParams.valueCount = n;
+  return NULL;
+}
 
-  // Clear buffer
-  while (modbusStream->available()) modbusStream->read();
-
-  // Build Request
-  uint8_t request[8];
-  request[0] = deviceAddress;
-  request[1] = functionCode;
-  request[2] = (registerAddress >> 8) & 0xFF;
-  request[3] = registerAddress & 0xFF;
-  request[4] = (registerCount >> 8) & 0xFF;
-  request[5] = registerCount & 0xFF;
-
-  uint16_t crc = calculateModbusCRC16(request, 6);
-  request[6] = crc & 0xFF;
-  request[7] = (crc >> 8) & 0xFF;
-
-  uint8_t response[64]; 
-  bool success = false;
-  uint8_t retryCount = 0;
-  const uint8_t maxRetries = 3;
-
-  while (!success && retryCount < maxRetries) {
-    retryCount++;
-    while (modbusStream->available()) modbusStream->read();
-    
-    delay(100); 
-    modbusStream->write(request, 8);
-    modbusStream->flush(); 
-    delay(100); 
-
-    uint8_t ch;
-    
-    if (readN(&ch, 1, timeout) == 1 && ch == deviceAddress) {
-      response[0] = ch;
-      if (readN(&ch, 1, timeout) == 1 && ch == functionCode) {
-        response[1] = ch;
-        if (readN(&ch, 1, timeout) == 1) {
-          uint8_t byteCount = ch;
-          response[2] = ch;
-          if (readN(&response[3], byteCount + 2, timeout) == byteCount + 2) {
-             // Modbus CRC is Little Endian: low byte first, high byte second
-             uint16_t receivedCRC = response[byteCount + 3] | (response[byteCount + 4] << 8); 
-             uint16_t calculatedCRC = calculateModbusCRC16(response, byteCount + 3);
-             if (receivedCRC == calculatedCRC) {
-               success = true;
-             }
-          }
-        }
+// "reads":[[slaveId,funcCode,startAddr,len],...] straight into modbusItems
+const __FlashStringHelper* parseModbusReads(ParamReader& in) {
+  uint8_t n = 0;
+  uint16_t offset = 0;
+  size_t replySize = MODBUS_PLAN_REPLY_SIZE;
+  if (!in.beginArray()) return NULL;
+  while (in.nextItem()) {
+    if (n >= MODBUS_PLAN_MAX) return F("ERR_INVALID_COUNT");
+    long field[4] = { 1, 3, 0, 1 };
+    uint8_t k = 0;
+    if (!in.beginArray()) return NULL;
+    while (in.nextItem()) {
+      if (k < 4) field[k] = in.readLong(field[k]);
+      else in.skip();
+      k++;
+    }
+    if (in.failed()) return NULL;
+
+    if (field[0] < 1 || field[0] > 247) return F("ERR_INVALID_ADDR");
+    if (field[1] < 1 || field[1] > 4) return F("ERR_INVALID_VALUE");
+    if (field[2] < 0 || field[2] > 0xFFFF) return F("ERR_OUT_OF_RANGE");
+    if (field[3] < 1 || offset + field[3] > MODBUS_MAX_REGISTERS) return F("ERR_INVALID_COUNT");
+    replySize += (n > 0 ? 1 : 0) + modbusReadReplySize(field[1], field[3]);
+    if (replySize >= JOB_RESULT_SIZE) return F("ERR_INVALID_COUNT");
+
+    ModbusItem& item = modbusItems[n++];
+    item.addr = field[0];
+    item.fc = field[1];
+    item.start = field[2];
+    item.count = field[3];
+    item.data = offset;
+    offset += item.count;
+  }
+  modbusParams.readCount = n;
+  return NULL;
+}
+
+// Decodes params into modbusParams without building a document. With
+// fillBus set, "values" and "reads" are written straight into modbusData /
+// modbusItems, so the caller must have checked that the bus is idle.
+// Returns an error code or NULL.
+const __FlashStringHelper* parseModbusParams(const char* params, bool fillBus) {
+  ModbusParams& mp = modbusParams;
+  mp.rxPin = 0;
+  mp.txPin = 1;
+  mp.baudRate = 4800;
+  mp.timeout = 500;
+  mp.slaveId = 1;
+  mp.funcCode = 0;
+  mp.startAddr = 0;
+  mp.count = 1;
+  mp.value = 0;
+  mp.hasValue = false;
+  mp.valueCount = 0;
+  mp.readCount = 0;
+
+  ParamReader in(params);
+  const __FlashStringHelper* error = NULL;
+  char key[16];
+  if (in.beginObject()) {
+    while (!error && in.nextKey(key, sizeof(key))) {
+      if (strcmp_P(key, PSTR("slaveId")) == 0 || strcmp_P(key, PSTR("deviceAddress")) == 0) mp.slaveId = in.readLong(1);
+      else if (strcmp_P(key, PSTR("funcCode")) == 0 || strcmp_P(key, PSTR("functionCode")) == 0) mp.funcCode = in.readLong(0);
+      else if (strcmp_P(key, PSTR("startAddr")) == 0 || strcmp_P(key, PSTR("registerAddress")) == 0) mp.startAddr = in.readLong(0);
+      else if (strcmp_P(key, PSTR("len")) == 0 || strcmp_P(key, PSTR("registerCount")) == 0) mp.count = in.readLong(1);
+      else if (strcmp_P(key, PSTR("rxPin")) == 0) mp.rxPin = in.readLong(0);
+      else if (strcmp_P(key, PSTR("txPin")) == 0) mp.txPin = in.readLong(1);
+      else if (strcmp_P(key, PSTR("pins")) == 0) parseModbusPins(in);
+      else if (strcmp_P(key, PSTR("baudRate")) == 0) mp.baudRate = in.readLong(4800);
+      else if (strcmp_P(key, PSTR("timeout")) == 0) mp.timeout = in.readLong(500);
+      else if (strcmp_P(key, PSTR("value")) == 0) {
+        mp.value = in.readLong(0);
+        mp.hasValue = true;
       }
+      else if (fillBus && strcmp_P(key, PSTR("values")) == 0) error = parseModbusValues(in);
+      else if (fillBus && strcmp_P(key, PSTR("reads")) == 0) error = parseModbusReads(in);
+      else in.skip();
     }
   }
+  if (in.failed()) return F("JSON_PARSE_ERROR");
+  if (error) return error;
+
+  if (mp.rxPin == mp.txPin) return F("ERR_SAME_PIN");
+  if (mp.rxPin < 0 || mp.txPin < 0 || mp.rxPin > 255 || mp.txPin > 255) return F("ERR_INVALID_PIN");
+  if (mp.baudRate <= 0) return F("ERR_INVALID_VALUE");
+  if (mp.slaveId < 1 || mp.slaveId > 247) return F("ERR_INVALID_ADDR");
+  if (mp.startAddr < 0 || mp.startAddr > 0xFFFF) return F("ERR_OUT_OF_RANGE");
+  if (mp.timeout < 0 || mp.timeout > 30000) mp.timeout = 30000;
+  return NULL;
+}
+
+// Starts the job; `request` is vars[0] (0 = modbusItems already filled and
+// the bus is claimed for the new job).
+Job* startModbusJob(long request, long start, ResponseBuffer& res) {
+  Job* job = startJob(stepModbus, res);
+  if (!job) return NULL;
+  if (request == 0) modbusBusOwner = job->id;
+  job->vars[0] = request;
+  job->vars[1] = start;
+  job->vars[2] = modbusParams.rxPin | (modbusParams.txPin << 8) | (modbusParams.timeout << 16);
+  job->vars[3] = modbusParams.baudRate;
+  return job;
+}
 
-  if (!success) {
-    return F("{\"ok\":0,\"error\":\"TIMEOUT_OR_CRC\"}");
+// MODBUS_RTU_READ|{"slaveId":1,"funcCode":3,"startAddr":0,"len":2,...}
+// FC01/02 answer {"ok":1,"bits":[...]}, FC03/04 {"ok":1,"registers":[...]}
+void handleModbusRtuRead(const char* params, ResponseBuffer& res) {
+  const __FlashStringHelper* error = parseModbusParams(params, false);
+  if (error) return res.error(error);
+
+  ModbusParams& mp = modbusParams;
+  long functionCode = mp.funcCode ? mp.funcCode : 3;
+  if (functionCode < 1 || functionCode > 4) return res.error(F("ERR_INVALID_VALUE"));
+  if (mp.count < 1 || mp.count > MODBUS_MAX_REGISTERS) return res.error(F("ERR_INVALID_COUNT"));
+  if (modbusReadReplySize(functionCode, mp.count) >= JOB_RESULT_SIZE) return res.error(F("ERR_INVALID_COUNT"));
+
+  startModbusJob(mp.slaveId | (functionCode << 8) | (mp.count << 16), mp.startAddr, res);
+}
+
+// MODBUS_RTU_WRITE|{"slaveId":1,"funcCode":6,"startAddr":10,"value":300,...}
+// FC05 (coil) and FC06 (register) take "value"; FC15/16 take "values":[...].
+// Answers {"ok":1} once the slave has confirmed the write.
+void handleModbusRtuWrite(const char* params, ResponseBuffer& res) {
+  // FC15/16 values are decoded straight into modbusData
+  bool busIdle = (modbusBusOwner == 0);
+  const __FlashStringHelper* error = parseModbusParams(params, busIdle);
+  if (error) return res.error(error);
+
+  ModbusParams& mp = modbusParams;
+  long functionCode = mp.funcCode ? mp.funcCode : 6;
+
+  if (functionCode == 5 || functionCode == 6) {
+    if (!mp.hasValue) return res.error(F("ERR_MISSING_PARAMETER"));
+    if (mp.value < 0 || mp.value > 0xFFFF) return res.error(F("ERR_OUT_OF_RANGE"));
+    startModbusJob(mp.slaveId | (functionCode << 8) | (1L << 16), mp.startAddr | (long)((unsigned long)mp.value << 16), res);
+    return;
   }
+  if (functionCode != 15 && functionCode != 16) return res.error(F("ERR_INVALID_VALUE"));
+  if (!busIdle) return res.error(F("ERR_BUSY"));
 
-  doc.clear();
-  doc["ok"] = 1;
-  JsonArray regs = doc.createNestedArray("registers");
-  
-  for (int i = 0; i < registerCount; i++) {
-     uint16_t val = (response[3 + i*2] << 8) | response[4 + i*2];
-     regs.add(val);
+  uint16_t maxCount = (functionCode == 16) ? min(123, MODBUS_MAX_REGISTERS) : MODBUS_MAX_REGISTERS;
+  if (mp.valueCount < 1 || mp.valueCount > maxCount) return res.error(F("ERR_INVALID_COUNT"));
+  if (functionCode == 15) {
+    for (uint16_t i = 0; i < mp.valueCount; i++) modbusData[i] = modbusData[i] ? 1 : 0;
   }
-  
-  String output;
-  serializeJson(doc, output);
-  
-  return output;
+
+  ModbusItem& item = modbusItems[0];
+  item.addr = mp.slaveId;
+  item.fc = functionCode;
+  item.start = mp.startAddr;
+  item.count = mp.valueCount;
+  item.data = 0;
+  if (!startModbusJob(0, 0, res)) return;
+  modbusItemCount = 1;
+  modbusPlanReply = false;
+}
+
+// MODBUS_RTU_PLAN|{"reads":[[slaveId,funcCode,startAddr,len],...],"baudRate":9600,...}
+// Runs all reads back to back in one job (spaced only by t3.5) and answers
+// {"ok":1,"ms":<bus time>,"results":[<MODBUS_RTU_READ reply>,...]}
+void handleModbusRtuPlan(const char* params, ResponseBuffer& res) {
+  // The plan is decoded straight into modbusItems, so the bus must be free now
+  if (modbusBusOwner != 0) return res.error(F("ERR_BUSY"));
+
+  const __FlashStringHelper* error = parseModbusParams(params, true);
+  if (error) return res.error(error);
+  if (modbusParams.readCount < 1) return res.error(F("ERR_INVALID_COUNT"));
+
+  if (!startModbusJob(0, 0, res)) return;
+  modbusItemCount = modbusParams.readCount;
+  modbusPlanReply = true;
 }
@@ -1,108 +1,466 @@
+// === ONEWIRE (DS18B20) ===
+// Bit-banged 1-Wire master with ROM search, so one pin can carry several
+// probes. A conversion is always started with Skip ROM + Convert T, which
+// converts every probe on the pin at once. Reads on the same pin within
+// ONEWIRE_FRESH_MS of a finished conversion reuse it and only fetch the
+// scratchpad, so reading N probes costs about one conversion time.
+//
+//   ONEWIRE_READ_TEMP|pin                  single probe (Skip ROM)
+//   ONEWIRE_READ_TEMP|pin|28FF4A...|res    one probe by ROM, optional 9-12 bit
+//   ONEWIRE_READ_TEMP|pin|*                every probe found on the pin, in
+//                                          ONEWIRE_SCAN order
+//   ONEWIRE_SCAN|pin                       list the ROMs on the pin
+
+#if defined(__AVR__)
+  #define ONEWIRE_MAX_PROBES 4
+  #define ONEWIRE_MAX_BUSES 2
+#else
+  #define ONEWIRE_MAX_PROBES 16
+  #define ONEWIRE_MAX_BUSES 4
+#endif
+
+#define ONEWIRE_FRESH_MS 1000UL
+#define ONEWIRE_POLL_MS 10
+
+#define ONEWIRE_MODE_SKIP 0  // the only probe on the pin
+#define ONEWIRE_MODE_ROM  1  // one probe, ROM in vars[2..3]
+#define ONEWIRE_MODE_ALL  2
+#define ONEWIRE_MODE_SCAN 3
+
+#define ONEWIRE_STEP_LOCK    0
+#define ONEWIRE_STEP_SEARCH  1
+#define ONEWIRE_STEP_CONVERT 2
+#define ONEWIRE_STEP_WAIT    3
+#define ONEWIRE_STEP_READ    4
+
+// Probes found by the last search on each pin, in search order
+struct OneWireProbe {
+  uint8_t pin;
+  uint8_t rom[8];
+  int16_t raw;   // last reading in 1/16 °C
+  bool valid;
+};
+
+struct OneWireBus {
+  uint8_t pin;
+  uint8_t resolution;         // last one written, 0 = unknown (power-on 12 bit)
+  unsigned long convertedAt;  // millis of the last finished conversion, 0 = none
+};
+
+OneWireProbe onewireProbes[ONEWIRE_MAX_PROBES];
+uint8_t onewireProbeCount = 0;
+OneWireBus onewireBuses[ONEWIRE_MAX_BUSES] = {};
+
+// Owned by the job holding the line (onewireBusOwner)
+uint8_t onewireBusOwner = 0;
+uint8_t onewireBusIndex = 0;
+uint8_t onewireSearchRom[8];
+uint8_t onewireLastDiscrepancy = 0;
+bool onewireSearchDone = false;
+unsigned long onewireConvertStart = 0;
+int16_t onewireRaw = 0;  // single-probe modes
+
+// --- Line primitives ---
+
+void writeOnewireBit(int pin, bool bit) {
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+
+  if (bit) {
+    delayMicroseconds(6);
+    pinMode(pin, INPUT);
+    delayMicroseconds(64);
+  } else {
+    delayMicroseconds(60);
+    pinMode(pin, INPUT);
+    delayMicroseconds(10);
+  }
+}
+
+bool readOnewireBit(int pin) {
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+  delayMicroseconds(3);
+  pinMode(pin, INPUT);
+  delayMicroseconds(10);
+  bool bit = digitalRead(pin);
+  delayMicroseconds(53);
+  return bit;
+}
 
 void writeOnewireByte(int pin, byte data) {
   for (int i = 0; i < 8; i++) {
-    pinMode(pin, OUTPUT);
-    digitalWrite(pin, LOW);
-
-    if (data & (1 << i)) {
-      delayMicroseconds(6);
-      pinMode(pin, INPUT);
-      delayMicroseconds(64);
-    } else {
-      delayMicroseconds(60);
-      pinMode(pin, INPUT);
-      delayMicroseconds(10);
-    }
+    writeOnewireBit(pin, data & (1 << i));
   }
 }
 
 byte readOnewireByte(int pin) {
   byte data = 0;
-
   for (int i = 0; i < 8; i++) {
-    pinMode(pin, OUTPUT);
-    digitalWrite(pin, LOW);
-    delayMicroseconds(3);
-    pinMode(pin, INPUT);
-    delayMicroseconds(10);
-
-    if (digitalRead(pin)) {
+    if (readOnewireBit(pin)) {
       data |= (1 << i);
     }
-
-    delayMicroseconds(53);
   }
-
   return data;
 }
 
-String handleOneWireReadTemp(const char* params) {
-  // Parse pin from params (e.g., "D5")
-  if (!params || strlen(params) < 2) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
-  }
-
-  int pin = parsePin(String(params));
-  if (pin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
-  }
-
-  byte data[9] = {0};  // DS18B20 scratchpad data
-  bool readSuccess = false;
-
-  // Step 1: Reset and check presence
+// Reset pulse + presence check; true if a device answered
+bool resetOnewire(int pin) {
   pinMode(pin, OUTPUT);
   digitalWrite(pin, LOW);
   delayMicroseconds(480);
   pinMode(pin, INPUT);
   delayMicroseconds(70);
+  bool present = (digitalRead(pin) == LOW);
+  delayMicroseconds(410);  // Complete presence sequence
+  return present;
+}
 
-  if (digitalRead(pin) == HIGH) {
-    return "{\"ok\":0,\"error\":\"ERR_SENSOR_NOT_FOUND\"}";
+// Dallas/Maxim CRC-8 (x^8 + x^5 + x^4 + 1, reflected)
+uint8_t onewireCrc8(const uint8_t* data, uint8_t len) {
+  uint8_t crc = 0;
+  while (len--) {
+    uint8_t b = *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      uint8_t mix = (crc ^ b) & 0x01;
+      crc >>= 1;
+      if (mix) crc ^= 0x8C;
+      b >>= 1;
+    }
   }
+  return crc;
+}
 
-  delayMicroseconds(410);  // Complete presence sequence
+// --- ROM search ---
 
-  // Step 2: Skip ROM + Convert T
-  writeOnewireByte(pin, 0xCC);  // Skip ROM
-  writeOnewireByte(pin, 0x44);  // Convert T
-  
-  // Wait for conversion (750ms for 12-bit)
-  delay(750);
+void onewireSearchReset() {
+  onewireLastDiscrepancy = 0;
+  onewireSearchDone = false;
+  memset(onewireSearchRom, 0, sizeof(onewireSearchRom));
+}
 
-  // Step 3: Reset, Skip ROM, Read Scratchpad
-  pinMode(pin, OUTPUT);
-  digitalWrite(pin, LOW);
-  delayMicroseconds(480);
-  pinMode(pin, INPUT);
-  delayMicroseconds(70);
+// Maxim ROM search, one device per call (~14 ms of line time). Leaves the
+// ROM in onewireSearchRom and returns true if it passed the CRC; sets
+// onewireSearchDone after the last device.
+bool onewireSearchNext(int pin) {
+  if (onewireSearchDone) return false;
+  if (!resetOnewire(pin)) {
+    onewireSearchDone = true;
+    return false;
+  }
+  writeOnewireByte(pin, 0xF0);  // Search ROM
 
-  if (digitalRead(pin) == LOW) {  // Presence OK
-    delayMicroseconds(410);
+  uint8_t lastZero = 0;
+  for (uint8_t bitIndex = 1; bitIndex <= 64; bitIndex++) {
+    bool bit = readOnewireBit(pin);
+    bool complement = readOnewireBit(pin);
+    if (bit && complement) {  // nobody left on the line
+      onewireSearchDone = true;
+      return false;
+    }
+
+    uint8_t& romByte = onewireSearchRom[(bitIndex - 1) / 8];
+    uint8_t mask = 1 << ((bitIndex - 1) % 8);
+    bool direction;
+    if (bit != complement) {
+      direction = bit;  // every remaining device has the same bit
+    } else {
+      // Discrepancy: take the path not taken last time
+      if (bitIndex < onewireLastDiscrepancy) direction = romByte & mask;
+      else direction = (bitIndex == onewireLastDiscrepancy);
+      if (!direction) lastZero = bitIndex;
+    }
+
+    if (direction) romByte |= mask;
+    else romByte &= ~mask;
+    writeOnewireBit(pin, direction);
+  }
+
+  onewireLastDiscrepancy = lastZero;
+  if (lastZero == 0) onewireSearchDone = true;
+  return onewireCrc8(onewireSearchRom, 7) == onewireSearchRom[7];
+}
 
+void onewireForgetPin(uint8_t pin) {
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < onewireProbeCount; i++) {
+    if (onewireProbes[i].pin != pin) onewireProbes[kept++] = onewireProbes[i];
+  }
+  onewireProbeCount = kept;
+}
+
+uint8_t onewireCountProbes(uint8_t pin) {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < onewireProbeCount; i++) {
+    if (onewireProbes[i].pin == pin) n++;
+  }
+  return n;
+}
+
+uint8_t onewireBusSlot(int pin) {
+  uint8_t oldest = 0;
+  for (uint8_t i = 0; i < ONEWIRE_MAX_BUSES; i++) {
+    if (onewireBuses[i].pin == pin) return i;
+    if (onewireBuses[i].convertedAt < onewireBuses[oldest].convertedAt) oldest = i;
+  }
+  onewireBuses[oldest].pin = pin;
+  onewireBuses[oldest].resolution = 0;
+  onewireBuses[oldest].convertedAt = 0;
+  return oldest;
+}
+
+// --- Scratchpad ---
+
+// Reads one probe (rom == NULL: Skip ROM). Returns false if it is missing or
+// the scratchpad fails its CRC.
+bool onewireReadScratchpad(int pin, const uint8_t* rom, int16_t& raw) {
+  if (!resetOnewire(pin)) return false;
+  if (rom) {
+    writeOnewireByte(pin, 0x55);  // Match ROM
+    for (uint8_t i = 0; i < 8; i++) writeOnewireByte(pin, rom[i]);
+  } else {
     writeOnewireByte(pin, 0xCC);  // Skip ROM
-    writeOnewireByte(pin, 0xBE);  // Read Scratchpad
+  }
+  writeOnewireByte(pin, 0xBE);  // Read Scratchpad
+
+  uint8_t data[9];
+  for (uint8_t i = 0; i < 9; i++) {
+    data[i] = readOnewireByte(pin);
+  }
+  if (onewireCrc8(data, 8) != data[8]) return false;  // also rejects an all-ones (empty) line
+
+  // Bits below the configured resolution are undefined
+  uint8_t unusedBits = 3 - ((data[4] >> 5) & 0x03);
+  raw = (int16_t)((data[1] << 8) | data[0]) & ~((1 << unusedBits) - 1);
+  return true;
+}
+
+void printOnewireRom(const uint8_t* rom, ResponseBuffer& res) {
+  static const char hex[] = "0123456789ABCDEF";
+  res.print('"');
+  for (uint8_t i = 0; i < 8; i++) {
+    res.print(hex[rom[i] >> 4]);
+    res.print(hex[rom[i] & 0x0F]);
+  }
+  res.print('"');
+}
+
+bool finishOnewireJob(ResponseBuffer& res, const __FlashStringHelper* error) {
+  onewireBusOwner = 0;
+  if (error) res.error(error);
+  return true;
+}
+
+// Job steps: see ONEWIRE_STEP_*. One line transaction per step (a search
+// pass or one scratchpad read, ~15 ms at most).
+// vars[0] = pin
+// vars[1] = mode | resolution << 8 (0 = leave as is) | probe index << 16
+// vars[2..3] = ROM (ONEWIRE_MODE_ROM)
+bool stepOneWireReadTemp(Job& job, ResponseBuffer& res) {
+  int pin = (int)job.vars[0];
+  uint8_t mode = job.vars[1] & 0xFF;
+  uint8_t resolution = (job.vars[1] >> 8) & 0xFF;
+
+  switch (job.step) {
+    case ONEWIRE_STEP_LOCK:
+      if (onewireBusOwner != 0 && onewireBusOwner != job.id) {
+        jobSleep(job, 5);
+        return false;
+      }
+      onewireBusOwner = job.id;
+      onewireBusIndex = onewireBusSlot(pin);
+      if (mode == ONEWIRE_MODE_SCAN || (mode == ONEWIRE_MODE_ALL && onewireCountProbes(pin) == 0)) {
+        onewireForgetPin(pin);
+        onewireSearchReset();
+        job.step = ONEWIRE_STEP_SEARCH;
+      } else {
+        job.step = ONEWIRE_STEP_CONVERT;
+      }
+      return false;
 
-    // Read 9 bytes
-    for (int i = 0; i < 9; i++) {
-      data[i] = readOnewireByte(pin);
+    case ONEWIRE_STEP_SEARCH: {
+      if (onewireSearchNext(pin) && onewireProbeCount < ONEWIRE_MAX_PROBES) {
+        OneWireProbe& probe = onewireProbes[onewireProbeCount++];
+        probe.pin = pin;
+        memcpy(probe.rom, onewireSearchRom, 8);
+        probe.valid = false;
+      }
+      if (!onewireSearchDone && onewireProbeCount < ONEWIRE_MAX_PROBES) return false;
+
+      if (mode == ONEWIRE_MODE_SCAN) {
+        res.print(F("{\"ok\":1,\"roms\":["));
+        bool first = true;
+        for (uint8_t i = 0; i < onewireProbeCount; i++) {
+          if (onewireProbes[i].pin != pin) continue;
+          if (!first) res.print(',');
+          printOnewireRom(onewireProbes[i].rom, res);
+          first = false;
+        }
+        res.print(F("]}"));
+        return finishOnewireJob(res, NULL);
+      }
+      if (onewireCountProbes(pin) == 0) return finishOnewireJob(res, F("ERR_SENSOR_NOT_FOUND"));
+      job.step = ONEWIRE_STEP_CONVERT;
+      return false;
     }
-    readSuccess = true;
-  } else {
-     return "{\"ok\":0,\"error\":\"ERR_SENSOR_LOST\"}";
+
+    case ONEWIRE_STEP_CONVERT: {
+      OneWireBus& bus = onewireBuses[onewireBusIndex];
+      if (resolution != 0 && resolution != bus.resolution) {
+        if (!resetOnewire(pin)) return finishOnewireJob(res, F("ERR_SENSOR_NOT_FOUND"));
+        writeOnewireByte(pin, 0xCC);  // Skip ROM: every probe on the pin
+        writeOnewireByte(pin, 0x4E);  // Write Scratchpad: TH, TL, config
+        writeOnewireByte(pin, 0x4B);  // power-on alarm defaults
+        writeOnewireByte(pin, 0x46);
+        writeOnewireByte(pin, ((resolution - 9) << 5) | 0x1F);
+        bus.resolution = resolution;
+        bus.convertedAt = 0;
+      }
+
+      if (bus.convertedAt != 0 && millis() - bus.convertedAt < ONEWIRE_FRESH_MS) {
+        job.step = ONEWIRE_STEP_READ;  // another job converted moments ago
+        return false;
+      }
+
+      if (!resetOnewire(pin)) return finishOnewireJob(res, F("ERR_SENSOR_NOT_FOUND"));
+      writeOnewireByte(pin, 0xCC);  // Skip ROM
+      writeOnewireByte(pin, 0x44);  // Convert T
+      onewireConvertStart = millis();
+      job.step = ONEWIRE_STEP_WAIT;
+      jobSleep(job, ONEWIRE_POLL_MS);
+      return false;
+    }
+
+    case ONEWIRE_STEP_WAIT: {
+      // Probes answer read slots with 1 once converted (94 ms at 9 bit up
+      // to 750 ms at 12 bit); the datasheet maximum is the fallback.
+      OneWireBus& bus = onewireBuses[onewireBusIndex];
+      unsigned long maxMs = 750UL >> (12 - (bus.resolution ? bus.resolution : 12));
+      if (!readOnewireBit(pin) && millis() - onewireConvertStart < maxMs + ONEWIRE_POLL_MS) {
+        jobSleep(job, ONEWIRE_POLL_MS);
+        return false;
+      }
+      bus.convertedAt = millis();
+      if (bus.convertedAt == 0) bus.convertedAt = 1;
+      job.step = ONEWIRE_STEP_READ;
+      return false;
+    }
+
+    default:
+      break;
+  }
+
+  // ONEWIRE_STEP_READ
+  if (mode != ONEWIRE_MODE_ALL) {
+    uint8_t rom[8];
+    memcpy(rom, &job.vars[2], 8);
+    if (!onewireReadScratchpad(pin, mode == ONEWIRE_MODE_ROM ? rom : NULL, onewireRaw)) {
+      return finishOnewireJob(res, F("ERR_SENSOR_LOST"));
+    }
+    res.print(F("{\"ok\":1,\"temp\":"));
+    res.print(onewireRaw / 16.0, 2);
+    res.print('}');
+    return finishOnewireJob(res, NULL);
+  }
+
+  // Every probe of the pin, one per step
+  uint8_t index = (job.vars[1] >> 16) & 0xFF;
+  for (; index < onewireProbeCount; index++) {
+    OneWireProbe& probe = onewireProbes[index];
+    if (probe.pin != pin) continue;
+    probe.valid = onewireReadScratchpad(pin, probe.rom, probe.raw);
+    job.vars[1] = (job.vars[1] & 0xFFFF) | ((long)(index + 1) << 16);
+    return false;
   }
 
-  if (readSuccess) {
-    // Convert data to temperature
-    int16_t raw = (data[1] << 8) | data[0];
-    float tempC = (float)raw / 16.0;
+  // Temperatures only, in ONEWIRE_SCAN order: with the ROMs four probes
+  // would not fit an AVR job result (JOB_RESULT_SIZE)
+  res.print(F("{\"ok\":1,\"temps\":["));
+  bool first = true;
+  bool lost = false;
+  for (uint8_t i = 0; i < onewireProbeCount; i++) {
+    OneWireProbe& probe = onewireProbes[i];
+    if (probe.pin != pin) continue;
+    if (!first) res.print(',');
+    if (probe.valid) res.print(probe.raw / 16.0, 2);
+    else res.print(F("null"));
+    if (!probe.valid) lost = true;
+    first = false;
+  }
+  res.print(F("]}"));
+  if (lost) onewireForgetPin(pin);  // search again next time
+  return finishOnewireJob(res, NULL);
+}
+
+// 16 hex digits, family code first (as printed by ONEWIRE_SCAN)
+bool parseOnewireRom(const char* text, size_t len, uint8_t* rom) {
+  if (len != 16) return false;
+  for (uint8_t i = 0; i < 16; i++) {
+    char c = text[i];
+    uint8_t nibble;
+    if (c >= '0' && c <= '9') nibble = c - '0';
+    else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+    else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+    else return false;
+    rom[i / 2] = (i % 2) ? (rom[i / 2] | nibble) : (nibble << 4);
+  }
+  return onewireCrc8(rom, 7) == rom[7];
+}
+
+// ONEWIRE_READ_TEMP|pin[|rom or *[|resolution]]
+void handleOneWireReadTemp(const char* params, ResponseBuffer& res) {
+  // Parse pin from params (e.g., "D5")
+  if (!params || params[0] == '\0') {
+    return res.error(F("ERR_MISSING_PARAMETER"));
+  }
 
-    // Build and return JSON response
-    String response = "{\"ok\":1,\"temp\":";
-    response += String(tempC, 2);
-    response += "}";
-    return response;
+  int pin = parsePin(params);
+  if (pin == -1) {
+    return res.error(F("ERR_INVALID_PIN"));
+  }
+
+  uint8_t mode = ONEWIRE_MODE_SKIP;
+  uint8_t rom[8] = {0};
+  long resolution = 0;
+
+  const char* romArg = strchr(params, '|');
+  if (romArg) {
+    romArg++;
+    const char* resArg = strchr(romArg, '|');
+    size_t romLen = resArg ? (size_t)(resArg - romArg) : strlen(romArg);
+
+    if (romLen == 1 && romArg[0] == '*') {
+      mode = ONEWIRE_MODE_ALL;
+    } else if (romLen > 0) {
+      if (!parseOnewireRom(romArg, romLen, rom)) return res.error(F("ERR_INVALID_ROM"));
+      mode = ONEWIRE_MODE_ROM;
+    }
+    if (resArg && resArg[1] != '\0') {
+      resolution = atol(resArg + 1);
+      if (resolution < 9 || resolution > 12) return res.error(F("ERR_OUT_OF_RANGE"));
+    }
+  }
+
+  Job* job = startJob(stepOneWireReadTemp, res);
+  if (!job) return;
+  job->vars[0] = pin;
+  job->vars[1] = mode | (resolution << 8);
+  memcpy(&job->vars[2], rom, 8);
+}
+
+// ONEWIRE_SCAN|pin - searches the pin and answers {"ok":1,"roms":["28FF...",...]}
+void handleOneWireScan(const char* params, ResponseBuffer& res) {
+  if (!params || params[0] == '\0') {
+    return res.error(F("ERR_MISSING_PARAMETER"));
+  }
+
+  int pin = parsePin(params);
+  if (pin == -1) {
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
-  return "{\"ok\":0,\"error\":\"ERR_READ_FAILED\"}";
+  Job* job = startJob(stepOneWireReadTemp, res);
+  if (!job) return;
+  job->vars[0] = pin;
+  job->vars[1] = ONEWIRE_MODE_SCAN;
 }
@@ -1,40 +1,245 @@
+// === PULSE COUNTERS ===
+// Flow meters and tachometers are counted in the background: the first
+// PULSE_RATE on a pin attaches an edge interrupt, and from then on reads
+// return at once from the counters.
+//
+// Rate: every PULSE_SNAPSHOT_MS loop() stores (count, time of the last edge).
+// The rate is the number of pulses between the oldest snapshot that saw fewer
+// pulses and now, divided by the time between their last edges. Because it
+// is measured edge to edge, 1 Hz reads as 1 Hz and not as 0 or 2 pulses per
+// window. When the pulses stop, the rate decays as 1 / time since last edge.
+//
+// Total: pulses since the last PULSE_RESET. It is saved to the config store
+// (sys_config.cpp) every PULSE_PERSIST_MS if it has changed, and restored
+// when the pin is attached again after a reboot.
+
 #include <Arduino.h>
 
+#ifndef IRAM_ATTR
+  #define IRAM_ATTR
+#endif
+
+#if defined(__AVR__)
+  #define PULSE_SLOTS 2  // INT0/INT1 on the Uno
+#else
+  #define PULSE_SLOTS 4
+#endif
+
+#define PULSE_SNAPSHOT_MS 500UL
+#define PULSE_SNAPSHOTS 8         // rate window: up to 4 s
+#define PULSE_GLITCH_US 100UL     // edges closer than this are noise
+
+#ifndef PULSE_PERSIST_MS
+  #define PULSE_PERSIST_MS 900000UL  // 15 min
+#endif
+
+struct PulseCounter {
+  int8_t pin;                      // -1 = free
+  volatile uint32_t count;         // since attach (written by the ISR)
+  volatile unsigned long lastEdgeUs;
+  uint32_t totalBase;              // restored total at attach / after reset
+  uint32_t savedTotal;
+  uint32_t snapCount[PULSE_SNAPSHOTS];
+  unsigned long snapEdgeUs[PULSE_SNAPSHOTS];
+  uint8_t snapHead;
+  uint8_t snapFill;
+};
+
+PulseCounter pulseCounters[PULSE_SLOTS];
+bool pulseCountersReady = false;
+unsigned long pulseLastSnapshot = 0;
+unsigned long pulseLastPersist = 0;
+
+// One ISR per slot: AVR attachInterrupt takes no argument
+#define PULSE_ISR(n) \
+  void IRAM_ATTR pulseIsr##n() { \
+    unsigned long now = micros(); \
+    if (now - pulseCounters[n].lastEdgeUs < PULSE_GLITCH_US && pulseCounters[n].count > 0) return; \
+    pulseCounters[n].count++; \
+    pulseCounters[n].lastEdgeUs = now; \
+  }
+
+PULSE_ISR(0)
+PULSE_ISR(1)
+#if PULSE_SLOTS > 2
+PULSE_ISR(2)
+PULSE_ISR(3)
+#endif
+
+void (* const pulseIsrs[PULSE_SLOTS])() = {
+  pulseIsr0, pulseIsr1,
+#if PULSE_SLOTS > 2
+  pulseIsr2, pulseIsr3,
+#endif
+};
+
+void initPulseCounters() {
+  for (uint8_t i = 0; i < PULSE_SLOTS; i++) pulseCounters[i].pin = -1;
+  pulseCountersReady = true;
+}
+
+// Consistent copy of the ISR-owned fields
+void readPulseCounter(uint8_t slot, uint32_t& count, unsigned long& lastEdgeUs) {
+  noInterrupts();
+  count = pulseCounters[slot].count;
+  lastEdgeUs = pulseCounters[slot].lastEdgeUs;
+  interrupts();
+}
+
+uint32_t pulseTotal(uint8_t slot) {
+  uint32_t count;
+  unsigned long lastEdgeUs;
+  readPulseCounter(slot, count, lastEdgeUs);
+  return pulseCounters[slot].totalBase + count;
+}
+
+// Config record per pin (the slot depends on the order pins are attached
+// after boot): pin, total (u32 little-endian)
+void savePulseTotal(uint8_t slot) {
+  PulseCounter& counter = pulseCounters[slot];
+  uint32_t total = pulseTotal(slot);
+  uint8_t record[5];
+  record[0] = (uint8_t)counter.pin;
+  for (uint8_t b = 0; b < 4; b++) record[1 + b] = (uint8_t)(total >> (8 * b));
+  configSet(CONFIG_PULSE_TOTAL, record[0], record, sizeof(record));
+  counter.savedTotal = total;
+}
+
+// Total saved for this pin before the last reboot, 0 if none
+uint32_t loadPulseTotal(int pin) {
+  uint8_t record[5];
+  if (!configGet(CONFIG_PULSE_TOTAL, (uint8_t)pin, record, sizeof(record)) || record[0] != (uint8_t)pin) return 0;
+  uint32_t total = 0;
+  for (uint8_t b = 0; b < 4; b++) total |= (uint32_t)record[1 + b] << (8 * b);
+  return total;
+}
+
+// Returns the slot counting `pin`, attaching it if needed; -1 if the pin has
+// no interrupt or all slots are taken.
+int attachPulseCounter(int pin) {
+  if (!pulseCountersReady) initPulseCounters();
+  for (uint8_t i = 0; i < PULSE_SLOTS; i++) {
+    if (pulseCounters[i].pin == pin) return i;
+  }
+
+  int irq = digitalPinToInterrupt(pin);
+  if (irq < 0) return -1;  // NOT_AN_INTERRUPT
+
+  for (uint8_t i = 0; i < PULSE_SLOTS; i++) {
+    PulseCounter& counter = pulseCounters[i];
+    if (counter.pin != -1) continue;
+
+    counter.pin = pin;
+    counter.count = 0;
+    counter.lastEdgeUs = 0;
+    counter.totalBase = loadPulseTotal(pin);
+    counter.savedTotal = counter.totalBase;
+    counter.snapHead = 0;
+    counter.snapFill = 0;
+    pinMode(pin, INPUT_PULLUP);  // open-collector hall sensors
+    attachInterrupt(irq, pulseIsrs[i], FALLING);
+    return i;
+  }
+  return -1;
+}
+
+// Called from loop(): takes the rate snapshots and saves changed totals
+void servicePulseCounters() {
+  if (!pulseCountersReady) return;
+  unsigned long now = millis();
+
+  if (now - pulseLastSnapshot >= PULSE_SNAPSHOT_MS) {
+    pulseLastSnapshot = now;
+    for (uint8_t i = 0; i < PULSE_SLOTS; i++) {
+      PulseCounter& counter = pulseCounters[i];
+      if (counter.pin == -1) continue;
+      readPulseCounter(i, counter.snapCount[counter.snapHead], counter.snapEdgeUs[counter.snapHead]);
+      counter.snapHead = (counter.snapHead + 1) % PULSE_SNAPSHOTS;
+      if (counter.snapFill < PULSE_SNAPSHOTS) counter.snapFill++;
+    }
+  }
+
+  if (now - pulseLastPersist >= PULSE_PERSIST_MS) {
+    pulseLastPersist = now;
+    for (uint8_t i = 0; i < PULSE_SLOTS; i++) {
+      if (pulseCounters[i].pin != -1 && pulseTotal(i) != pulseCounters[i].savedTotal) savePulseTotal(i);
+    }
+  }
+}
+
+float pulseRateHz(uint8_t slot) {
+  PulseCounter& counter = pulseCounters[slot];
+  uint32_t count;
+  unsigned long lastEdgeUs;
+  readPulseCounter(slot, count, lastEdgeUs);
+
+  // Oldest snapshot in the window that still saw fewer pulses than now
+  for (uint8_t age = counter.snapFill; age > 0; age--) {
+    uint8_t idx = (counter.snapHead + PULSE_SNAPSHOTS - age) % PULSE_SNAPSHOTS;
+    uint32_t pulses = count - counter.snapCount[idx];
+    // A snapshot taken before the first edge has no edge time
+    if (pulses == 0 || counter.snapCount[idx] == 0) continue;
+    unsigned long spanUs = lastEdgeUs - counter.snapEdgeUs[idx];
+    if (spanUs == 0) continue;
+
+    float hz = pulses * 1000000.0 / spanUs;
+    // Pulses stopped: no faster than one pulse since the last edge
+    float sinceLastUs = (float)(micros() - lastEdgeUs);
+    if (sinceLastUs > 1000000.0 / hz) hz = 1000000.0 / sinceLastUs;
+    return hz;
+  }
+  return 0.0;
+}
+
 /**
  * handlePulseRate
- * Measures the high pulse duration on a pin and returns the frequency in Hz.
- * Assumes a 50% duty cycle for flow sensors.
+ * Returns the pulse frequency (Hz) and the total pulse count of a pin.
+ * The first call attaches the counter; the rate is valid once a few pulses
+ * have been seen.
  * Params: "PinLabel_GPIO"
  */
-String handlePulseRate(const char* params) {
+void handlePulseRate(const char* params, ResponseBuffer& res) {
   if (!params) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
-  int pin = parsePin(String(params));
+  int pin = parsePin(params);
   if (pin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
-  pinMode(pin, INPUT);
-  
-  // Use a long timeout (500ms) to support low flow rates
-  // 30 L/h = 0.5 L/min = 1.25 Hz -> ~400ms High pulse
-  unsigned long duration = pulseIn(pin, HIGH, 500000);
+  int slot = attachPulseCounter(pin);
+  if (slot < 0) {
+    return res.error(F("ERR_NO_INTERRUPT"));
+  }
 
-  if (duration == 0) {
-    // Timeout or no pulses
-    return "{\"ok\":1,\"hz\":0.0}";
+  res.print(F("{\"ok\":1,\"hz\":"));
+  res.print(pulseRateHz(slot), 2);
+  res.print(F(",\"total\":"));
+  res.print(pulseTotal(slot));
+  res.print('}');
+}
+
+// PULSE_RESET|pin - zeroes the total (and saves it with the next commit)
+void handlePulseReset(const char* params, ResponseBuffer& res) {
+  if (!params) {
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
-  // Frequency = 1 / Period
-  // Period = 2 * duration (assuming 50% duty cycle)
-  // Hz = 1,000,000 / (2 * duration)
-  float hz = 500000.0 / (float)duration;
+  int pin = parsePin(params);
+  if (pin == -1) {
+    return res.error(F("ERR_INVALID_PIN"));
+  }
 
-  String response = "{\"ok\":1,\"hz\":";
-  response += String(hz, 2);
-  response += "}";
+  int slot = attachPulseCounter(pin);
+  if (slot < 0) {
+    return res.error(F("ERR_NO_INTERRUPT"));
+  }
 
-  return response;
+  uint32_t count;
+  unsigned long lastEdgeUs;
+  readPulseCounter(slot, count, lastEdgeUs);
+  pulseCounters[slot].totalBase = (uint32_t)0 - count;  // total = base + count = 0
+  savePulseTotal(slot);
+  res.print(F("{\"ok\":1,\"total\":0}"));
 }
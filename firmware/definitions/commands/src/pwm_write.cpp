@@ -8,10 +8,10 @@ bool isPWMPin(int pin) {
   return true; 
 }
 
-String handlePWMWrite(const char* params) {
+void handlePWMWrite(const char* params, ResponseBuffer& res) {
   // Parse params: "D9|128" -> pin=D9, value=128
   if (!params || strlen(params) < 4) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
   // Find delimiter
@@ -21,7 +21,7 @@ String handlePWMWrite(const char* params) {
   
   char* delimiter = strchr(paramsCopy, '|');
   if (!delimiter) {
-     return "{\"ok\":0,\"error\":\"ERR_INVALID_FORMAT\"}";
+     return res.error(F("ERR_INVALID_FORMAT"));
   }
   
   *delimiter = '\0';
@@ -29,15 +29,15 @@ String handlePWMWrite(const char* params) {
   const char* valStr = delimiter + 1;
 
   // Parse pin
-  int pin = parsePin(String(pinStr));
+  int pin = parsePin(pinStr);
   if (pin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
   // Parse value (0-255)
   int value = atoi(valStr);
   if (value < 0 || value > 255) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_VALUE\"}";
+    return res.error(F("ERR_INVALID_VALUE"));
   }
 
   // Set PWM value
@@ -45,11 +45,9 @@ String handlePWMWrite(const char* params) {
   analogWrite(pin, value);
 
   // Build and return JSON response
-  String response = "{\"ok\":1,\"pin\":\"";
-  response += pinStr;
-  response += "\",\"value\":";
-  response += value;
-  response += "}";
-  
-  return response;
+  res.print(F("{\"ok\":1,\"pin\":\""));
+  res.print(pinStr);
+  res.print(F("\",\"value\":"));
+  res.print(value);
+  res.print('}');
 }
@@ -0,0 +1,230 @@
+// === SERIAL PORT POOL ===
+// Serial sensors lease a port from a fixed pool instead of owning a stream.
+// A port is keyed by (rx, tx, baud):
+//   - hardware UARTs are used when the pins allow: Serial1 on D0/D1 on the
+//     Uno R4, Serial1/Serial2 on any pins on the ESP32 (UART0 is the console)
+//   - other pins get one of SERIAL_SOFT_PORTS SoftwareSerial slots
+// Several leases of the same key share the port (e.g. two Modbus slaves on
+// one bus). A port stays open when its last lease is released, so the next
+// lease of the same key does not reopen it; an idle port is only closed when
+// its pins or its slot are needed for another key.
+//
+// Nothing is allocated and changing pins never reboots the board. The
+// SoftwareSerial objects live in static storage and are rebuilt in place;
+// on the R4, where deleting one caused a bus fault, the destructor is
+// skipped and end() releases the pins.
+//
+// AVR SoftwareSerial receives on one port at a time: the newest lease
+// listens, and releasing it hands the receiver back to another leased port.
+//
+// Commands that use it add "@file:commands/src/serial_ports.cpp" to their
+// functions before their own file; the builder includes it once.
+
+#include <new>
+
+#ifndef SERIAL_SOFT_PORTS
+  #define SERIAL_SOFT_PORTS 2
+#endif
+
+#if defined(ESP32)
+  #if defined(SOC_UART_NUM) && SOC_UART_NUM > 2
+    #define SERIAL_HW_PORTS 2
+  #else
+    #define SERIAL_HW_PORTS 1
+  #endif
+#elif defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
+  #define SERIAL_HW_PORTS 1
+#else
+  #define SERIAL_HW_PORTS 0  // Uno: Serial is the USB link; ESP8266: Serial1 is TX only
+#endif
+
+#define SERIAL_PORTS (SERIAL_HW_PORTS + SERIAL_SOFT_PORTS)
+
+struct SerialPort {
+  int8_t rx;                 // -1 = closed
+  int8_t tx;
+  uint8_t leases;
+  unsigned long baud;
+  unsigned long openedAt;
+  unsigned long usedAt;      // last lease, picks the idle port to close
+};
+
+SerialPort serialPorts[SERIAL_PORTS];
+bool serialPortsReady = false;
+
+// Ports 0 .. SERIAL_HW_PORTS-1 are the hardware UARTs
+#if SERIAL_HW_PORTS > 0
+HardwareSerial* const serialHardware[SERIAL_HW_PORTS] = {
+  &Serial1,
+#if SERIAL_HW_PORTS > 1
+  &Serial2,
+#endif
+};
+#endif
+
+alignas(SoftwareSerial) uint8_t serialSoftStorage[SERIAL_SOFT_PORTS][sizeof(SoftwareSerial)];
+
+#if defined(__AVR__)
+int8_t serialListener = -1;  // software port receiving
+#endif
+
+SoftwareSerial* serialSoftPort(uint8_t port) {
+  return reinterpret_cast<SoftwareSerial*>(serialSoftStorage[port - SERIAL_HW_PORTS]);
+}
+
+void initSerialPorts() {
+  for (uint8_t i = 0; i < SERIAL_PORTS; i++) {
+    serialPorts[i].rx = -1;
+    serialPorts[i].leases = 0;
+  }
+  serialPortsReady = true;
+}
+
+// Whether hardware port `port` can be routed to these pins
+bool serialHardwareFits(uint8_t port, int rx, int tx) {
+  #if defined(ESP32)
+    return true;  // the GPIO matrix routes a UART to any pins
+  #else
+    return port == 0 && rx == 0 && tx == 1;
+  #endif
+}
+
+void beginSerialPort(uint8_t port) {
+  SerialPort& p = serialPorts[port];
+  #if SERIAL_HW_PORTS > 0
+    if (port < SERIAL_HW_PORTS) {
+      #if defined(ESP32)
+        serialHardware[port]->begin(p.baud, SERIAL_8N1, p.rx, p.tx);
+      #else
+        serialHardware[port]->begin(p.baud);
+      #endif
+      p.openedAt = millis();
+      return;
+    }
+  #endif
+  serialSoftPort(port)->begin(p.baud);
+  #if defined(__AVR__)
+    serialListener = port;  // begin() listens
+  #endif
+  p.openedAt = millis();
+}
+
+void closeSerialPort(uint8_t port) {
+  SerialPort& p = serialPorts[port];
+  if (p.rx == -1) return;
+  #if SERIAL_HW_PORTS > 0
+    if (port < SERIAL_HW_PORTS) {
+      serialHardware[port]->end();
+      p.rx = -1;
+      return;
+    }
+  #endif
+  SoftwareSerial* soft = serialSoftPort(port);
+  soft->end();
+  #if !defined(ARDUINO_UNOR4_WIFI) && !defined(ARDUINO_UNOR4_MINIMA)
+    soft->~SoftwareSerial();
+  #endif
+  #if defined(__AVR__)
+    if (serialListener == port) serialListener = -1;
+  #endif
+  p.rx = -1;
+}
+
+void openSerialPort(uint8_t port, int rx, int tx, unsigned long baud) {
+  SerialPort& p = serialPorts[port];
+  if (port >= SERIAL_HW_PORTS) new (serialSoftStorage[port - SERIAL_HW_PORTS]) SoftwareSerial(rx, tx);
+  p.rx = rx;
+  p.tx = tx;
+  p.baud = baud;
+  p.leases = 0;
+  beginSerialPort(port);
+}
+
+// A closed port of the kind the pins allow, else the least recently used
+// idle one (closed first); -1 if every candidate is leased
+int8_t freeSerialPort(int rx, int tx) {
+  int8_t idle = -1;
+  for (uint8_t i = 0; i < SERIAL_PORTS; i++) {
+    if (i < SERIAL_HW_PORTS && !serialHardwareFits(i, rx, tx)) continue;
+    SerialPort& p = serialPorts[i];
+    if (p.rx == -1) return i;
+    if (p.leases == 0 && (idle == -1 || (long)(p.usedAt - serialPorts[idle].usedAt) < 0)) idle = i;
+  }
+  if (idle >= 0) closeSerialPort(idle);
+  return idle;
+}
+
+// Leases the port for (rx, tx, baud), opening it if needed. Returns the
+// port, or -1 if the pins are held by another lease (also at another baud)
+// or no port is free.
+int8_t leaseSerialPort(int rx, int tx, unsigned long baud) {
+  if (!serialPortsReady) initSerialPorts();
+
+  int8_t port = -1;
+  for (uint8_t i = 0; i < SERIAL_PORTS; i++) {
+    SerialPort& p = serialPorts[i];
+    if (p.rx == -1) continue;
+    if (p.rx == rx && p.tx == tx) {
+      port = i;
+      continue;
+    }
+    if (p.rx == rx || p.rx == tx || p.tx == rx || p.tx == tx) {
+      if (p.leases > 0) return -1;
+      closeSerialPort(i);  // idle port on overlapping pins
+    }
+  }
+
+  if (port >= 0 && serialPorts[port].baud != baud) {
+    if (serialPorts[port].leases > 0) return -1;
+    serialPorts[port].baud = baud;
+    #if SERIAL_HW_PORTS > 0
+      if (port < SERIAL_HW_PORTS) serialHardware[port]->end();
+    #endif
+    beginSerialPort(port);
+  }
+
+  if (port < 0) {
+    port = freeSerialPort(rx, tx);
+    if (port < 0) return -1;
+    openSerialPort(port, rx, tx, baud);
+  }
+
+  SerialPort& p = serialPorts[port];
+  p.leases++;
+  p.usedAt = millis();
+  #if defined(__AVR__)
+    if (port >= SERIAL_HW_PORTS && serialListener != port) {
+      serialSoftPort(port)->listen();
+      serialListener = port;
+    }
+  #endif
+  return port;
+}
+
+void releaseSerialPort(int8_t port) {
+  if (port < 0 || serialPorts[port].leases == 0) return;
+  serialPorts[port].leases--;
+  #if defined(__AVR__)
+    if (serialPorts[port].leases > 0 || serialListener != port) return;
+    for (uint8_t i = SERIAL_HW_PORTS; i < SERIAL_PORTS; i++) {
+      if (serialPorts[i].leases > 0) {
+        serialSoftPort(i)->listen();
+        serialListener = i;
+        return;
+      }
+    }
+  #endif
+}
+
+Stream* serialPortStream(int8_t port) {
+  #if SERIAL_HW_PORTS > 0
+    if (port < SERIAL_HW_PORTS) return serialHardware[port];
+  #endif
+  return serialSoftPort(port);
+}
+
+// ms since the port was opened or its baud changed; lets a caller wait
+// for a fresh port to settle
+unsigned long serialPortAge(int8_t port) {
+  return millis() - serialPorts[port].openedAt;
+}
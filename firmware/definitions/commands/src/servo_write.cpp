@@ -24,10 +24,10 @@ int getServoIndex(int pin) {
   return -1;
 }
 
-String handleServoWrite(const char* params) {
+void handleServoWrite(const char* params, ResponseBuffer& res) {
   // Parse params: "D9|90" -> pin=D9, angle=90
   if (!params || strlen(params) < 4) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
   // Find delimiter
@@ -37,7 +37,7 @@ String handleServoWrite(const char* params) {
   
   char* delimiter = strchr(paramsCopy, '|');
   if (!delimiter) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_FORMAT\"}";
+    return res.error(F("ERR_INVALID_FORMAT"));
   }
 
   *delimiter = '\0';
@@ -45,15 +45,15 @@ String handleServoWrite(const char* params) {
   const char* angleStr = delimiter + 1;
 
   // Parse pin
-  int pin = parsePin(String(pinStr));
+  int pin = parsePin(pinStr);
   if (pin == -1 || getServoIndex(pin) == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
   // Parse angle (0-180)
   int angle = atoi(angleStr);
   if (angle < 0 || angle > 180) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_VALUE\"}";
+    return res.error(F("ERR_INVALID_VALUE"));
   }
 
   // Attach servo if not already attached
@@ -67,11 +67,9 @@ String handleServoWrite(const char* params) {
   servos[servoIndex].write(angle);
 
   // Build and return JSON response
-  String response = "{\"ok\":1,\"pin\":\"";
-  response += pinStr;
-  response += "\",\"angle\":";
-  response += angle;
-  response += "}";
-  
-  return response;
+  res.print(F("{\"ok\":1,\"pin\":\""));
+  res.print(pinStr);
+  res.print(F("\",\"angle\":"));
+  res.print(angle);
+  res.print('}');
 }
@@ -2,10 +2,57 @@
 // For Arduino Uno R3, Mega, Nano, etc.
 
 // === MEMORY ===
-int freeMemory() {
-  extern int __heap_start, *__brkval;
-  int v;
-  return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+// The heap grows up from __heap_start, the stack down from RAMEND. Free heap
+// is the gap between the two plus the chunks on malloc's free list.
+extern char __heap_start;
+extern char* __brkval;
+struct __freelist {
+  size_t sz;
+  struct __freelist* nx;
+};
+extern struct __freelist* __flp;
+
+#define STACK_CANARY 0xC5
+
+char* memHeapTop() {
+  return __brkval ? __brkval : &__heap_start;
+}
+
+long memStackGap() {
+  char here;
+  return &here - memHeapTop();
+}
+
+long memFreeHeap() {
+  long total = memStackGap();
+  for (struct __freelist* fp = __flp; fp; fp = fp->nx) total += fp->sz;
+  return total;
+}
+
+long memLargestBlock() {
+  long largest = memStackGap();
+  for (struct __freelist* fp = __flp; fp; fp = fp->nx) {
+    if ((long)fp->sz > largest) largest = fp->sz;
+  }
+  return largest;
+}
+
+long memMinFreeHeap() {
+  return -1;  // sampled by sys_memstats.cpp
+}
+
+// Fills the RAM between heap and stack with a canary; memStackFree() counts
+// what the stack has never overwritten
+void initMemStats() {
+  char here;
+  for (char* p = memHeapTop(); p < &here - 32; p++) *p = STACK_CANARY;
+}
+
+long memStackFree() {
+  char here;
+  char* p = memHeapTop();
+  while (p < &here && (uint8_t)*p == STACK_CANARY) p++;
+  return p - memHeapTop();
 }
 
 // === RESET ===
@@ -14,6 +61,6 @@ void resetDevice() {
   resetFunc();
 }
 
-String getMacAddress() {
-  return "00:00:00:00:00:00";
+void printMacAddress(Print& out) {
+  out.print(F("00:00:00:00:00:00"));
 }
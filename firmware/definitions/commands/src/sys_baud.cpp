@@ -0,0 +1,107 @@
+// === SERIAL BAUD NEGOTIATION ===
+// Compiled in when the transport defines ENABLE_SERIAL_BAUD (serial_standard).
+// The host raises the link speed without losing the board:
+//
+//   host: SET_BAUD|500000          (at the current rate)
+//   fw:   {"ok":1,"baud":500000,"from":9600,"confirm_ms":2000}
+//         the reply is flushed, then Serial restarts at 500000
+//   host: switches its port and sends PING at the new rate
+//   fw:   the PING confirms the rate, which is saved in the config store
+//
+// Without a PING within SERIAL_BAUD_CONFIRM_MS the firmware goes back to the
+// previous rate, so a rate the USB bridge or the host cannot do costs one
+// timeout. setup() starts Serial at the saved rate (initSerialBaud()), so
+// the host probes the known rates when the configured one gets no answer.
+
+#ifdef ENABLE_SERIAL_BAUD
+
+#ifndef SERIAL_BAUD_CONFIRM_MS
+  #define SERIAL_BAUD_CONFIRM_MS 2000UL
+#endif
+
+// Exact or within 2% on a 16 MHz AVR
+const uint32_t SERIAL_BAUD_RATES[] PROGMEM = {
+  9600, 19200, 38400, 57600, 115200, 250000, 500000, 1000000
+};
+#define SERIAL_BAUD_RATE_COUNT (sizeof(SERIAL_BAUD_RATES) / sizeof(SERIAL_BAUD_RATES[0]))
+
+uint32_t serialBaud = 0;
+uint32_t serialBaudNext = 0;        // switch after the SET_BAUD reply is out
+uint32_t serialBaudFallback = 0;    // while on trial: the rate to go back to
+unsigned long serialBaudTrialAt = 0;
+
+bool isSerialBaudRate(uint32_t rate) {
+  for (uint8_t i = 0; i < SERIAL_BAUD_RATE_COUNT; i++) {
+    if (pgm_read_dword(&SERIAL_BAUD_RATES[i]) == rate) return true;
+  }
+  return false;
+}
+
+// From setup(): the saved rate, else the transport's default
+uint32_t initSerialBaud(uint32_t defaultRate) {
+  uint32_t saved;
+  serialBaud = defaultRate;
+  if (configGet(CONFIG_SERIAL_BAUD, 0, &saved, sizeof(saved)) && isSerialBaudRate(saved)) serialBaud = saved;
+  return serialBaud;
+}
+
+void switchSerialBaud(uint32_t rate) {
+  Serial.flush();
+  Serial.end();
+  Serial.begin(rate);
+  serialBaud = rate;
+  // Bytes received around the switch are noise
+  for (InputSource* source = inputSources; source; source = source->next) {
+    if (source->stream == &Serial) source->clear();
+  }
+}
+
+// From loop()
+void serviceSerialBaud() {
+  #ifdef ENABLE_DUAL_CORE
+  // SET_BAUD and PING run on the acquisition task: switch once the reply is out
+  if (coreRequestsInFlight()) return;
+  #endif
+  if (serialBaudNext) {
+    serialBaudFallback = serialBaud;
+    switchSerialBaud(serialBaudNext);
+    serialBaudNext = 0;
+    serialBaudTrialAt = millis();
+  } else if (serialBaudFallback && millis() - serialBaudTrialAt >= SERIAL_BAUD_CONFIRM_MS) {
+    switchSerialBaud(serialBaudFallback);
+    serialBaudFallback = 0;
+  }
+}
+
+// handlePing(): a command arrived at the trial rate, keep it
+void confirmSerialBaud() {
+  if (!serialBaudFallback) return;
+  serialBaudFallback = 0;
+  configSet(CONFIG_SERIAL_BAUD, 0, &serialBaud, sizeof(serialBaud));
+}
+
+// SET_BAUD[|rate]: without a rate, reports the current one
+void handleSetBaud(const char* params, ResponseBuffer& res) {
+  if (params) {
+    char* end;
+    uint32_t rate = strtoul(params, &end, 10);
+    if (end == params || *end != '\0' || !isSerialBaudRate(rate)) return res.error(F("ERR_INVALID_VALUE"));
+    if (serialBaudNext || serialBaudFallback) return res.error(F("ERR_BUSY"));
+    if (rate != serialBaud) {
+      serialBaudNext = rate;
+      res.print(F("{\"ok\":1,\"baud\":"));
+      res.print(rate);
+      res.print(F(",\"from\":"));
+      res.print(serialBaud);
+      res.print(F(",\"confirm_ms\":"));
+      res.print(SERIAL_BAUD_CONFIRM_MS);
+      res.print('}');
+      return;
+    }
+  }
+  res.print(F("{\"ok\":1,\"baud\":"));
+  res.print(serialBaud);
+  res.print('}');
+}
+
+#endif
@@ -0,0 +1,115 @@
+// === RESULT CACHE ===
+// Commands whose definition declares "cache_ttl_ms" carry that TTL in
+// COMMAND_TABLE. processCommand() answers a repeat of the same command and
+// parameters from here while the stored reply is younger than the TTL, with
+// the reply's age spliced in: {"ok":1,"temp":21.50,"age":340}. Only "ok"
+// replies are stored. A job command stores its pushed result when the job
+// finishes; until then repeats start their own job.
+//
+// RESULT_CACHE_COMMANDS (the number of cacheable commands) is generated by
+// FirmwareBuilder; without any the cache is not compiled in.
+
+#if RESULT_CACHE_COMMANDS > 0
+
+#if defined(__AVR__)
+  #define RESULT_CACHE_MAX_SLOTS 2
+  #define RESULT_CACHE_VALUE_SIZE 64
+#else
+  #define RESULT_CACHE_MAX_SLOTS 16
+  #define RESULT_CACHE_VALUE_SIZE 256
+#endif
+
+// Two parameter sets per cacheable command (e.g. two probes), within the cap
+#if RESULT_CACHE_COMMANDS * 2 < RESULT_CACHE_MAX_SLOTS
+  #define RESULT_CACHE_SLOTS (RESULT_CACHE_COMMANDS * 2)
+#else
+  #define RESULT_CACHE_SLOTS RESULT_CACHE_MAX_SLOTS
+#endif
+
+struct CachedResult {
+  uint32_t key;              // 0 = free
+  unsigned long storedAt;
+  uint16_t ttlMs;
+  uint8_t jobId;             // != 0: waiting for this job's result
+  char value[RESULT_CACHE_VALUE_SIZE];
+};
+
+CachedResult resultCache[RESULT_CACHE_SLOTS];
+
+// FNV-1a over the parameters, seeded with the command hash. 0 is reserved
+// for free slots.
+uint32_t resultCacheKey(uint16_t commandHash, const char* params) {
+  uint32_t h = 2166136261UL ^ commandHash;
+  if (params) {
+    for (const char* p = params; *p; p++) h = (h ^ (uint8_t)*p) * 16777619UL;
+  }
+  return h ? h : 1;
+}
+
+bool resultCacheFresh(uint8_t slot) {
+  const CachedResult& entry = resultCache[slot];
+  return entry.key != 0 && entry.jobId == 0 && millis() - entry.storedAt < entry.ttlMs;
+}
+
+// Answers from the cache; returns false on a miss
+bool serveCachedResult(uint32_t key, ResponseBuffer& res) {
+  for (uint8_t i = 0; i < RESULT_CACHE_SLOTS; i++) {
+    if (resultCache[i].key != key || !resultCacheFresh(i)) continue;
+    const char* value = resultCache[i].value;
+    res.write((const uint8_t*)value, strlen(value) - 1);  // without the closing brace
+    res.print(F(",\"age\":"));
+    res.print(millis() - resultCache[i].storedAt);
+    res.print('}');
+    return true;
+  }
+  return false;
+}
+
+// Slot for `key`: its own, else a free or expired one, else the oldest
+uint8_t resultCacheSlot(uint32_t key) {
+  for (uint8_t i = 0; i < RESULT_CACHE_SLOTS; i++) {
+    if (resultCache[i].key == key) return i;
+  }
+  uint8_t oldest = 0;
+  for (uint8_t i = 0; i < RESULT_CACHE_SLOTS; i++) {
+    const CachedResult& entry = resultCache[i];
+    if (entry.key == 0 || (entry.jobId == 0 && !resultCacheFresh(i))) return i;
+    if ((long)(entry.storedAt - resultCache[oldest].storedAt) < 0) oldest = i;
+  }
+  return oldest;
+}
+
+void storeCachedValue(uint8_t slot, const char* reply) {
+  CachedResult& entry = resultCache[slot];
+  size_t len = strlen(reply);
+  if (len >= sizeof(entry.value) || strncmp_P(reply, PSTR("{\"ok\":1,"), 8) != 0 || reply[len - 1] != '}') {
+    entry.key = 0;  // errors and oversized replies are not cached
+    return;
+  }
+  memcpy(entry.value, reply, len + 1);
+  entry.storedAt = millis();
+  entry.jobId = 0;
+}
+
+// Called by processCommand after a cacheable handler ran
+void storeCachedResult(uint32_t key, uint16_t ttlMs, const char* reply) {
+  uint8_t slot = resultCacheSlot(key);
+  CachedResult& entry = resultCache[slot];
+  entry.key = key;
+  entry.ttlMs = ttlMs;
+  if (strncmp_P(reply, PSTR("{\"ok\":1,\"job\":"), 14) == 0) {
+    entry.jobId = lastJobId;  // set by startJob() for this request
+    entry.storedAt = millis();
+    return;
+  }
+  storeCachedValue(slot, reply);
+}
+
+// Called by serviceJobs() when a job has finished
+void cacheJobResult(uint8_t jobId, const char* result) {
+  for (uint8_t i = 0; i < RESULT_CACHE_SLOTS; i++) {
+    if (resultCache[i].key != 0 && resultCache[i].jobId == jobId) storeCachedValue(i, result);
+  }
+}
+
+#endif
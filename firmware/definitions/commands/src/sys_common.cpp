@@ -4,92 +4,274 @@
 
 // Forward declarations of architecture-specific functions
 // These must be implemented in the architecture-specific files (e.g., sys_avr.cpp)
-int freeMemory();
+long memFreeHeap();      // < 0 wherever a value cannot be measured
+long memLargestBlock();
+long memMinFreeHeap();
+long memStackFree();
+void initMemStats();
 void resetDevice();
-String getMacAddress();
+void printMacAddress(Print& out);
 
-// === COMMAND PARSER ===
-String processCommand(String input) {
-  input.trim();
-  char cmdBuffer[120];
-  strncpy(cmdBuffer, input.c_str(), sizeof(cmdBuffer) - 1);
-  cmdBuffer[sizeof(cmdBuffer) - 1] = '\0';
-  
-  // Find delimiter position and isolate command name
-  char* delimiter = strchr(cmdBuffer, '|');
-  if (delimiter) {
-    *delimiter = '\0';  // Terminate string at delimiter to isolate command
+// Not every core ships pgm_read_ptr (PROGMEM is a no-op outside AVR/ESP8266)
+#ifndef pgm_read_ptr
+  #define pgm_read_ptr(addr) (*(void* const*)(addr))
+#endif
+
+// === DISPATCH TABLE TYPES ===
+typedef void (*CommandHandler)(const char* params, ResponseBuffer& res);
+
+struct CommandEntry {
+  const char* name;        // PROGMEM string
+  CommandHandler handler;
+  uint16_t cacheTtlMs;     // 0 = never served from the result cache
+};
+
+// Must stay in sync with FirmwareBuilder.hashCommandName()
+inline uint16_t hashCommandStep(uint16_t h, char c) {
+  return (uint16_t)((h ^ (uint8_t)c) * 0x0193u);
+}
+
+// === SYSTEM HANDLERS ===
+void printCapabilities(ResponseBuffer& res) {
+  res.print(F("\"capabilities\":["));
+  for (int i = 0; i < CAPABILITIES_COUNT; i++) {
+    res.print('"');
+    res.print(CAPABILITIES[i]);
+    res.print('"');
+    if (i < CAPABILITIES_COUNT - 1) res.print(',');
   }
-  const char* cmd = cmdBuffer;
-  
-  // === SYSTEM COMMANDS ===
-  
-  if (strcmp(cmd, "PING") == 0) {
-    return F("{\"ok\":1,\"pong\":1}");
+  res.print(']');
+}
+
+void handlePing(const char* params, ResponseBuffer& res) {
+  #ifdef ENABLE_SERIAL_BAUD
+  confirmSerialBaud();
+  #endif
+  res.print(F("{\"ok\":1,\"pong\":1}"));
+}
+
+// HYDROPONICS_DISCOVERY[|MEM]: MEM adds "mem":{...} as in MEMSTATS (sys_memstats.cpp)
+void handleDiscovery(const char* params, ResponseBuffer& res) {
+  res.print(F("{\"type\":\"ANNOUNCE\",\"mac\":\""));
+  printMacAddress(res);
+  #if defined(ESP8266) || defined(ESP32) || defined(ARDUINO_UNOR4_WIFI)
+  res.print(F("\",\"ip\":\""));
+  res.print(WiFi.localIP());
+  #endif
+  res.print(F("\",\"model\":\"{{BOARD_NAME}}\",\"firmware\":\""));
+  res.print(F(FIRMWARE_VERSION));
+  res.print(F("\","));
+  printCapabilities(res);
+  #ifdef ENABLE_STALL_WATCH
+  printStallBreadcrumb(res);
+  #endif
+  if (params && strcmp_P(params, PSTR("MEM")) == 0) {
+    res.print(F(",\"mem\":{"));
+    printMemStats(res);
+    res.print('}');
   }
+  res.print('}');
+}
+
+void handleInfo(const char* params, ResponseBuffer& res) {
+  res.print(F("{\"ok\":1,\"up\":"));
+  res.print(millis());
+  printMemValue(res, F(",\"mem\":"), memFreeHeap());
+  res.print(F(",\"ver\":\""));
+  res.print(F(FIRMWARE_VERSION));
+  res.print(F("\","));
+  printCapabilities(res);
+  #ifdef ENABLE_STALL_WATCH
+  printStallBreadcrumb(res);
+  #endif
+  res.print('}');
+}
+
+void handleStatus(const char* params, ResponseBuffer& res) {
+  res.print(F("{\"ok\":1,\"status\":\"running\",\"up\":"));
+  res.print(millis());
+  res.print('}');
+}
+
+void handleReset(const char* params, ResponseBuffer& res) {
+  #ifdef ENABLE_CONFIG_STORE
+  flushConfigStore();
+  #endif
+  Serial.println(F("{\"ok\":1,\"msg\":\"Resetting...\"}"));
+  delay(100);
+  resetDevice();
+  res.print(F("{\"ok\":1,\"msg\":\"Resetting\"}"));
+}
+
+void handleTestWatchdog(const char* params, ResponseBuffer& res) {
+  Serial.println(F("{\"ok\":1,\"msg\":\"Blocking loop for 10s to test Watchdog...\"}"));
+  delay(10000); // Block for 10s, should trigger WDT (8s timeout)
+  res.error(F("WDT_FAILED_TO_RESET")); // Should not be reached if WDT is working
+}
+
+// === BATCH ===
+// BATCH|CMD1|a|b;CMD2|c;... runs the items in order through processCommand and
+// answers {"ok":1,"results":[<reply 1>,<reply 2>,...],"done":N}, each item's
+// own reply at its index. Each reply is written in place into the space the
+// response buffer has left. An item starts only with BATCH_ITEM_MIN_SPACE
+// free, so the short replies of commands that change something always fit.
+// A longer reply that does not fit is cut off with the rest of the batch
+// (done < item count) and the client resends those items; done = 0 means the
+// first item needs a reply of its own.
+#ifndef BATCH_ITEM_MIN_SPACE
+  #define BATCH_ITEM_MIN_SPACE 48  // {"ok":0,"error":"ERR_RESPONSE_OVERFLOW"} and the like
+#endif
+#define BATCH_TAIL_SPACE 16        // ],"done":255}
+
+void handleBatch(const char* params, ResponseBuffer& res) {
+  if (!params) return res.error(F("ERR_MISSING_PARAMETER"));
+
+  res.print(F("{\"ok\":1,\"results\":["));
+  uint8_t done = 0;
+  const char* item = params;
+  while (item && done < 255) {
+    if (res.space() < BATCH_ITEM_MIN_SPACE + BATCH_TAIL_SPACE) break;
+
+    const char* sep = strchr(item, ';');
+    size_t itemLen = sep ? (size_t)(sep - item) : strlen(item);
 
-  else if (strcmp(cmd, "HYDROPONICS_DISCOVERY") == 0) {
-    String response = F("{\"type\":\"ANNOUNCE\",\"mac\":\"");
-    response += getMacAddress();
-    #if defined(ESP8266) || defined(ESP32) || defined(ARDUINO_UNOR4_WIFI)
-    response += F("\",\"ip\":\"");
-    response += WiFi.localIP().toString();
-    #endif
-    response += F("\",\"model\":\"{{BOARD_NAME}}\",\"firmware\":\"");
-    response += FIRMWARE_VERSION;
-    response += F("\",\"capabilities\":[");
-    for (int i = 0; i < CAPABILITIES_COUNT; i++) {
-      response += "\"";
-      response += CAPABILITIES[i];
-      response += "\"";
-      if (i < CAPABILITIES_COUNT - 1) response += ",";
+    char line[COMMAND_BUFFER_SIZE];
+    size_t sepLen = done > 0 ? 1 : 0;  // the ',' goes in front once the item is kept
+    ResponseBuffer itemRes(res.tail() + sepLen, res.space() + 1 - sepLen - BATCH_TAIL_SPACE);
+    if (itemLen >= sizeof(line)) {
+      itemRes.error(F("ERR_COMMAND_TOO_LONG"));
+    } else if (itemLen >= 5 && strncmp_P(item, PSTR("BATCH"), 5) == 0 && (itemLen == 5 || item[5] == '|')) {
+      itemRes.error(F("ERR_INVALID_COMMAND"));  // no nesting
+    } else {
+      memcpy(line, item, itemLen);
+      line[itemLen] = '\0';
+      processCommand(line, itemRes);
+      // Did not fit here: the client sends it again (alone if it is the first)
+      if (strcmp_P(itemRes.c_str(), PSTR("{\"ok\":0,\"error\":\"ERR_RESPONSE_OVERFLOW\"}")) == 0) {
+        res.tail()[0] = '\0';
+        break;
+      }
     }
-    response += F("]}");
-    return response;
+
+    if (sepLen) res.tail()[0] = ',';
+    res.append(sepLen + itemRes.length());
+    if (itemRes.length() == 0) res.print(F("null"));  // empty item
+    done++;
+    item = sep ? sep + 1 : NULL;
   }
-  
-  else if (strcmp(cmd, "INFO") == 0) {
-    String response = F("{\"ok\":1,\"up\":");
-    response += millis();
-    response += F(",\"mem\":");
-    response += freeMemory();
-    response += F(",\"ver\":\"");
-    response += FIRMWARE_VERSION;
-    response += F("\",\"capabilities\":[");
-    for (int i = 0; i < CAPABILITIES_COUNT; i++) {
-      response += "\"";
-      response += CAPABILITIES[i];
-      response += "\"";
-      if (i < CAPABILITIES_COUNT - 1) response += ",";
-    }
-    response += F("]}");
-    return response;
+  res.print(F("],\"done\":"));
+  res.print(done);
+  res.print('}');
+}
+
+// === DISPATCH TABLE (generated by FirmwareBuilder) ===
+{{COMMAND_TABLE}}
+
+// Name of the command in the slot of `h` (PROGMEM), for code that runs
+// before the table is defined
+const char* commandName(uint16_t h) {
+  return (const char*)pgm_read_ptr(&COMMAND_TABLE[h % COMMAND_TABLE_SLOTS].name);
+}
+
+// Name of loop section `n`: the id of the definition whose loop block it is
+// (LOOP_SECTION_NAMES, FirmwareBuilder)
+void printLoopSectionName(Print& out, uint8_t n) {
+  const char* p = PSTR(LOOP_SECTION_NAMES);
+  for (char c = pgm_read_byte(p); c != '\0' && n > 0; c = pgm_read_byte(++p)) {
+    if (c == ',') n--;
   }
-  
-  else if (strcmp(cmd, "STATUS") == 0) {
-    String response = F("{\"ok\":1,\"status\":\"running\",\"up\":");
-    response += millis();
-    response += F("}");
-    return response;
+  for (char c = pgm_read_byte(p); c != '\0' && c != ','; c = pgm_read_byte(++p)) out.print(c);
+}
+
+// Runs the command in the slot of `h` (its name has been checked). Commands
+// with a cache TTL go through the result cache (sys_cache.cpp).
+void runCommand(uint16_t h, const char* params, ResponseBuffer& res) {
+  const CommandEntry* entry = &COMMAND_TABLE[h % COMMAND_TABLE_SLOTS];
+  #if RESULT_CACHE_COMMANDS > 0
+  uint16_t ttlMs = pgm_read_word(&entry->cacheTtlMs);
+  uint32_t key = 0;
+  if (ttlMs) {
+    key = resultCacheKey(h, params);
+    if (serveCachedResult(key, res) && !res.overflow()) return;
+    res.clear();
   }
-  
-  else if (strcmp(cmd, "RESET") == 0) {
-    Serial.println("{\"ok\":1,\"msg\":\"Resetting...\"}");
-    delay(100);
-    resetDevice();
-    return "{\"ok\":1,\"msg\":\"Resetting\"}";
+  #endif
+
+  CommandHandler handler = (CommandHandler)pgm_read_ptr(&entry->handler);
+  long freeBefore = memFreeHeap();
+  #ifdef ENABLE_STALL_WATCH
+  StallTask outerTask = enterCommandTask(h);
+  #endif
+  #ifdef ENABLE_COMMAND_STATS
+  unsigned long startUs = micros();
+  handler(params, res);
+  recordCommandTime(h, micros() - startUs);
+  #else
+  handler(params, res);
+  #endif
+  #ifdef ENABLE_STALL_WATCH
+  leaveTask(outerTask);
+  #endif
+  recordCommandHeap(h, freeBefore);
+  if (res.overflow()) {
+    res.clear();
+    res.error(F("ERR_RESPONSE_OVERFLOW"));
   }
 
-  else if (strcmp(cmd, "TEST_WATCHDOG") == 0) {
-    Serial.println("{\"ok\":1,\"msg\":\"Blocking loop for 10s to test Watchdog...\"}");
-    delay(10000); // Block for 10s, should trigger WDT (8s timeout)
-    return "{\"ok\":0,\"error\":\"WDT_FAILED_TO_RESET\"}"; // Should not be reached if WDT is working
+  #if RESULT_CACHE_COMMANDS > 0
+  if (ttlMs) storeCachedResult(key, ttlMs, res.c_str());
+  #endif
+}
+
+// === COMMAND PARSER ===
+// Parses `input` in place (trimmed) and writes the reply into `res`.
+// Writes nothing for an empty line.
+void processCommand(char* input, ResponseBuffer& res) {
+  while (*input == ' ' || *input == '\t' || *input == '\r' || *input == '\n') input++;
+  size_t inputLen = strlen(input);
+  while (inputLen > 0 && (input[inputLen - 1] == ' ' || input[inputLen - 1] == '\t' ||
+                          input[inputLen - 1] == '\r' || input[inputLen - 1] == '\n')) {
+    input[--inputLen] = '\0';
+  }
+  if (inputLen == 0) return;
+
+  const char* cmd = input;
+
+  // Hash the command name while scanning for the delimiter (single pass, no copy)
+  uint16_t h = COMMAND_HASH_SEED;
+  const char* p = cmd;
+  while (*p && *p != '|') {
+    h = hashCommandStep(h, *p);
+    p++;
   }
-  
-  // === DYNAMIC DISPATCHERS ===
-  {{COMMAND_DISPATCHERS}}
-  
-  else {
-    return F("{\"ok\":0,\"error\":\"ERR_INVALID_COMMAND\"}");
+  size_t cmdLen = p - cmd;
+  const char* params = (*p == '|') ? p + 1 : NULL;
+
+  // Perfect hash: at most one candidate slot, confirm with a single compare
+  const CommandEntry* entry = &COMMAND_TABLE[h % COMMAND_TABLE_SLOTS];
+  const char* name = (const char*)pgm_read_ptr(&entry->name);
+  if (name && strlen_P(name) == cmdLen && strncmp_P(cmd, name, cmdLen) == 0) {
+    runCommand(h, params, res);
+    return;
   }
+
+  res.error(F("ERR_INVALID_COMMAND"));
+}
+
+// Binary frames carry the 16-bit name hash instead of the name. The hash of
+// the name stored in the slot is recomputed to reject hashes of commands that
+// are not compiled in. Returns false if nothing matched.
+bool dispatchHashedCommand(uint16_t h, const char* params, ResponseBuffer& res) {
+  const CommandEntry* entry = &COMMAND_TABLE[h % COMMAND_TABLE_SLOTS];
+  const char* name = (const char*)pgm_read_ptr(&entry->name);
+  if (!name) return false;
+
+  uint16_t nameHash = COMMAND_HASH_SEED;
+  for (char c = pgm_read_byte(name); c != '\0'; c = pgm_read_byte(++name)) {
+    nameHash = hashCommandStep(nameHash, c);
+  }
+  if (nameHash != h) return false;
+
+  runCommand(h, params, res);
+  return true;
 }
@@ -0,0 +1,187 @@
+// === CONFIG STORE ===
+// Persistent state lives in one store instead of fixed EEPROM addresses.
+// Definitions that persist something add "#define ENABLE_CONFIG_STORE" to
+// their globals; without one the store is not compiled in.
+//
+// Records are typed: (type, index, length, data), e.g. (CONFIG_PULSE_TOTAL,
+// pin, 5, pin + total). The types are listed in system_commands.json.
+// configSet() only changes the RAM copy; serviceConfigStore() commits it
+// CONFIG_COMMIT_DELAY_MS after the first change, so a burst of relay
+// toggles costs one commit and a handler never waits for a write.
+//
+// Each commit writes the whole image to the next of CONFIG_BANKS banks in
+// turn (wear leveling): magic, version, length, sequence, records, CRC-16.
+// The CRC is written last, so a commit cut short by a power loss leaves
+// the previous bank as the newest valid one. At boot the valid bank with
+// the highest sequence number is loaded.
+//
+// AVR and R4 EEPROM writes take milliseconds per byte, so the commit is
+// written a byte at a time from loop(). On the ESP the EEPROM is a RAM copy
+// of a flash sector: the image is copied in and committed with one erase.
+
+#ifdef ENABLE_CONFIG_STORE
+
+#define CONFIG_STORE_SIZE 512
+#define CONFIG_STORE_MAGIC 0xC5
+#define CONFIG_STORE_VERSION 1
+#define CONFIG_HEADER_SIZE 5    // magic, version, length, sequence (u16)
+#define CONFIG_FRAME_EXTRA (CONFIG_HEADER_SIZE + 2)  // + CRC
+
+#if defined(__AVR__)
+  #define CONFIG_BANK_SIZE 64
+#else
+  #define CONFIG_BANK_SIZE 128
+#endif
+
+#define CONFIG_BANKS (CONFIG_STORE_SIZE / CONFIG_BANK_SIZE)
+#define CONFIG_RECORDS_MAX (CONFIG_BANK_SIZE - CONFIG_FRAME_EXTRA)
+
+#ifndef CONFIG_COMMIT_DELAY_MS
+  #define CONFIG_COMMIT_DELAY_MS 3000UL
+#endif
+
+uint8_t configRecords[CONFIG_RECORDS_MAX];  // live records
+uint8_t configRecordsLen = 0;
+uint8_t configFrame[CONFIG_BANK_SIZE];      // image being committed
+uint8_t configFrameLen = 0;
+int16_t configWritePos = -1;                // next byte to write, -1 = idle
+uint8_t configBank = CONFIG_BANKS - 1;      // bank of the newest image
+uint16_t configSeq = 0;
+bool configDirty = false;
+unsigned long configDirtyAt = 0;
+bool configStoreReady = false;
+
+// Loads the newest valid bank; called on first use
+void initConfigStore() {
+  if (configStoreReady) return;
+  configStoreReady = true;
+  #if defined(ESP8266) || defined(ESP32)
+    EEPROM.begin(CONFIG_STORE_SIZE);
+  #endif
+
+  bool found = false;
+  for (uint8_t bank = 0; bank < CONFIG_BANKS; bank++) {
+    int base = bank * CONFIG_BANK_SIZE;
+    if (EEPROM.read(base) != CONFIG_STORE_MAGIC || EEPROM.read(base + 1) != CONFIG_STORE_VERSION) continue;
+    uint8_t len = EEPROM.read(base + 2);
+    if (len > CONFIG_RECORDS_MAX) continue;
+    uint8_t frameLen = len + CONFIG_FRAME_EXTRA;
+    for (uint8_t i = 0; i < frameLen; i++) configFrame[i] = EEPROM.read(base + i);
+    uint16_t crc = configFrame[frameLen - 2] | (configFrame[frameLen - 1] << 8);
+    if (calculateModbusCRC16(configFrame, frameLen - 2) != crc) continue;
+
+    uint16_t seq = configFrame[3] | (configFrame[4] << 8);
+    if (found && (int16_t)(seq - configSeq) <= 0) continue;
+    found = true;
+    configSeq = seq;
+    configBank = bank;
+    configRecordsLen = len;
+    memcpy(configRecords, configFrame + CONFIG_HEADER_SIZE, len);
+  }
+}
+
+// Offset of record (type, index) in configRecords, -1 if there is none
+int findConfigRecord(uint8_t type, uint8_t index) {
+  initConfigStore();
+  uint8_t pos = 0;
+  while (pos + 3 <= configRecordsLen) {
+    if (configRecords[pos] == type && configRecords[pos + 1] == index) return pos;
+    pos += 3 + configRecords[pos + 2];
+  }
+  return -1;
+}
+
+// Copies the record into `data`; false if it is missing or has another length
+bool configGet(uint8_t type, uint8_t index, void* data, uint8_t len) {
+  int pos = findConfigRecord(type, index);
+  if (pos < 0 || configRecords[pos + 2] != len) return false;
+  memcpy(data, configRecords + pos + 3, len);
+  return true;
+}
+
+// Stores the record for the next commit; false if the store is full
+bool configSet(uint8_t type, uint8_t index, const void* data, uint8_t len) {
+  int pos = findConfigRecord(type, index);
+  if (pos >= 0 && configRecords[pos + 2] == len) {
+    if (memcmp(configRecords + pos + 3, data, len) == 0) return true;
+  } else {
+    if (pos >= 0) {
+      // Length changed: drop the old record and append the new one
+      uint8_t size = 3 + configRecords[pos + 2];
+      memmove(configRecords + pos, configRecords + pos + size, configRecordsLen - pos - size);
+      configRecordsLen -= size;
+    }
+    if (configRecordsLen + 3 + len > CONFIG_RECORDS_MAX) return false;
+    pos = configRecordsLen;
+    configRecords[pos] = type;
+    configRecords[pos + 1] = index;
+    configRecords[pos + 2] = len;
+    configRecordsLen += 3 + len;
+  }
+  memcpy(configRecords + pos + 3, data, len);
+  if (!configDirty) configDirtyAt = millis();
+  configDirty = true;
+  return true;
+}
+
+// Snapshots the records into the next bank's image
+void beginConfigCommit() {
+  configSeq++;
+  configBank = (configBank + 1) % CONFIG_BANKS;
+  configFrame[0] = CONFIG_STORE_MAGIC;
+  configFrame[1] = CONFIG_STORE_VERSION;
+  configFrame[2] = configRecordsLen;
+  configFrame[3] = configSeq & 0xFF;
+  configFrame[4] = configSeq >> 8;
+  memcpy(configFrame + CONFIG_HEADER_SIZE, configRecords, configRecordsLen);
+  configFrameLen = configRecordsLen + CONFIG_FRAME_EXTRA;
+  uint16_t crc = calculateModbusCRC16(configFrame, configFrameLen - 2);
+  configFrame[configFrameLen - 2] = crc & 0xFF;
+  configFrame[configFrameLen - 1] = crc >> 8;
+  configWritePos = 0;
+  configDirty = false;
+}
+
+// Writes image bytes; all of them when `all`, else as many as the EEPROM
+// takes without blocking
+void writeConfigFrame(bool all) {
+  int base = configBank * CONFIG_BANK_SIZE;
+  while (configWritePos < configFrameLen) {
+    #if defined(ESP8266) || defined(ESP32)
+      EEPROM.write(base + configWritePos, configFrame[configWritePos]);
+    #else
+      #if defined(__AVR__)
+        if (!all && !eeprom_is_ready()) return;
+      #endif
+      EEPROM.update(base + configWritePos, configFrame[configWritePos]);
+    #endif
+    configWritePos++;
+    #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
+      if (!all) return;  // each byte is a data flash write
+    #endif
+  }
+  #if defined(ESP8266) || defined(ESP32)
+    EEPROM.commit();
+  #endif
+  configWritePos = -1;
+}
+
+// Called from loop()
+void serviceConfigStore() {
+  if (configWritePos < 0) {
+    if (!configDirty || millis() - configDirtyAt < CONFIG_COMMIT_DELAY_MS) return;
+    beginConfigCommit();
+  }
+  writeConfigFrame(false);
+}
+
+// Commits pending changes now (before a reset)
+void flushConfigStore() {
+  if (configWritePos >= 0) writeConfigFrame(true);
+  if (configDirty) {
+    beginConfigCommit();
+    writeConfigFrame(true);
+  }
+}
+
+#endif
@@ -1,10 +1,38 @@
 // === SYSTEM COMMANDS (ESP8266/ESP32 IMPLEMENTATION) ===
 
 // === MEMORY ===
-int freeMemory() {
+// The SDKs track the heap themselves. The stack figure is the loop task's
+// (ESP32) or the sketch's continuation stack (ESP8266), both painted at boot.
+long memFreeHeap() {
   return ESP.getFreeHeap();
 }
 
+long memLargestBlock() {
+  #ifdef ESP32
+  return ESP.getMaxAllocHeap();
+  #else
+  return ESP.getMaxFreeBlockSize();
+  #endif
+}
+
+long memMinFreeHeap() {
+  #ifdef ESP32
+  return ESP.getMinFreeHeap();
+  #else
+  return -1;  // sampled by sys_memstats.cpp
+  #endif
+}
+
+long memStackFree() {
+  #ifdef ESP32
+  return uxTaskGetStackHighWaterMark(NULL);  // bytes on the ESP32
+  #else
+  return ESP.getFreeContStack();
+  #endif
+}
+
+void initMemStats() { }
+
 // === RESET ===
 void resetDevice() {
   ESP.restart();
@@ -17,6 +45,10 @@ void resetDevice() {
 #include <WiFi.h>
 #endif
 
-String getMacAddress() {
-  return WiFi.macAddress();
+void printMacAddress(Print& out) {
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  char buf[18];
+  snprintf(buf, sizeof(buf), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  out.print(buf);
 }
@@ -0,0 +1,119 @@
+// === JOB ENGINE ===
+// A slow handler validates its parameters, calls startJob() and returns at
+// once; the client gets {"ok":1,"job":N,"pending":1}. serviceJobs() (run from
+// loop) calls the job's step function whenever its wakeAt time has passed.
+// Steps must not block for more than a few milliseconds - they schedule the
+// next step with jobSleep() instead of delay().
+//
+// The finished result is pushed to the route the request came from as
+// {"job":N,...}. Jobs started from a route that cannot be pushed to
+// (ROUTE_NONE) keep their result until polled with JOB|N or it expires.
+// ROUTE_LOCAL results go straight back to the telemetry sampler.
+
+#define JOB_RESULT_TTL_MS 30000UL
+
+Job jobs[JOB_SLOTS];
+uint8_t lastJobId = 0;
+
+// Allocates a job and answers the request with its id. Returns NULL (and
+// answers ERR_BUSY) when every slot is taken.
+Job* startJob(JobStep run, ResponseBuffer& res) {
+  for (uint8_t i = 0; i < JOB_SLOTS; i++) {
+    Job& job = jobs[i];
+    if (job.id != 0) continue;
+
+    if (++lastJobId == 0) lastJobId = 1;
+    job.id = lastJobId;
+    job.step = 0;
+    job.done = false;
+    job.wakeAt = millis();
+    job.run = run;
+    job.route = currentRoute;
+    memset(job.vars, 0, sizeof(job.vars));
+    job.result[0] = '\0';
+
+    res.print(F("{\"ok\":1,\"job\":"));
+    res.print(job.id);
+    res.print(F(",\"pending\":1}"));
+    return &job;
+  }
+  res.error(F("ERR_BUSY"));
+  return NULL;
+}
+
+void jobSleep(Job& job, unsigned long ms) {
+  job.wakeAt = millis() + ms;
+}
+
+// Writes the stored result with the job id spliced in: {"job":N,"ok":1,...}
+void writeJobReply(const Job& job, ResponseBuffer& out) {
+  out.print(F("{\"job\":"));
+  out.print(job.id);
+  if (job.result[0] == '{' && job.result[1] != '}') {
+    out.print(',');
+    out.print(job.result + 1);
+  } else {
+    out.print('}');
+  }
+}
+
+void serviceJobs() {
+  for (uint8_t i = 0; i < JOB_SLOTS; i++) {
+    Job& job = jobs[i];
+    if (job.id == 0) continue;
+
+    if (job.done) {
+      // Unclaimed results expire (wakeAt holds the completion time)
+      if (millis() - job.wakeAt > JOB_RESULT_TTL_MS) job.id = 0;
+      continue;
+    }
+    if ((long)(millis() - job.wakeAt) < 0) continue;
+
+    ResponseBuffer res(job.result, sizeof(job.result));
+    if (!job.run(job, res)) continue;
+
+    if (res.overflow()) {
+      res.clear();
+      res.error(F("ERR_RESPONSE_OVERFLOW"));
+    }
+    job.done = true;
+    job.wakeAt = millis();
+    #if RESULT_CACHE_COMMANDS > 0
+    cacheJobResult(job.id, job.result);
+    #endif
+
+    if (job.route.kind == ROUTE_LOCAL) {
+      #ifdef ENABLE_TELEMETRY
+      recordTelemetrySample(job.route.seq, job.result);
+      #endif
+      job.id = 0;
+    } else if (job.route.kind != ROUTE_NONE) {
+      ResponseBuffer out(responseStorage, sizeof(responseStorage));
+      writeJobReply(job, out);
+      pushReply(job.route, out.c_str());
+      job.id = 0;
+    }
+  }
+}
+
+// JOB|<id> - poll a job: pending ack while running, the result once done
+void handleJob(const char* params, ResponseBuffer& res) {
+  if (!params) return res.error(F("ERR_MISSING_PARAMETER"));
+
+  int id = atoi(params);
+  for (uint8_t i = 0; i < JOB_SLOTS; i++) {
+    Job& job = jobs[i];
+    if (id <= 0 || job.id != id) continue;
+
+    if (!job.done) {
+      res.print(F("{\"ok\":1,\"job\":"));
+      res.print(job.id);
+      res.print(F(",\"pending\":1}"));
+      return;
+    }
+    writeJobReply(job, res);
+    job.id = 0;
+    return;
+  }
+  res.error(F("ERR_UNKNOWN_JOB"));
+}
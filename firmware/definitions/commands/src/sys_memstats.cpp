@@ -0,0 +1,140 @@
+// === MEMORY STATISTICS ===
+// The architecture file (sys_avr.cpp, sys_esp.cpp, ...) measures the heap
+// and the stack; this file keeps the history and answers MEMSTATS:
+//
+//   {"ok":1,"free":N,"min_free":N,"largest":N,"frag":P,"stack_free":N,
+//    "cmds":N,"heap_cmds":N,"by_cmd":[{"cmd":"NAME","changes":N,"max_delta":N}]}
+//
+//   free        bytes malloc can still hand out
+//   min_free    lowest `free` since boot (or MEMSTATS|RESET)
+//   largest     largest single allocation that would succeed
+//   frag        100 - largest * 100 / free: 0 = all free memory in one block
+//   stack_free  stack bytes never used since boot
+//   cmds        commands run; heap_cmds: those that left the heap changed
+//   by_cmd      commands that did: how often, and the largest change in
+//               bytes (> 0 = memory kept, < 0 = memory released)
+//
+// A value the core cannot measure is null. Allocations a handler frees
+// again before it returns are not seen here; the host build (firmware/host)
+// counts every one. On the ESP the WiFi stack allocates concurrently, so a
+// few changes there are not the command's.
+//
+//   MEMSTATS|RESET clears the counters and the low-water mark.
+
+#if defined(__AVR__)
+  #define MEMSTATS_COMMANDS 4
+#else
+  #define MEMSTATS_COMMANDS 16
+#endif
+
+#define MEMSTATS_SAMPLE_MS 250UL
+
+struct MemCommandStats {
+  uint16_t hash;      // command name hash, 0 = free slot
+  uint16_t changes;
+  long maxDelta;
+};
+
+MemCommandStats memCommandStats[MEMSTATS_COMMANDS];
+unsigned long memCommandsRun = 0;
+unsigned long memCommandsChanged = 0;
+long memLowWater = -1;
+unsigned long memSampledAt = 0;
+
+void sampleMemStats(long freeHeap) {
+  if (freeHeap >= 0 && (memLowWater < 0 || freeHeap < memLowWater)) memLowWater = freeHeap;
+}
+
+// From loop(): cores without a low-water mark of their own are sampled
+void serviceMemStats() {
+  if (millis() - memSampledAt < MEMSTATS_SAMPLE_MS) return;
+  memSampledAt = millis();
+  sampleMemStats(memFreeHeap());
+}
+
+// runCommand() calls this after each handler with memFreeHeap() from before
+void recordCommandHeap(uint16_t h, long freeBefore) {
+  memCommandsRun++;
+  long freeAfter = memFreeHeap();
+  if (freeAfter == freeBefore) return;
+  sampleMemStats(freeAfter);
+  memCommandsChanged++;
+
+  MemCommandStats* slot = NULL;
+  for (uint8_t i = 0; i < MEMSTATS_COMMANDS; i++) {
+    if (memCommandStats[i].hash == h) {
+      slot = &memCommandStats[i];
+      break;
+    }
+    if (!slot && memCommandStats[i].hash == 0) slot = &memCommandStats[i];
+  }
+  if (!slot) return;  // table full: counted in heap_cmds only
+
+  long delta = freeBefore - freeAfter;
+  if (slot->hash != h) {
+    slot->hash = h;
+    slot->changes = 0;
+    slot->maxDelta = 0;
+  }
+  if (slot->changes < 0xFFFF) slot->changes++;
+  if (labs(delta) > labs(slot->maxDelta)) slot->maxDelta = delta;
+}
+
+void printMemValue(ResponseBuffer& res, const __FlashStringHelper* key, long value) {
+  res.print(key);
+  if (value < 0) res.print(F("null"));
+  else res.print(value);
+}
+
+// "free":N,...,"stack_free":N - also used by the discovery announcement
+void printMemStats(ResponseBuffer& res) {
+  long freeHeap = memFreeHeap();
+  long largest = memLargestBlock();
+  long minFree = memMinFreeHeap();
+  sampleMemStats(freeHeap);
+  if (minFree < 0) minFree = memLowWater;
+
+  printMemValue(res, F("\"free\":"), freeHeap);
+  printMemValue(res, F(",\"min_free\":"), minFree);
+  printMemValue(res, F(",\"largest\":"), largest);
+  long frag = -1;
+  if (freeHeap > 0 && largest >= 0) frag = 100 - constrain(largest * 100 / freeHeap, 0L, 100L);
+  printMemValue(res, F(",\"frag\":"), frag);
+  printMemValue(res, F(",\"stack_free\":"), memStackFree());
+}
+
+// MEMSTATS[|RESET]
+void handleMemStats(const char* params, ResponseBuffer& res) {
+  if (params && strcmp_P(params, PSTR("RESET")) == 0) {
+    memset(memCommandStats, 0, sizeof(memCommandStats));
+    memCommandsRun = 0;
+    memCommandsChanged = 0;
+    memLowWater = -1;
+    res.print(F("{\"ok\":1}"));
+    return;
+  }
+  if (params) return res.error(F("ERR_INVALID_VALUE"));
+
+  res.print(F("{\"ok\":1,"));
+  printMemStats(res);
+  res.print(F(",\"cmds\":"));
+  res.print(memCommandsRun);
+  res.print(F(",\"heap_cmds\":"));
+  res.print(memCommandsChanged);
+  res.print(F(",\"by_cmd\":["));
+  bool first = true;
+  for (uint8_t i = 0; i < MEMSTATS_COMMANDS; i++) {
+    const MemCommandStats& stats = memCommandStats[i];
+    if (stats.hash == 0) continue;
+    if (!first) res.print(',');
+    first = false;
+    res.print(F("{\"cmd\":\""));
+    res.print((const __FlashStringHelper*)commandName(stats.hash));
+    res.print(F("\",\"changes\":"));
+    res.print(stats.changes);
+    res.print(F(",\"max_delta\":"));
+    res.print(stats.maxDelta);
+    res.print('}');
+  }
+  res.print(F("]}"));
+}
@@ -4,13 +4,48 @@
 
 
 // === MEMORY ===
-int freeMemory() {
-  // Renesas RA4M1 specific memory check
-  // Using mallinfo if available, or a safe approximation
+// The FSP linker script gives the heap and the main stack fixed regions
+// (__HeapBase..__HeapLimit, __StackLimit..__StackTop). newlib's malloc
+// claims the heap region with sbrk(); free heap is what it holds on its free
+// lists (fordblks) plus the part of the region not claimed yet.
+extern "C" char* sbrk(int incr);
+extern char __HeapLimit;
+extern char __StackLimit;
+
+#define STACK_CANARY 0xC5
+
+long memUnclaimedHeap() {
+  return &__HeapLimit - sbrk(0);
+}
+
+long memFreeHeap() {
+  struct mallinfo mi = mallinfo();
+  return mi.fordblks + memUnclaimedHeap();
+}
+
+// newlib does not expose its largest free chunk: this is the top chunk plus
+// the unclaimed region, so a lower bound
+long memLargestBlock() {
   struct mallinfo mi = mallinfo();
-  return mi.fordblks; // Free space in heap
-  // Note: This might need adjustment depending on the specific core version,
-  // but it's standard for newlib-based ARM cores.
+  return mi.keepcost + memUnclaimedHeap();
+}
+
+long memMinFreeHeap() {
+  return -1;  // sampled by sys_memstats.cpp
+}
+
+// Fills the unused part of the stack region with a canary; memStackFree()
+// counts what has never been overwritten
+void initMemStats() {
+  char here;
+  for (char* p = &__StackLimit; p < &here - 32; p++) *p = STACK_CANARY;
+}
+
+long memStackFree() {
+  char here;
+  char* p = &__StackLimit;
+  while (p < &here && (uint8_t)*p == STACK_CANARY) p++;
+  return p - &__StackLimit;
 }
 
 // === RESET ===
@@ -21,10 +56,10 @@ void resetDevice() {
 // === NETWORK ===
 #include <WiFiS3.h>
 
-String getMacAddress() {
+void printMacAddress(Print& out) {
   byte mac[6];
   WiFi.macAddress(mac);
   char buf[20];
   sprintf(buf, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-  return String(buf);
+  out.print(buf);
 }
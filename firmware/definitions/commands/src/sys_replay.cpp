@@ -0,0 +1,101 @@
+// === REQUEST IDS ===
+// A request may carry a client-chosen id: "#<id>|CMD|params" (1..65535).
+// The reply echoes it as its first member, {"id":<id>,"ok":1,...}, so the
+// client can keep several requests in flight and match replies by id
+// instead of by arrival order. Requests without the prefix work as before.
+//
+// The last REPLAY_CACHE_SLOTS replies are kept per (sender, id). A
+// retransmission of a request whose reply was lost is answered from there
+// instead of running again, so a resent RELAY_SET does not switch twice.
+// A reply too long for a slot is not kept; its repeat answers
+// ERR_DUPLICATE_REQUEST without running. Entries expire after
+// REPLAY_CACHE_TTL_MS, long after the client has given up retrying.
+//
+// Transports that take ids add "#define ENABLE_REQUEST_IDS" to their
+// globals and call processRequest() instead of processCommand().
+
+#ifdef ENABLE_REQUEST_IDS
+
+#if defined(__AVR__)
+  #define REPLAY_CACHE_SLOTS 2
+  #define REPLAY_REPLY_SIZE 48
+#else
+  #define REPLAY_CACHE_SLOTS 8
+  #define REPLAY_REPLY_SIZE 256
+#endif
+
+#define REPLAY_CACHE_TTL_MS 30000UL
+
+struct ReplayEntry {
+  uint16_t id;               // 0 = free
+  uint8_t kind;              // sender: route kind, peer address and port
+  uint8_t ip[4];
+  uint16_t port;
+  bool kept;                 // the reply fit into `reply`
+  unsigned long storedAt;
+  char reply[REPLAY_REPLY_SIZE];
+};
+
+ReplayEntry replayCache[REPLAY_CACHE_SLOTS];
+uint8_t replayNext = 0;      // oldest slot, overwritten next
+
+int findReplay(uint16_t id, const ReplyRoute& route) {
+  for (uint8_t i = 0; i < REPLAY_CACHE_SLOTS; i++) {
+    const ReplayEntry& entry = replayCache[i];
+    if (entry.id != id || entry.kind != route.kind || entry.port != route.port) continue;
+    if (memcmp(entry.ip, route.ip, 4) != 0) continue;
+    if (millis() - entry.storedAt < REPLAY_CACHE_TTL_MS) return i;
+  }
+  return -1;
+}
+
+void storeReplay(uint16_t id, const ReplyRoute& route, const ResponseBuffer& res) {
+  ReplayEntry& entry = replayCache[replayNext];
+  replayNext = (replayNext + 1) % REPLAY_CACHE_SLOTS;
+  entry.id = id;
+  entry.kind = route.kind;
+  memcpy(entry.ip, route.ip, 4);
+  entry.port = route.port;
+  entry.storedAt = millis();
+  entry.kept = res.length() < sizeof(entry.reply);
+  if (entry.kept) memcpy(entry.reply, res.c_str(), res.length() + 1);
+}
+
+// Splices "id":<id> in after the opening brace. A reply with no room left
+// for it is replaced: without the id the client would match it to another
+// request in flight.
+void echoRequestId(uint16_t id, ResponseBuffer& res) {
+  if (res.length() == 0 || res.c_str()[0] != '{') return;
+  char field[16];
+  snprintf(field, sizeof(field), "\"id\":%u%s", id, res.length() > 2 ? "," : "");
+  if (res.insert(1, field)) return;
+  res.clear();
+  res.error(F("ERR_RESPONSE_OVERFLOW"));
+  snprintf(field, sizeof(field), "\"id\":%u,", id);
+  res.insert(1, field);
+}
+
+// processCommand() for requests that may carry an id; the sender is currentRoute
+void processRequest(char* input, ResponseBuffer& res) {
+  if (input[0] != '#') return processCommand(input, res);
+
+  char* end;
+  unsigned long id = strtoul(input + 1, &end, 10);
+  if (*end != '|' || id == 0 || id > 65535UL) return res.error(F("ERR_INVALID_REQUEST_ID"));
+
+  int slot = findReplay((uint16_t)id, currentRoute);
+  if (slot >= 0) {
+    if (replayCache[slot].kept) {
+      res.print(replayCache[slot].reply);
+    } else {
+      res.error(F("ERR_DUPLICATE_REQUEST"));
+    }
+  } else {
+    processCommand(end + 1, res);
+    if (res.length() == 0) return;  // empty line
+    storeReplay((uint16_t)id, currentRoute, res);
+  }
+  echoRequestId((uint16_t)id, res);
+}
+
+#endif
@@ -2,11 +2,19 @@
 // Fallback for unknown architectures
 
 // === MEMORY ===
-int freeMemory() {
-  return 0; // Unknown
-}
+// Unknown: MEMSTATS and INFO report null
+long memFreeHeap() { return -1; }
+long memLargestBlock() { return -1; }
+long memMinFreeHeap() { return -1; }
+long memStackFree() { return -1; }
+void initMemStats() { }
 
 // === RESET ===
 void resetDevice() {
   // No-op or soft reset attempt
 }
+
+// === NETWORK ===
+void printMacAddress(Print& out) {
+  out.print(F("00:00:00:00:00:00"));
+}
@@ -0,0 +1,91 @@
+// === UART FRAME PARSER ===
+// Frame sync for sensors that stream fixed-length frames on their own
+// (A02YYUW, JSN-SR04T in UART mode, PM2.5 sensors, ...). Frames start with a
+// header byte and end with an optional checksum over the bytes before it.
+// Fed from loop(), the parser keeps the latest good frame and when it
+// arrived, so a read only has to look at it.
+//
+// On a bad checksum it resyncs on the next header byte inside the rejected
+// bytes instead of dropping them, so a header value inside the data cannot
+// lock it out of step.
+//
+// Commands that use it add "@file:commands/src/uart_frames.cpp" to their
+// functions before their own file; the builder includes it once.
+
+#define UART_CHECKSUM_NONE 0
+#define UART_CHECKSUM_SUM  1   // low byte of the sum of all preceding bytes
+#define UART_CHECKSUM_XOR  2   // XOR of all preceding bytes
+
+#ifndef UART_FRAME_MAX
+  #define UART_FRAME_MAX 32
+#endif
+
+class UartFrameParser {
+ public:
+  // `length` counts the header and the checksum byte
+  UartFrameParser(uint8_t header, uint8_t length, uint8_t checksum)
+    : header(header), length(length > UART_FRAME_MAX ? UART_FRAME_MAX : length),
+      checksum(checksum), pos(0), valid(false), receivedAt(0), badFrames(0) { }
+
+  void reset() {
+    pos = 0;
+    valid = false;
+    badFrames = 0;
+  }
+
+  // Feeds what `stream` has buffered; returns true if a new frame arrived
+  bool poll(Stream& stream) {
+    bool fresh = false;
+    while (stream.available() > 0) {
+      if (push((uint8_t)stream.read())) fresh = true;
+    }
+    return fresh;
+  }
+
+  bool push(uint8_t b) {
+    if (pos == 0 && b != header) return false;
+    buf[pos++] = b;
+    if (pos < length) return false;
+
+    if (checksumOk()) {
+      memcpy(last, buf, length);
+      valid = true;
+      receivedAt = millis();
+      pos = 0;
+      return true;
+    }
+
+    // Resync on the next header byte inside the rejected frame
+    badFrames++;
+    uint8_t next = 1;
+    while (next < length && buf[next] != header) next++;
+    pos = length - next;
+    memmove(buf, buf + next, pos);
+    return false;
+  }
+
+  bool hasFrame() const { return valid; }
+  const uint8_t* frame() const { return last; }
+  unsigned long age() const { return millis() - receivedAt; }
+  uint16_t errors() const { return badFrames; }  // checksum failures since reset()
+
+ private:
+  bool checksumOk() const {
+    if (checksum == UART_CHECKSUM_NONE) return true;
+    uint8_t sum = 0;
+    for (uint8_t i = 0; i < length - 1; i++) {
+      sum = (checksum == UART_CHECKSUM_SUM) ? (uint8_t)(sum + buf[i]) : (uint8_t)(sum ^ buf[i]);
+    }
+    return sum == buf[length - 1];
+  }
+
+  uint8_t header;
+  uint8_t length;
+  uint8_t checksum;
+  uint8_t buf[UART_FRAME_MAX];
+  uint8_t pos;
+  uint8_t last[UART_FRAME_MAX];
+  bool valid;
+  unsigned long receivedAt;
+  uint16_t badFrames;
+};
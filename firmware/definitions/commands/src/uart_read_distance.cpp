@@ -1,68 +1,123 @@
+// UART Read Distance Handler
+//
+// The sensor streams 4-byte frames (0xFF, high, low, sum) about every
+// 100 ms. loop() feeds them through a UartFrameParser (uart_frames.cpp), so
+// a read answers from the latest good frame; only the first read after the
+// pins are set waits for one, as a job.
+//
+// Each sensor (pin pair) keeps a lease on its serial port (serial_ports.cpp)
+// and its own parser. A read on new pins takes a free sensor slot, or
+// replaces the sensor read least recently.
+
+#if defined(__AVR__)
+  #define UART_DISTANCE_SENSORS 1   // SoftwareSerial receives on one port at a time
+#else
+  #define UART_DISTANCE_SENSORS 4
+#endif
 
-// UART Read Distance Handler with EEPROM Config + Auto-Reset
-// Prevents Bus Fault on Arduino Uno R4 when pins change at runtime
+#define UART_DISTANCE_BAUD 9600
+#define UART_DISTANCE_STALE_MS 1000UL   // older frames mean the sensor stopped
+#define UART_DISTANCE_WAIT_MS 1000UL    // first frame after (re)configuring
+
+struct UartDistanceSensor {
+  int8_t port;               // serial port lease, -1 = free
+  int8_t rxPin;
+  int8_t txPin;
+  unsigned long usedAt;      // last read
+};
+
+UartDistanceSensor uartDistanceSensors[UART_DISTANCE_SENSORS];
+bool uartDistanceReady = false;
+
+#define UART_DISTANCE_PARSER UartFrameParser(0xFF, 4, UART_CHECKSUM_SUM)
+UartFrameParser distanceFrames[UART_DISTANCE_SENSORS] = {
+  UART_DISTANCE_PARSER,
+#if UART_DISTANCE_SENSORS > 1
+  UART_DISTANCE_PARSER, UART_DISTANCE_PARSER, UART_DISTANCE_PARSER,
+#endif
+};
 
-// Note: Globals (uartStream, uartSoftwareSerial, uartRxPin, uartTxPin, uartIsHardware) 
-// are provided by the command definition JSON file
+// Called from loop()
+void serviceUartDistance() {
+  if (!uartDistanceReady) return;
+  for (uint8_t i = 0; i < UART_DISTANCE_SENSORS; i++) {
+    if (uartDistanceSensors[i].port >= 0) distanceFrames[i].poll(*serialPortStream(uartDistanceSensors[i].port));
+  }
+}
 
-// EEPROM addresses for UART config (avoid conflicts with other configs)
-#define EEPROM_UART_MAGIC_ADDR 100
-#define EEPROM_UART_RX_ADDR    101
-#define EEPROM_UART_TX_ADDR    102
-#define EEPROM_UART_MAGIC_VALUE 0xAB
+// Sensor slot for these pins, leasing a port if they are new; -1 if no
+// port is free
+int uartDistanceSensor(int rxPin, int txPin) {
+  if (!uartDistanceReady) {
+    for (uint8_t i = 0; i < UART_DISTANCE_SENSORS; i++) uartDistanceSensors[i].port = -1;
+    uartDistanceReady = true;
+  }
+  int slot = -1;
+  for (uint8_t i = 0; i < UART_DISTANCE_SENSORS; i++) {
+    UartDistanceSensor& sensor = uartDistanceSensors[i];
+    if (sensor.port >= 0 && sensor.rxPin == rxPin && sensor.txPin == txPin) return i;
+    if (sensor.port < 0) slot = i;
+  }
+  if (slot < 0) {
+    slot = 0;
+    for (uint8_t i = 1; i < UART_DISTANCE_SENSORS; i++) {
+      if ((long)(uartDistanceSensors[i].usedAt - uartDistanceSensors[slot].usedAt) < 0) slot = i;
+    }
+  }
 
-#if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-  #include <EEPROM.h>
-#endif
+  UartDistanceSensor& sensor = uartDistanceSensors[slot];
+  releaseSerialPort(sensor.port);
+  sensor.port = leaseSerialPort(rxPin, txPin, UART_DISTANCE_BAUD);
+  if (sensor.port < 0) return -1;
+  sensor.rxPin = rxPin;
+  sensor.txPin = txPin;
+  distanceFrames[slot].reset();
+  return slot;
+}
 
-// Save UART config to EEPROM (R4 only)
-void saveUartConfig(int rxPin, int txPin) {
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    EEPROM.write(EEPROM_UART_MAGIC_ADDR, EEPROM_UART_MAGIC_VALUE);
-    EEPROM.write(EEPROM_UART_RX_ADDR, (uint8_t)rxPin);
-    EEPROM.write(EEPROM_UART_TX_ADDR, (uint8_t)txPin);
-  #endif
+bool uartDistanceFresh(uint8_t slot) {
+  return distanceFrames[slot].hasFrame() && distanceFrames[slot].age() < UART_DISTANCE_STALE_MS;
 }
 
-// Load UART config from EEPROM (R4 only)
-// Returns true if valid config found, fills rxPin/txPin
-bool loadUartConfig(int* rxPin, int* txPin) {
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    if (EEPROM.read(EEPROM_UART_MAGIC_ADDR) == EEPROM_UART_MAGIC_VALUE) {
-      *rxPin = EEPROM.read(EEPROM_UART_RX_ADDR);
-      *txPin = EEPROM.read(EEPROM_UART_TX_ADDR);
-      return true;
-    }
-  #endif
-  return false;
+void printUartDistance(uint8_t slot, ResponseBuffer& res) {
+  const uint8_t* frame = distanceFrames[slot].frame();
+  uint16_t distance = (frame[1] << 8) | frame[2];
+  if (distance < 30 || distance > 4500) {
+    return res.error(F("ERR_OUT_OF_RANGE"));
+  }
+
+  res.print(F("{\"ok\":1,\"distance\":"));
+  res.print(distance);
+  res.print(F(",\"age\":"));
+  res.print(distanceFrames[slot].age());
+  res.print('}');
 }
 
-// Initialize UART from saved config at boot (call from setup())
-void initUartFromEeprom() {
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    int rxPin, txPin;
-    if (loadUartConfig(&rxPin, &txPin)) {
-      if (rxPin == 0 && txPin == 1) {
-        Serial1.begin(9600);
-        uartStream = &Serial1;
-        uartIsHardware = true;
-      } else if (rxPin >= 0 && txPin >= 0 && rxPin != txPin) {
-        uartSoftwareSerial = new SoftwareSerial(rxPin, txPin);
-        if (uartSoftwareSerial) {
-          uartSoftwareSerial->begin(9600);
-          uartStream = uartSoftwareSerial;
-          uartIsHardware = false;
-        }
-      }
-      uartRxPin = rxPin;
-      uartTxPin = txPin;
-    }
-  #endif
+// Job step: waits for the first good frame. vars[0] = start time,
+// vars[1] = sensor slot, vars[2] = rx pin
+bool stepUartReadDistance(Job& job, ResponseBuffer& res) {
+  uint8_t slot = (uint8_t)job.vars[1];
+  if (uartDistanceSensors[slot].port < 0 || uartDistanceSensors[slot].rxPin != job.vars[2]) {
+    res.error(F("ERR_PORT_BUSY"));  // a read on other pins took the slot
+    return true;
+  }
+  serviceUartDistance();
+  if (uartDistanceFresh(slot)) {
+    printUartDistance(slot, res);
+    return true;
+  }
+  if (millis() - (unsigned long)job.vars[0] > UART_DISTANCE_WAIT_MS) {
+    // Bytes arrived but never a valid frame: wiring or baud problem
+    res.error(distanceFrames[slot].errors() > 0 ? F("ERR_CHECKSUM_FAILED") : F("ERR_SENSOR_TIMEOUT"));
+    return true;
+  }
+  jobSleep(job, 10);
+  return false;
 }
 
-String handleUARTReadDistance(const char* params) {
+void handleUARTReadDistance(const char* params, ResponseBuffer& res) {
   if (!params || strlen(params) < 3) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
   char paramsCopy[16];
@@ -71,130 +126,38 @@ String handleUARTReadDistance(const char* params) {
   
   char* pipePos = strchr(paramsCopy, '|');
   if (!pipePos) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_FORMAT\"}";
+    return res.error(F("ERR_INVALID_FORMAT"));
   }
 
   *pipePos = '\0';
   const char* rxPinStr = paramsCopy;
   const char* txPinStr = pipePos + 1;
 
-  int rxPin = parsePin(String(rxPinStr));
-  int txPin = parsePin(String(txPinStr));
+  int rxPin = parsePin(rxPinStr);
+  int txPin = parsePin(txPinStr);
   
   if (rxPin == -1 || txPin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
   if (rxPin == txPin) {
-    return "{\"ok\":0,\"error\":\"ERR_SAME_PIN\"}";
-  }
-
-  // === R4 EEPROM + AUTO-RESET LOGIC ===
-  #if defined(ARDUINO_UNOR4_WIFI) || defined(ARDUINO_UNOR4_MINIMA)
-    // Check if UART is already initialized with different pins
-    if (uartStream != nullptr && (rxPin != uartRxPin || txPin != uartTxPin)) {
-      // Pins changed! Save new config and trigger auto-reset
-      saveUartConfig(rxPin, txPin);
-      delay(50); // Ensure EEPROM write completes
-      
-      // Return message before reset (backend should handle this)
-      // Then reset - this line won't return
-      NVIC_SystemReset();
-      
-      // Fallback (never reached)
-      return "{\"ok\":0,\"error\":\"ERR_RESTARTING\"}";
-    }
-    
-    // First-time initialization
-    if (uartStream == nullptr) {
-      // Save config to EEPROM for future boots
-      saveUartConfig(rxPin, txPin);
-      
-      if (rxPin == 0 && txPin == 1) {
-        Serial1.begin(9600);
-        uartStream = &Serial1;
-        uartIsHardware = true;
-      } else {
-        uartSoftwareSerial = new SoftwareSerial(rxPin, txPin);
-        if (uartSoftwareSerial == nullptr) {
-          return "{\"ok\":0,\"error\":\"ERR_MEMORY\"}";
-        }
-        uartSoftwareSerial->begin(9600);
-        uartStream = uartSoftwareSerial;
-        uartIsHardware = false;
-      }
-      
-      uartRxPin = rxPin;
-      uartTxPin = txPin;
-      delay(150);
-    }
-  #else
-    // Non-R4 platforms: allow runtime pin changes (they handle it fine)
-    if (uartStream == nullptr || rxPin != uartRxPin || txPin != uartTxPin) {
-      if (uartSoftwareSerial != nullptr) {
-        delete uartSoftwareSerial;
-        uartSoftwareSerial = nullptr;
-      }
-      uartStream = nullptr;
-      
-      uartSoftwareSerial = new SoftwareSerial(rxPin, txPin);
-      if (uartSoftwareSerial == nullptr) {
-        return "{\"ok\":0,\"error\":\"ERR_MEMORY\"}";
-      }
-      uartSoftwareSerial->begin(9600);
-      uartStream = uartSoftwareSerial;
-      uartIsHardware = false;
-      
-      uartRxPin = rxPin;
-      uartTxPin = txPin;
-      delay(100);
-    }
-  #endif
-
-  // Safety check
-  if (uartStream == nullptr) {
-    return "{\"ok\":0,\"error\":\"ERR_STREAM_NULL\"}";
-  }
-
-  // Clear buffer
-  while (uartStream->available()) {
-    uartStream->read();
-  }
-
-  // Wait for sensor data
-  unsigned long startTime = millis();
-  while (uartStream->available() < 4 && (millis() - startTime) < 1000) {
-    delay(10);
-  }
-
-  if (uartStream->available() < 4) {
-    return "{\"ok\":0,\"error\":\"ERR_SENSOR_TIMEOUT\"}";
-  }
-
-  // Read frame
-  uint8_t frame[4];
-  for (int i = 0; i < 4; i++) {
-    frame[i] = uartStream->read();
+    return res.error(F("ERR_SAME_PIN"));
   }
 
-  if (frame[0] != 0xFF) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_HEADER\"}";
+  int slot = uartDistanceSensor(rxPin, txPin);
+  if (slot < 0) {
+    return res.error(F("ERR_PORT_BUSY"));
   }
+  uartDistanceSensors[slot].usedAt = millis();
 
-  uint8_t checksum = (frame[0] + frame[1] + frame[2]) & 0xFF;
-  if (checksum != frame[3]) {
-    return "{\"ok\":0,\"error\":\"ERR_CHECKSUM_FAILED\"}";
+  if (uartDistanceFresh(slot)) {
+    return printUartDistance(slot, res);
   }
 
-  uint16_t distance = (frame[1] << 8) | frame[2];
-
-  if (distance < 30 || distance > 4500) {
-    return "{\"ok\":0,\"error\":\"ERR_OUT_OF_RANGE\"}";
+  Job* job = startJob(stepUartReadDistance, res);
+  if (job) {
+    job->vars[0] = (long)millis();
+    job->vars[1] = slot;
+    job->vars[2] = rxPin;
   }
-
-  String response = "{\"ok\":1,\"distance\":";
-  response += distance;
-  response += "}";
-  
-  return response;
 }
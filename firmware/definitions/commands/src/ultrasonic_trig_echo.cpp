@@ -1,93 +1,295 @@
+// === ULTRASONIC (HC-SR04) ===
+// Sensors are pinged in the background from loop(): one ping at a time,
+// round robin over the sensors read in the last ULTRASONIC_IDLE_MS, with
+// ULTRASONIC_GAP_MS between pings so the echo of one sensor cannot reach
+// another. The echo is timed by a CHANGE interrupt on the echo pin while
+// loop() keeps running; pins without an interrupt fall back to pulseIn().
+//
+// Each sensor keeps its last `samples` pings. A read answers at once with
+// the median of the valid ones and the age of the newest, so a single stray
+// echo no longer shows up as a wrong level. Only the first read of a sensor
+// (or after a pause) waits for a full set, as a job.
+//
+//   ULTRASONIC_TRIG_ECHO|trig|echo[|samples]    samples: 1..ULTRASONIC_MAX_SAMPLES, default 5
 
+#ifndef IRAM_ATTR
+  #define IRAM_ATTR
+#endif
 
-// Robust Ultrasonic Handler - Prevents Bus Fault on Uno R4
-String handleUltrasonicTrigEcho(const char* params) {
-  // Expected params: "D2_2|D3_3" (Trig|Echo)
-  
+#if defined(__AVR__)
+  #define ULTRASONIC_SENSORS 2
+  #define ULTRASONIC_MAX_SAMPLES 9
+#else
+  #define ULTRASONIC_SENSORS 4
+  #define ULTRASONIC_MAX_SAMPLES 15
+#endif
+
+#define ULTRASONIC_DEFAULT_SAMPLES 5
+#define ULTRASONIC_GAP_MS 60UL             // between pings, any sensor
+#define ULTRASONIC_ECHO_TIMEOUT_US 30000UL // ~5 m
+#define ULTRASONIC_IDLE_MS 60000UL         // stop pinging a sensor nobody reads
+#define ULTRASONIC_STALE_MS 1000UL         // newer pings than this answer at once
+#define ULTRASONIC_MIN_US 117              // 2 cm
+#define ULTRASONIC_MAX_US 23324            // 400 cm
+
+// Ping results besides an echo time
+#define ULTRASONIC_NO_ECHO 0
+#define ULTRASONIC_OUT_OF_RANGE 0xFFFF
+
+struct UltrasonicSensor {
+  int8_t trigPin;            // -1 = free
+  int8_t echoPin;
+  uint8_t samples;           // window size
+  uint8_t head;
+  uint8_t fill;
+  uint16_t pings[ULTRASONIC_MAX_SAMPLES];  // echo time in us, or a result above
+  unsigned long pingAt;      // newest ping
+  unsigned long usedAt;      // last read
+};
+
+UltrasonicSensor ultrasonicSensors[ULTRASONIC_SENSORS];
+bool ultrasonicReady = false;
+int8_t ultrasonicCurrent = -1;   // sensor waiting for its echo
+uint8_t ultrasonicNext = 0;      // round robin position
+unsigned long ultrasonicFiredUs = 0;
+unsigned long ultrasonicLastPing = 0;
+
+// Echo edges of the current ping (written by the ISR)
+volatile int8_t ultrasonicEchoPin = -1;
+volatile uint8_t ultrasonicEdges = 0;
+volatile unsigned long ultrasonicRiseUs = 0;
+volatile unsigned long ultrasonicFallUs = 0;
+
+void IRAM_ATTR ultrasonicEchoIsr() {
+  unsigned long now = micros();
+  if (digitalRead(ultrasonicEchoPin) == HIGH) {
+    ultrasonicRiseUs = now;
+    ultrasonicEdges = 1;
+  } else if (ultrasonicEdges == 1) {
+    ultrasonicFallUs = now;
+    ultrasonicEdges = 2;
+  }
+}
+
+void initUltrasonicSensors() {
+  for (uint8_t i = 0; i < ULTRASONIC_SENSORS; i++) ultrasonicSensors[i].trigPin = -1;
+  ultrasonicReady = true;
+}
+
+void recordUltrasonicPing(uint8_t slot, unsigned long echoUs) {
+  UltrasonicSensor& sensor = ultrasonicSensors[slot];
+  uint16_t ping = echoUs;
+  if (echoUs == 0) ping = ULTRASONIC_NO_ECHO;
+  else if (echoUs < ULTRASONIC_MIN_US || echoUs > ULTRASONIC_MAX_US) ping = ULTRASONIC_OUT_OF_RANGE;
+  sensor.pings[sensor.head] = ping;
+  sensor.head = (sensor.head + 1) % sensor.samples;
+  if (sensor.fill < sensor.samples) sensor.fill++;
+  sensor.pingAt = millis();
+}
+
+// Sends the trigger pulse; the echo is collected by serviceUltrasonic()
+void fireUltrasonic(uint8_t slot) {
+  const UltrasonicSensor& sensor = ultrasonicSensors[slot];
+  digitalWrite(sensor.trigPin, LOW);
+  delayMicroseconds(2);
+  digitalWrite(sensor.trigPin, HIGH);
+  delayMicroseconds(10);
+  digitalWrite(sensor.trigPin, LOW);
+
+  int irq = digitalPinToInterrupt(sensor.echoPin);
+  if (irq < 0) {
+    // No interrupt on this pin: time the echo the old way (blocks up to 30 ms)
+    recordUltrasonicPing(slot, pulseIn(sensor.echoPin, HIGH, ULTRASONIC_ECHO_TIMEOUT_US));
+    ultrasonicLastPing = millis();
+    return;
+  }
+  ultrasonicEdges = 0;
+  ultrasonicEchoPin = sensor.echoPin;
+  ultrasonicCurrent = slot;
+  ultrasonicFiredUs = micros();
+  attachInterrupt(irq, ultrasonicEchoIsr, CHANGE);
+}
+
+// Called from loop(): collects the current echo or fires the next sensor
+void serviceUltrasonic() {
+  if (!ultrasonicReady) return;
+
+  if (ultrasonicCurrent >= 0) {
+    uint8_t edges = ultrasonicEdges;
+    // The echo starts ~0.5 ms after the trigger and lasts at most ~25 ms
+    if (edges < 2 && micros() - ultrasonicFiredUs < ULTRASONIC_ECHO_TIMEOUT_US + 1000) return;
+    detachInterrupt(digitalPinToInterrupt(ultrasonicEchoPin));
+    unsigned long echoUs = 0;
+    if (edges == 2) {
+      noInterrupts();
+      echoUs = ultrasonicFallUs - ultrasonicRiseUs;
+      interrupts();
+    }
+    recordUltrasonicPing(ultrasonicCurrent, echoUs);
+    ultrasonicCurrent = -1;
+    ultrasonicLastPing = millis();
+    return;
+  }
+
+  if (millis() - ultrasonicLastPing < ULTRASONIC_GAP_MS) return;
+  for (uint8_t n = 0; n < ULTRASONIC_SENSORS; n++) {
+    uint8_t slot = ultrasonicNext;
+    ultrasonicNext = (ultrasonicNext + 1) % ULTRASONIC_SENSORS;
+    const UltrasonicSensor& sensor = ultrasonicSensors[slot];
+    if (sensor.trigPin == -1 || millis() - sensor.usedAt > ULTRASONIC_IDLE_MS) continue;
+    fireUltrasonic(slot);
+    return;
+  }
+}
+
+// Sensor slot for these pins, claiming a free one or the one read least
+// recently. A new window size restarts the window.
+uint8_t ultrasonicSensor(int trigPin, int echoPin, uint8_t samples) {
+  if (!ultrasonicReady) initUltrasonicSensors();
+  int slot = -1;
+  for (uint8_t i = 0; i < ULTRASONIC_SENSORS; i++) {
+    UltrasonicSensor& sensor = ultrasonicSensors[i];
+    if (sensor.trigPin == trigPin && sensor.echoPin == echoPin) {
+      slot = i;
+      break;
+    }
+    if (sensor.trigPin == -1) slot = i;
+  }
+  if (slot < 0) {
+    slot = 0;
+    for (uint8_t i = 1; i < ULTRASONIC_SENSORS; i++) {
+      if ((long)(ultrasonicSensors[i].usedAt - ultrasonicSensors[slot].usedAt) < 0) slot = i;
+    }
+  }
+
+  UltrasonicSensor& sensor = ultrasonicSensors[slot];
+  bool moved = sensor.trigPin != trigPin || sensor.echoPin != echoPin;
+  if (moved && slot == ultrasonicCurrent) {
+    // Replacing the sensor being pinged: drop its ping
+    detachInterrupt(digitalPinToInterrupt(ultrasonicEchoPin));
+    ultrasonicCurrent = -1;
+  }
+  if (moved || sensor.samples != samples || millis() - sensor.usedAt > ULTRASONIC_IDLE_MS) {
+    sensor.trigPin = trigPin;
+    sensor.echoPin = echoPin;
+    sensor.samples = samples;
+    sensor.head = 0;
+    sensor.fill = 0;
+    pinMode(trigPin, OUTPUT);
+    digitalWrite(trigPin, LOW);
+    pinMode(echoPin, INPUT);
+  }
+  sensor.usedAt = millis();
+  return slot;
+}
+
+bool ultrasonicFresh(uint8_t slot) {
+  const UltrasonicSensor& sensor = ultrasonicSensors[slot];
+  return sensor.fill >= sensor.samples && millis() - sensor.pingAt < ULTRASONIC_STALE_MS;
+}
+
+// Median of the valid pings in the window; errors if fewer than half are valid
+void printUltrasonicDistance(uint8_t slot, ResponseBuffer& res) {
+  const UltrasonicSensor& sensor = ultrasonicSensors[slot];
+  uint16_t valid[ULTRASONIC_MAX_SAMPLES];
+  uint8_t count = 0;
+  uint8_t outOfRange = 0;
+  for (uint8_t i = 0; i < sensor.fill; i++) {
+    uint16_t ping = sensor.pings[i];
+    if (ping == ULTRASONIC_OUT_OF_RANGE) outOfRange++;
+    if (ping == ULTRASONIC_NO_ECHO || ping == ULTRASONIC_OUT_OF_RANGE) continue;
+    // Insertion sort while collecting
+    uint8_t j = count++;
+    while (j > 0 && valid[j - 1] > ping) {
+      valid[j] = valid[j - 1];
+      j--;
+    }
+    valid[j] = ping;
+  }
+
+  if (count == 0 || count * 2 < sensor.fill) {
+    return res.error(outOfRange * 2 >= sensor.fill - count ? F("ERR_OUT_OF_RANGE") : F("ERR_TIMEOUT"));
+  }
+
+  float echoUs = (count % 2) ? valid[count / 2] : (valid[count / 2 - 1] + valid[count / 2]) / 2.0;
+  // Speed of sound 343 m/s = 0.0343 cm/us, there and back
+  res.print(F("{\"ok\":1,\"distance\":"));
+  res.print(echoUs * 0.0343 / 2.0, 1);
+  res.print(F(",\"age\":"));
+  res.print(millis() - sensor.pingAt);
+  res.print('}');
+}
+
+// Job step: waits for a full window of pings. vars[0] = start time,
+// vars[1] = sensor slot, vars[2] = trig pin
+bool stepUltrasonic(Job& job, ResponseBuffer& res) {
+  uint8_t slot = (uint8_t)job.vars[1];
+  const UltrasonicSensor& sensor = ultrasonicSensors[slot];
+  if (sensor.trigPin != job.vars[2]) {
+    res.error(F("ERR_BUSY"));  // a read on other pins took the slot
+    return true;
+  }
+  if (ultrasonicFresh(slot)) {
+    printUltrasonicDistance(slot, res);
+    return true;
+  }
+  // Every sensor in the rotation pings once per round
+  unsigned long waitMs = (unsigned long)(sensor.samples + 1) * ULTRASONIC_GAP_MS * ULTRASONIC_SENSORS;
+  if (millis() - (unsigned long)job.vars[0] > waitMs) {
+    if (sensor.fill == 0) res.error(F("ERR_TIMEOUT"));
+    else printUltrasonicDistance(slot, res);
+    return true;
+  }
+  jobSleep(job, 10);
+  return false;
+}
+
+void handleUltrasonicTrigEcho(const char* params, ResponseBuffer& res) {
+  // Expected params: "D2_2|D3_3[|samples]" (Trig|Echo)
   if (!params) {
-    return "{\"ok\":0,\"error\":\"ERR_MISSING_PARAMETER\"}";
+    return res.error(F("ERR_MISSING_PARAMETER"));
   }
 
-  // Parse Trig Pin
   char paramsCopy[64];
   strncpy(paramsCopy, params, sizeof(paramsCopy) - 1);
   paramsCopy[sizeof(paramsCopy) - 1] = '\0';
 
   char* pipe = strchr(paramsCopy, '|');
   if (!pipe) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_FORMAT\"}";
+    return res.error(F("ERR_INVALID_FORMAT"));
   }
   *pipe = '\0';
-  
-  const char* trigPinStr = paramsCopy;
-  const char* echoPinStr = pipe + 1;
+  char* echoPinStr = pipe + 1;
+  char* samplesStr = strchr(echoPinStr, '|');
+  if (samplesStr) *samplesStr++ = '\0';
 
-  int trigPin = parsePin(String(trigPinStr));
-  int echoPin = parsePin(String(echoPinStr));
+  int trigPin = parsePin(paramsCopy);
+  int echoPin = parsePin(echoPinStr);
 
   if (trigPin == -1 || echoPin == -1) {
-    return "{\"ok\":0,\"error\":\"ERR_INVALID_PIN\"}";
+    return res.error(F("ERR_INVALID_PIN"));
   }
 
   // Validate pins are different
   if (trigPin == echoPin) {
-    return "{\"ok\":0,\"error\":\"ERR_SAME_PIN\"}";
-  }
-
-  // Configure pins with explicit cleanup
-  pinMode(trigPin, OUTPUT);
-  pinMode(echoPin, INPUT);
-  digitalWrite(trigPin, LOW);
-  
-  // Small delay to ensure pin states are stable
-  delay(2);
-
-  // --- CRITICAL SECTION: Interrupt-safe trigger pulse ---
-  // On Uno R4 (Renesas RA4M1), interrupts can corrupt pulseIn timing
-  noInterrupts();
-  
-  // Clear any residual state
-  digitalWrite(trigPin, LOW);
-  delayMicroseconds(5);
-
-  // Send 10us Trigger Pulse
-  digitalWrite(trigPin, HIGH);
-  delayMicroseconds(10);
-  digitalWrite(trigPin, LOW);
-  
-  interrupts();
-  // --- END CRITICAL SECTION ---
-
-  // Read Echo with timeout (30ms = ~5m range)
-  // Using volatile to prevent optimizer issues on R4
-  volatile long duration = pulseIn(echoPin, HIGH, 30000);
-
-  // IMPORTANT: Reset pins to safe state regardless of result
-  // This prevents interrupt handler corruption on next call
-  digitalWrite(trigPin, LOW);
-  pinMode(trigPin, INPUT);  // Release pin control
-  
-  // Small delay to let hardware settle
-  delayMicroseconds(100);
-
-  if (duration == 0) {
-    return "{\"ok\":0,\"error\":\"ERR_TIMEOUT\"}";
+    return res.error(F("ERR_SAME_PIN"));
   }
 
-  // Calculate Distance (cm)
-  // Speed of sound = 343 m/s = 0.0343 cm/us
-  // Distance = (duration * 0.0343) / 2
-  float distance = (duration * 0.0343) / 2.0;
-
-  // Sanity check - HC-SR04 range is 2-400cm
-  if (distance < 2.0 || distance > 400.0) {
-    return "{\"ok\":0,\"error\":\"ERR_OUT_OF_RANGE\"}";
+  long samples = ULTRASONIC_DEFAULT_SAMPLES;
+  if (samplesStr && *samplesStr != '\0') {
+    samples = atol(samplesStr);
+    if (samples < 1 || samples > ULTRASONIC_MAX_SAMPLES) return res.error(F("ERR_OUT_OF_RANGE"));
   }
 
-  String response = "{\"ok\":1,\"distance\":";
-  response += String(distance, 1);
-  response += "}";
+  uint8_t slot = ultrasonicSensor(trigPin, echoPin, (uint8_t)samples);
+  if (ultrasonicFresh(slot)) {
+    return printUltrasonicDistance(slot, res);
+  }
 
-  return response;
+  Job* job = startJob(stepUltrasonic, res);
+  if (job) {
+    job->vars[0] = (long)millis();
+    job->vars[1] = slot;
+    job->vars[2] = trigPin;
+  }
 }
-
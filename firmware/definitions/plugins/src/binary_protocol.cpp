@@ -0,0 +1,298 @@
+// === BINARY PROTOCOL ===
+// Optional compact framing next to the text protocol. A frame on the wire is
+//
+//   0x00 | COBS( payload | crc16_le ) | 0x00
+//
+// The leading zero can never start a text line, so transports tell the two
+// formats apart per message and answer in the format they were asked in.
+//
+//   Request payload: op_hash u16 | seq u8 | arg* (tagged values)
+//   Reply payload:   seq u8 | value (the handler's JSON reply, tagged)
+//
+// op_hash is the dispatch hash of the command name (COMMAND_HASH_SEED is
+// announced by PROTO). Arguments are re-joined as "a|b|c" and the handler
+// runs unchanged; its JSON reply is transcoded into tagged values.
+
+#define BIN_T_NULL   0x00
+#define BIN_T_I8     0x01
+#define BIN_T_I16    0x02
+#define BIN_T_I32    0x03
+#define BIN_T_F32    0x04
+#define BIN_T_STR    0x05  // u8 length + bytes
+#define BIN_T_TRUE   0x06
+#define BIN_T_FALSE  0x07
+#define BIN_T_ARRAY  0x08  // values until BIN_T_END
+#define BIN_T_OBJECT 0x09  // (u8 key length + key, value) pairs until BIN_T_END
+#define BIN_T_U32    0x0A
+#define BIN_T_END    0xFF
+
+// Decoded arguments are re-joined as text; a BATCH can exceed a single line
+#ifndef BINARY_ARGS_SIZE
+  #if defined(__AVR__)
+    #define BINARY_ARGS_SIZE COMMAND_BUFFER_SIZE
+  #else
+    #define BINARY_ARGS_SIZE 512
+  #endif
+#endif
+
+void handleProto(const char* params, ResponseBuffer& res) {
+  res.print(F("{\"ok\":1,\"proto\":\"bin\",\"ver\":"));
+  res.print(BINARY_PROTOCOL_VERSION);
+  res.print(F(",\"seed\":"));
+  res.print(COMMAND_HASH_SEED);
+  res.print('}');
+}
+
+// --- COBS ---
+
+// Decodes in place; returns the decoded length or 0 on a malformed frame.
+size_t cobsDecode(uint8_t* buf, size_t len) {
+  size_t in = 0, out = 0;
+  while (in < len) {
+    uint8_t code = buf[in++];
+    if (code == 0) return 0;
+    for (uint8_t i = 1; i < code; i++) {
+      if (in >= len) return 0;
+      buf[out++] = buf[in++];
+    }
+    if (code != 0xFF && in < len) buf[out++] = 0;
+  }
+  return out;
+}
+
+// Streams binaryReply as a complete frame (both delimiters) without a
+// second buffer: each COBS block is scanned ahead in place.
+void writeBinaryReply(Print& out) {
+  out.write((uint8_t)0);
+  size_t start = 0;
+  while (true) {
+    size_t end = start;
+    while (end < binaryReplyLen && binaryReply[end] != 0 && end - start < 254) end++;
+    out.write((uint8_t)(end - start + 1));
+    out.write(binaryReply + start, end - start);
+    if (end >= binaryReplyLen) break;
+    start = (binaryReply[end] == 0) ? end + 1 : end;
+  }
+  out.write((uint8_t)0);
+}
+
+// --- Reply encoder (JSON -> tagged values) ---
+
+bool binPut(uint8_t b) {
+  // The last two bytes stay reserved for the CRC
+  if (binaryReplyLen + 1 > sizeof(binaryReply) - 2) {
+    binaryOverflow = true;
+    return false;
+  }
+  binaryReply[binaryReplyLen++] = b;
+  return true;
+}
+
+void binPutLE(uint32_t v, uint8_t bytes) {
+  for (uint8_t i = 0; i < bytes; i++) binPut((uint8_t)(v >> (8 * i)));
+}
+
+const char* binSkipSpace(const char* p) {
+  while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+  return p;
+}
+
+// Copies a JSON string body (p points past the opening quote) as u8 length
+// + bytes. Returns the position after the closing quote, or NULL.
+const char* binPutString(const char* p) {
+  size_t lenPos = binaryReplyLen;
+  if (!binPut(0)) return NULL;
+  uint16_t n = 0;
+  while (*p && *p != '"') {
+    char c = *p++;
+    if (c == '\\') {
+      c = *p++;
+      if (c == 'n') c = '\n';
+      else if (c == 't') c = '\t';
+      else if (c == 'r') c = '\r';
+      else if (c == '\0') return NULL;
+    }
+    if (++n > 255 || !binPut((uint8_t)c)) return NULL;
+  }
+  if (*p != '"') return NULL;
+  binaryReply[lenPos] = (uint8_t)n;
+  return p + 1;
+}
+
+const char* binPutNumber(const char* p) {
+  char* end;
+  bool isFloat = false;
+  for (const char* q = p; *q && strchr("+-0123456789.eE", *q); q++) {
+    if (*q == '.' || *q == 'e' || *q == 'E') isFloat = true;
+  }
+
+  if (!isFloat) {
+    if (*p == '-') {
+      long v = strtol(p, &end, 10);
+      if (end == p) return NULL;
+      if (v >= -128) { binPut(BIN_T_I8); binPutLE((uint32_t)v, 1); }
+      else if (v >= -32768) { binPut(BIN_T_I16); binPutLE((uint32_t)v, 2); }
+      else { binPut(BIN_T_I32); binPutLE((uint32_t)v, 4); }
+    } else {
+      unsigned long v = strtoul(p, &end, 10);
+      if (end == p) return NULL;
+      if (v <= 127) { binPut(BIN_T_I8); binPutLE(v, 1); }
+      else if (v <= 32767) { binPut(BIN_T_I16); binPutLE(v, 2); }
+      else if (v <= 2147483647UL) { binPut(BIN_T_I32); binPutLE(v, 4); }
+      else { binPut(BIN_T_U32); binPutLE(v, 4); }
+    }
+    return end;
+  }
+
+  float f = (float)strtod(p, &end);
+  if (end == p) return NULL;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  binPut(BIN_T_F32);
+  binPutLE(bits, 4);
+  return end;
+}
+
+// Encodes one JSON value; returns the position after it, or NULL.
+const char* binPutValue(const char* p) {
+  p = binSkipSpace(p);
+  switch (*p) {
+    case '{':
+    case '[': {
+      bool isObject = (*p == '{');
+      char close = isObject ? '}' : ']';
+      binPut(isObject ? BIN_T_OBJECT : BIN_T_ARRAY);
+      p = binSkipSpace(p + 1);
+      if (*p == close) { binPut(BIN_T_END); return p + 1; }
+      while (true) {
+        if (isObject) {
+          if (*p != '"') return NULL;
+          p = binPutString(p + 1);
+          if (!p) return NULL;
+          p = binSkipSpace(p);
+          if (*p != ':') return NULL;
+          p++;
+        }
+        p = binPutValue(p);
+        if (!p) return NULL;
+        p = binSkipSpace(p);
+        if (*p == ',') { p = binSkipSpace(p + 1); continue; }
+        if (*p != close) return NULL;
+        binPut(BIN_T_END);
+        return p + 1;
+      }
+    }
+    case '"':
+      binPut(BIN_T_STR);
+      return binPutString(p + 1);
+    case 't':
+      binPut(BIN_T_TRUE);
+      return strncmp(p, "true", 4) == 0 ? p + 4 : NULL;
+    case 'f':
+      binPut(BIN_T_FALSE);
+      return strncmp(p, "false", 5) == 0 ? p + 5 : NULL;
+    case 'n':
+      binPut(BIN_T_NULL);
+      return strncmp(p, "null", 4) == 0 ? p + 4 : NULL;
+    default:
+      return binPutNumber(p);
+  }
+}
+
+void encodeBinaryReply(uint8_t seq, const char* json) {
+  binaryReplyLen = 0;
+  binaryOverflow = false;
+  binPut(seq);
+  if (!binPutValue(json) || binaryOverflow) {
+    binaryReplyLen = 0;
+    binaryOverflow = false;
+    binPut(seq);
+    binPutValue("{\"ok\":0,\"error\":\"ERR_BINARY_ENCODE\"}");
+  }
+  uint16_t crc = calculateModbusCRC16(binaryReply, binaryReplyLen);
+  binaryReply[binaryReplyLen++] = (uint8_t)crc;
+  binaryReply[binaryReplyLen++] = (uint8_t)(crc >> 8);
+}
+
+// --- Request decoder ---
+
+uint32_t binReadLE(const uint8_t* p, uint8_t bytes) {
+  uint32_t v = 0;
+  for (uint8_t i = 0; i < bytes; i++) v |= (uint32_t)p[i] << (8 * i);
+  return v;
+}
+
+// Re-joins tagged arguments as "a|b|c" text. Returns the number of
+// arguments, or -1 if they are malformed or do not fit.
+int decodeBinaryArgs(const uint8_t* p, size_t len, char* out, size_t outSize) {
+  ResponseBuffer text(out, outSize);
+  const uint8_t* end = p + len;
+  int count = 0;
+  while (p < end) {
+    if (count++ > 0) text.print('|');
+    uint8_t tag = *p++;
+    uint16_t size = 0;
+    switch (tag) {
+      case BIN_T_I8:  size = 1; break;
+      case BIN_T_I16: size = 2; break;
+      case BIN_T_I32:
+      case BIN_T_U32:
+      case BIN_T_F32: size = 4; break;
+      case BIN_T_STR: size = (p < end) ? *p + 1 : 1; break;
+      case BIN_T_NULL:
+      case BIN_T_TRUE:
+      case BIN_T_FALSE: break;
+      default: return -1;
+    }
+    if ((size_t)(end - p) < size) return -1;
+
+    switch (tag) {
+      case BIN_T_I8:  text.print((int)(int8_t)p[0]); break;
+      case BIN_T_I16: text.print((int)(int16_t)binReadLE(p, 2)); break;
+      case BIN_T_I32: text.print((long)(int32_t)binReadLE(p, 4)); break;
+      case BIN_T_U32: text.print((unsigned long)binReadLE(p, 4)); break;
+      case BIN_T_F32: {
+        uint32_t bits = binReadLE(p, 4);
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        text.print(f, 4);
+        break;
+      }
+      case BIN_T_STR:   text.write(p + 1, p[0]); break;
+      case BIN_T_TRUE:  text.print('1'); break;
+      case BIN_T_FALSE: text.print('0'); break;
+      default: break;
+    }
+    p += size;
+  }
+  return text.overflow() ? -1 : count;
+}
+
+// Decodes, checks and executes one frame (delimiters stripped; a trailing
+// zero is tolerated). The handler's JSON reply is left in `res` and
+// currentRoute carries the sequence number for encodeBinaryReply(). Corrupt
+// frames are dropped without a reply because their sequence number cannot
+// be trusted.
+bool runBinaryFrame(uint8_t* frame, size_t len, ResponseBuffer& res) {
+  if (len > 0 && frame[len - 1] == 0) len--;
+  len = cobsDecode(frame, len);
+  if (len < 5) return false;
+
+  len -= 2;
+  uint16_t crc = (uint16_t)binReadLE(frame + len, 2);
+  if (calculateModbusCRC16(frame, len) != crc) return false;
+
+  uint16_t op = (uint16_t)binReadLE(frame, 2);
+  currentRoute.binary = true;  // the dispatcher has set the route kind
+  currentRoute.seq = frame[2];
+
+  char params[BINARY_ARGS_SIZE];
+  int argc = decodeBinaryArgs(frame + 3, len - 3, params, sizeof(params));
+
+  if (argc < 0) {
+    res.error(F("ERR_BINARY_ARGS"));
+  } else if (!dispatchHashedCommand(op, argc > 0 ? params : NULL, res)) {
+    res.error(F("ERR_INVALID_COMMAND"));
+  }
+  return true;
+}
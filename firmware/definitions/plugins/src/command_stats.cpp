@@ -0,0 +1,211 @@
+// === COMMAND STATS ===
+// Times every command handler (runCommand) and the loop, so a slow reply can
+// be traced to the handler, to other work in the loop, or to the network:
+//
+//   {"ok":1,"loops":N,"loop_us":[min,avg,max],
+//    "sections":{"wifi_native":[avg,max],...,"system_commands":[avg,max]},
+//    "bucket_us":[16,64,...],
+//    "cmds":{"PING":{"n":N,"avg":us,"max":us,"hist":[...]},...},"more":K}
+//
+// loop_us is the period of loop(); each section is one definition's loop
+// block (LOOP_SECTION_END, FirmwareBuilder). With the dual_core plugin,
+// loop_us covers the network loop only. hist[i] counts the calls that
+// took less than bucket_us[i]; the last bucket takes the rest. Averages are
+// decaying: once a sum would overflow, the older half of it is dropped.
+// Replies served from the result cache do not run the handler and are not
+// counted.
+//
+// The reply stops adding commands when the buffer is nearly full and says
+// "more":K; STATS|K lists the rest (commands only). STATS|RESET clears
+// everything.
+
+#if defined(__AVR__)
+  #define STATS_COMMANDS 4
+  #define STATS_BUCKETS 8
+  #define STATS_BUCKET_SHIFT 2      // bucket bounds grow x4: 16 us .. 65 ms
+  typedef uint16_t StatsCount;
+#else
+  #define STATS_COMMANDS 32
+  #define STATS_BUCKETS 16
+  #define STATS_BUCKET_SHIFT 1      // x2: 16 us .. 262 ms
+  typedef uint32_t StatsCount;
+#endif
+
+#define STATS_BUCKET_BASE_US 16UL
+#define STATS_ENTRY_SIZE (90 + STATS_BUCKETS * (sizeof(StatsCount) == 2 ? 6 : 11))
+
+struct StatsTimer {
+  unsigned long n;
+  unsigned long sum;     // of the last `weight` samples
+  unsigned long weight;
+  unsigned long minUs;
+  unsigned long maxUs;
+
+  void add(unsigned long us) {
+    if (sum + us < sum) {
+      sum >>= 1;
+      weight >>= 1;
+    }
+    sum += us;
+    weight++;
+    if (n == 0 || us < minUs) minUs = us;
+    if (us > maxUs) maxUs = us;
+    n++;
+  }
+
+  unsigned long avg() const { return weight ? sum / weight : 0; }
+};
+
+struct CommandStats {
+  uint16_t hash;
+  StatsTimer time;       // time.n == 0: free slot
+  StatsCount hist[STATS_BUCKETS];
+};
+
+CommandStats commandStats[STATS_COMMANDS];
+StatsTimer loopStats;
+StatsTimer sectionStats[LOOP_SECTIONS > 0 ? LOOP_SECTIONS : 1];
+unsigned long loopStartUs = 0;
+unsigned long sectionStartUs = 0;
+bool loopStarted = false;
+
+// LOOP_PERIOD_START(): top of every loop() pass
+void profileLoopStart() {
+  unsigned long now = micros();
+  if (loopStarted) loopStats.add(now - loopStartUs);
+  loopStarted = true;
+  loopStartUs = now;
+  sectionStartUs = now;
+}
+
+// LOOP_SECTION_END(n): the section ran since the previous mark
+void profileLoopSection(uint8_t section) {
+  unsigned long now = micros();
+  sectionStats[section].add(now - sectionStartUs);
+  sectionStartUs = now;
+}
+
+// dual_core: acquisition sections are timed from the start of their pass
+unsigned long acquisitionStartUs = 0;
+
+void profileAcquisitionStart() {
+  acquisitionStartUs = micros();
+}
+
+void profileAcquisitionSection(uint8_t section) {
+  unsigned long now = micros();
+  sectionStats[section].add(now - acquisitionStartUs);
+  acquisitionStartUs = now;
+}
+
+// runCommand(): one handler call of `us` microseconds
+void recordCommandTime(uint16_t h, unsigned long us) {
+  CommandStats* slot = NULL;
+  for (uint8_t i = 0; i < STATS_COMMANDS; i++) {
+    if (commandStats[i].time.n == 0) {
+      if (!slot) slot = &commandStats[i];
+      break;  // slots fill in order: h has none yet
+    }
+    if (commandStats[i].hash == h) {
+      slot = &commandStats[i];
+      break;
+    }
+  }
+  if (!slot) return;  // table full
+
+  slot->hash = h;
+  slot->time.add(us);
+  uint8_t bucket = 0;
+  unsigned long bound = STATS_BUCKET_BASE_US;
+  while (bucket < STATS_BUCKETS - 1 && us >= bound) {
+    bound <<= STATS_BUCKET_SHIFT;
+    bucket++;
+  }
+  if (slot->hist[bucket] != (StatsCount)-1) slot->hist[bucket]++;
+}
+
+void resetCommandStats() {
+  memset(commandStats, 0, sizeof(commandStats));
+  memset(&loopStats, 0, sizeof(loopStats));
+  memset(sectionStats, 0, sizeof(sectionStats));
+  loopStarted = false;
+}
+
+void printStatsLoop(ResponseBuffer& res) {
+  res.print(F("\"loops\":"));
+  res.print(loopStats.n);
+  res.print(F(",\"loop_us\":["));
+  res.print(loopStats.minUs);
+  res.print(',');
+  res.print(loopStats.avg());
+  res.print(',');
+  res.print(loopStats.maxUs);
+  res.print(F("],\"sections\":{"));
+  for (uint8_t i = 0; i < LOOP_SECTIONS; i++) {
+    if (i > 0) res.print(',');
+    res.print('"');
+    printLoopSectionName(res, i);
+    res.print(F("\":["));
+    res.print(sectionStats[i].avg());
+    res.print(',');
+    res.print(sectionStats[i].maxUs);
+    res.print(']');
+  }
+  res.print(F("},\"bucket_us\":["));
+  unsigned long bound = STATS_BUCKET_BASE_US;
+  for (uint8_t i = 0; i < STATS_BUCKETS - 1; i++) {
+    if (i > 0) res.print(',');
+    res.print(bound);
+    bound <<= STATS_BUCKET_SHIFT;
+  }
+  res.print(F("],"));
+}
+
+// STATS[|K|RESET]
+void handleStats(const char* params, ResponseBuffer& res) {
+  uint8_t from = 0;
+  if (params) {
+    if (strcmp_P(params, PSTR("RESET")) == 0 || strcmp_P(params, PSTR("reset")) == 0) {
+      resetCommandStats();
+      res.print(F("{\"ok\":1}"));
+      return;
+    }
+    char* end;
+    long value = strtol(params, &end, 10);
+    if (end == params || *end != '\0' || value < 0 || value >= STATS_COMMANDS) {
+      return res.error(F("ERR_INVALID_VALUE"));
+    }
+    from = (uint8_t)value;
+  }
+
+  res.print(F("{\"ok\":1,"));
+  if (!params) printStatsLoop(res);
+  res.print(F("\"cmds\":{"));
+  uint8_t i = from;
+  for (; i < STATS_COMMANDS && commandStats[i].time.n > 0; i++) {
+    // Room for this entry plus },"more":K}
+    if (res.capacity() - res.length() < STATS_ENTRY_SIZE + 16) break;
+    const CommandStats& stats = commandStats[i];
+    if (i > from) res.print(',');
+    res.print('"');
+    res.print((const __FlashStringHelper*)commandName(stats.hash));
+    res.print(F("\":{\"n\":"));
+    res.print(stats.time.n);
+    res.print(F(",\"avg\":"));
+    res.print(stats.time.avg());
+    res.print(F(",\"max\":"));
+    res.print(stats.time.maxUs);
+    res.print(F(",\"hist\":["));
+    for (uint8_t b = 0; b < STATS_BUCKETS; b++) {
+      if (b > 0) res.print(',');
+      res.print(stats.hist[b]);
+    }
+    res.print(F("]}"));
+  }
+  res.print('}');
+  if (i < STATS_COMMANDS && commandStats[i].time.n > 0) {
+    res.print(F(",\"more\":"));
+    res.print(i);
+  }
+  res.print('}');
+}
@@ -0,0 +1,163 @@
+// === DUAL-CORE SPLIT ===
+// The ESP32 has two cores and the Arduino loop task runs on core 1. With
+// this plugin loop() keeps the transport polling only (the transport, the
+// network_loop blocks: mDNS, OTA, Telnet, WiFi failover) and everything else
+// runs on the acquisition task, pinned to core 0:
+//
+//   core 1  loop()            reads input, queues it, sends the replies
+//   core 0  acquisitionPass() runs the commands, the jobs and the sensor
+//                             sampling (the loop blocks, FirmwareBuilder)
+//
+// The WiFi driver and lwIP tasks also run on core 0, at a higher priority
+// than the acquisition task, so what is isolated is loop(): a slow handler
+// or a long burst no longer holds up reading input and sending replies, and
+// a blocking reconnect or OTA check in loop() no longer stalls sampling.
+// A handler that blocks for seconds keeps IDLE0 from running, which the
+// default task watchdog checks, so it can trip even without watchdog_timer.
+//
+// The two tasks share no lock: a request is copied into coreRequests, its
+// reply (exactly one entry per request, empty if there is nothing to send)
+// into coreReplies, and deferred replies (pushReply) take the same queue.
+// With coreRequests full a stream source keeps its line until the next pass
+// and a datagram is dropped (counted); with coreReplies full the acquisition
+// task waits for loop().
+//
+//   CORES  {"ok":1,"acq_core":0,"requests":N,"in_flight":N,"dropped":N,"reply_waits":N}
+//
+// Handlers run on the acquisition task, so one that drives the network
+// itself (WiFi.begin(), a socket) races with loop(). With watchdog_timer the
+// acquisition task is watched too and keeps its own stall breadcrumb.
+//
+// On the host a task is a thread that runs in lockstep with loop() (see
+// firmware/host/include/freertos/task.h).
+
+#ifndef ACQUISITION_CORE
+  #define ACQUISITION_CORE 0         // with the WiFi stack; loop() runs on core 1
+#endif
+#define ACQUISITION_STACK_SIZE 8192  // bytes: handlers run here
+#define ACQUISITION_PRIORITY 1       // as the loop task
+#define CORE_REQUEST_SIZE 512        // longer messages answer ERR_COMMAND_TOO_LONG
+#define CORE_REQUEST_SLOTS 4
+#define CORE_REPLY_SLOTS 4
+
+struct CoreRequest {
+  ReplyRoute route;
+  uint16_t len;
+  bool binary;
+  bool overflow;
+  char msg[CORE_REQUEST_SIZE];
+};
+
+struct CoreReply {
+  ReplyRoute route;
+  bool answer;       // the reply to a queued request (else a pushed one)
+  char json[RESPONSE_BUFFER_SIZE];
+};
+
+SpscQueue<CoreRequest, CORE_REQUEST_SLOTS> coreRequests;  // loop -> acquisition
+SpscQueue<CoreReply, CORE_REPLY_SLOTS> coreReplies;       // acquisition -> loop
+TaskHandle_t acquisitionTaskHandle = NULL;
+
+// Written by the loop task
+std::atomic<uint32_t> coreQueued{0};
+std::atomic<uint32_t> coreAnswered{0};
+std::atomic<uint32_t> coreDropped{0};
+// Written by the acquisition task
+std::atomic<uint32_t> coreReplyWaits{0};
+
+// dispatchInput(): copies the source's message for the acquisition task;
+// false if the queue is full
+bool queueInput(InputSource& source) {
+  CoreRequest* req = coreRequests.claim();
+  if (!req) {
+    if (!source.stream) coreDropped++;
+    return false;
+  }
+  req->route = source.route;
+  req->binary = source.binary();
+  req->overflow = source.overflow() || source.length() >= sizeof(req->msg);
+  req->len = req->overflow ? 0 : source.length();
+  memcpy(req->msg, source.line(), req->len);
+  req->msg[req->len] = '\0';
+  coreRequests.push();
+  coreQueued++;
+  if (acquisitionTaskHandle) xTaskNotifyGive(acquisitionTaskHandle);
+  return true;
+}
+
+// Acquisition task: a reply for loop() to send, waiting while the queue is full
+void queueReply(const ReplyRoute& route, const char* json, bool answer) {
+  CoreReply* reply;
+  while (!(reply = coreReplies.claim())) {
+    coreReplyWaits++;
+    #ifdef ENABLE_STALL_WATCH
+    touchTask();
+    #endif
+    vTaskDelay(1);
+  }
+  reply->route = route;
+  reply->answer = answer;
+  strncpy(reply->json, json, sizeof(reply->json) - 1);
+  reply->json[sizeof(reply->json) - 1] = '\0';
+  coreReplies.push();
+}
+
+// From acquisitionPass(): runs the queued requests
+void serviceCoreRequests() {
+  while (CoreRequest* req = coreRequests.front()) {
+    ResponseBuffer res(responseStorage, sizeof(responseStorage));
+    bool hasReply = runInput(req->route, req->msg, req->len, req->binary, req->overflow, res);
+    queueReply(currentRoute, hasReply ? res.c_str() : "", true);
+    coreRequests.pop();
+  }
+}
+
+// From loop(): sends what the acquisition task has queued
+void serviceCoreReplies() {
+  while (CoreReply* reply = coreReplies.front()) {
+    if (reply->json[0]) sendToRoute(reply->route, reply->json);
+    if (reply->answer) coreAnswered++;
+    coreReplies.pop();
+  }
+}
+
+// Loop task: requests queued whose reply has not been sent yet
+uint32_t coreRequestsInFlight() {
+  return coreQueued - coreAnswered;
+}
+
+bool onAcquisitionTask() {
+  return acquisitionTaskHandle && xTaskGetCurrentTaskHandle() == acquisitionTaskHandle;
+}
+
+void acquisitionTask(void* arg) {
+  acquisitionTaskHandle = xTaskGetCurrentTaskHandle();  // may run before the creator stores it
+  #if defined(ENABLE_STALL_WATCH) && defined(ESP32)
+  esp_task_wdt_add(NULL);  // fed at its own task boundaries
+  #endif
+  for (;;) {
+    acquisitionPass();
+    // Back at once when a request is queued, else after a tick
+    ulTaskNotifyTake(pdTRUE, 1);
+  }
+}
+
+// From setup(), after every definition's setup code
+void startAcquisitionTask() {
+  xTaskCreatePinnedToCore(acquisitionTask, "acquisition", ACQUISITION_STACK_SIZE, NULL,
+                          ACQUISITION_PRIORITY, &acquisitionTaskHandle, ACQUISITION_CORE);
+}
+
+void handleCores(const char* params, ResponseBuffer& res) {
+  res.print(F("{\"ok\":1,\"acq_core\":"));
+  res.print((int)xPortGetCoreID());
+  res.print(F(",\"requests\":"));
+  res.print((unsigned long)coreQueued);
+  res.print(F(",\"in_flight\":"));
+  res.print((unsigned long)(coreQueued - coreAnswered));
+  res.print(F(",\"dropped\":"));
+  res.print((unsigned long)coreDropped);
+  res.print(F(",\"reply_waits\":"));
+  res.print((unsigned long)coreReplyWaits);
+  res.print('}');
+}
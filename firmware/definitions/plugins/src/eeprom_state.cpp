@@ -0,0 +1,30 @@
+// === OUTPUT STATE PERSISTENCE ===
+// DIGITAL_WRITE and RELAY_SET record the level of each output pin in one
+// config store record (sys_config.cpp): a mask of the pins written and
+// their levels. The store commits it a few seconds after the last change,
+// so switching a relay does not wait for an EEPROM or flash write.
+// restoreState() drives every recorded pin back to its level at boot.
+
+#define CONFIG_OUTPUT_PINS 40
+#define CONFIG_OUTPUT_BYTES (CONFIG_OUTPUT_PINS / 8)
+
+// record: mask[CONFIG_OUTPUT_BYTES], levels[CONFIG_OUTPUT_BYTES]
+uint8_t outputState[CONFIG_OUTPUT_BYTES * 2];
+
+void saveState(int pin, int state) {
+  if (pin < 0 || pin >= CONFIG_OUTPUT_PINS) return;
+  uint8_t bit = 1 << (pin % 8);
+  outputState[pin / 8] |= bit;
+  if (state) outputState[CONFIG_OUTPUT_BYTES + pin / 8] |= bit;
+  else outputState[CONFIG_OUTPUT_BYTES + pin / 8] &= ~bit;
+  configSet(CONFIG_OUTPUTS, 0, outputState, sizeof(outputState));
+}
+
+void restoreState() {
+  if (!configGet(CONFIG_OUTPUTS, 0, outputState, sizeof(outputState))) return;
+  for (uint8_t pin = 0; pin < CONFIG_OUTPUT_PINS; pin++) {
+    if (!(outputState[pin / 8] & (1 << (pin % 8)))) continue;
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, (outputState[CONFIG_OUTPUT_BYTES + pin / 8] >> (pin % 8)) & 1);
+  }
+}
@@ -0,0 +1,294 @@
+// === TELEMETRY SAMPLER ===
+// SUBSCRIBE|cmd|params|period_ms runs an ordinary command on a schedule and
+// keeps its replies in a ring buffer. serviceTelemetry() pushes them in
+// batches to the route of the most recent SUBSCRIBE:
+//
+//   {"type":"TELEMETRY","dropped":0,"samples":[{"sub":1,"age":120,"data":{...}},...]}
+//
+// "age" is how many ms before the push the sample was taken, so the receiver
+// needs no clock sync. Commands that start a job are sampled through a
+// ROUTE_LOCAL job and recorded when the job finishes. A full ring overwrites
+// the oldest samples and counts them in "dropped". A subscriber on a route
+// that cannot be pushed to (ROUTE_NONE) polls with TELEMETRY instead.
+//
+// Subscriptions live in RAM; the client re-subscribes after a reset.
+// Subscribing the same command again only updates its period.
+
+#ifndef TELEMETRY_SUBS
+  #if defined(__AVR__)
+    #define TELEMETRY_SUBS 4
+  #else
+    #define TELEMETRY_SUBS 16
+  #endif
+#endif
+
+#ifndef TELEMETRY_COMMAND_SIZE
+  #if defined(__AVR__)
+    #define TELEMETRY_COMMAND_SIZE 32
+  #else
+    #define TELEMETRY_COMMAND_SIZE COMMAND_BUFFER_SIZE
+  #endif
+#endif
+
+#ifndef TELEMETRY_RING_SIZE
+  #if defined(__AVR__)
+    #define TELEMETRY_RING_SIZE 192
+  #else
+    #define TELEMETRY_RING_SIZE 2048
+  #endif
+#endif
+
+// Longest stored reply; it must fit a batch together with the envelope
+#if defined(__AVR__)
+  #define TELEMETRY_MAX_SAMPLE 96
+#else
+  #define TELEMETRY_MAX_SAMPLE 255
+#endif
+
+#define TELEMETRY_MIN_PERIOD_MS 100UL
+#define TELEMETRY_MAX_PERIOD_MS 86400000UL  // one day
+#define TELEMETRY_RECORD_HEADER 6    // sub id u8 | millis u32 | length u8
+#define TELEMETRY_ITEM_OVERHEAD 40   // {"sub":N,"age":N,"data":...}, plus "]}"
+
+struct TelemetrySub {
+  uint8_t id;                 // 0 = free slot
+  bool pending;               // a sampled job has not finished yet
+  unsigned long period;
+  unsigned long nextAt;
+  char command[TELEMETRY_COMMAND_SIZE];  // "CMD|params"
+};
+
+TelemetrySub telemetrySubs[TELEMETRY_SUBS];
+uint8_t lastTelemetryId = 0;
+uint8_t telemetryNext = 0;    // round-robin position
+ReplyRoute telemetryRoute = { ROUTE_NONE, false, 0, { 0, 0, 0, 0 }, 0 };
+
+uint8_t telemetryRing[TELEMETRY_RING_SIZE];
+uint16_t telemetryTail = 0;   // oldest record
+uint16_t telemetryUsed = 0;
+uint16_t telemetryDropped = 0;
+
+// --- Ring buffer ---
+
+uint8_t telemetryRingAt(uint16_t offset) {
+  return telemetryRing[(telemetryTail + offset) % TELEMETRY_RING_SIZE];
+}
+
+unsigned long telemetryOldestTime() {
+  unsigned long t = 0;
+  for (uint8_t i = 0; i < 4; i++) t |= (unsigned long)telemetryRingAt(1 + i) << (8 * i);
+  return t;
+}
+
+void telemetryDropOldest() {
+  uint16_t size = TELEMETRY_RECORD_HEADER + telemetryRingAt(5);
+  telemetryTail = (telemetryTail + size) % TELEMETRY_RING_SIZE;
+  telemetryUsed -= size;
+}
+
+void telemetryRingPut(uint8_t b) {
+  telemetryRing[(telemetryTail + telemetryUsed) % TELEMETRY_RING_SIZE] = b;
+  telemetryUsed++;
+}
+
+// Stores one reply. Also the completion path of sampled jobs (serviceJobs).
+void recordTelemetrySample(uint8_t subId, const char* json) {
+  bool known = false;
+  for (uint8_t i = 0; i < TELEMETRY_SUBS; i++) {
+    if (telemetrySubs[i].id != subId) continue;
+    telemetrySubs[i].pending = false;
+    known = true;
+  }
+  if (!known) return;  // unsubscribed while its job was running
+
+  char tooLarge[40];
+  size_t len = strlen(json);
+  if (len > TELEMETRY_MAX_SAMPLE) {
+    strcpy_P(tooLarge, PSTR("{\"ok\":0,\"error\":\"ERR_SAMPLE_TOO_LARGE\"}"));
+    json = tooLarge;
+    len = strlen(json);
+  }
+
+  while ((uint16_t)(TELEMETRY_RING_SIZE - telemetryUsed) < TELEMETRY_RECORD_HEADER + len) {
+    telemetryDropOldest();
+    if (telemetryDropped < 0xFFFF) telemetryDropped++;
+  }
+
+  unsigned long now = millis();
+  telemetryRingPut(subId);
+  for (uint8_t i = 0; i < 4; i++) telemetryRingPut((uint8_t)(now >> (8 * i)));
+  telemetryRingPut((uint8_t)len);
+  for (size_t i = 0; i < len; i++) telemetryRingPut((uint8_t)json[i]);
+}
+
+// Moves as many samples as fit from the ring into `out`.
+void writeTelemetryBatch(ResponseBuffer& out, bool asReply) {
+  unsigned long now = millis();
+  out.print(asReply ? F("{\"ok\":1,\"type\":\"TELEMETRY\",\"dropped\":") : F("{\"type\":\"TELEMETRY\",\"dropped\":"));
+  out.print(telemetryDropped);
+  out.print(F(",\"samples\":["));
+  telemetryDropped = 0;
+
+  bool first = true;
+  while (telemetryUsed > 0) {
+    uint8_t len = telemetryRingAt(5);
+    if (out.length() + len + TELEMETRY_ITEM_OVERHEAD >= out.capacity()) break;
+
+    if (!first) out.print(',');
+    first = false;
+    out.print(F("{\"sub\":"));
+    out.print(telemetryRingAt(0));
+    out.print(F(",\"age\":"));
+    out.print(now - telemetryOldestTime());
+    out.print(F(",\"data\":"));
+
+    // The record body may wrap around the end of the ring
+    uint16_t start = (telemetryTail + TELEMETRY_RECORD_HEADER) % TELEMETRY_RING_SIZE;
+    uint16_t firstPart = min((uint16_t)len, (uint16_t)(TELEMETRY_RING_SIZE - start));
+    out.write(telemetryRing + start, firstPart);
+    out.write(telemetryRing, len - firstPart);
+    out.print('}');
+
+    telemetryDropOldest();
+  }
+  out.print(F("]}"));
+}
+
+// --- Sampler ---
+
+void runTelemetrySample(uint8_t slot) {
+  TelemetrySub& sub = telemetrySubs[slot];
+  char line[TELEMETRY_COMMAND_SIZE];
+  strcpy(line, sub.command);
+
+  // Jobs started by the command report back through recordTelemetrySample()
+  ReplyRoute saved = currentRoute;
+  currentRoute.kind = ROUTE_LOCAL;
+  currentRoute.binary = false;
+  currentRoute.seq = sub.id;
+
+  ResponseBuffer res(responseStorage, sizeof(responseStorage));
+  processCommand(line, res);
+  currentRoute = saved;
+
+  if (strncmp_P(res.c_str(), PSTR("{\"ok\":1,\"job\":"), 14) == 0) {
+    sub.pending = true;
+    return;
+  }
+  recordTelemetrySample(sub.id, res.c_str());
+}
+
+void serviceTelemetry() {
+  unsigned long now = millis();
+
+  // At most one sample per pass keeps loop() latency flat
+  for (uint8_t n = 0; n < TELEMETRY_SUBS; n++) {
+    uint8_t slot = telemetryNext;
+    telemetryNext = (telemetryNext + 1) % TELEMETRY_SUBS;
+
+    TelemetrySub& sub = telemetrySubs[slot];
+    if (sub.id == 0 || sub.pending || (long)(now - sub.nextAt) < 0) continue;
+
+    // Keep the phase; after a stall restart from now instead of bursting
+    sub.nextAt += sub.period;
+    if ((long)(now - sub.nextAt) >= 0) sub.nextAt = now + sub.period;
+
+    runTelemetrySample(slot);
+    break;
+  }
+
+  if (telemetryUsed == 0 || telemetryRoute.kind == ROUTE_NONE) return;
+  if (millis() - telemetryOldestTime() < TELEMETRY_FLUSH_MS && telemetryUsed < TELEMETRY_RING_SIZE / 2) return;
+
+  ResponseBuffer out(responseStorage, sizeof(responseStorage));
+  writeTelemetryBatch(out, false);
+  pushReply(telemetryRoute, out.c_str());
+}
+
+// --- Commands ---
+
+bool isTelemetryCommand(const char* cmd, size_t len) {
+  return (len == 9 && strncmp_P(cmd, PSTR("SUBSCRIBE"), 9) == 0) ||
+         (len == 11 && strncmp_P(cmd, PSTR("UNSUBSCRIBE"), 11) == 0) ||
+         (len == 9 && strncmp_P(cmd, PSTR("TELEMETRY"), 9) == 0);
+}
+
+// SUBSCRIBE|<cmd>[|params...]|<period_ms> -> {"ok":1,"sub":N}
+void handleSubscribe(const char* params, ResponseBuffer& res) {
+  if (!params) return res.error(F("ERR_MISSING_PARAMETER"));
+
+  const char* lastBar = strrchr(params, '|');
+  if (!lastBar || lastBar == params) return res.error(F("ERR_MISSING_PARAMETER"));
+
+  long period = atol(lastBar + 1);
+  if (period < (long)TELEMETRY_MIN_PERIOD_MS || period > (long)TELEMETRY_MAX_PERIOD_MS) return res.error(F("ERR_INVALID_VALUE"));
+
+  size_t cmdLen = lastBar - params;
+  if (cmdLen >= TELEMETRY_COMMAND_SIZE) return res.error(F("ERR_COMMAND_TOO_LONG"));
+
+  const char* nameEnd = strchr(params, '|');
+  if (isTelemetryCommand(params, nameEnd - params)) return res.error(F("ERR_INVALID_COMMAND"));
+
+  int8_t freeSlot = -1;
+  int8_t slot = -1;
+  for (uint8_t i = 0; i < TELEMETRY_SUBS; i++) {
+    TelemetrySub& sub = telemetrySubs[i];
+    if (sub.id == 0) {
+      if (freeSlot < 0) freeSlot = i;
+    } else if (strncmp(sub.command, params, cmdLen) == 0 && sub.command[cmdLen] == '\0') {
+      slot = i;
+    }
+  }
+
+  if (slot < 0) {
+    if (freeSlot < 0) return res.error(F("ERR_BUSY"));
+    slot = freeSlot;
+    TelemetrySub& sub = telemetrySubs[slot];
+    // Skip ids still in use so late job results cannot be misattributed
+    bool taken;
+    do {
+      if (++lastTelemetryId == 0) lastTelemetryId = 1;
+      taken = false;
+      for (uint8_t i = 0; i < TELEMETRY_SUBS; i++) {
+        if (telemetrySubs[i].id == lastTelemetryId) taken = true;
+      }
+    } while (taken);
+    sub.id = lastTelemetryId;
+    sub.pending = false;
+    memcpy(sub.command, params, cmdLen);
+    sub.command[cmdLen] = '\0';
+    sub.nextAt = millis();
+  }
+
+  telemetrySubs[slot].period = (unsigned long)period;
+  if (currentRoute.kind != ROUTE_LOCAL) telemetryRoute = currentRoute;
+
+  res.print(F("{\"ok\":1,\"sub\":"));
+  res.print(telemetrySubs[slot].id);
+  res.print(F(",\"period\":"));
+  res.print(period);
+  res.print('}');
+}
+
+// UNSUBSCRIBE[|<sub>] - one subscription, or all of them without a parameter
+void handleUnsubscribe(const char* params, ResponseBuffer& res) {
+  int id = params ? atoi(params) : 0;
+  if (params && id <= 0) return res.error(F("ERR_INVALID_VALUE"));
+
+  uint8_t removed = 0;
+  for (uint8_t i = 0; i < TELEMETRY_SUBS; i++) {
+    if (telemetrySubs[i].id == 0 || (id > 0 && telemetrySubs[i].id != id)) continue;
+    telemetrySubs[i].id = 0;
+    removed++;
+  }
+  if (id > 0 && removed == 0) return res.error(F("ERR_UNKNOWN_SUBSCRIPTION"));
+
+  res.print(F("{\"ok\":1,\"removed\":"));
+  res.print(removed);
+  res.print('}');
+}
+
+// TELEMETRY - poll the buffered samples (for subscribers that are not pushed to)
+void handleTelemetry(const char* params, ResponseBuffer& res) {
+  writeTelemetryBatch(res, true);
+}
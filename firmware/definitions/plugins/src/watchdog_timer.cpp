@@ -0,0 +1,211 @@
+// === WATCHDOG & STALL BREADCRUMBS ===
+// The watchdog is restarted at every task boundary: the start of loop(), the
+// end of each definition's loop block (LOOP_SECTION_END) and around each
+// command handler (runCommand). Every task therefore gets the whole timeout,
+// and the one that overruns it is the task that hung. Just before the reset
+// it is written to memory that survives it:
+//
+//   AVR      the watchdog runs in interrupt + reset mode: its interrupt fires
+//            after 4 s and writes the breadcrumb to .noinit RAM; the reset
+//            follows 4 s later
+//   ESP32    esp_task_wdt_isr_user_handler() -> RTC_NOINIT memory
+//   ESP8266  custom_crash_callback() (soft WDT, exceptions) -> RTC user memory
+//   R4       no hook before the reset: the current task is kept in .noinit
+//            RAM and reported after a watchdog reset (RSTSR1.WDTRF); its run
+//            time is unknown (null) and up_ms is when it started
+//
+// At boot the breadcrumb moves to RAM; INFO and HYDROPONICS_DISCOVERY report
+// it until the next reset:
+//
+//   "stall":{"task":"ANALOG_BURST","ran_ms":4002,"up_ms":81233}
+//
+// A task is a command name, a definition id (its loop block) or "core": the
+// Arduino core between two loop() calls (WiFi stack, yield()).
+//
+// With dual_core the loop task and the acquisition task keep a breadcrumb
+// each, and both are watched. The one that has been in its task longer is
+// the one that stopped feeding: a handler hanging on core 0 starves IDLE0
+// while loop() carries on.
+
+#define STALL_MAGIC 0x5AC3
+#define STALL_RAN_UNKNOWN 0xFFFFFFFFUL
+#define TASK_LOOP 0      // id: loop section, LOOP_SECTIONS = between loop() calls
+#define TASK_COMMAND 1   // id: command name hash
+
+#ifdef ENABLE_DUAL_CORE
+  #define STALL_TASKS 2  // 0: loop(), 1: acquisition task
+#else
+  #define STALL_TASKS 1
+#endif
+
+#if defined(ESP8266)
+  #define STALL_RTC_BLOCK 32  // past the OTA boot command (first 128 bytes)
+#endif
+
+struct StallRecord {
+  uint16_t magic;
+  uint8_t kind;
+  uint16_t id;
+  uint32_t ranMs;
+  uint32_t upMs;
+};
+
+#if defined(ESP32)
+  RTC_NOINIT_ATTR StallRecord stallRecord;
+#elif defined(__AVR__)
+  StallRecord stallRecord __attribute__((section(".noinit")));
+#else
+  StallRecord stallRecord;  // ESP8266: copied to and from RTC user memory
+#endif
+StallRecord bootStall;      // the previous boot's breadcrumb (magic 0 = none)
+
+#if defined(ARDUINO_ARCH_RENESAS)
+  volatile uint8_t taskKind[STALL_TASKS] __attribute__((section(".noinit")));
+  volatile uint16_t taskId[STALL_TASKS] __attribute__((section(".noinit")));
+  volatile unsigned long taskStartMs[STALL_TASKS] __attribute__((section(".noinit")));
+#else
+  volatile uint8_t taskKind[STALL_TASKS];
+  volatile uint16_t taskId[STALL_TASKS];
+  volatile unsigned long taskStartMs[STALL_TASKS];
+#endif
+
+// The breadcrumb of the calling task
+uint8_t currentStallTask() {
+  #ifdef ENABLE_DUAL_CORE
+  return onAcquisitionTask() ? 1 : 0;
+  #else
+  return 0;
+  #endif
+}
+
+void feedWatchdog() {
+  #if defined(__AVR__)
+  wdt_reset();
+  // The task recovered after the interrupt: it was slow, not hung
+  if (!(WDTCSR & _BV(WDIE))) stallRecord.magic = 0;
+  WDTCSR |= _BV(WDIE);  // cleared by hardware when the interrupt runs
+  #elif defined(ESP32)
+  esp_task_wdt_reset();
+  #elif defined(ESP8266)
+  ESP.wdtFeed();
+  #elif defined(ARDUINO_ARCH_RENESAS)
+  WDT.refresh();
+  #endif
+}
+
+// Interrupt / crash context: the watchdog is about to reset the board
+void recordStall() {
+  uint8_t t = 0;
+  unsigned long now = millis();
+  #ifdef ENABLE_DUAL_CORE
+  if (now - taskStartMs[1] > now - taskStartMs[0]) t = 1;
+  #endif
+  stallRecord.kind = taskKind[t];
+  stallRecord.id = taskId[t];
+  stallRecord.upMs = now;
+  stallRecord.ranMs = now - taskStartMs[t];
+  stallRecord.magic = STALL_MAGIC;
+  #if defined(ESP8266)
+  ESP.rtcUserMemoryWrite(STALL_RTC_BLOCK, (uint32_t*)&stallRecord, sizeof(stallRecord));
+  #endif
+}
+
+#if defined(__AVR__)
+ISR(WDT_vect) {
+  recordStall();
+}
+#elif defined(ESP32)
+extern "C" void esp_task_wdt_isr_user_handler(void) {
+  recordStall();
+}
+#elif defined(ESP8266)
+extern "C" void custom_crash_callback(struct rst_info* info, uint32_t stack, uint32_t stackEnd) {
+  recordStall();
+}
+#endif
+
+// From setup(), before the watchdog is started
+void initStallWatch() {
+  #if defined(ESP8266)
+  ESP.rtcUserMemoryRead(STALL_RTC_BLOCK, (uint32_t*)&stallRecord, sizeof(stallRecord));
+  #elif defined(ARDUINO_ARCH_RENESAS)
+  stallRecord.magic = 0;
+  if (R_SYSTEM->RSTSR1_b.WDTRF) {
+    stallRecord.magic = STALL_MAGIC;
+    stallRecord.kind = taskKind[0];
+    stallRecord.id = taskId[0];
+    stallRecord.ranMs = STALL_RAN_UNKNOWN;
+    stallRecord.upMs = taskStartMs[0];
+    R_SYSTEM->RSTSR1 = 0;
+  }
+  #endif
+
+  bootStall = stallRecord;
+  if (bootStall.magic != STALL_MAGIC) bootStall.magic = 0;
+  stallRecord.magic = 0;
+  #if defined(ESP8266)
+  ESP.rtcUserMemoryWrite(STALL_RTC_BLOCK, (uint32_t*)&stallRecord, sizeof(stallRecord));
+  #endif
+
+  for (uint8_t t = 0; t < STALL_TASKS; t++) {
+    taskKind[t] = TASK_LOOP;
+    taskId[t] = LOOP_SECTIONS;
+    taskStartMs[t] = millis();
+  }
+}
+
+void enterTask(uint8_t kind, uint16_t id) {
+  feedWatchdog();
+  uint8_t t = currentStallTask();
+  taskKind[t] = kind;
+  taskId[t] = id;
+  taskStartMs[t] = millis();
+}
+
+// dual_core: the calling task is waiting for the other one, not hung
+void touchTask() {
+  feedWatchdog();
+  taskStartMs[currentStallTask()] = millis();
+}
+
+// LOOP_PERIOD_START() / LOOP_SECTION_END(n): loop section n begins
+void enterLoopTask(uint8_t section) {
+  enterTask(TASK_LOOP, section);
+}
+
+// runCommand(): the handler of `h` runs inside the current task
+StallTask enterCommandTask(uint16_t h) {
+  uint8_t t = currentStallTask();
+  StallTask outer = { taskKind[t], taskId[t], taskStartMs[t] };
+  enterTask(TASK_COMMAND, h);
+  return outer;
+}
+
+void leaveTask(const StallTask& outer) {
+  feedWatchdog();
+  uint8_t t = currentStallTask();
+  taskKind[t] = outer.kind;
+  taskId[t] = outer.id;
+  taskStartMs[t] = outer.startMs;
+}
+
+// ,"stall":{...} if the previous boot ended in a watchdog reset
+void printStallBreadcrumb(ResponseBuffer& res) {
+  if (bootStall.magic != STALL_MAGIC) return;
+  res.print(F(",\"stall\":{\"task\":\""));
+  if (bootStall.kind == TASK_COMMAND && commandName(bootStall.id)) {
+    res.print((const __FlashStringHelper*)commandName(bootStall.id));
+  } else if (bootStall.kind == TASK_LOOP && bootStall.id < LOOP_SECTIONS) {
+    printLoopSectionName(res, bootStall.id);
+  } else if (bootStall.kind == TASK_LOOP && bootStall.id == LOOP_SECTIONS) {
+    res.print(F("core"));
+  } else {
+    res.print('?');
+  }
+  res.print(F("\",\"ran_ms\":"));
+  if (bootStall.ranMs == STALL_RAN_UNKNOWN) res.print(F("null"));
+  else res.print(bootStall.ranMs);
+  res.print(F(",\"up_ms\":"));
+  res.print(bootStall.upMs);
+  res.print('}');
+}
@@ -0,0 +1,24 @@
+#!/usr/bin/env bash
+# Builds the generated firmware for Linux against the host Arduino core.
+#
+#   firmware/host/build.sh [--transport wifi_native] [--plugins a,b] [--commands all|a,b]
+#
+# Produces firmware/host/out/host_fw; run it with a script, e.g.
+#   firmware/host/out/host_fw firmware/host/bench/commands.bench
+# Extra compiler flags go in HOST_CXXFLAGS (e.g. "-O0 -g -fsanitize=address").
+set -euo pipefail
+
+HOST_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+REPO_DIR="$(cd "$HOST_DIR/../.." && pwd)"
+OUT_DIR="$HOST_DIR/out"
+mkdir -p "$OUT_DIR"
+
+(cd "$REPO_DIR/backend" && npx ts-node --transpile-only src/build-host-firmware.ts "$@" --out "$OUT_DIR/sketch.cpp")
+
+g++ -std=gnu++17 -O2 -pthread ${HOST_CXXFLAGS:-} \
+  -I"$HOST_DIR/include" -I"$HOST_DIR" \
+  "$OUT_DIR/sketch.cpp" "$HOST_DIR/core.cpp" "$HOST_DIR/models.cpp" "$HOST_DIR/main.cpp" \
+  -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc \
+  -o "$OUT_DIR/host_fw"
+
+echo "Built $OUT_DIR/host_fw"
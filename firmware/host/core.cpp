@@ -0,0 +1,632 @@
+// === HOST CORE ===
+// Implements the host Arduino API (include/) on top of the simulation in
+// sim.h: virtual clock and events, pins and interrupts, the console,
+// SoftwareSerial lines, EEPROM, WiFiUDP, FreeRTOS tasks and the allocation
+// counters.
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "SoftwareSerial.h"
+#include "Wire.h"
+#include "WiFiUdp.h"
+#include "freertos/task.h"
+#include "sim.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+// === ALLOCATION COUNTERS ===
+// build.sh links with -Wl,--wrap=malloc,... so only the firmware's own calls
+// land here; operator new is replaced for the C++ side. What the simulation
+// and the models allocate on the firmware's behalf (events, queued bytes) is
+// not the firmware's and runs inside a SimScope.
+static sim::Counters simCounters = { 0, 0, 0, 0 };
+static int simDepth = 0;
+
+struct SimScope {
+  SimScope() { simDepth++; }
+  ~SimScope() { simDepth--; }
+};
+
+static void countAllocation(size_t size) {
+  if (simDepth > 0) return;
+  simCounters.allocations++;
+  simCounters.allocatedBytes += size;
+}
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  countAllocation(size);
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  countAllocation(count * size);
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  countAllocation(size);
+  return __real_realloc(ptr, size);
+}
+}
+
+// Pairs with free(): both sides go through the real malloc
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+  countAllocation(size);
+  void* p = __real_malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+namespace sim {
+
+const Counters& counters() { return simCounters; }
+
+// === CLOCK ===
+static uint64_t clockUs = 0;
+static std::multimap<uint64_t, std::function<void()>> events;
+static bool inEvent = false;
+
+uint64_t now() { return clockUs; }
+
+void advance(uint64_t us) {
+  SimScope scope;
+  uint64_t target = clockUs + us;
+  if (inEvent) {
+    clockUs = target;  // an event handler waiting: no nested events
+    return;
+  }
+  while (!events.empty() && events.begin()->first <= target) {
+    auto next = events.begin();
+    std::function<void()> fn = next->second;
+    if (next->first > clockUs) clockUs = next->first;
+    events.erase(next);
+    inEvent = true;
+    fn();
+    inEvent = false;
+  }
+  if (target > clockUs) clockUs = target;
+}
+
+void at(uint64_t us, std::function<void()> fn) {
+  SimScope scope;
+  events.emplace(us, fn);
+}
+
+void after(uint64_t us, std::function<void()> fn) { at(clockUs + us, fn); }
+
+// === PINS ===
+struct Pin {
+  uint8_t mode = INPUT;
+  uint8_t out = LOW;
+  uint8_t in = LOW;
+  bool inSet = false;        // the runner or a model set the input level
+  int analog = 0;
+  int noise = 0;
+  PinModel* model = nullptr;
+  void (*isr)() = nullptr;
+  int isrMode = 0;
+};
+
+static Pin pins[HOST_PINS];
+static bool interruptsEnabled = true;
+static std::vector<void (*)()> pendingIsrs;
+
+static Pin* pinAt(uint8_t pin) { return pin < HOST_PINS ? &pins[pin] : nullptr; }
+
+void attach(uint8_t pin, PinModel* model) {
+  if (Pin* p = pinAt(pin)) p->model = model;
+}
+
+static void fireIsr(Pin& p, uint8_t from, uint8_t to) {
+  if (!p.isr || from == to) return;
+  bool fire = p.isrMode == CHANGE || (p.isrMode == RISING && to == HIGH) || (p.isrMode == FALLING && to == LOW);
+  if (!fire) return;
+  if (interruptsEnabled) {
+    p.isr();
+  } else {
+    pendingIsrs.push_back(p.isr);
+  }
+}
+
+void setLevel(uint8_t pin, uint8_t level) {
+  Pin* p = pinAt(pin);
+  if (!p) return;
+  uint8_t before = p->inSet ? p->in : (p->mode == INPUT_PULLUP ? HIGH : LOW);
+  p->in = level ? HIGH : LOW;
+  p->inSet = true;
+  fireIsr(*p, before, p->in);
+}
+
+uint8_t pinMode(uint8_t pin) { return pinAt(pin) ? pinAt(pin)->mode : INPUT; }
+uint8_t outputLevel(uint8_t pin) { return pinAt(pin) ? pinAt(pin)->out : LOW; }
+bool driven(uint8_t pin) { return pinAt(pin) && pinAt(pin)->mode == OUTPUT && pinAt(pin)->out == LOW; }
+
+void setAnalog(uint8_t pin, int value, int noise) {
+  if (Pin* p = pinAt(pin)) {
+    p->analog = value;
+    p->noise = noise;
+  }
+}
+
+// === SERIAL LINES ===
+struct TimedByte {
+  uint64_t at;
+  uint8_t value;
+};
+
+static std::map<uint8_t, std::deque<TimedByte>> rxLines;
+static std::map<uint8_t, SerialModel*> txModels;
+
+void attachSerial(uint8_t txPin, SerialModel* model) { txModels[txPin] = model; }
+
+void deliver(uint8_t rxPin, const uint8_t* data, size_t size, unsigned long baud, uint64_t startUs) {
+  SimScope scope;
+  uint64_t byteUs = 10000000ULL / (baud ? baud : 9600);
+  std::deque<TimedByte>& line = rxLines[rxPin];
+  uint64_t t = startUs;
+  if (!line.empty() && line.back().at > t) t = line.back().at;
+  for (size_t i = 0; i < size; i++) {
+    t += byteUs;
+    line.push_back({ t, data[i] });
+  }
+}
+
+int serialAvailable(uint8_t rxPin) {
+  auto it = rxLines.find(rxPin);
+  if (it == rxLines.end()) return 0;
+  int n = 0;
+  for (const TimedByte& b : it->second) {
+    if (b.at > clockUs) break;
+    n++;
+  }
+  return n;
+}
+
+int serialRead(uint8_t rxPin, bool consume) {
+  auto it = rxLines.find(rxPin);
+  if (it == rxLines.end() || it->second.empty() || it->second.front().at > clockUs) return -1;
+  uint8_t value = it->second.front().value;
+  if (consume) it->second.pop_front();
+  return value;
+}
+
+void serialSent(uint8_t txPin, uint8_t b) {
+  SimScope scope;
+  auto it = txModels.find(txPin);
+  if (it != txModels.end()) it->second->onByte(b);
+}
+
+// === CONSOLE AND UDP ===
+static std::deque<char> consoleIn;
+static std::string consoleOut;
+static bool consoleEcho = true;
+static std::deque<std::string> udpIn;
+static std::string udpOut;
+
+void consoleInput(const std::string& line) {
+  consoleIn.insert(consoleIn.end(), line.begin(), line.end());
+  consoleIn.push_back('\n');
+}
+
+void udpInput(const std::string& datagram) { udpIn.push_back(datagram); }
+void setConsoleEcho(bool on) { consoleEcho = on; }
+
+std::string takeConsoleOutput() {
+  std::string out;
+  out.swap(consoleOut);
+  return out;
+}
+
+std::string takeUdpOutput() {
+  std::string out;
+  out.swap(udpOut);
+  return out;
+}
+
+static void consoleWrite(const uint8_t* data, size_t size) {
+  SimScope scope;
+  consoleOut.append((const char*)data, size);
+  if (consoleEcho) fwrite(data, 1, size, stdout);
+}
+
+}  // namespace sim
+
+// === ARDUINO API ===
+unsigned long micros() {
+  sim::advance(1);
+  return (unsigned long)sim::now();
+}
+
+unsigned long millis() {
+  sim::advance(1);
+  return (unsigned long)(sim::now() / 1000);
+}
+
+void delay(unsigned long ms) { sim::advance((uint64_t)ms * 1000); }
+void delayMicroseconds(unsigned int us) { sim::advance(us); }
+void yield() { }
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  sim::Pin* p = sim::pinAt(pin);
+  if (!p) return;
+  p->mode = mode;
+  if (p->model) {
+    SimScope scope;
+    p->model->onMode(pin, mode);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  sim::Pin* p = sim::pinAt(pin);
+  if (!p) return;
+  p->out = level ? HIGH : LOW;
+  if (p->model) {
+    SimScope scope;
+    p->model->onWrite(pin, p->out);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  sim::advance(1);
+  sim::Pin* p = sim::pinAt(pin);
+  if (!p) return LOW;
+  if (p->model) {
+    SimScope scope;
+    int level = p->model->onRead(pin);
+    if (level >= 0) return level;
+  }
+  if (p->mode == OUTPUT) return p->out;
+  if (!p->inSet) return p->mode == INPUT_PULLUP ? HIGH : LOW;
+  return p->in;
+}
+
+static uint32_t noiseState = 12345;
+
+static int nextNoise(int amplitude) {
+  if (amplitude <= 0) return 0;
+  noiseState = noiseState * 1103515245u + 12345u;
+  return (int)((noiseState >> 16) % (uint32_t)(2 * amplitude + 1)) - amplitude;
+}
+
+static int adcBits = 10;
+
+int analogRead(uint8_t pin) {
+  sim::advance(100);  // conversion time of an AVR ADC
+  sim::Pin* p = sim::pinAt(pin);
+  if (!p) return 0;
+  int value = p->analog + nextNoise(p->noise);
+  int top = (1 << adcBits) - 1;
+  return value < 0 ? 0 : (value > top ? top : value);
+}
+
+void analogWrite(uint8_t pin, int value) { digitalWrite(pin, value > 127 ? HIGH : LOW); }
+void analogReadResolution(int bits) { adcBits = bits; }
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeoutUs) {
+  uint64_t start = sim::now();
+  while (digitalRead(pin) == state) {
+    if (sim::now() - start > timeoutUs) return 0;
+  }
+  while (digitalRead(pin) != state) {
+    if (sim::now() - start > timeoutUs) return 0;
+  }
+  uint64_t rise = sim::now();
+  while (digitalRead(pin) == state) {
+    if (sim::now() - start > timeoutUs) return 0;
+  }
+  return (unsigned long)(sim::now() - rise);
+}
+
+void attachInterrupt(int irq, void (*isr)(), int mode) {
+  sim::Pin* p = sim::pinAt((uint8_t)irq);
+  if (!p) return;
+  p->isr = isr;
+  p->isrMode = mode;
+}
+
+void detachInterrupt(int irq) {
+  if (sim::Pin* p = sim::pinAt((uint8_t)irq)) p->isr = nullptr;
+}
+
+void noInterrupts() { sim::interruptsEnabled = false; }
+
+void interrupts() {
+  sim::interruptsEnabled = true;
+  std::vector<void (*)()> pending;
+  pending.swap(sim::pendingIsrs);
+  for (void (*isr)() : pending) isr();
+}
+
+static uint32_t randomState = 1;
+
+long random(long max) {
+  if (max <= 0) return 0;
+  randomState = randomState * 1103515245u + 12345u;
+  return (long)((randomState >> 8) % (uint32_t)max);
+}
+
+long random(long min, long max) { return max <= min ? min : min + random(max - min); }
+void randomSeed(unsigned long seed) { randomState = (uint32_t)seed; }
+
+int Stream::timedRead() {
+  uint64_t start = sim::now();
+  do {
+    int c = read();
+    if (c >= 0) return c;
+    sim::advance(100);
+  } while (sim::now() - start < (uint64_t)timeoutMs * 1000);
+  return -1;
+}
+
+// === SERIAL PORTS ===
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+HardwareSerial Serial2(2);
+
+int HardwareSerial::available() { return index == 0 ? (int)sim::consoleIn.size() : 0; }
+
+int HardwareSerial::read() {
+  if (index != 0 || sim::consoleIn.empty()) return -1;
+  uint8_t c = (uint8_t)sim::consoleIn.front();
+  sim::consoleIn.pop_front();
+  return c;
+}
+
+int HardwareSerial::peek() { return index != 0 || sim::consoleIn.empty() ? -1 : (uint8_t)sim::consoleIn.front(); }
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+
+size_t HardwareSerial::write(const uint8_t* data, size_t size) {
+  if (index == 0) sim::consoleWrite(data, size);
+  return size;
+}
+
+int SoftwareSerial::available() { return sim::serialAvailable(rx); }
+int SoftwareSerial::read() { return sim::serialRead(rx, true); }
+int SoftwareSerial::peek() { return sim::serialRead(rx, false); }
+
+size_t SoftwareSerial::write(uint8_t b) {
+  sim::advance(10000000UL / baud);  // the bit-banged byte blocks
+  sim::serialSent(tx, b);
+  return 1;
+}
+
+// === EEPROM ===
+EEPROMClass EEPROM;
+
+static struct EepromFile {
+  EepromFile() {
+    memset(EEPROM.data, 0xFF, sizeof(EEPROM.data));
+    const char* path = getenv("HOST_EEPROM_FILE");
+    if (!path) return;
+    if (FILE* f = fopen(path, "rb")) {
+      size_t n = fread(EEPROM.data, 1, sizeof(EEPROM.data), f);
+      (void)n;
+      fclose(f);
+    }
+  }
+  ~EepromFile() {
+    const char* path = getenv("HOST_EEPROM_FILE");
+    if (!path) return;
+    if (FILE* f = fopen(path, "wb")) {
+      fwrite(EEPROM.data, 1, sizeof(EEPROM.data), f);
+      fclose(f);
+    }
+  }
+} eepromFile;
+
+void EEPROMClass::write(int address, uint8_t value) {
+  if (!inRange(address) || data[address] == value) return;
+  data[address] = value;
+  simCounters.eepromWrites++;
+}
+
+bool EEPROMClass::commit() {
+  simCounters.eepromCommits++;
+  return true;
+}
+
+// === WIRE / WIFI ===
+TwoWire Wire;
+WiFiClass WiFi;
+
+// Packets from the runner appear to come from here
+static const IPAddress RUNNER_PEER(10, 0, 0, 2);
+static const uint16_t RUNNER_PORT = 5000;
+
+bool hostServeUdp = false;  // set by `host_fw --serve`
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+  if (!hostServeUdp || fd >= 0) return 1;
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    fprintf(stderr, "host: cannot bind UDP port %u\n", port);
+    if (fd >= 0) close(fd);
+    fd = -1;
+    return 0;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  fprintf(stderr, "host: listening on UDP port %u\n", port);
+  return 1;
+}
+
+void WiFiUDP::stop() {
+  if (fd >= 0) close(fd);
+  fd = -1;
+}
+
+int WiFiUDP::parsePacket() {
+  readPos = 0;
+  if (!sim::udpIn.empty()) {
+    packet = sim::udpIn.front();
+    sim::udpIn.pop_front();
+    peerIp = RUNNER_PEER;
+    peerPort = RUNNER_PORT;
+    return (int)packet.size();
+  }
+  if (fd < 0) return 0;
+
+  char buf[1500];
+  sockaddr_in from = {};
+  socklen_t fromLen = sizeof(from);
+  ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr*)&from, &fromLen);
+  if (n <= 0) {
+    packet.clear();
+    return 0;
+  }
+  packet.assign(buf, (size_t)n);
+  uint32_t ip = ntohl(from.sin_addr.s_addr);
+  peerIp = IPAddress(ip >> 24, (ip >> 16) & 0xFF, (ip >> 8) & 0xFF, ip & 0xFF);
+  peerPort = ntohs(from.sin_port);
+  return (int)n;
+}
+
+int WiFiUDP::read() { return readPos < packet.size() ? (uint8_t)packet[readPos++] : -1; }
+
+int WiFiUDP::read(uint8_t* buf, size_t size) {
+  size_t n = packet.size() - readPos;
+  if (n > size) n = size;
+  memcpy(buf, packet.data() + readPos, n);
+  readPos += n;
+  return (int)n;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+  SimScope scope;
+  outgoing.clear();
+  outgoing.reserve(1500);
+  outIp = ip;
+  outPort = port;
+  return 1;
+}
+
+int WiFiUDP::endPacket() {
+  SimScope scope;
+  if (outIp == RUNNER_PEER && outPort == RUNNER_PORT) {
+    sim::udpOut += outgoing;
+    sim::udpOut += '\n';
+    return 1;
+  }
+  if (fd < 0) return 0;
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(outPort);
+  to.sin_addr.s_addr = htonl(((uint32_t)outIp[0] << 24) | ((uint32_t)outIp[1] << 16) | ((uint32_t)outIp[2] << 8) | outIp[3]);
+  return sendto(fd, outgoing.data(), outgoing.size(), 0, (sockaddr*)&to, sizeof(to)) >= 0;
+}
+
+// === TASKS ===
+// One baton: runningTask is the thread allowed to run (NULL = the main
+// thread, i.e. setup() and loop()). A blocking call hands it back to main;
+// sim::runTasks() passes it to each task in turn. The lock and the condition
+// are never destroyed, so tasks still blocked at exit stay harmless.
+struct HostTask {
+  TaskFunction_t fn;
+  void* arg;
+  BaseType_t core;
+  uint32_t notified;
+  bool ended;
+};
+
+static std::mutex* taskLock = new std::mutex;
+static std::condition_variable* taskTurn = new std::condition_variable;
+static std::vector<HostTask*> tasks;
+static HostTask* runningTask = NULL;
+
+// Task side: back to main until runTasks() comes round again
+static void blockTask(HostTask* self) {
+  std::unique_lock<std::mutex> lock(*taskLock);
+  runningTask = NULL;
+  taskTurn->notify_all();
+  taskTurn->wait(lock, [self] { return runningTask == self; });
+}
+
+static void taskMain(HostTask* task) {
+  {
+    std::unique_lock<std::mutex> lock(*taskLock);
+    taskTurn->wait(lock, [task] { return runningTask == task; });
+  }
+  task->fn(task->arg);
+  std::unique_lock<std::mutex> lock(*taskLock);
+  task->ended = true;
+  runningTask = NULL;
+  taskTurn->notify_all();
+}
+
+namespace sim {
+
+void runTasks() {
+  for (HostTask* task : tasks) {
+    if (task->ended) continue;
+    std::unique_lock<std::mutex> lock(*taskLock);
+    runningTask = task;
+    taskTurn->notify_all();
+    taskTurn->wait(lock, [] { return runningTask == NULL; });
+  }
+}
+
+}  // namespace sim
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackSize, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  SimScope scope;
+  HostTask* task = new HostTask{ fn, arg, core, 0, false };
+  tasks.push_back(task);
+  std::thread(taskMain, task).detach();
+  if (handle) *handle = task;
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  if (runningTask) blockTask(runningTask);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+  HostTask* self = runningTask;
+  if (!self) return 0;
+  if (self->notified == 0) blockTask(self);
+  uint32_t count = self->notified;
+  if (count > 0) self->notified = clearOnExit ? 0 : count - 1;
+  return count;
+}
+
+void xTaskNotifyGive(TaskHandle_t task) {
+  if (task) task->notified++;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return runningTask;
+}
+
+BaseType_t xPortGetCoreID() {
+  return runningTask ? runningTask->core : 1;
+}
@@ -0,0 +1,255 @@
+// === HOST ARDUINO CORE ===
+// The subset of the Arduino API the generated firmware uses, for building it
+// on Linux with g++ (see firmware/host/build.sh). Time, pins and serial
+// lines are simulated by core.cpp; sensors are modelled in models.cpp.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <type_traits>
+
+#define HOST_BUILD 1
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// --- PROGMEM (flat address space) ---
+class __FlashStringHelper;
+#define PROGMEM
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define PSTR(s) (s)
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define memcpy_P memcpy
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+#define pgm_read_ptr(addr) (*(void* const*)(addr))
+
+// --- Constants ---
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+#define NOT_AN_INTERRUPT -1
+#define SERIAL_8N1 0x800001c
+
+// Uno numbering for the analog pins
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define HOST_PINS 64
+
+// --- Time, pins, interrupts (core.cpp) ---
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+void analogReadResolution(int bits);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeoutUs = 1000000UL);
+
+inline int digitalPinToInterrupt(int pin) { return pin >= 0 && pin < HOST_PINS ? pin : NOT_AN_INTERRUPT; }
+void attachInterrupt(int irq, void (*isr)(), int mode);
+void detachInterrupt(int irq);
+void noInterrupts();
+void interrupts();
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+inline bool isDigit(int c) { return c >= '0' && c <= '9'; }
+
+template <class T, class L, class H>
+T constrain(T value, L low, H high) { return value < low ? low : (value > high ? high : value); }
+template <class A, class B>
+typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <class A, class B>
+typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+// --- String (heap backed, as on the boards) ---
+class String {
+ public:
+  String() { }
+  String(const char* s) { if (s) str = s; }
+  String(const __FlashStringHelper* s) { if (s) str = reinterpret_cast<const char*>(s); }
+  String(char c) : str(1, c) { }
+  String(int v) : str(std::to_string(v)) { }
+  String(unsigned v) : str(std::to_string(v)) { }
+  String(long v) : str(std::to_string(v)) { }
+  String(unsigned long v) : str(std::to_string(v)) { }
+  String(double v, int digits = 2) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, v);
+    str = buf;
+  }
+
+  String& operator+=(const String& s) { str += s.str; return *this; }
+  String& operator+=(const char* s) { if (s) str += s; return *this; }
+  String& operator+=(char c) { str += c; return *this; }
+  friend String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+  bool operator==(const char* s) const { return s && str == s; }
+  bool operator==(const String& s) const { return str == s.str; }
+
+  const char* c_str() const { return str.c_str(); }
+  unsigned int length() const { return str.size(); }
+  char charAt(unsigned int i) const { return i < str.size() ? str[i] : 0; }
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t pos = str.find(c, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  String substring(unsigned int from) const { return from < str.size() ? String(str.substr(from).c_str()) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from >= str.size() || to <= from) return String();
+    return String(str.substr(from, to - from).c_str());
+  }
+  bool startsWith(const char* prefix) const { return str.rfind(prefix, 0) == 0; }
+  long toInt() const { return atol(str.c_str()); }
+  float toFloat() const { return (float)atof(str.c_str()); }
+  void trim() {
+    size_t first = str.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) { str.clear(); return; }
+    str = str.substr(first, str.find_last_not_of(" \t\r\n") - first + 1);
+  }
+
+ private:
+  std::string str;
+};
+
+// --- Print / Stream ---
+class Print;
+
+class Printable {
+ public:
+  virtual ~Printable() { }
+  virtual size_t printTo(Print& out) const = 0;
+};
+
+class Print {
+ public:
+  virtual ~Print() { }
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* data, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*data++);
+    return n;
+  }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  virtual void flush() { }
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+  size_t print(const String& s) { return write(s.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%ld", v);
+    return write(buf);
+  }
+  size_t print(unsigned long v, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lX" : "%lu", v);
+    return write(buf);
+  }
+  size_t print(double v, int digits = 2) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", digits, v);
+    return write(buf);
+  }
+  size_t print(const Printable& p) { return p.printTo(*this); }
+
+  template <class T>
+  size_t println(const T& v) { return print(v) + println(); }
+  template <class T>
+  size_t println(const T& v, int format) { return print(v, format) + println(); }
+  size_t println() { return write((const uint8_t*)"\r\n", 2); }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long ms) { timeoutMs = ms; }
+
+  // Like the boards, waits up to the timeout for each byte
+  size_t readBytes(uint8_t* buf, size_t size) {
+    size_t n = 0;
+    while (n < size) {
+      int c = timedRead();
+      if (c < 0) break;
+      buf[n++] = (uint8_t)c;
+    }
+    return n;
+  }
+  size_t readBytes(char* buf, size_t size) { return readBytes((uint8_t*)buf, size); }
+  size_t readBytesUntil(char terminator, char* buf, size_t size) {
+    size_t n = 0;
+    while (n < size) {
+      int c = timedRead();
+      if (c < 0 || c == terminator) break;
+      buf[n++] = (char)c;
+    }
+    return n;
+  }
+
+ protected:
+  int timedRead();
+  unsigned long timeoutMs = 1000;
+};
+
+// Serial is the console: the host runner feeds its input and prints its
+// output. Other ports exist so board-specific code compiles.
+class HardwareSerial : public Stream {
+ public:
+  explicit HardwareSerial(uint8_t index) : index(index) { }
+  void begin(unsigned long baud) { }
+  void begin(unsigned long baud, uint32_t config, int rx = -1, int tx = -1) { }
+  void end() { }
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* data, size_t size) override;
+  using Print::write;
+  operator bool() const { return true; }
+
+ private:
+  uint8_t index;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
@@ -0,0 +1,38 @@
+// === HOST EEPROM ===
+// 4 KB in RAM, erased to 0xFF. HOST_EEPROM_FILE keeps the contents across
+// runs. Changed bytes and commits are counted (sim::counters()).
+
+#pragma once
+
+#include "Arduino.h"
+
+#define HOST_EEPROM_SIZE 4096
+
+class EEPROMClass {
+ public:
+  void begin(size_t size) { }
+  bool commit();
+  void end() { }
+  uint8_t read(int address) const { return inRange(address) ? data[address] : 0xFF; }
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value) { write(address, value); }
+  uint16_t length() const { return HOST_EEPROM_SIZE; }
+
+  template <class T>
+  T& get(int address, T& value) const {
+    for (size_t i = 0; i < sizeof(T); i++) reinterpret_cast<uint8_t*>(&value)[i] = read(address + i);
+    return value;
+  }
+  template <class T>
+  const T& put(int address, const T& value) {
+    for (size_t i = 0; i < sizeof(T); i++) write(address + i, reinterpret_cast<const uint8_t*>(&value)[i]);
+    return value;
+  }
+
+  uint8_t data[HOST_EEPROM_SIZE];
+
+ private:
+  static bool inRange(int address) { return address >= 0 && address < HOST_EEPROM_SIZE; }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,18 @@
+// === HOST SERVO ===
+
+#pragma once
+
+#include "Arduino.h"
+
+class Servo {
+ public:
+  uint8_t attach(int pin) { attachedPin = pin; return 0; }
+  void detach() { attachedPin = -1; }
+  bool attached() const { return attachedPin >= 0; }
+  void write(int angle) { lastAngle = angle; }
+  int read() const { return lastAngle; }
+
+ private:
+  int attachedPin = -1;
+  int lastAngle = 90;
+};
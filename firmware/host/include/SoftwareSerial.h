@@ -0,0 +1,27 @@
+// === HOST SOFTWARESERIAL ===
+// Bytes written go to the serial model attached to the TX pin; bytes read
+// come from what models delivered to the RX pin (sim::deliver). Writing
+// blocks for the bytes' time on the wire, as the bit-banged original does.
+
+#pragma once
+
+#include "Arduino.h"
+
+class SoftwareSerial : public Stream {
+ public:
+  SoftwareSerial(uint8_t rx, uint8_t tx) : rx(rx), tx(tx), baud(9600) { }
+  void begin(unsigned long rate) { baud = rate; }
+  void end() { }
+  bool listen() { return true; }
+  bool isListening() const { return true; }
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t b) override;
+  using Print::write;
+
+ private:
+  uint8_t rx;
+  uint8_t tx;
+  unsigned long baud;
+};
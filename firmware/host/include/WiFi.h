@@ -0,0 +1,64 @@
+// === HOST WIFI ===
+// Always connected as 192.168.1.50. Nothing connects to a WiFiServer (the
+// Telnet console of remote_debug); the runner talks UDP and Serial.
+
+#pragma once
+
+#include "Arduino.h"
+
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+#define WIFI_STA 1
+
+class IPAddress : public Printable {
+ public:
+  IPAddress() : octets{0, 0, 0, 0} { }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} { }
+  uint8_t operator[](int i) const { return octets[i]; }
+  uint8_t& operator[](int i) { return octets[i]; }
+  bool operator==(const IPAddress& o) const { return memcmp(octets, o.octets, 4) == 0; }
+  bool operator!=(const IPAddress& o) const { return !(*this == o); }
+  size_t printTo(Print& out) const override {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+    return out.print(buf);
+  }
+
+ private:
+  uint8_t octets[4];
+};
+
+class WiFiClass {
+ public:
+  int begin(const char* ssid, const char* password) { return WL_CONNECTED; }
+  int status() const { return WL_CONNECTED; }
+  void mode(int mode) { }
+  void disconnect() { }
+  IPAddress localIP() const { return IPAddress(192, 168, 1, 50); }
+  uint8_t* macAddress(uint8_t* mac) const {
+    for (uint8_t i = 0; i < 6; i++) mac[i] = 0x02 + i;  // locally administered
+    return mac;
+  }
+  long RSSI() const { return -50; }
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient : public Stream {
+ public:
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t b) override { return 0; }
+  using Print::write;
+  bool connected() { return false; }
+  void stop() { }
+  explicit operator bool() const { return false; }
+};
+
+class WiFiServer {
+ public:
+  explicit WiFiServer(uint16_t port) { }
+  void begin() { }
+  WiFiClient available() { return WiFiClient(); }
+};
@@ -0,0 +1,39 @@
+// === HOST WIFIUDP ===
+// Packets come from the runner (sim::udpInput) and, with `host_fw --serve`,
+// from a real UDP socket on the port passed to begin(). Replies to runner
+// packets are collected for it; replies to real peers are sent back.
+
+#pragma once
+
+#include "WiFi.h"
+#include <string>
+
+class WiFiUDP : public Stream {
+ public:
+  uint8_t begin(uint16_t port);
+  void stop();
+  int parsePacket();
+  int read() override;
+  int read(uint8_t* buf, size_t size);
+  int read(char* buf, size_t size) { return read((uint8_t*)buf, size); }
+  int available() override { return (int)(packet.size() - readPos); }
+  int peek() override { return readPos < packet.size() ? (uint8_t)packet[readPos] : -1; }
+  IPAddress remoteIP() const { return peerIp; }
+  uint16_t remotePort() const { return peerPort; }
+
+  int beginPacket(IPAddress ip, uint16_t port);
+  size_t write(uint8_t b) override { outgoing += (char)b; return 1; }
+  size_t write(const uint8_t* data, size_t size) override { outgoing.append((const char*)data, size); return size; }
+  using Print::write;
+  int endPacket();
+
+ private:
+  int fd = -1;
+  std::string packet;
+  size_t readPos = 0;
+  IPAddress peerIp;
+  uint16_t peerPort = 0;
+  std::string outgoing;
+  IPAddress outIp;
+  uint16_t outPort = 0;
+};
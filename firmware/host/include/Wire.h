@@ -0,0 +1,23 @@
+// === HOST WIRE ===
+// No I2C devices: every transfer is answered with a NACK and reads return
+// nothing, so handlers take their "no device" paths.
+
+#pragma once
+
+#include "Arduino.h"
+
+class TwoWire : public Stream {
+ public:
+  void begin() { }
+  void setClock(uint32_t hz) { }
+  void beginTransmission(uint8_t address) { }
+  uint8_t endTransmission(bool stop = true) { return 2; }
+  uint8_t requestFrom(uint8_t address, uint8_t count, bool stop = true) { return 0; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t b) override { return 1; }
+  using Print::write;
+};
+
+extern TwoWire Wire;
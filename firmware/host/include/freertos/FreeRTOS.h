@@ -0,0 +1,21 @@
+// === HOST FREERTOS ===
+// The types the dual_core plugin uses. A tick is 1 ms, as on the ESP32.
+// Tasks are threads that run in lockstep with loop() (see task.h).
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void*);
+
+struct HostTask;
+typedef HostTask* TaskHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
@@ -0,0 +1,17 @@
+// === HOST FREERTOS TASKS ===
+// A task is a thread, but only one thread runs at a time: after each loop()
+// the runner calls sim::runTasks(), which runs every task until it blocks
+// (vTaskDelay, ulTaskNotifyTake). Runs stay reproducible, and the firmware
+// sees the task boundaries it would on the board, not their timing.
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackSize, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+void vTaskDelay(TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+void xTaskNotifyGive(TaskHandle_t task);
+TaskHandle_t xTaskGetCurrentTaskHandle();  // NULL outside a task
+BaseType_t xPortGetCoreID();  // 1 outside a task: loop() runs on core 1
@@ -0,0 +1,430 @@
+// === HOST RUNNER ===
+// Boots the generated firmware (setup()) and drives it from a script, one
+// statement per line ('#' starts a comment):
+//
+//   Models
+//     analog <pin> <value> [noise]        ADC reading (+/- noise counts)
+//     input <pin> <0|1>                   input level
+//     echo <trig> <echo> <cm>             HC-SR04
+//     ds18b20 <pin> <celsius>...          1-Wire bus, one probe per value
+//     dht22 <pin> <celsius> <rh>
+//     uart <rx> <baud> <period_ms> <hex>  sensor streaming a frame
+//     modbus <rx> <tx> <baud> <addr>...   Modbus RTU slaves
+//     pulses <pin> <hz>
+//
+//   Actions
+//     send <line>                         console command, prints the reply
+//     udp <datagram>                      UDP command, prints the reply
+//     wait <ms>                           runs loop(), prints pushed replies
+//     expect <text>                       fails the run unless <text> was
+//                                         output since the last send/udp
+//     bench <iterations> <line>           microbenchmark (see below)
+//
+// bench calls processCommand() directly (no transport) `iterations` times.
+// In between it runs loop() once, or until the job a command started has
+// pushed its result, and reports:
+//   cmds_per_s   host throughput
+//   ns_mean/max  host time per command (max = worst-case handler latency)
+//   sim_mean/max simulated us the handler blocks the device
+//   loop_max     longest loop() pass in between, in simulated us (job steps)
+//   allocs       heap allocations per command, job steps included (should be 0)
+//
+// Usage: host_fw [--json] [--compare <baseline>] [--tolerance <pct>]
+//                [--serve] [script]
+// Without a script, statements are read from stdin. --json prints bench
+// results as JSON lines, the format --compare reads back: a result slower
+// than the baseline by more than the tolerance (default 25%), or with more
+// allocations, fails the run. --serve keeps running after the script with
+// the simulated clock following the wall clock: stdin lines go to the
+// console and WiFiUDP binds a real socket, so the backend can talk to it.
+
+#include "Arduino.h"
+#include "models.h"
+#include "sim.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+void setup();
+void loop();
+void hostProcessCommand(char* line, char* reply, size_t size);  // appended by build-host-firmware.ts
+
+extern bool hostServeUdp;
+
+static const uint64_t REPLY_TIMEOUT_US = 2000000;
+static const size_t REPLY_SIZE = 1024;
+static const size_t LINE_SIZE = 256;
+
+struct BenchResult {
+  std::string line;
+  unsigned long iterations;
+  double nsMean;
+  double nsMax;
+  double simMean;
+  double simMax;
+  double loopMax;
+  double allocs;
+  unsigned long errors;
+};
+
+struct Options {
+  bool json = false;
+  bool serve = false;
+  std::string compare;
+  double tolerance = 25;
+  std::string script;
+};
+
+static std::vector<std::unique_ptr<sim::PinModel>> pinModels;
+static std::vector<std::unique_ptr<ModbusSlaves>> busModels;
+static std::vector<std::unique_ptr<UartStream>> streamModels;
+static std::vector<std::unique_ptr<PulseSource>> pulseModels;
+static std::vector<BenchResult> results;
+static std::string lastOutput;
+static bool failed = false;
+
+// One loop() pass, then the tasks' turn; an idle pass still costs the board
+// some time
+static void step() {
+  uint64_t before = sim::now();
+  loop();
+  sim::runTasks();
+  if (sim::now() == before) sim::advance(10);
+}
+
+static void runFor(uint64_t us) {
+  uint64_t end = sim::now() + us;
+  while (sim::now() < end) step();
+}
+
+// Runs loop() until `output` yields a JSON line, or the timeout
+static std::string awaitReply(std::string (*output)()) {
+  std::string collected;
+  uint64_t end = sim::now() + REPLY_TIMEOUT_US;
+  while (sim::now() < end) {
+    step();
+    collected += output();
+    if (collected.find("\n{") != std::string::npos || collected.rfind("{", 0) == 0) {
+      if (collected.back() == '\n') break;
+    }
+  }
+  return collected;
+}
+
+static void printReplies(const std::string& output) {
+  std::istringstream lines(output);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    if (!line.empty() && line[0] == '{') std::cout << "< " << line << "\n";
+  }
+}
+
+static std::vector<uint8_t> parseHex(const std::string& hex) {
+  std::vector<uint8_t> bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) bytes.push_back((uint8_t)strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+  return bytes;
+}
+
+static std::string jsonEscape(const std::string& s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+// === BENCH ===
+static void bench(unsigned long iterations, const std::string& line, bool json) {
+  static char input[LINE_SIZE];
+  static char reply[REPLY_SIZE];
+  BenchResult r = { line, iterations, 0, 0, 0, 0, 0, 0, 0 };
+  if (iterations == 0) return;
+
+  uint64_t allocs = 0;
+  for (unsigned long i = 0; i < iterations; i++) {
+    strncpy(input, line.c_str(), sizeof(input) - 1);  // processCommand splits in place
+    uint64_t simStart = sim::now();
+    uint64_t allocStart = sim::counters().allocations;
+    auto wallStart = std::chrono::steady_clock::now();
+    hostProcessCommand(input, reply, sizeof(reply));
+    auto wallEnd = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(wallEnd - wallStart).count();
+    double simUs = (double)(sim::now() - simStart);
+    r.nsMean += ns;
+    r.simMean += simUs;
+    if (ns > r.nsMax) r.nsMax = ns;
+    if (simUs > r.simMax) r.simMax = simUs;
+    if (strstr(reply, "\"error\"")) r.errors++;
+
+    bool pending = strstr(reply, "\"pending\":1") != nullptr;
+    uint64_t end = sim::now() + REPLY_TIMEOUT_US;
+    do {
+      uint64_t loopStart = sim::now();
+      step();
+      if (sim::now() - loopStart > r.loopMax) r.loopMax = (double)(sim::now() - loopStart);
+      if (sim::takeConsoleOutput().find("{\"job\":") != std::string::npos) pending = false;
+    } while (pending && sim::now() < end);
+    allocs += sim::counters().allocations - allocStart;
+  }
+  r.nsMean /= iterations;
+  r.simMean /= iterations;
+  r.allocs = (double)allocs / iterations;
+  sim::takeConsoleOutput();
+  sim::takeUdpOutput();
+  lastOutput = reply;
+  results.push_back(r);
+
+  if (json) {
+    printf("{\"bench\":\"%s\",\"iterations\":%lu,\"cmds_per_s\":%.0f,\"ns_mean\":%.0f,\"ns_max\":%.0f,"
+           "\"sim_us_mean\":%.1f,\"sim_us_max\":%.0f,\"loop_us_max\":%.0f,\"allocs_per_cmd\":%.2f,"
+           "\"errors\":%lu}\n",
+           jsonEscape(line).c_str(), r.iterations, 1e9 / r.nsMean, r.nsMean, r.nsMax, r.simMean, r.simMax, r.loopMax,
+           r.allocs, r.errors);
+  } else {
+    printf("%-40.40s %7lu %10.0f %8.0f %8.0f %9.1f %9.0f %9.0f %6.2f %s\n", line.c_str(), r.iterations,
+           1e9 / r.nsMean, r.nsMean, r.nsMax, r.simMean, r.simMax, r.loopMax, r.allocs, r.errors ? "errors" : "");
+  }
+  fflush(stdout);
+}
+
+static void printBenchHeader() {
+  printf("%-40s %7s %10s %8s %8s %9s %9s %9s %6s\n", "command", "iters", "cmds/s", "ns_mean", "ns_max", "sim_mean",
+         "sim_max", "loop_max", "allocs");
+}
+
+static bool jsonNumber(const std::string& line, const char* key, double& value) {
+  std::string needle = std::string("\"") + key + "\":";
+  size_t pos = line.find(needle);
+  if (pos == std::string::npos) return false;
+  value = strtod(line.c_str() + pos + needle.size(), nullptr);
+  return true;
+}
+
+static bool jsonString(const std::string& line, const char* key, std::string& value) {
+  std::string needle = std::string("\"") + key + "\":\"";
+  size_t pos = line.find(needle);
+  if (pos == std::string::npos) return false;
+  value.clear();
+  for (size_t i = pos + needle.size(); i < line.size() && line[i] != '"'; i++) {
+    if (line[i] == '\\' && i + 1 < line.size()) i++;
+    value += line[i];
+  }
+  return true;
+}
+
+// Compares this run with a --json baseline; false on a regression
+static bool compareBaseline(const Options& options) {
+  std::ifstream in(options.compare);
+  if (!in) {
+    fprintf(stderr, "host: cannot read baseline %s\n", options.compare.c_str());
+    return false;
+  }
+  std::map<std::string, std::string> baseline;
+  std::string line, name;
+  while (std::getline(in, line)) {
+    if (jsonString(line, "bench", name)) baseline[name] = line;
+  }
+
+  bool ok = true;
+  double limit = 1 + options.tolerance / 100;
+  for (const BenchResult& r : results) {
+    auto it = baseline.find(r.line);
+    if (it == baseline.end()) continue;
+    double nsMean = 0, simMax = 0, loopMax = 0, allocs = 0;
+    jsonNumber(it->second, "ns_mean", nsMean);
+    jsonNumber(it->second, "sim_us_max", simMax);
+    jsonNumber(it->second, "loop_us_max", loopMax);
+    jsonNumber(it->second, "allocs_per_cmd", allocs);
+    if (r.nsMean > nsMean * limit + 50) {  // slack for timer noise on the fastest commands
+      fprintf(stderr, "REGRESSION %s: %.0f ns/cmd (baseline %.0f)\n", r.line.c_str(), r.nsMean, nsMean);
+      ok = false;
+    }
+    if (r.simMax > simMax * limit + 10) {
+      fprintf(stderr, "REGRESSION %s: blocks %.0f us (baseline %.0f)\n", r.line.c_str(), r.simMax, simMax);
+      ok = false;
+    }
+    if (r.loopMax > loopMax * limit + 10) {
+      fprintf(stderr, "REGRESSION %s: loop pass of %.0f us (baseline %.0f)\n", r.line.c_str(), r.loopMax, loopMax);
+      ok = false;
+    }
+    if (r.allocs > allocs + 0.005) {
+      fprintf(stderr, "REGRESSION %s: %.2f allocations/cmd (baseline %.2f)\n", r.line.c_str(), r.allocs, allocs);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// === SCRIPT ===
+static void execute(const std::string& statement, const Options& options) {
+  std::istringstream in(statement);
+  std::string op;
+  in >> op;
+  if (op.empty() || op[0] == '#') return;
+  std::string rest;
+  std::getline(in >> std::ws, rest);
+  std::istringstream args(rest);
+
+  if (op == "analog") {
+    int pin, value, noise = 0;
+    args >> pin >> value >> noise;
+    sim::setAnalog(pin, value, noise);
+  } else if (op == "input") {
+    int pin, level;
+    args >> pin >> level;
+    sim::setLevel(pin, level);
+  } else if (op == "echo") {
+    int trig, echo;
+    float cm;
+    args >> trig >> echo >> cm;
+    pinModels.emplace_back(new EchoSensor(trig, echo, cm));
+  } else if (op == "ds18b20") {
+    int pin;
+    float celsius;
+    args >> pin;
+    Ds18b20Bus* bus = new Ds18b20Bus(pin);
+    while (args >> celsius) bus->addProbe(celsius);
+    pinModels.emplace_back(bus);
+  } else if (op == "dht22") {
+    int pin;
+    float celsius, rh;
+    args >> pin >> celsius >> rh;
+    pinModels.emplace_back(new Dht22(pin, celsius, rh));
+  } else if (op == "uart") {
+    int rx;
+    unsigned long baud, periodMs;
+    std::string hex;
+    args >> rx >> baud >> periodMs >> hex;
+    streamModels.emplace_back(new UartStream(rx, baud, periodMs, parseHex(hex)));
+  } else if (op == "modbus") {
+    int rx, tx, address;
+    unsigned long baud;
+    args >> rx >> tx >> baud;
+    ModbusSlaves* slaves = new ModbusSlaves(rx, tx, baud);
+    while (args >> address) slaves->addSlave(address);
+    busModels.emplace_back(slaves);
+  } else if (op == "pulses") {
+    int pin;
+    float hz;
+    args >> pin >> hz;
+    pulseModels.emplace_back(new PulseSource(pin, hz));
+  } else if (op == "send") {
+    std::cout << "> " << rest << "\n";
+    sim::takeConsoleOutput();
+    sim::consoleInput(rest);
+    lastOutput = awaitReply(sim::takeConsoleOutput);
+    printReplies(lastOutput);
+  } else if (op == "udp") {
+    std::cout << "> udp " << rest << "\n";
+    sim::takeUdpOutput();
+    sim::udpInput(rest);
+    lastOutput = awaitReply(sim::takeUdpOutput);
+    printReplies(lastOutput);
+  } else if (op == "wait") {
+    unsigned long ms = 0;
+    args >> ms;
+    runFor((uint64_t)ms * 1000);
+    std::string output = sim::takeConsoleOutput() + sim::takeUdpOutput();
+    printReplies(output);
+    lastOutput += output;
+  } else if (op == "expect") {
+    if (lastOutput.find(rest) == std::string::npos) {
+      fprintf(stderr, "EXPECT FAILED: %s\n", rest.c_str());
+      failed = true;
+    }
+  } else if (op == "bench") {
+    unsigned long iterations = 0;
+    std::string line;
+    args >> iterations;
+    std::getline(args >> std::ws, line);
+    if (results.empty() && !options.json) printBenchHeader();
+    bench(iterations, line, options.json);
+  } else {
+    fprintf(stderr, "host: unknown statement '%s'\n", op.c_str());
+    failed = true;
+  }
+  std::cout.flush();
+}
+
+// === SERVE ===
+static void serve() {
+  sim::setConsoleEcho(true);
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  bool stdinOpen = true;
+  auto start = std::chrono::steady_clock::now();
+  uint64_t simStart = sim::now();
+  std::string pending;
+  for (;;) {
+    pollfd in = { STDIN_FILENO, POLLIN, 0 };
+    if (stdinOpen && poll(&in, 1, 0) > 0) {
+      char buf[256];
+      ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+      if (n <= 0) stdinOpen = false;  // keep serving UDP
+      else pending.append(buf, (size_t)n);
+      size_t nl;
+      while ((nl = pending.find('\n')) != std::string::npos) {
+        sim::consoleInput(pending.substr(0, nl));
+        pending.erase(0, nl + 1);
+      }
+    }
+
+    loop();
+    sim::runTasks();
+    sim::takeConsoleOutput();
+    sim::takeUdpOutput();
+    uint64_t wall = simStart + (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                                   std::chrono::steady_clock::now() - start).count();
+    if (sim::now() < wall) {
+      sim::advance(wall - sim::now());
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(sim::now() - wall));
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--json") options.json = true;
+    else if (arg == "--serve") options.serve = true;
+    else if (arg == "--compare" && i + 1 < argc) options.compare = argv[++i];
+    else if (arg == "--tolerance" && i + 1 < argc) options.tolerance = atof(argv[++i]);
+    else options.script = arg;
+  }
+
+  hostServeUdp = options.serve;
+  sim::setConsoleEcho(options.serve);
+  setup();
+  sim::takeConsoleOutput();
+
+  std::ifstream file;
+  if (!options.script.empty()) {
+    file.open(options.script);
+    if (!file) {
+      fprintf(stderr, "host: cannot read %s\n", options.script.c_str());
+      return 2;
+    }
+  }
+  std::istream& script = options.script.empty() ? std::cin : file;
+  if (!options.script.empty() || !options.serve) {
+    std::string statement;
+    while (std::getline(script, statement)) execute(statement, options);
+  }
+
+  if (!options.compare.empty() && !compareBaseline(options)) failed = true;
+  if (options.serve) serve();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,369 @@
+// === HOST SENSOR MODELS ===
+
+#include "models.h"
+
+#include "Arduino.h"
+
+static uint8_t crc8Maxim(const uint8_t* data, size_t size) {
+  uint8_t crc = 0;
+  while (size--) {
+    uint8_t b = *data++;
+    for (uint8_t i = 0; i < 8; i++) {
+      uint8_t mix = (crc ^ b) & 0x01;
+      crc >>= 1;
+      if (mix) crc ^= 0x8C;
+      b >>= 1;
+    }
+  }
+  return crc;
+}
+
+static uint16_t crc16Modbus(const uint8_t* data, size_t size) {
+  uint16_t crc = 0xFFFF;
+  while (size--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++) crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+// === HC-SR04 ===
+EchoSensor::EchoSensor(uint8_t trig, uint8_t echo, float cm) : trig(trig), echo(echo), distanceCm(cm) {
+  sim::attach(trig, this);
+  sim::setLevel(echo, LOW);
+}
+
+void EchoSensor::onWrite(uint8_t pin, uint8_t level) {
+  bool falling = lastLevel == HIGH && level == LOW;
+  lastLevel = level;
+  if (!falling || distanceCm <= 0) return;
+  // The echo rises ~450 us after the burst and lasts the round trip
+  uint64_t width = (uint64_t)(distanceCm * 58.3f);
+  uint8_t pinEcho = echo;
+  sim::after(450, [pinEcho] { sim::setLevel(pinEcho, HIGH); });
+  sim::after(450 + width, [pinEcho] { sim::setLevel(pinEcho, LOW); });
+}
+
+// === DS18B20 ===
+Ds18b20Bus::Ds18b20Bus(uint8_t pin) : pin(pin) {
+  sim::attach(pin, this);
+  sim::setLevel(pin, HIGH);  // pull-up
+}
+
+void Ds18b20Bus::addProbe(float celsius) {
+  Probe probe = {};
+  probe.rom[0] = 0x28;  // DS18B20 family
+  probe.rom[1] = 0xA0 + (uint8_t)probes.size();
+  probe.rom[2] = 0x5E;
+  probe.rom[7] = crc8Maxim(probe.rom, 7);
+  probe.raw = (int16_t)lroundf(celsius * 16);
+  probe.scratch[0] = 0x4B;
+  probe.scratch[1] = 0x46;
+  probe.scratch[2] = 0x7F;  // 12 bit
+  probes.push_back(probe);
+}
+
+// The firmware pulls the line low with OUTPUT (latch LOW) and releases it
+// with INPUT; the slot type follows from how long it stayed low.
+void Ds18b20Bus::update(uint8_t busPin) {
+  bool nowLow = sim::driven(busPin);
+  if (nowLow == low) return;
+  low = nowLow;
+  uint64_t t = sim::now();
+  if (low) {
+    if (shortSlot) {
+      shortSlot = false;  // not sampled: it was a write-1 slot
+      onBit(1);
+    }
+    lowSince = t;
+    return;
+  }
+
+  uint64_t width = t - lowSince;
+  if (width >= 400) {
+    reset();
+    presenceUntil = t + 300;
+  } else if (width >= 15) {
+    onBit(0);
+  } else {
+    shortSlot = true;
+  }
+}
+
+int Ds18b20Bus::onRead(uint8_t busPin) {
+  if (low) return LOW;
+  if (sim::now() < presenceUntil) return probes.empty() ? HIGH : LOW;
+  if (!shortSlot) return HIGH;
+  shortSlot = false;
+  return readBit();
+}
+
+void Ds18b20Bus::reset() {
+  state = ROM_COMMAND;
+  shift = 0;
+  bits = 0;
+  shortSlot = false;
+  for (Probe& probe : probes) {
+    probe.active = true;
+    probe.selected = false;
+  }
+}
+
+void Ds18b20Bus::onBit(uint8_t bit) {
+  presenceUntil = 0;
+  if (state == SEARCH_ROM || state == MATCH_ROM) {
+    // Direction chosen by the master: probes with the other bit drop out
+    for (Probe& probe : probes) {
+      if (probe.active && romBit(probe) != bit) probe.active = false;
+    }
+    searchPhase = 0;
+    if (++bitIndex == 64) {
+      for (Probe& probe : probes) probe.selected = probe.active;
+      state = FUNCTION_COMMAND;
+    }
+    return;
+  }
+
+  shift |= bit << bits;
+  if (++bits < 8) return;
+  uint8_t b = shift;
+  shift = 0;
+  bits = 0;
+  onByte(b);
+}
+
+void Ds18b20Bus::onByte(uint8_t b) {
+  if (state == ROM_COMMAND) {
+    if (b == 0xCC) {
+      for (Probe& probe : probes) probe.selected = true;
+      state = FUNCTION_COMMAND;
+    } else if (b == 0x55 || b == 0xF0) {
+      state = b == 0x55 ? MATCH_ROM : SEARCH_ROM;
+      bitIndex = 0;
+      searchPhase = 0;
+    } else {
+      state = IDLE;
+    }
+    return;
+  }
+
+  if (state == WRITE_SCRATCH) {
+    buffer.push_back(b);
+    if (buffer.size() < 3) return;
+    for (Probe& probe : probes) {
+      if (!probe.selected) continue;
+      memcpy(probe.scratch, buffer.data(), 3);
+      probe.scratch[2] |= 0x1F;
+    }
+    state = IDLE;
+    return;
+  }
+
+  if (state != FUNCTION_COMMAND) return;
+  if (b == 0x44) {
+    for (Probe& probe : probes) {
+      if (!probe.selected) continue;
+      uint8_t resolution = (probe.scratch[2] >> 5) & 0x03;
+      probe.readyAt = sim::now() + (750000ULL >> (3 - resolution));
+    }
+    state = CONVERTING;
+  } else if (b == 0x4E) {
+    buffer.clear();
+    state = WRITE_SCRATCH;
+  } else if (b == 0xBE) {
+    // Wired-AND of every selected probe's scratchpad
+    buffer.assign(9, 0xFF);
+    for (const Probe& probe : probes) {
+      if (!probe.selected) continue;
+      uint8_t resolution = (probe.scratch[2] >> 5) & 0x03;
+      int16_t raw = probe.raw & ~((1 << (3 - resolution)) - 1);
+      uint8_t data[9] = { (uint8_t)(raw & 0xFF), (uint8_t)(raw >> 8), probe.scratch[0], probe.scratch[1],
+                          probe.scratch[2], 0xFF, 0x0C, 0x10, 0 };
+      data[8] = crc8Maxim(data, 8);
+      for (uint8_t i = 0; i < 9; i++) buffer[i] &= data[i];
+    }
+    readPos = 0;
+    state = READ_SCRATCH;
+  }
+}
+
+int Ds18b20Bus::readBit() {
+  if (state == SEARCH_ROM) {
+    // Bit, then its complement, of every probe still in the search (wired-AND)
+    uint8_t level = 1;
+    for (const Probe& probe : probes) {
+      if (probe.active) level &= searchPhase == 0 ? romBit(probe) : !romBit(probe);
+    }
+    searchPhase = 1;
+    return level;
+  }
+  if (state == READ_SCRATCH) {
+    if (readPos >= 72) return HIGH;
+    int bit = (buffer[readPos / 8] >> (readPos % 8)) & 1;
+    readPos++;
+    return bit;
+  }
+  if (state == CONVERTING) {
+    for (const Probe& probe : probes) {
+      if (probe.selected && sim::now() < probe.readyAt) return LOW;
+    }
+    return HIGH;
+  }
+  return HIGH;
+}
+
+// === DHT22 ===
+Dht22::Dht22(uint8_t pin, float celsius, float humidity) : pin(pin), temp(celsius), rh(humidity) {
+  sim::attach(pin, this);
+  sim::setLevel(pin, HIGH);
+}
+
+void Dht22::update(uint8_t dataPin) {
+  bool nowLow = sim::driven(dataPin);
+  if (nowLow == low) return;
+  low = nowLow;
+  if (low) {
+    lowSince = sim::now();
+  } else if (sim::now() - lowSince >= 800) {
+    playFrame();
+  }
+}
+
+void Dht22::playFrame() {
+  uint16_t humidity = (uint16_t)lroundf(rh * 10);
+  uint16_t t = (uint16_t)lroundf(fabsf(temp) * 10);
+  if (temp < 0) t |= 0x8000;
+  uint8_t data[5] = { (uint8_t)(humidity >> 8), (uint8_t)humidity, (uint8_t)(t >> 8), (uint8_t)t, 0 };
+  data[4] = data[0] + data[1] + data[2] + data[3];
+
+  // Response: 80 us low, 80 us high; then per bit 50 us low + 26/70 us high
+  uint8_t dataPin = pin;
+  uint64_t at = sim::now() + 30;
+  sim::at(at, [dataPin] { sim::setLevel(dataPin, LOW); });
+  at += 80;
+  sim::at(at, [dataPin] { sim::setLevel(dataPin, HIGH); });
+  at += 80;
+  for (uint8_t i = 0; i < 40; i++) {
+    sim::at(at, [dataPin] { sim::setLevel(dataPin, LOW); });
+    at += 50;
+    sim::at(at, [dataPin] { sim::setLevel(dataPin, HIGH); });
+    at += (data[i / 8] >> (7 - i % 8)) & 1 ? 70 : 26;
+  }
+  sim::at(at, [dataPin] { sim::setLevel(dataPin, LOW); });
+  sim::at(at + 50, [dataPin] { sim::setLevel(dataPin, HIGH); });
+}
+
+// === UART STREAM ===
+UartStream::UartStream(uint8_t rx, unsigned long baud, unsigned long periodMs, const std::vector<uint8_t>& frame)
+  : rx(rx), baud(baud), periodMs(periodMs ? periodMs : 100), frame(frame) {
+  sim::after(this->periodMs * 1000, [this] { send(); });
+}
+
+void UartStream::send() {
+  sim::deliver(rx, frame.data(), frame.size(), baud, sim::now());
+  sim::after(periodMs * 1000, [this] { send(); });
+}
+
+// === MODBUS RTU ===
+ModbusSlaves::ModbusSlaves(uint8_t rx, uint8_t tx, unsigned long baud) : rx(rx), baud(baud) {
+  for (int i = 0; i < 256; i++) {
+    registers[i] = 100 + i;
+    coils[i] = i & 1;
+  }
+  sim::attachSerial(tx, this);
+}
+
+void ModbusSlaves::onByte(uint8_t b) {
+  // A t3.5 gap starts a new request
+  uint64_t t = sim::now();
+  if (!request.empty() && t - lastByteAt > 35000000ULL / baud + 1000) request.clear();
+  lastByteAt = t;
+
+  request.push_back(b);
+  if (request.size() < 8) return;
+  uint8_t fc = request[1];
+  size_t needed = (fc == 15 || fc == 16) ? 9 + request[6] : 8;
+  if (request.size() < needed) return;
+
+  std::vector<uint8_t> frame;
+  frame.swap(request);
+  uint16_t crc = frame[frame.size() - 2] | (frame[frame.size() - 1] << 8);
+  if (crc16Modbus(frame.data(), frame.size() - 2) == crc) answer(frame);
+}
+
+void ModbusSlaves::answer(const std::vector<uint8_t>& q) {
+  uint8_t address = q[0];
+  uint8_t fc = q[1];
+  if (address >= 248 || !present[address]) return;
+  uint16_t start = (q[2] << 8) | q[3];
+  uint16_t count = (q[4] << 8) | q[5];
+  if (start + (fc == 5 || fc == 6 ? 1 : count) > 256) {
+    reply({ address, (uint8_t)(fc | 0x80), 2 });  // illegal data address
+    return;
+  }
+
+  std::vector<uint8_t> r = { address, fc };
+  switch (fc) {
+    case 1:
+    case 2:
+      r.push_back((uint8_t)((count + 7) / 8));
+      for (uint16_t i = 0; i < count; i += 8) {
+        uint8_t packed = 0;
+        for (uint8_t k = 0; k < 8 && i + k < count; k++) packed |= coils[start + i + k] << k;
+        r.push_back(packed);
+      }
+      break;
+    case 3:
+    case 4:
+      r.push_back((uint8_t)(count * 2));
+      for (uint16_t i = 0; i < count; i++) {
+        r.push_back(registers[start + i] >> 8);
+        r.push_back(registers[start + i] & 0xFF);
+      }
+      break;
+    case 5:
+      coils[start] = count == 0xFF00;
+      r.insert(r.end(), q.begin() + 2, q.begin() + 6);
+      break;
+    case 6:
+      registers[start] = count;
+      r.insert(r.end(), q.begin() + 2, q.begin() + 6);
+      break;
+    case 15:
+      for (uint16_t i = 0; i < count; i++) coils[start + i] = (q[7 + i / 8] >> (i % 8)) & 1;
+      r.insert(r.end(), q.begin() + 2, q.begin() + 6);
+      break;
+    case 16:
+      for (uint16_t i = 0; i < count; i++) registers[start + i] = (q[7 + 2 * i] << 8) | q[8 + 2 * i];
+      r.insert(r.end(), q.begin() + 2, q.begin() + 6);
+      break;
+    default:
+      r = { address, (uint8_t)(fc | 0x80), 1 };  // illegal function
+  }
+  reply(r);
+}
+
+void ModbusSlaves::reply(std::vector<uint8_t> frame) {
+  uint16_t crc = crc16Modbus(frame.data(), frame.size());
+  frame.push_back(crc & 0xFF);
+  frame.push_back(crc >> 8);
+  sim::deliver(rx, frame.data(), frame.size(), baud, sim::now() + 5000);  // 5 ms turnaround
+}
+
+// === PULSES ===
+PulseSource::PulseSource(uint8_t pin, float hz) : pin(pin), rate(hz) {
+  sim::setLevel(pin, HIGH);
+  tick(true);
+}
+
+void PulseSource::tick(bool high) {
+  if (rate <= 0) {
+    sim::after(100000, [this, high] { tick(high); });  // paused; check again
+    return;
+  }
+  uint64_t half = (uint64_t)(500000.0f / rate);
+  sim::after(half ? half : 1, [this, high] {
+    sim::setLevel(pin, high ? LOW : HIGH);
+    tick(!high);
+  });
+}
@@ -0,0 +1,139 @@
+// === HOST SENSOR MODELS ===
+// Pin- and byte-level stand-ins for the sensors the commands talk to. Each
+// one answers the firmware's own protocol code, so a host run exercises the
+// same bit-banging, interrupt and frame-parsing paths as a board.
+
+#pragma once
+
+#include "sim.h"
+
+#include <vector>
+
+// HC-SR04: a trigger pulse on `trig` answers with an echo pulse on `echo`,
+// 58 us per cm. A distance of 0 never echoes.
+class EchoSensor : public sim::PinModel {
+ public:
+  EchoSensor(uint8_t trig, uint8_t echo, float cm);
+  void setDistance(float cm) { distanceCm = cm; }
+  void onWrite(uint8_t pin, uint8_t level) override;
+
+ private:
+  uint8_t trig;
+  uint8_t echo;
+  float distanceCm;
+  uint8_t lastLevel = 0;
+};
+
+// DS18B20 probes on a 1-Wire bus: reset/presence, ROM search, match/skip
+// ROM, write/read scratchpad and convert with the resolution's conversion
+// time, all decoded from how long the firmware holds the line low.
+class Ds18b20Bus : public sim::PinModel {
+ public:
+  explicit Ds18b20Bus(uint8_t pin);
+  void addProbe(float celsius);
+  void onMode(uint8_t pin, uint8_t mode) override { update(pin); }
+  void onWrite(uint8_t pin, uint8_t level) override { update(pin); }
+  int onRead(uint8_t pin) override;
+
+ private:
+  struct Probe {
+    uint8_t rom[8];
+    int16_t raw;             // 1/16 C
+    uint8_t scratch[3];      // TH, TL, config
+    bool active;             // still in the search / match
+    bool selected;
+    uint64_t readyAt;        // end of the conversion
+  };
+
+  enum State { ROM_COMMAND, FUNCTION_COMMAND, MATCH_ROM, SEARCH_ROM, WRITE_SCRATCH, READ_SCRATCH, CONVERTING, IDLE };
+
+  void update(uint8_t pin);
+  void reset();
+  void onBit(uint8_t bit);
+  void onByte(uint8_t b);
+  int readBit();
+  uint8_t romBit(const Probe& probe) const { return (probe.rom[bitIndex / 8] >> (bitIndex % 8)) & 1; }
+
+  uint8_t pin;
+  std::vector<Probe> probes;
+  bool low = false;
+  bool shortSlot = false;    // a short low: write-1 unless sampled (read slot)
+  uint64_t lowSince = 0;
+  uint64_t presenceUntil = 0;
+  State state = IDLE;
+  uint8_t shift = 0;
+  uint8_t bits = 0;
+  uint8_t bitIndex = 0;
+  uint8_t searchPhase = 0;
+  std::vector<uint8_t> buffer;
+  size_t readPos = 0;
+};
+
+// DHT22: releasing the line after a start signal (>= 0.8 ms low) plays the
+// 40-bit frame with its 50 us low / 26 or 70 us high bit timing.
+class Dht22 : public sim::PinModel {
+ public:
+  Dht22(uint8_t pin, float celsius, float humidity);
+  void set(float celsius, float humidity) { temp = celsius; rh = humidity; }
+  void onMode(uint8_t pin, uint8_t mode) override { update(pin); }
+  void onWrite(uint8_t pin, uint8_t level) override { update(pin); }
+
+ private:
+  void update(uint8_t pin);
+  void playFrame();
+
+  uint8_t pin;
+  float temp;
+  float rh;
+  bool low = false;
+  uint64_t lowSince = 0;
+};
+
+// A UART sensor streaming `frame` every `periodMs` to `rx` (A02YYUW, ...)
+class UartStream {
+ public:
+  UartStream(uint8_t rx, unsigned long baud, unsigned long periodMs, const std::vector<uint8_t>& frame);
+
+ private:
+  void send();
+
+  uint8_t rx;
+  unsigned long baud;
+  unsigned long periodMs;
+  std::vector<uint8_t> frame;
+};
+
+// Modbus RTU slaves behind a SoftwareSerial pair. Register i holds
+// 100 + i, coil i holds i & 1; writes change them. Addresses not added
+// stay silent.
+class ModbusSlaves : public sim::SerialModel {
+ public:
+  ModbusSlaves(uint8_t rx, uint8_t tx, unsigned long baud);
+  void addSlave(uint8_t address) { present[address] = true; }
+  void onByte(uint8_t b) override;
+
+ private:
+  void answer(const std::vector<uint8_t>& request);
+  void reply(std::vector<uint8_t> frame);
+
+  uint8_t rx;
+  unsigned long baud;
+  bool present[248] = {};
+  uint16_t registers[256];
+  uint8_t coils[256];
+  std::vector<uint8_t> request;
+  uint64_t lastByteAt = 0;
+};
+
+// Falling edges on `pin` at `hz` (flow meters, anemometers)
+class PulseSource {
+ public:
+  PulseSource(uint8_t pin, float hz);
+  void setRate(float hz) { rate = hz; }
+
+ private:
+  void tick(bool high);
+
+  uint8_t pin;
+  float rate;
+};
@@ -0,0 +1,81 @@
+// === HOST SIMULATION API ===
+// What core.cpp simulates and how models plug into it. The firmware only
+// sees the Arduino API; the runner (main.cpp) and the models use this.
+//
+// Time is virtual: micros() starts at 0 and only moves when the firmware
+// waits (delay, delayMicroseconds, a timed read) or the runner advances it.
+// Every clock read also moves it by 1 us, so a busy-wait on micros() ends.
+// Runs are therefore reproducible, and the simulated time a handler spends
+// is what it would block the board for (timing loops aside).
+//
+// Pin levels come from the pin's model if it has one, else from what the
+// runner set. Models change input levels with setLevel(), which fires the
+// pin's interrupt like a real edge would.
+
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+
+namespace sim {
+
+// --- Clock ---
+uint64_t now();                                  // simulated us
+void advance(uint64_t us);                       // fires due events on the way
+void at(uint64_t us, std::function<void()> fn);  // event at simulated time `us`
+void after(uint64_t us, std::function<void()> fn);
+
+// --- Pins ---
+class PinModel {
+ public:
+  virtual ~PinModel() { }
+  virtual void onMode(uint8_t pin, uint8_t mode) { }
+  virtual void onWrite(uint8_t pin, uint8_t level) { }
+  virtual int onRead(uint8_t pin) { return -1; }  // -1 = the pin's input level
+};
+
+void attach(uint8_t pin, PinModel* model);
+void setLevel(uint8_t pin, uint8_t level);       // input level, fires the ISR on an edge
+uint8_t pinMode(uint8_t pin);
+uint8_t outputLevel(uint8_t pin);                // last digitalWrite
+bool driven(uint8_t pin);                        // OUTPUT and LOW: pulls an open-drain bus
+void setAnalog(uint8_t pin, int value, int noise = 0);
+
+// --- Serial lines (SoftwareSerial) ---
+// A model attached to a TX pin gets every byte the firmware sends on it and
+// answers by delivering bytes to an RX pin.
+class SerialModel {
+ public:
+  virtual ~SerialModel() { }
+  virtual void onByte(uint8_t b) = 0;
+};
+
+void attachSerial(uint8_t txPin, SerialModel* model);
+void deliver(uint8_t rxPin, const uint8_t* data, size_t size, unsigned long baud, uint64_t startUs);
+int serialAvailable(uint8_t rxPin);
+int serialRead(uint8_t rxPin, bool consume);
+void serialSent(uint8_t txPin, uint8_t b);
+
+// --- Console and UDP ---
+void consoleInput(const std::string& line);      // Serial: a line, '\n' appended
+void udpInput(const std::string& datagram);      // next packet for parsePacket()
+void setConsoleEcho(bool on);                    // print Serial output to stdout
+std::string takeConsoleOutput();                 // since the last call
+std::string takeUdpOutput();                     // datagrams sent, one per line
+
+// --- Tasks ---
+// FreeRTOS tasks (dual_core plugin) run in lockstep with loop(): the runner
+// calls this after every pass and each task runs until it blocks.
+void runTasks();
+
+// --- Counters ---
+struct Counters {
+  uint64_t allocations;     // malloc/new calls
+  uint64_t allocatedBytes;
+  uint64_t eepromWrites;    // bytes changed
+  uint64_t eepromCommits;
+};
+const Counters& counters();
+
+}  // namespace sim
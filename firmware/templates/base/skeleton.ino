@@ -9,38 +9,547 @@
 #include <Arduino.h>
 {{INCLUDES}}
 
+// === RESPONSE BUFFER ===
+// Handlers write their JSON reply into a fixed buffer (responseStorage, see
+// INPUT SOURCES), so answering a command never touches the heap.
+#ifndef RESPONSE_BUFFER_SIZE
+  #if defined(__AVR__)
+    #define RESPONSE_BUFFER_SIZE 256
+  #else
+    #define RESPONSE_BUFFER_SIZE 1024
+  #endif
+#endif
+
+#ifndef COMMAND_BUFFER_SIZE
+  #define COMMAND_BUFFER_SIZE 128
+#endif
+
+class ResponseBuffer : public Print {
+public:
+  ResponseBuffer(char* storage, size_t capacity) : buf(storage), cap(capacity), len(0), overflowed(false) {
+    buf[0] = '\0';
+  }
+
+  size_t write(uint8_t c) override {
+    if (len + 1 >= cap) {
+      overflowed = true;
+      return 0;
+    }
+    buf[len++] = (char)c;
+    buf[len] = '\0';
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) override {
+    size_t room = cap - 1 - len;
+    if (size > room) {
+      overflowed = true;
+      size = room;
+    }
+    memcpy(buf + len, data, size);
+    len += size;
+    buf[len] = '\0';
+    return size;
+  }
+  using Print::write;
+
+  void clear() {
+    len = 0;
+    buf[0] = '\0';
+    overflowed = false;
+  }
+
+  // Writes {"ok":0,"error":"<code>"}; handlers use it as `return res.error(F("ERR_..."));`
+  void error(const __FlashStringHelper* code) {
+    print(F("{\"ok\":0,\"error\":\""));
+    print(code);
+    print(F("\"}"));
+  }
+
+  // Inserts `text` at `pos` (e.g. a field after the opening brace); false if
+  // it does not fit
+  bool insert(size_t pos, const char* text) {
+    size_t size = strlen(text);
+    if (pos > len || len + size + 1 > cap) return false;
+    memmove(buf + pos + size, buf + pos, len - pos + 1);
+    memcpy(buf + pos, text, size);
+    len += size;
+    return true;
+  }
+
+  // The free space after the reply, for a nested reply written in place
+  // (BATCH items); append() then adds the `size` bytes written there
+  char* tail() { return buf + len; }
+  size_t space() const { return cap - 1 - len; }
+  void append(size_t size) {
+    len += size;
+    buf[len] = '\0';
+  }
+
+  const char* c_str() const { return buf; }
+  size_t length() const { return len; }
+  size_t capacity() const { return cap; }
+  bool overflow() const { return overflowed; }
+
+private:
+  char* buf;
+  size_t cap;
+  size_t len;
+  bool overflowed;
+};
+
+// === PARAM READER ===
+// Single-pass reader for JSON command parameters (CMD|{"a":1,"b":[2,3]}).
+// It walks the text in place: no document, no copies, no heap. The handler
+// pulls the members it knows and skips the rest:
+//
+//   ParamReader in(params);
+//   char key[16];
+//   if (in.beginObject()) {
+//     while (in.nextKey(key, sizeof(key))) {
+//       if (strcmp(key, "slaveId") == 0) slaveId = in.readLong(1);
+//       else in.skip();
+//     }
+//   }
+//   if (in.failed()) return res.error(F("JSON_PARSE_ERROR"));
+class ParamReader {
+public:
+  explicit ParamReader(const char* json) : p(json ? json : "{}"), ok(true), atStart(false), lastLen(0) {}
+
+  bool beginObject() { return open('{'); }
+  bool beginArray() { return open('['); }
+
+  // Advances to the next member; false at the closing brace (or on error).
+  // A key that does not fit into keySize comes back as "" (matches nothing).
+  bool nextKey(char* key, size_t keySize) {
+    if (!next('}')) return false;
+    if (*p != '"' || !copyString(key, keySize)) return fail();
+    if (lastLen >= keySize) key[0] = '\0';
+    skipSpace();
+    if (*p != ':') return fail();
+    p++;
+    skipSpace();
+    return true;
+  }
+
+  // Advances to the next array element; false at the closing bracket.
+  bool nextItem() { return next(']'); }
+
+  // Numbers (fraction dropped), true/false as 1/0, null as `fallback`
+  long readLong(long fallback) {
+    if (!ok) return fallback;
+    if (strncmp(p, "null", 4) == 0) { p += 4; return fallback; }
+    if (strncmp(p, "true", 4) == 0) { p += 4; return 1; }
+    if (strncmp(p, "false", 5) == 0) { p += 5; return 0; }
+    char* end;
+    long v = strtol(p, &end, 10);
+    if (end == p) { fail(); return fallback; }
+    p = end;
+    if (*p == '.' || *p == 'e' || *p == 'E') skipNumber();
+    return v;
+  }
+
+  // Copies a string value (truncated to size - 1); NULL if it is not a string
+  const char* readString(char* out, size_t size) {
+    if (!ok || *p != '"') {
+      fail();
+      return NULL;
+    }
+    return copyString(out, size) ? out : NULL;
+  }
+
+  // Skips any value, including nested arrays and objects
+  void skip() {
+    if (!ok) return;
+    uint8_t depth = 0;
+    do {
+      if (*p == '"') {
+        if (!copyString(NULL, 0)) return;
+      } else if (*p == '{' || *p == '[') {
+        depth++;
+        p++;
+      } else if (*p == '}' || *p == ']') {
+        if (depth == 0) { fail(); return; }
+        depth--;
+        p++;
+      } else if (*p == '\0') {
+        fail();
+        return;
+      } else if (depth == 0) {
+        skipNumber();  // number or literal
+        return;
+      } else {
+        p++;
+      }
+    } while (depth > 0);
+  }
+
+  bool failed() const { return !ok; }
+
+private:
+  const char* p;
+  bool ok;
+  bool atStart;    // just opened an object/array: no comma before the first member
+  size_t lastLen;  // untruncated length of the last string copied
+
+  bool fail() {
+    ok = false;
+    return false;
+  }
+
+  void skipSpace() {
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+  }
+
+  // Literals and numbers end at the next delimiter
+  void skipNumber() {
+    while (*p && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\r' && *p != '\n' && *p != '\t') p++;
+  }
+
+  bool open(char c) {
+    if (!ok) return false;
+    skipSpace();
+    if (*p != c) return fail();
+    p++;
+    atStart = true;
+    return true;
+  }
+
+  bool next(char close) {
+    if (!ok) return false;
+    skipSpace();
+    if (*p == close) {
+      p++;
+      atStart = false;
+      return false;
+    }
+    if (!atStart) {
+      if (*p != ',') return fail();
+      p++;
+      skipSpace();
+    }
+    atStart = false;
+    return true;
+  }
+
+  // p is at the opening quote; leaves it after the closing one. out may be NULL.
+  bool copyString(char* out, size_t size) {
+    size_t n = 0;
+    p++;
+    while (*p != '"') {
+      char c = *p++;
+      if (c == '\0') return fail();
+      if (c == '\\') {
+        c = *p++;
+        if (c == '\0') return fail();
+        if (c == 'n') c = '\n';
+        else if (c == 't') c = '\t';
+      }
+      if (out && n + 1 < size) out[n] = c;
+      n++;
+    }
+    p++;
+    lastLen = n;
+    if (out && size > 0) out[n + 1 < size ? n : size - 1] = '\0';
+    return true;
+  }
+};
+
+// === REPLY ROUTES ===
+// Where a deferred reply (e.g. a finished job) is sent. The input dispatcher
+// fills in currentRoute before calling processCommand, transports implement
+// sendToRoute() and handlers push through pushReply().
+#define ROUTE_NONE   0  // not pushable, the client polls
+#define ROUTE_SERIAL 1
+#define ROUTE_UDP    2
+#define ROUTE_LOCAL  3  // consumed on the device (telemetry sampler), seq = owner id
+#define ROUTE_TELNET 4  // remote_debug client
+
+struct ReplyRoute {
+  uint8_t kind;
+  bool binary;      // reply as a binary frame (binary_protocol plugin)
+  uint8_t seq;      // sequence number of the binary request
+  uint8_t ip[4];    // ROUTE_UDP peer
+  uint16_t port;
+};
+
+ReplyRoute currentRoute = { ROUTE_NONE, false, 0, { 0, 0, 0, 0 }, 0 };
+
+// === INPUT SOURCES ===
+// Every input channel is a source with its own accumulator. A stream
+// (Serial, a Telnet client) is polled for the bytes that have arrived -
+// nothing waits for the rest of a line - and a datagram (UDP) arrives whole.
+// A complete line, or binary frame (leading zero byte), goes through one
+// dispatcher and is answered on the source it came from:
+//
+//   char serialLine[COMMAND_BUFFER_SIZE];
+//   InputSource serialSource(serialLine, sizeof(serialLine), ROUTE_SERIAL, &Serial);
+//   loop: if (pollInput(serialSource)) answerInput(serialSource);
+//
+// A line longer than the buffer is answered ERR_COMMAND_TOO_LONG once its
+// end has arrived. Deferred replies (jobs, telemetry) reach stream sources
+// through sendToSource(). A new transport or console adds a source.
+#ifndef INPUT_POLL_BYTES
+  #define INPUT_POLL_BYTES 64  // per source and pollInput(), so no source starves the others
+#endif
+
+#define INPUT_REPLY_NONE   0
+#define INPUT_REPLY_TEXT   1   // in the ResponseBuffer
+#define INPUT_REPLY_BINARY 2   // in binaryReply (binary_protocol plugin)
+
+char responseStorage[RESPONSE_BUFFER_SIZE];
+
+class InputSource;
+InputSource* inputSources = NULL;  // every source, for sendToSource()
+
+class InputSource {
+public:
+  InputSource(char* storage, size_t capacity, uint8_t routeKind, Stream* input = NULL)
+    : stream(input), next(inputSources), buf(storage), cap(capacity) {
+    route = { routeKind, false, 0, { 0, 0, 0, 0 }, 0 };
+    inputSources = this;
+    clear();
+  }
+
+  ReplyRoute route;    // sender; a datagram source fills in the peer
+  Stream* stream;      // NULL: datagrams, the transport reads and answers
+  InputSource* next;
+
+  // Adds one byte; true once a line or frame is complete
+  bool feed(uint8_t c) {
+    if (done) return true;
+    if (mode == MODE_IDLE) {
+      if (c == 0) {
+        mode = MODE_FRAME;
+        return false;
+      }
+      mode = MODE_LINE;
+    }
+    if (mode == MODE_FRAME ? c == 0 : c == '\n') {
+      if (mode == MODE_FRAME && len == 0) return false;  // opening delimiter after a lost byte
+      buf[len] = '\0';
+      done = true;
+      return true;
+    }
+    if (len + 1 < cap) buf[len++] = (char)c;
+    else overflowed = true;
+    return false;
+  }
+
+  // Datagram sources: the first `size` bytes of storage() are one message.
+  // `truncated` if it did not fit.
+  void complete(size_t size, bool truncated) {
+    if (size >= cap) size = cap - 1;
+    mode = MODE_LINE;
+    if (size > 0 && buf[0] == 0) {
+      mode = MODE_FRAME;
+      memmove(buf, buf + 1, --size);
+    }
+    len = size;
+    buf[len] = '\0';
+    overflowed = truncated;
+    done = true;
+  }
+
+  void clear() {
+    len = 0;
+    buf[0] = '\0';
+    mode = MODE_IDLE;
+    overflowed = false;
+    done = false;
+  }
+
+  char* storage() { return buf; }
+  size_t capacity() const { return cap; }
+  char* line() { return buf; }
+  size_t length() const { return len; }
+  bool ready() const { return done; }
+  bool binary() const { return mode == MODE_FRAME; }
+  bool overflow() const { return overflowed; }
+
+private:
+  enum { MODE_IDLE, MODE_LINE, MODE_FRAME };
+  char* buf;
+  size_t cap;
+  size_t len;
+  uint8_t mode;
+  bool overflowed;
+  bool done;
+};
+
+// === JOBS ===
+// Slow handlers run as resumable state machines (see sys_jobs.cpp) so loop()
+// keeps serving other commands while a sensor converts or a bus answers.
+#ifndef JOB_SLOTS
+  #if defined(__AVR__)
+    #define JOB_SLOTS 2
+  #else
+    #define JOB_SLOTS 4
+  #endif
+#endif
+
+#ifndef JOB_RESULT_SIZE
+  #if defined(__AVR__)
+    #define JOB_RESULT_SIZE 96
+  #else
+    #define JOB_RESULT_SIZE RESPONSE_BUFFER_SIZE
+  #endif
+#endif
+
+struct Job;
+// Runs one step; returns true once the result has been written to `res`.
+typedef bool (*JobStep)(Job& job, ResponseBuffer& res);
+
+struct Job {
+  uint8_t id;             // 0 = free slot
+  uint8_t step;           // state-machine position, owned by the step function
+  bool done;
+  unsigned long wakeAt;   // next step runs once millis() reaches this
+  JobStep run;
+  ReplyRoute route;       // where the result is pushed
+  long vars[4];           // step-function state (pin, parsed params, ...)
+  char result[JOB_RESULT_SIZE];
+};
+
 // === GLOBALS ===
 {{GLOBALS}}
 
+// === LOOP HOOKS ===
+// loop() starts with LOOP_PERIOD_START() and FirmwareBuilder ends every
+// definition's loop block with LOOP_SECTION_END(n). The command_stats plugin
+// (ENABLE_COMMAND_STATS) times the sections, the watchdog_timer plugin
+// (ENABLE_STALL_WATCH) restarts the watchdog at each; without them the hooks
+// compile to nothing.
+#ifdef ENABLE_COMMAND_STATS
+  #define STATS_HOOK(call) call
+#else
+  #define STATS_HOOK(call)
+#endif
+#ifdef ENABLE_STALL_WATCH
+  #define STALL_HOOK(call) call
+#else
+  #define STALL_HOOK(call)
+#endif
+#ifdef ENABLE_DUAL_CORE
+  // After the last network section loop() returns to the core
+  #define NEXT_LOOP_TASK(n) ((n) + 1 < LOOP_NETWORK_SECTIONS ? (n) + 1 : LOOP_SECTIONS)
+#else
+  #define NEXT_LOOP_TASK(n) ((n) + 1)
+#endif
+#define LOOP_PERIOD_START() STATS_HOOK(profileLoopStart()); STALL_HOOK(enterLoopTask(0))
+#define LOOP_SECTION_END(n) STATS_HOOK(profileLoopSection(n)); STALL_HOOK(enterLoopTask(NEXT_LOOP_TASK(n)))
+
+// Loop blocks that are not network work (sensors, jobs, telemetry) run in
+// acquisitionPass() and end with ACQUISITION_SECTION_END(n); they are
+// numbered after the network sections. Without the dual_core plugin loop()
+// runs the pass and they are ordinary sections; with it the pass runs on the
+// acquisition task, timed on its own and with its own watchdog breadcrumb.
+#ifdef ENABLE_DUAL_CORE
+  #define ACQUISITION_PASS_START() STATS_HOOK(profileAcquisitionStart()); STALL_HOOK(enterLoopTask(LOOP_NETWORK_SECTIONS))
+  #define ACQUISITION_SECTION_END(n) STATS_HOOK(profileAcquisitionSection(n)); STALL_HOOK(enterLoopTask((n) + 1))
+#else
+  #define ACQUISITION_PASS_START()
+  #define ACQUISITION_SECTION_END(n) LOOP_SECTION_END(n)
+#endif
+
+// === CORE QUEUES ===
+// Lock-free single-producer/single-consumer ring for the dual_core plugin:
+// one task fills slots, the other drains them, with no lock and no copy
+// beyond the slot itself. N must be a power of two (indices wrap at 256).
+#ifdef ENABLE_DUAL_CORE
+#include <atomic>
+
+template <typename T, uint8_t N>
+class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+public:
+  // Producer: the next free slot, or NULL when full. push() publishes it.
+  T* claim() {
+    uint8_t h = head.load(std::memory_order_relaxed);
+    if ((uint8_t)(h - tail.load(std::memory_order_acquire)) >= N) return NULL;
+    return &slots[h % N];
+  }
+  void push() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Consumer: the oldest slot, or NULL when empty. pop() frees it.
+  T* front() {
+    uint8_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return NULL;
+    return &slots[t % N];
+  }
+  void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  uint8_t size() const {
+    return (uint8_t)(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+  }
+
+private:
+  T slots[N];
+  std::atomic<uint8_t> head{0};
+  std::atomic<uint8_t> tail{0};
+};
+#endif
+
+// Input replies are built in inputReplyStorage by the network loop;
+// responseStorage belongs to the handlers. With dual_core the two run on
+// different tasks and every reply comes back through sendToRoute(), so the
+// loop's buffer is never written.
+#ifdef ENABLE_DUAL_CORE
+char inputReplyStorage[1];
+#else
+#define inputReplyStorage responseStorage
+#endif
+
+// === HEAP GUARD ===
+// Everything below must answer through ResponseBuffer. Any use of Arduino
+// String from here on is rejected at compile time.
+#pragma GCC poison String
+
 // === PROTOTYPES ===
-String processCommand(String input);
+void processCommand(char* input, ResponseBuffer& res);
+void sendToRoute(const ReplyRoute& route, const char* json); // Implemented by the transport
 
 // === SETUP ===
 void setup() {
   {{SETUP_CODE}}
+  #ifdef ENABLE_DUAL_CORE
+  startAcquisitionTask();
+  #endif
 }
 
 // === LOOP ===
 void loop() {
+  LOOP_PERIOD_START();
   {{LOOP_CODE}}
+  #ifndef ENABLE_DUAL_CORE
+  acquisitionPass();
+  #endif
+}
+
+// Sensor, job and command work; the acquisition task's body with dual_core
+void acquisitionPass() {
+  ACQUISITION_PASS_START();
+  {{ACQUISITION_LOOP_CODE}}
 }
 
 // === FUNCTIONS ===
-int parsePin(String pinStr) {
+int parsePin(const char* pinStr) {
+  if (!pinStr) return -1;
+
   // 1. Handle Label_GPIO format (e.g. "D1_25" -> 25)
-  int underscoreIndex = pinStr.indexOf('_');
-  if (underscoreIndex != -1) {
-    return pinStr.substring(underscoreIndex + 1).toInt();
+  const char* underscore = strchr(pinStr, '_');
+  if (underscore) {
+    return atoi(underscore + 1);
   }
 
   // 2. Handle "D5" -> 5
-  if (pinStr.startsWith("D")) {
-    return pinStr.substring(1).toInt();
+  if (pinStr[0] == 'D') {
+    return atoi(pinStr + 1);
   }
 
   // 3. Handle "A0" -> A0
-  if (pinStr.startsWith("A")) {
-    int pin = pinStr.substring(1).toInt();
+  if (pinStr[0] == 'A') {
+    int pin = atoi(pinStr + 1);
     #if defined(ESP8266)
       return A0; // ESP8266 only has A0
     #elif defined(A1)
@@ -54,7 +563,133 @@ int parsePin(String pinStr) {
   }
 
   // 4. Handle raw number "5"
-  return pinStr.toInt();
+  return atoi(pinStr);
+}
+
+// CRC-16/MODBUS (poly 0xA001, init 0xFFFF). Shared by the Modbus RTU driver
+// and the binary protocol frame check.
+unsigned int calculateModbusCRC16(unsigned char *buf, int len) {
+  unsigned int crc = 0xFFFF;
+  for (int pos = 0; pos < len; pos++) {
+    crc ^= (unsigned int)buf[pos];
+    for (int i = 8; i != 0; i--) {
+      if ((crc & 0x0001) != 0) {
+        crc >>= 1;
+        crc ^= 0xA001;
+      } else {
+        crc >>= 1;
+      }
+    }
+  }
+  return crc;
+}
+
+// === INPUT DISPATCH ===
+// Reads what the source's stream has buffered, at most INPUT_POLL_BYTES;
+// true once a line or frame is complete
+bool pollInput(InputSource& source) {
+  if (source.ready()) return true;
+  for (uint8_t n = 0; n < INPUT_POLL_BYTES && source.stream->available() > 0; n++) {
+    if (source.feed((uint8_t)source.stream->read())) return true;
+  }
+  return false;
+}
+
+// Runs one complete message as sent by `route` and writes the JSON reply
+// into `res`. A binary request leaves currentRoute.binary set: its reply is
+// still JSON here and gets encoded on the way out. False if there is nothing
+// to answer (empty line, corrupt frame).
+bool runInput(const ReplyRoute& route, char* msg, size_t len, bool binary, bool overflow, ResponseBuffer& res) {
+  currentRoute = route;
+  if (binary) {
+    #ifdef ENABLE_BINARY_PROTOCOL
+    return !overflow && runBinaryFrame((uint8_t*)msg, len, res);
+    #else
+    return false;
+    #endif
+  }
+  if (overflow) {
+    res.error(F("ERR_COMMAND_TOO_LONG"));
+  } else {
+    #ifdef ENABLE_REQUEST_IDS
+    processRequest(msg, res);
+    #else
+    processCommand(msg, res);
+    #endif
+  }
+  return res.length() > 0;
+}
+
+// Runs the message the source has completed, as sent by source.route, and
+// clears it. Returns which reply to send (INPUT_REPLY_*). With the dual_core
+// plugin the message is queued for the acquisition task instead and the
+// reply arrives later through sendToRoute() (INPUT_REPLY_NONE).
+uint8_t dispatchInput(InputSource& source, ResponseBuffer& res) {
+  uint8_t reply = INPUT_REPLY_NONE;
+  #ifdef ENABLE_DUAL_CORE
+  // Queue full: a stream keeps its message and offers it again next pass, a
+  // datagram is dropped (the client resends)
+  if (!queueInput(source) && source.stream) return INPUT_REPLY_NONE;
+  #else
+  if (runInput(source.route, source.line(), source.length(), source.binary(), source.overflow(), res)) {
+    reply = INPUT_REPLY_TEXT;
+    #ifdef ENABLE_BINARY_PROTOCOL
+    if (currentRoute.binary) {
+      encodeBinaryReply(currentRoute.seq, res.c_str());
+      reply = INPUT_REPLY_BINARY;
+    }
+    #endif
+  }
+  #endif
+  source.clear();
+  return reply;
+}
+
+// Stream sources end a text reply with a newline; datagrams do not
+void writeInputReply(const InputSource& source, uint8_t reply, const ResponseBuffer& res, Print& out) {
+  if (reply == INPUT_REPLY_TEXT) {
+    out.write((const uint8_t*)res.c_str(), res.length());
+    if (source.stream) out.println();
+  }
+  #ifdef ENABLE_BINARY_PROTOCOL
+  if (reply == INPUT_REPLY_BINARY) writeBinaryReply(out);
+  #endif
+}
+
+// Dispatches what a stream source has completed and answers on the stream
+void answerInput(InputSource& source) {
+  ResponseBuffer res(inputReplyStorage, sizeof(inputReplyStorage));
+  uint8_t reply = dispatchInput(source, res);
+  writeInputReply(source, reply, res, *source.stream);
+}
+
+// Sends a deferred reply (finished job, telemetry). Code on the acquisition
+// task cannot touch the transport, so with the dual_core plugin the reply is
+// queued for loop() to send.
+void pushReply(const ReplyRoute& route, const char* json) {
+  #ifdef ENABLE_DUAL_CORE
+  queueReply(route, json, false);
+  #else
+  sendToRoute(route, json);
+  #endif
+}
+
+// Pushes a deferred reply to the stream source of the route's kind; false if
+// there is none (datagram routes are the transport's)
+bool sendToSource(const ReplyRoute& route, const char* json) {
+  for (InputSource* source = inputSources; source; source = source->next) {
+    if (source->route.kind != route.kind || !source->stream) continue;
+    #ifdef ENABLE_BINARY_PROTOCOL
+    if (route.binary) {
+      encodeBinaryReply(route.seq, json);
+      writeBinaryReply(*source->stream);
+      return true;
+    }
+    #endif
+    source->stream->println(json);
+    return true;
+  }
+  return false;
 }
 
 {{FUNCTIONS_CODE}}
\ No newline at end of file